@@ -0,0 +1,1145 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compute.h"
+
+#define MIN_ELT_COUNT_VAR_NAME "SUM_BENCH_MIN_ELT_COUNT"
+#define MAX_ELT_COUNT_VAR_NAME "SUM_BENCH_MAX_ELT_COUNT"
+#define WORKGROUP_SIZES_VAR_NAME "SUM_BENCH_WORKGROUP_SIZES"
+#define PLACEMENTS_VAR_NAME "SUM_BENCH_PLACEMENTS"
+#define WARMUP_VAR_NAME "SUM_BENCH_WARMUP"
+#define REPETITIONS_VAR_NAME "SUM_BENCH_REPETITIONS"
+#define OUTPUT_VAR_NAME "SUM_BENCH_OUTPUT"
+/* Same as for sum: measures the binding fallback. */
+#define NO_PUSH_DESCRIPTORS_VAR_NAME "SUM_NO_PUSH_DESCRIPTORS"
+
+/* 1 K to 1 G elements, multiplied by ELT_COUNT_STEP at each step. Sizes the
+ * device cannot hold are skipped. */
+#define DEFAULT_MIN_ELT_COUNT 1024
+#define DEFAULT_MAX_ELT_COUNT (1024 * 1024 * 1024)
+#define ELT_COUNT_STEP 4
+#define DEFAULT_WORKGROUP_SIZES "32,64,128,256"
+#define DEFAULT_PLACEMENTS "host,device"
+#define DEFAULT_WARMUP 3
+#define DEFAULT_REPETITIONS 30
+/* Results go to <output>.csv, <output>-reduce.csv, <output>-batch.csv,
+ * <output>-bindings.csv, <output>-fusion.csv and <output>.json. */
+#define DEFAULT_OUTPUT "sum_bench"
+#define MAX_WORKGROUP_SIZES 16
+/* Jobs of bench_batch, of BATCH_MIN_JOB_ELT_COUNT to BATCH_MAX_JOB_ELT_COUNT
+ * elements: arrays too small to fill the device on their own. */
+#define BATCH_JOB_COUNT 1024
+#define BATCH_MIN_JOB_ELT_COUNT 64
+#define BATCH_MAX_JOB_ELT_COUNT 1024
+/* Dispatches of a bench_bindings sample, cycling through BINDING_SET_COUNT
+ * bindings. Not a divisor of COMMAND_RING_SIZE: each dispatch finds its
+ * slot recorded with other bindings. */
+#define BINDING_DISPATCH_COUNT 256
+#define BINDING_SET_COUNT 3
+#define BINDING_ELT_COUNT 1024
+
+/* The buffer layouts of the do_sum_* scenarios. */
+enum topology {
+    TOPOLOGY_ONE_BUFFER,
+    TOPOLOGY_TWO_BUFFERS_ONE_MEMORY,
+    TOPOLOGY_TWO_BUFFERS_TWO_MEMORIES,
+    TOPOLOGY_COUNT,
+};
+
+static const char *const topology_names[TOPOLOGY_COUNT] = {
+    "one-buffer",
+    "two-buffers-one-memory",
+    "two-buffers-two-memories",
+};
+
+struct bench_options {
+    uint32_t                min_elt_count;
+    uint32_t                max_elt_count;
+    uint32_t                workgroup_sizes[MAX_WORKGROUP_SIZES];
+    uint32_t                workgroup_size_count;
+    uint8_t                 placements[2];
+    uint32_t                warmup;
+    uint32_t                repetitions;
+    const char             *output;
+    uint8_t                 no_push_descriptors;
+};
+
+struct bench_buffers {
+    struct gpu_memory       input;
+    struct gpu_memory       output;
+    /* Backs both buffers with TOPOLOGY_TWO_BUFFERS_ONE_MEMORY. */
+    struct arena_allocation shared;
+};
+
+struct bench_result {
+    uint32_t                elt_count;
+    uint32_t                workgroup_size;
+    /* Name of the kernel that ran. */
+    char                    kernel[32];
+    enum topology           topology;
+    enum memory_placement   placement;
+    uint32_t                repetitions;
+    double                  min_us;
+    double                  median_us;
+    double                  p99_us;
+    /* Bytes read and written by the kernel over the median latency. With
+     * device placement, the latency includes the staging copies. */
+    double                  gbps;
+};
+
+/* A reduction on the device, against the same one on the host. */
+struct reduce_result {
+    uint32_t                elt_count;
+    uint32_t                workgroup_size;
+    /* One of reduce_kernels. */
+    const char             *kernel;
+    enum reduce_op          op;
+    enum reduce_type        type;
+    enum memory_placement   placement;
+    uint32_t                repetitions;
+    double                  min_us;
+    double                  median_us;
+    double                  p99_us;
+    /* Bytes read over the median latency. */
+    double                  gbps;
+    /* reduce_on_host, single-threaded. */
+    double                  host_median_us;
+};
+
+/* The same small jobs submitted as one batch, and one by one. */
+struct batch_result {
+    uint32_t                job_count;
+    /* Over all the jobs. */
+    uint32_t                elt_count;
+    uint32_t                workgroup_size;
+    enum memory_placement   placement;
+    uint32_t                repetitions;
+    /* Median time to run every job, host packing included. */
+    double                  batched_median_us;
+    double                  separate_median_us;
+    double                  batched_jobs_per_s;
+    double                  separate_jobs_per_s;
+};
+
+/* Small dispatches through the ring, with bindings changing each time,
+ * then always the same. */
+struct binding_result {
+    uint32_t                workgroup_size;
+    enum memory_placement   placement;
+    uint8_t                 push_descriptors;
+    uint32_t                repetitions;
+    /* Median per dispatch. */
+    double                  rebound_us;
+    double                  reused_us;
+    /* Host time record_bindings takes, on average. */
+    double                  binding_ns;
+};
+
+/* A chain of elementwise operations as one fused pass, then as one pass
+ * per operation. */
+struct fusion_result {
+    uint32_t                elt_count;
+    uint32_t                workgroup_size;
+    enum memory_placement   placement;
+    uint32_t                op_count;
+    uint32_t                repetitions;
+    double                  fused_median_us;
+    double                  unfused_median_us;
+    /* Bytes each one reads and writes in global memory. */
+    double                  fused_bytes;
+    double                  unfused_bytes;
+};
+
+struct bench_results {
+    struct bench_result    *results;
+    uint32_t                count;
+    uint32_t                capacity;
+
+    struct reduce_result   *reductions;
+    uint32_t                reduction_count;
+    uint32_t                reduction_capacity;
+
+    struct batch_result    *batches;
+    uint32_t                batch_count;
+    uint32_t                batch_capacity;
+
+    struct binding_result  *bindings;
+    uint32_t                binding_count;
+    uint32_t                binding_capacity;
+
+    struct fusion_result   *fusions;
+    uint32_t                fusion_count;
+    uint32_t                fusion_capacity;
+
+    char                    device_name[VK_MAX_PHYSICAL_DEVICE_NAME_SIZE];
+    uint32_t                driver_version;
+};
+
+static uint32_t env_uint(const char *name, uint32_t fallback)
+{
+    const char *value = getenv(name);
+    return value ? strtoul(value, NULL, 0) : fallback;
+}
+
+static uint8_t parse_options(struct bench_options *options)
+{
+    memset(options, 0, sizeof(*options));
+    options->min_elt_count = env_uint(MIN_ELT_COUNT_VAR_NAME, DEFAULT_MIN_ELT_COUNT);
+    options->max_elt_count = env_uint(MAX_ELT_COUNT_VAR_NAME, DEFAULT_MAX_ELT_COUNT);
+    options->warmup = env_uint(WARMUP_VAR_NAME, DEFAULT_WARMUP);
+    options->repetitions = env_uint(REPETITIONS_VAR_NAME, DEFAULT_REPETITIONS);
+    options->output = getenv(OUTPUT_VAR_NAME) ? getenv(OUTPUT_VAR_NAME) : DEFAULT_OUTPUT;
+    options->no_push_descriptors = getenv(NO_PUSH_DESCRIPTORS_VAR_NAME) != NULL;
+
+    if (options->min_elt_count == 0 || options->min_elt_count > options->max_elt_count) {
+        fprintf(stderr, "invalid element count range [%u, %u].\n",
+                options->min_elt_count, options->max_elt_count);
+        return 0;
+    }
+    if (options->repetitions == 0) {
+        fprintf(stderr, "%s must be positive.\n", REPETITIONS_VAR_NAME);
+        return 0;
+    }
+
+    const char *sizes = getenv(WORKGROUP_SIZES_VAR_NAME);
+    char *list = strdup(sizes ? sizes : DEFAULT_WORKGROUP_SIZES);
+    assert(list);
+    for (char *save = NULL, *token = strtok_r(list, ",", &save);
+         token;
+         token = strtok_r(NULL, ",", &save)) {
+        if (options->workgroup_size_count == MAX_WORKGROUP_SIZES) {
+            fprintf(stderr, "too many workgroup sizes, keeping the first %u.\n",
+                    MAX_WORKGROUP_SIZES);
+            break;
+        }
+        options->workgroup_sizes[options->workgroup_size_count++] = strtoul(token, NULL, 0);
+    }
+    free(list);
+
+    const char *placements = getenv(PLACEMENTS_VAR_NAME);
+    if (placements == NULL)
+        placements = DEFAULT_PLACEMENTS;
+    options->placements[MEMORY_PLACEMENT_HOST] = strstr(placements, "host") != NULL;
+    options->placements[MEMORY_PLACEMENT_DEVICE] = strstr(placements, "device") != NULL;
+
+    return options->workgroup_size_count > 0;
+}
+
+/* Whether |elt_count| elements fit: the storage buffer range, and leaving
+ * half of the largest heap for everything else. */
+static uint8_t elt_count_fits(const struct vulkan_state *state, uint32_t elt_count)
+{
+    const VkPhysicalDeviceMemoryProperties *properties = &state->arena.properties;
+    const VkDeviceSize size = sum_buffer_size(elt_count);
+    VkDeviceSize largest_heap = 0;
+
+    if (size > state->limits.maxStorageBufferRange)
+        return 0;
+
+    for (uint32_t i = 0; i < properties->memoryHeapCount; i++) {
+        if (properties->memoryHeaps[i].size > largest_heap)
+            largest_heap = properties->memoryHeaps[i].size;
+    }
+
+    /* Input and output, plus both staging buffers with device placement. */
+    VkDeviceSize needed = 2 * size;
+    if (state->placement == MEMORY_PLACEMENT_DEVICE)
+        needed += 2 * size;
+    return needed <= largest_heap / 2;
+}
+
+static struct bench_buffers bench_buffers_create(struct vulkan_state *state,
+                                                 enum topology topology,
+                                                 VkDeviceSize size)
+{
+    struct bench_buffers buffers;
+    memset(&buffers, 0, sizeof(buffers));
+
+    switch (topology) {
+    case TOPOLOGY_ONE_BUFFER:
+        buffers.input = allocate_buffer(state, size,
+                                        kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+        buffers.output = buffers.input;
+        break;
+
+    case TOPOLOGY_TWO_BUFFERS_ONE_MEMORY: {
+        VkMemoryRequirements requirements;
+        VkBuffer input = create_gpu_buffer(state, size);
+        VkBuffer output = create_gpu_buffer(state, size);
+
+        vkGetBufferMemoryRequirements(state->device, input, &requirements);
+        if (requirements.alignment < SUM_VECTOR_SIZE)
+            requirements.alignment = SUM_VECTOR_SIZE;
+        const VkDeviceSize offset = align_up(requirements.size, requirements.alignment);
+        requirements.size = offset + requirements.size;
+        buffers.shared = arena_alloc(state, &requirements,
+                                     kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+
+        buffers.input = gpu_memory_view(&buffers.shared, input, 0, size);
+        buffers.output = gpu_memory_view(&buffers.shared, output, offset, size);
+        CALL_VK(vkBindBufferMemory, (state->device, input,
+                                     buffers.input.vk_memory, buffers.input.vk_offset));
+        CALL_VK(vkBindBufferMemory, (state->device, output,
+                                     buffers.output.vk_memory, buffers.output.vk_offset));
+        break;
+    }
+
+    case TOPOLOGY_TWO_BUFFERS_TWO_MEMORIES:
+        buffers.input = allocate_buffer(state, size,
+                                        kernel_memory_usage(state, MEMORY_USAGE_UPLOAD));
+        buffers.output = allocate_buffer(state, size,
+                                         kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+        break;
+
+    default:
+        abort();
+    }
+
+    descriptor_set_bind(state, &buffers.input, 0);
+    descriptor_set_bind(state, &buffers.output, 1);
+    return buffers;
+}
+
+static void bench_buffers_destroy(struct vulkan_state *state,
+                                  enum topology topology,
+                                  struct bench_buffers *buffers)
+{
+    free_buffer(state, &buffers->input);
+    if (topology != TOPOLOGY_ONE_BUFFER)
+        free_buffer(state, &buffers->output);
+    if (topology == TOPOLOGY_TWO_BUFFERS_ONE_MEMORY)
+        arena_free(state, &buffers->shared);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double median_us(const uint64_t *sorted, uint32_t n)
+{
+    return (n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2) / 1e3;
+}
+
+/* Times |repetitions| dispatches over |elt_count| elements, each waited for,
+ * after |warmup| untimed ones. The result of a last dispatch is checked. */
+static struct bench_result bench_run(struct vulkan_state *state,
+                                     const struct bench_options *options,
+                                     enum topology topology,
+                                     uint32_t elt_count)
+{
+    const VkDeviceSize size = sum_buffer_size(elt_count);
+    struct bench_buffers buffers = bench_buffers_create(state, topology, size);
+    const struct kernel *kernel = sum_kernel_select(state, elt_count);
+    uint64_t *samples = malloc(sizeof(*samples) * options->repetitions);
+    void *ptr;
+
+    assert(samples);
+
+    ptr = kernel_input(state, &buffers.input);
+    generate_payload(ptr, elt_count, 0);
+    kernel_input_flush(state, &buffers.input);
+
+    for (uint32_t i = 0; i < options->warmup; i++)
+        execute_sum_kernel(state, elt_count);
+
+    for (uint32_t i = 0; i < options->repetitions; i++) {
+        uint64_t start = get_time_ns();
+        execute_sum_kernel(state, elt_count);
+        samples[i] = get_time_ns() - start;
+    }
+
+    /* The one-buffer topology doubled its input in place: start over. */
+    ptr = kernel_input(state, &buffers.input);
+    generate_payload(ptr, elt_count, 0);
+    kernel_input_flush(state, &buffers.input);
+    execute_sum_kernel(state, elt_count);
+    check_payload(kernel_output(state, &buffers.output), elt_count, 0);
+
+    bench_buffers_destroy(state, topology, &buffers);
+
+    qsort(samples, options->repetitions, sizeof(*samples), compare_u64);
+
+    const uint32_t n = options->repetitions;
+    const uint32_t p99 = (uint32_t)((n * 99ull + 99) / 100) - 1;
+    struct bench_result result = {
+        elt_count,
+        state->sum->workgroup_size,
+        "",
+        topology,
+        state->placement,
+        n,
+        samples[0] / 1e3,
+        median_us(samples, n),
+        samples[p99] / 1e3,
+        0.
+    };
+    snprintf(result.kernel, sizeof(result.kernel), "%s", kernel->name);
+    result.gbps = 2. * sizeof(int) * elt_count / (result.median_us * 1e3);
+
+    free(samples);
+    return result;
+}
+
+/* The reduce kernels loaded on the device are all timed: with subgroup
+ * operations, and from shared memory only. */
+static const char *const reduce_kernels[] = { "reduce", "reduce_shared" };
+
+/* Times every reduction over |elt_count| values with state->reduce, one of
+ * |kernel|, as bench_run does, then the host reference over the same
+ * values. */
+static void bench_reduce(struct vulkan_state *state,
+                         const struct bench_options *options,
+                         uint32_t elt_count,
+                         const char *kernel,
+                         struct bench_results *results)
+{
+    const VkDeviceSize size = sizeof(uint32_t) * (VkDeviceSize)elt_count;
+    const uint32_t n = options->repetitions;
+    const uint32_t p99 = (uint32_t)((n * 99ull + 99) / 100) - 1;
+    struct gpu_memory input = allocate_buffer(state, size,
+                                              kernel_memory_usage(state, MEMORY_USAGE_UPLOAD));
+    union reduce_value *values = malloc(size);
+    uint64_t *samples = malloc(sizeof(*samples) * n);
+    uint64_t *host_samples = malloc(sizeof(*host_samples) * n);
+
+    assert(values && samples && host_samples);
+
+    for (uint32_t type = REDUCE_TYPE_INT; type <= REDUCE_TYPE_FLOAT; type++) {
+        generate_reduce_payload(values, elt_count, type);
+        gpu_memory_upload(state, &input, values, size);
+
+        for (uint32_t op = REDUCE_OP_SUM; op <= REDUCE_OP_MAX; op++) {
+            union reduce_value value, expected;
+
+            for (uint32_t i = 0; i < options->warmup; i++)
+                execute_reduce(state, &input, elt_count, op, type);
+
+            for (uint32_t i = 0; i < n; i++) {
+                uint64_t start = get_time_ns();
+                value = execute_reduce(state, &input, elt_count, op, type);
+                samples[i] = get_time_ns() - start;
+            }
+
+            for (uint32_t i = 0; i < n; i++) {
+                uint64_t start = get_time_ns();
+                expected = reduce_on_host(values, elt_count, op, type);
+                host_samples[i] = get_time_ns() - start;
+            }
+
+            if (!reduce_value_matches(value, expected, values, elt_count, op, type)) {
+                fprintf(stderr, "invalid %s %s reduction of %u values.\n",
+                        reduce_type_name(type), reduce_op_name(op), elt_count);
+                abort();
+            }
+
+            qsort(samples, n, sizeof(*samples), compare_u64);
+            qsort(host_samples, n, sizeof(*host_samples), compare_u64);
+
+            struct reduce_result result = {
+                elt_count,
+                state->reduce->workgroup_size,
+                kernel,
+                op,
+                type,
+                state->placement,
+                n,
+                samples[0] / 1e3,
+                median_us(samples, n),
+                samples[p99] / 1e3,
+                0.,
+                median_us(host_samples, n)
+            };
+            result.gbps = (double)size / (result.median_us * 1e3);
+
+            printf("%10u elements, workgroup %4u, %-13s %-3s %-5s %-6s: "
+                   "median %10.2f us, host %10.2f us, %8.3f GB/s\n",
+                   result.elt_count, result.workgroup_size, kernel,
+                   reduce_op_name(op), reduce_type_name(type), placement_name(result.placement),
+                   result.median_us, result.host_median_us, result.gbps);
+
+            if (results->reduction_count == results->reduction_capacity) {
+                results->reduction_capacity = results->reduction_capacity
+                                            ? results->reduction_capacity * 2 : 64;
+                results->reductions = realloc(results->reductions,
+                                              sizeof(*results->reductions)
+                                              * results->reduction_capacity);
+                assert(results->reductions);
+            }
+            results->reductions[results->reduction_count++] = result;
+        }
+    }
+
+    free(host_samples);
+    free(samples);
+    free(values);
+    free_buffer(state, &input);
+}
+
+static uint32_t batch_job_elt_count(uint32_t job)
+{
+    return BATCH_MIN_JOB_ELT_COUNT
+         + (job * 7919u) % (BATCH_MAX_JOB_ELT_COUNT - BATCH_MIN_JOB_ELT_COUNT + 1);
+}
+
+/* Times BATCH_JOB_COUNT small jobs as one sum_batch, then each through
+ * execute_sum_kernel as the scenarios do. Each sample covers every job,
+ * copying its input in included. The batch results are checked. */
+static void bench_batch(struct vulkan_state *state,
+                        const struct bench_options *options,
+                        struct bench_results *results)
+{
+    const uint32_t n = options->repetitions;
+    const VkDeviceSize job_size = sum_buffer_size(BATCH_MAX_JOB_ELT_COUNT);
+    uint64_t *batched = malloc(sizeof(*batched) * n);
+    uint64_t *separate = malloc(sizeof(*separate) * n);
+    int *data = malloc(sizeof(int) * (size_t)BATCH_JOB_COUNT * BATCH_MAX_JOB_ELT_COUNT);
+    uint32_t firsts[BATCH_JOB_COUNT];
+    uint32_t elt_count = 0;
+    struct sum_batch batch;
+
+    assert(batched && separate && data);
+
+    for (uint32_t i = 0; i < BATCH_JOB_COUNT; i++) {
+        firsts[i] = elt_count;
+        elt_count += batch_job_elt_count(i);
+    }
+    generate_payload(data, elt_count, 0);
+    sum_batch_create(state, &batch, BATCH_JOB_COUNT, elt_count);
+
+    for (uint32_t i = 0; i < options->warmup + n; i++) {
+        uint64_t start = get_time_ns();
+        sum_batch_reset(&batch);
+        for (uint32_t job = 0; job < BATCH_JOB_COUNT; job++)
+            sum_batch_add(&batch, data + firsts[job], batch_job_elt_count(job));
+        wait_sum_kernel(state, submit_sum_batch(state, &batch));
+        if (i >= options->warmup)
+            batched[i - options->warmup] = get_time_ns() - start;
+    }
+
+    for (uint32_t job = 0; job < BATCH_JOB_COUNT; job++) {
+        uint32_t count;
+        int *result = sum_batch_result(state, &batch, job, &count);
+        check_payload(result, count, firsts[job]);
+    }
+    sum_batch_destroy(state, &batch);
+
+    staging_create(state, job_size);
+    struct gpu_memory input = allocate_buffer(state, job_size,
+                                              kernel_memory_usage(state, MEMORY_USAGE_UPLOAD));
+    struct gpu_memory output = allocate_buffer(state, job_size,
+                                               kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+    descriptor_set_bind(state, &input, 0);
+    descriptor_set_bind(state, &output, 1);
+
+    for (uint32_t i = 0; i < options->warmup + n; i++) {
+        uint64_t start = get_time_ns();
+        for (uint32_t job = 0; job < BATCH_JOB_COUNT; job++) {
+            uint32_t count = batch_job_elt_count(job);
+
+            memcpy(kernel_input(state, &input), data + firsts[job], sizeof(int) * count);
+            kernel_input_flush(state, &input);
+            execute_sum_kernel(state, count);
+        }
+        if (i >= options->warmup)
+            separate[i - options->warmup] = get_time_ns() - start;
+    }
+
+    free_buffer(state, &input);
+    free_buffer(state, &output);
+
+    qsort(batched, n, sizeof(*batched), compare_u64);
+    qsort(separate, n, sizeof(*separate), compare_u64);
+
+    struct batch_result result = {
+        BATCH_JOB_COUNT,
+        elt_count,
+        state->sum_batch->workgroup_size,
+        state->placement,
+        n,
+        median_us(batched, n),
+        median_us(separate, n),
+        0.,
+        0.
+    };
+    result.batched_jobs_per_s = BATCH_JOB_COUNT / (result.batched_median_us / 1e6);
+    result.separate_jobs_per_s = BATCH_JOB_COUNT / (result.separate_median_us / 1e6);
+
+    printf("%10u jobs, workgroup %4u, %-6s: batched %12.0f jobs/s, separate %12.0f jobs/s\n",
+           result.job_count, result.workgroup_size, placement_name(result.placement),
+           result.batched_jobs_per_s, result.separate_jobs_per_s);
+
+    if (results->batch_count == results->batch_capacity) {
+        results->batch_capacity = results->batch_capacity ? results->batch_capacity * 2 : 16;
+        results->batches = realloc(results->batches,
+                                   sizeof(*results->batches) * results->batch_capacity);
+        assert(results->batches);
+    }
+    results->batches[results->batch_count++] = result;
+
+    free(data);
+    free(separate);
+    free(batched);
+}
+
+/* Submits BINDING_DISPATCH_COUNT sums and waits for them, returning the
+ * time it took. */
+static uint64_t bench_bindings_sample(struct vulkan_state *state,
+                                      const struct kernel_bindings *sets,
+                                      uint32_t set_count)
+{
+    uint64_t start = get_time_ns();
+    uint64_t job = 0;
+
+    for (uint32_t i = 0; i < BINDING_DISPATCH_COUNT; i++)
+        job = submit_sum_kernel(state, state->sum, &sets[i % set_count], BINDING_ELT_COUNT, NULL);
+    /* The last jobs of each queue. */
+    for (uint32_t i = 0; i < COMMAND_RING_SIZE; i++)
+        wait_sum_kernel(state, job - i);
+    return get_time_ns() - start;
+}
+
+/* Times small dispatches whose bindings change every time, so that each
+ * is recorded again, then dispatches reusing their recording. The mean
+ * cost of record_bindings tells what binding takes on its own. Results
+ * are not checked, bench_run covers the kernel. */
+static void bench_bindings(struct vulkan_state *state,
+                           const struct bench_options *options,
+                           struct bench_results *results)
+{
+    const uint32_t n = options->repetitions;
+    const VkDeviceSize size = sum_buffer_size(BINDING_ELT_COUNT);
+    struct gpu_memory buffers[BINDING_SET_COUNT];
+    struct kernel_bindings sets[BINDING_SET_COUNT];
+    uint64_t *rebound = malloc(sizeof(*rebound) * n);
+    uint64_t *reused = malloc(sizeof(*reused) * n);
+    uint64_t binding_ns = 0;
+    uint64_t binding_count = 0;
+
+    assert(rebound && reused);
+    assert(COMMAND_RING_SIZE % BINDING_SET_COUNT != 0);
+
+    for (uint32_t i = 0; i < BINDING_SET_COUNT; i++) {
+        buffers[i] = allocate_buffer(state, size,
+                                     kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+        memset(&sets[i], 0, sizeof(sets[i]));
+        kernel_bindings_write(&sets[i], buffers[i].vk_buffer, size, 0);
+        kernel_bindings_write(&sets[i], buffers[i].vk_buffer, size, 1);
+    }
+
+    for (uint32_t i = 0; i < options->warmup + n; i++) {
+        uint64_t ns = state->binding_ns;
+        uint64_t count = state->binding_count;
+        uint64_t sample = bench_bindings_sample(state, sets, BINDING_SET_COUNT);
+
+        if (i < options->warmup)
+            continue;
+        rebound[i - options->warmup] = sample;
+        binding_ns += state->binding_ns - ns;
+        binding_count += state->binding_count - count;
+    }
+
+    for (uint32_t i = 0; i < options->warmup + n; i++) {
+        uint64_t sample = bench_bindings_sample(state, sets, 1);
+
+        if (i >= options->warmup)
+            reused[i - options->warmup] = sample;
+    }
+
+    for (uint32_t i = 0; i < BINDING_SET_COUNT; i++)
+        free_buffer(state, &buffers[i]);
+
+    qsort(rebound, n, sizeof(*rebound), compare_u64);
+    qsort(reused, n, sizeof(*reused), compare_u64);
+
+    struct binding_result result = {
+        state->sum->workgroup_size,
+        state->placement,
+        state->push_descriptors,
+        n,
+        median_us(rebound, n) / BINDING_DISPATCH_COUNT,
+        median_us(reused, n) / BINDING_DISPATCH_COUNT,
+        binding_count ? (double)binding_ns / binding_count : 0.
+    };
+
+    printf("%10u dispatches, workgroup %4u, %-6s: %s bindings %8.1f ns, "
+           "rebound %8.2f us, reused %8.2f us per dispatch\n",
+           BINDING_DISPATCH_COUNT, result.workgroup_size, placement_name(result.placement),
+           result.push_descriptors ? "push" : "set", result.binding_ns,
+           result.rebound_us, result.reused_us);
+
+    if (results->binding_count == results->binding_capacity) {
+        results->binding_capacity = results->binding_capacity ? results->binding_capacity * 2 : 16;
+        results->bindings = realloc(results->bindings,
+                                    sizeof(*results->bindings) * results->binding_capacity);
+        assert(results->bindings);
+    }
+    results->bindings[results->binding_count++] = result;
+
+    free(reused);
+    free(rebound);
+}
+
+/* Times chains of 1 to MAX_FUSED_OPS operations over |elt_count|
+ * elements, fused and not. Results are not checked, do_fused_chain
+ * covers the kernel. */
+static void bench_fusion(struct vulkan_state *state,
+                         const struct bench_options *options,
+                         uint32_t elt_count,
+                         struct bench_results *results)
+{
+    static const enum fused_op ops[] = {
+        FUSED_OP_ADD, FUSED_OP_MUL, FUSED_OP_MAX, FUSED_OP_MIN,
+    };
+    static const int32_t operands[] = { 3, 5, -100000, 100000 };
+    const VkDeviceSize size = sizeof(int32_t) * (VkDeviceSize)elt_count;
+    const uint32_t n = options->repetitions;
+    struct gpu_memory input = allocate_buffer(state, size,
+                                              kernel_memory_usage(state, MEMORY_USAGE_UPLOAD));
+    struct gpu_memory output = allocate_buffer(state, size,
+                                               kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+    struct fused_chain chain = { { FUSED_OP_NONE }, { 0 }, 0 };
+    uint64_t *samples[2] = {
+        malloc(sizeof(*samples[0]) * n),
+        malloc(sizeof(*samples[1]) * n),
+    };
+
+    assert(samples[0] && samples[1]);
+
+    for (uint32_t op_count = 1; op_count <= MAX_FUSED_OPS; op_count++) {
+        uint32_t op = (op_count - 1) % (sizeof(ops) / sizeof(*ops));
+        fused_chain_append(&chain, ops[op], operands[op]);
+
+        for (uint32_t fuse = 0; fuse < 2; fuse++) {
+            for (uint32_t i = 0; i < options->warmup; i++)
+                execute_fused_chain(state, &chain, &input, &output, elt_count, fuse);
+
+            for (uint32_t i = 0; i < n; i++) {
+                uint64_t start = get_time_ns();
+                execute_fused_chain(state, &chain, &input, &output, elt_count, fuse);
+                samples[fuse][i] = get_time_ns() - start;
+            }
+            qsort(samples[fuse], n, sizeof(*samples[fuse]), compare_u64);
+        }
+
+        struct fusion_result result = {
+            elt_count,
+            state->fused->workgroup_size,
+            state->placement,
+            op_count,
+            n,
+            median_us(samples[1], n),
+            median_us(samples[0], n),
+            2. * (double)size,
+            2. * (double)size * op_count
+        };
+
+        printf("%10u elements, workgroup %4u, %u operations %-6s: "
+               "fused %10.2f us (%8.3f GB/s), unfused %10.2f us (%8.3f GB/s)\n",
+               result.elt_count, result.workgroup_size, result.op_count,
+               placement_name(result.placement),
+               result.fused_median_us, result.fused_bytes / (result.fused_median_us * 1e3),
+               result.unfused_median_us, result.unfused_bytes / (result.unfused_median_us * 1e3));
+
+        if (results->fusion_count == results->fusion_capacity) {
+            results->fusion_capacity = results->fusion_capacity ? results->fusion_capacity * 2 : 64;
+            results->fusions = realloc(results->fusions,
+                                       sizeof(*results->fusions) * results->fusion_capacity);
+            assert(results->fusions);
+        }
+        results->fusions[results->fusion_count++] = result;
+    }
+
+    free(samples[1]);
+    free(samples[0]);
+    free_buffer(state, &output);
+    free_buffer(state, &input);
+}
+
+static void results_add(struct bench_results *results, const struct bench_result *result)
+{
+    if (results->count == results->capacity) {
+        results->capacity = results->capacity ? results->capacity * 2 : 64;
+        results->results = realloc(results->results,
+                                   sizeof(*results->results) * results->capacity);
+        assert(results->results);
+    }
+    results->results[results->count++] = *result;
+}
+
+/* Runs the sweep for one device setup: the placement and the workgroup size
+ * the pipeline is specialized with. */
+static void bench_configuration(const char *argv0,
+                                const struct bench_options *options,
+                                enum memory_placement placement,
+                                uint32_t workgroup_size,
+                                struct bench_results *results)
+{
+    struct vulkan_state *state = create_state();
+    if (state == NULL)
+        abort();
+
+    state->placement = placement;
+    state->workgroup_size = workgroup_size;
+    state->elt_count = options->min_elt_count;
+    state->no_push_descriptors = options->no_push_descriptors;
+    initialize_device(state);
+
+    if (results->device_name[0] == '\0') {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(state->phys_device, &properties);
+        memcpy(results->device_name, properties.deviceName, sizeof(results->device_name));
+        results->driver_version = properties.driverVersion;
+    }
+
+    if (!validate_problem_size(state)) {
+        destroy_state(&state);
+        return;
+    }
+
+    uint32_t largest = options->min_elt_count;
+    for (uint64_t count = options->min_elt_count;
+         count <= options->max_elt_count;
+         count *= ELT_COUNT_STEP) {
+        if (!elt_count_fits(state, count)) {
+            printf("skipping %llu elements and more: too large for the device\n",
+                   (unsigned long long)count);
+            break;
+        }
+        largest = count;
+    }
+    state->elt_count = largest;
+    staging_create(state, sum_buffer_size(largest));
+
+    char *cache_path = path_next_to_binary(argv0, PIPELINE_CACHE_NAME);
+    pipeline_cache_create(state, cache_path);
+    free(cache_path);
+
+    if (!load_kernels(state, argv0)) {
+        destroy_state(&state);
+        abort();
+    }
+    kernel_registry_build_async(state);
+    state->sum = kernel_find(state, "sum");
+    state->sum_vec4 = kernel_find(state, "sum_vec4");
+    state->sum_batch = kernel_find(state, "sum_batch");
+    state->fused = kernel_find(state, "fused");
+    assert(state->sum && state->sum_vec4 && state->sum_batch && state->fused);
+    pipeline_cache_save(state);
+
+    if (state->sum->workgroup_size != workgroup_size) {
+        printf("skipping workgroup size %u: the sum kernel only runs with %u\n",
+               workgroup_size, state->sum->workgroup_size);
+        destroy_state(&state);
+        return;
+    }
+
+    for (uint64_t count = options->min_elt_count;
+         count <= largest;
+         count *= ELT_COUNT_STEP) {
+        for (uint32_t topology = 0; topology < TOPOLOGY_COUNT; topology++) {
+            for (uint32_t variant = SUM_VARIANT_SCALAR; variant <= SUM_VARIANT_VEC4; variant++) {
+                state->sum_variant = variant;
+                struct bench_result result = bench_run(state, options, topology, count);
+
+                printf("%10u elements, workgroup %4u, %-8s %-24s %-6s: "
+                       "median %10.2f us, p99 %10.2f us, %8.3f GB/s\n",
+                       result.elt_count, result.workgroup_size, result.kernel,
+                       topology_names[topology], placement_name(placement),
+                       result.median_us, result.p99_us, result.gbps);
+                results_add(results, &result);
+            }
+        }
+
+        for (uint32_t i = 0; i < sizeof(reduce_kernels) / sizeof(*reduce_kernels); i++) {
+            state->reduce = kernel_find(state, reduce_kernels[i]);
+            if (state->reduce)
+                bench_reduce(state, options, count, reduce_kernels[i], results);
+        }
+    }
+
+    state->sum_variant = SUM_VARIANT_AUTO;
+    bench_batch(state, options, results);
+    bench_bindings(state, options, results);
+    bench_fusion(state, options, largest, results);
+
+    destroy_state(&state);
+}
+
+static uint8_t write_csv(const struct bench_results *results, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return 0;
+
+    fprintf(file, "elt_count,workgroup_size,kernel,topology,placement,repetitions,"
+                  "min_us,median_us,p99_us,gbps\n");
+    for (uint32_t i = 0; i < results->count; i++) {
+        const struct bench_result *result = &results->results[i];
+
+        fprintf(file, "%u,%u,%s,%s,%s,%u,%.3f,%.3f,%.3f,%.3f\n",
+                result->elt_count, result->workgroup_size, result->kernel,
+                topology_names[result->topology], placement_name(result->placement),
+                result->repetitions,
+                result->min_us, result->median_us, result->p99_us, result->gbps);
+    }
+    fclose(file);
+    return 1;
+}
+
+static uint8_t write_reduce_csv(const struct bench_results *results, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return 0;
+
+    fprintf(file, "elt_count,workgroup_size,kernel,op,type,placement,repetitions,"
+                  "min_us,median_us,p99_us,gbps,host_median_us\n");
+    for (uint32_t i = 0; i < results->reduction_count; i++) {
+        const struct reduce_result *result = &results->reductions[i];
+
+        fprintf(file, "%u,%u,%s,%s,%s,%s,%u,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                result->elt_count, result->workgroup_size, result->kernel,
+                reduce_op_name(result->op), reduce_type_name(result->type),
+                placement_name(result->placement), result->repetitions,
+                result->min_us, result->median_us, result->p99_us, result->gbps,
+                result->host_median_us);
+    }
+    fclose(file);
+    return 1;
+}
+
+static uint8_t write_batch_csv(const struct bench_results *results, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return 0;
+
+    fprintf(file, "job_count,elt_count,workgroup_size,placement,repetitions,"
+                  "batched_median_us,separate_median_us,batched_jobs_per_s,separate_jobs_per_s\n");
+    for (uint32_t i = 0; i < results->batch_count; i++) {
+        const struct batch_result *result = &results->batches[i];
+
+        fprintf(file, "%u,%u,%u,%s,%u,%.3f,%.3f,%.1f,%.1f\n",
+                result->job_count, result->elt_count, result->workgroup_size,
+                placement_name(result->placement), result->repetitions,
+                result->batched_median_us, result->separate_median_us,
+                result->batched_jobs_per_s, result->separate_jobs_per_s);
+    }
+    fclose(file);
+    return 1;
+}
+
+static uint8_t write_bindings_csv(const struct bench_results *results, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return 0;
+
+    fprintf(file, "workgroup_size,placement,binding,repetitions,"
+                  "rebound_us,reused_us,binding_ns\n");
+    for (uint32_t i = 0; i < results->binding_count; i++) {
+        const struct binding_result *result = &results->bindings[i];
+
+        fprintf(file, "%u,%s,%s,%u,%.3f,%.3f,%.1f\n",
+                result->workgroup_size, placement_name(result->placement),
+                result->push_descriptors ? "push" : "set", result->repetitions,
+                result->rebound_us, result->reused_us, result->binding_ns);
+    }
+    fclose(file);
+    return 1;
+}
+
+static uint8_t write_fusion_csv(const struct bench_results *results, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return 0;
+
+    fprintf(file, "elt_count,workgroup_size,placement,op_count,repetitions,"
+                  "fused_median_us,unfused_median_us,fused_bytes,unfused_bytes\n");
+    for (uint32_t i = 0; i < results->fusion_count; i++) {
+        const struct fusion_result *result = &results->fusions[i];
+
+        fprintf(file, "%u,%u,%s,%u,%u,%.3f,%.3f,%.0f,%.0f\n",
+                result->elt_count, result->workgroup_size,
+                placement_name(result->placement), result->op_count, result->repetitions,
+                result->fused_median_us, result->unfused_median_us,
+                result->fused_bytes, result->unfused_bytes);
+    }
+    fclose(file);
+    return 1;
+}
+
+static uint8_t write_json(const struct bench_results *results,
+                          const struct bench_options *options,
+                          const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return 0;
+
+    fprintf(file, "{\n  \"device\": \"");
+    /* Device names are plain ASCII, but keep the output valid JSON. */
+    for (const char *c = results->device_name; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            fputc('\\', file);
+        fputc(*c, file);
+    }
+    fprintf(file, "\",\n  \"driver_version\": %u,\n", results->driver_version);
+    fprintf(file, "  \"shader\": \"%s\",\n", SHADER_SUFFIX);
+    fprintf(file, "  \"warmup\": %u,\n", options->warmup);
+    fprintf(file, "  \"results\": [\n");
+    for (uint32_t i = 0; i < results->count; i++) {
+        const struct bench_result *result = &results->results[i];
+
+        fprintf(file, "    {\"elt_count\": %u, \"workgroup_size\": %u, \"kernel\": \"%s\", "
+                      "\"topology\": \"%s\", \"placement\": \"%s\", \"repetitions\": %u, "
+                      "\"min_us\": %.3f, \"median_us\": %.3f, \"p99_us\": %.3f, "
+                      "\"gbps\": %.3f}%s\n",
+                result->elt_count, result->workgroup_size, result->kernel,
+                topology_names[result->topology], placement_name(result->placement),
+                result->repetitions,
+                result->min_us, result->median_us, result->p99_us, result->gbps,
+                i + 1 < results->count ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"reductions\": [\n");
+    for (uint32_t i = 0; i < results->reduction_count; i++) {
+        const struct reduce_result *result = &results->reductions[i];
+
+        fprintf(file, "    {\"elt_count\": %u, \"workgroup_size\": %u, \"kernel\": \"%s\", "
+                      "\"op\": \"%s\", \"type\": \"%s\", \"placement\": \"%s\", \"repetitions\": %u, "
+                      "\"min_us\": %.3f, \"median_us\": %.3f, \"p99_us\": %.3f, "
+                      "\"gbps\": %.3f, \"host_median_us\": %.3f}%s\n",
+                result->elt_count, result->workgroup_size, result->kernel,
+                reduce_op_name(result->op), reduce_type_name(result->type),
+                placement_name(result->placement), result->repetitions,
+                result->min_us, result->median_us, result->p99_us, result->gbps,
+                result->host_median_us,
+                i + 1 < results->reduction_count ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"batches\": [\n");
+    for (uint32_t i = 0; i < results->batch_count; i++) {
+        const struct batch_result *result = &results->batches[i];
+
+        fprintf(file, "    {\"job_count\": %u, \"elt_count\": %u, \"workgroup_size\": %u, "
+                      "\"placement\": \"%s\", \"repetitions\": %u, "
+                      "\"batched_median_us\": %.3f, \"separate_median_us\": %.3f, "
+                      "\"batched_jobs_per_s\": %.1f, \"separate_jobs_per_s\": %.1f}%s\n",
+                result->job_count, result->elt_count, result->workgroup_size,
+                placement_name(result->placement), result->repetitions,
+                result->batched_median_us, result->separate_median_us,
+                result->batched_jobs_per_s, result->separate_jobs_per_s,
+                i + 1 < results->batch_count ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"bindings\": [\n");
+    for (uint32_t i = 0; i < results->binding_count; i++) {
+        const struct binding_result *result = &results->bindings[i];
+
+        fprintf(file, "    {\"workgroup_size\": %u, \"placement\": \"%s\", \"binding\": \"%s\", "
+                      "\"repetitions\": %u, \"rebound_us\": %.3f, \"reused_us\": %.3f, "
+                      "\"binding_ns\": %.1f}%s\n",
+                result->workgroup_size, placement_name(result->placement),
+                result->push_descriptors ? "push" : "set", result->repetitions,
+                result->rebound_us, result->reused_us, result->binding_ns,
+                i + 1 < results->binding_count ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"fusions\": [\n");
+    for (uint32_t i = 0; i < results->fusion_count; i++) {
+        const struct fusion_result *result = &results->fusions[i];
+
+        fprintf(file, "    {\"elt_count\": %u, \"workgroup_size\": %u, \"placement\": \"%s\", "
+                      "\"op_count\": %u, \"repetitions\": %u, "
+                      "\"fused_median_us\": %.3f, \"unfused_median_us\": %.3f, "
+                      "\"fused_bytes\": %.0f, \"unfused_bytes\": %.0f}%s\n",
+                result->elt_count, result->workgroup_size,
+                placement_name(result->placement), result->op_count, result->repetitions,
+                result->fused_median_us, result->unfused_median_us,
+                result->fused_bytes, result->unfused_bytes,
+                i + 1 < results->fusion_count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_options options;
+    struct bench_results results;
+
+    if (argc <= 0)
+        return 1;
+    if (!parse_options(&options))
+        return 1;
+    memset(&results, 0, sizeof(results));
+
+    for (uint32_t placement = 0; placement < 2; placement++) {
+        if (!options.placements[placement])
+            continue;
+
+        for (uint32_t i = 0; i < options.workgroup_size_count; i++) {
+            bench_configuration(argv[0], &options, placement,
+                                options.workgroup_sizes[i], &results);
+        }
+    }
+
+    size_t path_len = strlen(options.output) + sizeof("-bindings.csv");
+    char *path = malloc(path_len);
+    assert(path);
+
+    int status = 0;
+    snprintf(path, path_len, "%s.csv", options.output);
+    if (write_csv(&results, path)) {
+        printf("results written to %s\n", path);
+    } else {
+        fprintf(stderr, "unable to write %s.\n", path);
+        status = 1;
+    }
+    snprintf(path, path_len, "%s-reduce.csv", options.output);
+    if (write_reduce_csv(&results, path)) {
+        printf("results written to %s\n", path);
+    } else {
+        fprintf(stderr, "unable to write %s.\n", path);
+        status = 1;
+    }
+    snprintf(path, path_len, "%s-batch.csv", options.output);
+    if (write_batch_csv(&results, path)) {
+        printf("results written to %s\n", path);
+    } else {
+        fprintf(stderr, "unable to write %s.\n", path);
+        status = 1;
+    }
+    snprintf(path, path_len, "%s-bindings.csv", options.output);
+    if (write_bindings_csv(&results, path)) {
+        printf("results written to %s\n", path);
+    } else {
+        fprintf(stderr, "unable to write %s.\n", path);
+        status = 1;
+    }
+    snprintf(path, path_len, "%s-fusion.csv", options.output);
+    if (write_fusion_csv(&results, path)) {
+        printf("results written to %s\n", path);
+    } else {
+        fprintf(stderr, "unable to write %s.\n", path);
+        status = 1;
+    }
+    snprintf(path, path_len, "%s.json", options.output);
+    if (write_json(&results, &options, path)) {
+        printf("results written to %s\n", path);
+    } else {
+        fprintf(stderr, "unable to write %s.\n", path);
+        status = 1;
+    }
+
+    free(path);
+    free(results.results);
+    free(results.reductions);
+    free(results.batches);
+    free(results.bindings);
+    free(results.fusions);
+    return status;
+}
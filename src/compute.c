@@ -0,0 +1,5404 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+#endif
+
+#include "compute.h"
+
+#define SHADER_ENTRY_POINT "main"
+#define REDHAT_VENDOR_ID 0x1af4
+#define VIRTIOGPU_DEVICE_ID 0x1012
+#define VIRTIO_VAR_NAME "USE_VIRTIOGPU"
+
+#define PIPELINE_CACHE_MAGIC 0x48435056u /* "VPCH" */
+
+/* Timestamps written by a profiled submission: start, after the upload,
+ * after the dispatch, after the download. */
+#define PROFILE_QUERY_COUNT 4
+/* Ring slots, plus one range for the one-shot path. */
+#define PROFILE_QUERY_RANGES (COMMAND_RING_SIZE + 1)
+
+static const char* vkresult_to_string(VkResult res)
+{
+    switch (res)
+    {
+#define VK2STR(Value) case Value: return #Value
+        VK2STR(VK_SUCCESS);
+        VK2STR(VK_NOT_READY);
+        VK2STR(VK_TIMEOUT);
+        VK2STR(VK_EVENT_SET);
+        VK2STR(VK_EVENT_RESET);
+        VK2STR(VK_INCOMPLETE);
+        VK2STR(VK_ERROR_OUT_OF_HOST_MEMORY);
+        VK2STR(VK_ERROR_OUT_OF_DEVICE_MEMORY);
+        VK2STR(VK_ERROR_INITIALIZATION_FAILED);
+        VK2STR(VK_ERROR_DEVICE_LOST);
+        VK2STR(VK_ERROR_MEMORY_MAP_FAILED);
+        VK2STR(VK_ERROR_LAYER_NOT_PRESENT);
+        VK2STR(VK_ERROR_EXTENSION_NOT_PRESENT);
+        VK2STR(VK_ERROR_FEATURE_NOT_PRESENT);
+        VK2STR(VK_ERROR_INCOMPATIBLE_DRIVER);
+        VK2STR(VK_ERROR_TOO_MANY_OBJECTS);
+        VK2STR(VK_ERROR_FORMAT_NOT_SUPPORTED);
+        VK2STR(VK_ERROR_FRAGMENTED_POOL);
+        VK2STR(VK_ERROR_OUT_OF_POOL_MEMORY);
+        VK2STR(VK_ERROR_INVALID_EXTERNAL_HANDLE);
+        VK2STR(VK_ERROR_SURFACE_LOST_KHR);
+        VK2STR(VK_ERROR_NATIVE_WINDOW_IN_USE_KHR);
+        VK2STR(VK_SUBOPTIMAL_KHR);
+        VK2STR(VK_ERROR_OUT_OF_DATE_KHR);
+        VK2STR(VK_ERROR_INCOMPATIBLE_DISPLAY_KHR);
+        VK2STR(VK_ERROR_VALIDATION_FAILED_EXT);
+        VK2STR(VK_ERROR_INVALID_SHADER_NV);
+        VK2STR(VK_ERROR_FRAGMENTATION_EXT);
+        VK2STR(VK_ERROR_NOT_PERMITTED_EXT);
+        VK2STR(VK_RESULT_MAX_ENUM);
+#undef VK2STR
+        default:
+            return "VK_UNKNOWN_RETURN_VALUE";
+    }
+}
+
+void check_vkresult(const char* fname, VkResult res)
+{
+    if (res == VK_SUCCESS) {
+        fprintf(stderr, "\033[32m%s\033[0m\n", fname);
+        return;
+    }
+
+    fprintf(stderr, "\033[31m%s = %s\033[0m\n", fname, vkresult_to_string(res));
+    assert(0);
+}
+
+
+static void dump_available_layers(void)
+{
+    uint32_t layer_count;
+    CALL_VK(vkEnumerateInstanceLayerProperties, (&layer_count, NULL));
+
+    if (layer_count == 0) {
+        fprintf(stderr, "no layers available.\n");
+        return;
+    }
+
+    VkLayerProperties *layers = malloc(sizeof(*layers) * layer_count);
+    assert(layers);
+
+
+    CALL_VK(vkEnumerateInstanceLayerProperties, (&layer_count, layers));
+
+    fprintf(stderr, "layers:\n");
+    for (uint32_t i = 0; i < layer_count; i++) {
+        fprintf(stderr, "\t%s: %s\n", layers[i].layerName, layers[i].description);
+    }
+
+    free(layers);
+}
+
+struct vulkan_state* create_state(void)
+{
+    struct vulkan_state *state = malloc(sizeof(*state));
+    if (NULL == state) {
+        abort();
+    }
+    memset(state, 0, sizeof(*state));
+
+    struct VkApplicationInfo app_info = {
+        VK_STRUCTURE_TYPE_APPLICATION_INFO,
+        NULL,
+        "sample-compute",
+        1,
+        "sample-engine",
+        1,
+        VK_API_VERSION_1_2
+    };
+
+    dump_available_layers();
+
+    const char* validation_layers[] = {
+#ifdef DEBUG
+        "VK_LAYER_KHRONOS_validation",
+#endif
+    };
+
+    struct VkInstanceCreateInfo info = {
+        VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        NULL,
+        0,
+        &app_info,
+        sizeof(validation_layers) / sizeof(*validation_layers),
+        validation_layers,
+        0,
+        NULL
+    };
+
+    CALL_VK(vkCreateInstance, (&info, NULL, &state->instance));
+    state->device_index = UINT32_MAX;
+
+    return state;
+}
+
+uint32_t physical_device_count(const struct vulkan_state *state)
+{
+    uint32_t device_count;
+
+    CALL_VK(vkEnumeratePhysicalDevices, (state->instance, &device_count, NULL));
+    return device_count;
+}
+
+static uint8_t device_extension_supported(const struct vulkan_state *state, const char *name)
+{
+    uint32_t count;
+    VkExtensionProperties *extensions;
+    uint8_t found = 0;
+
+    CALL_VK(vkEnumerateDeviceExtensionProperties, (state->phys_device, NULL, &count, NULL));
+    extensions = malloc(sizeof(*extensions) * count);
+    assert(extensions || count == 0);
+    CALL_VK(vkEnumerateDeviceExtensionProperties,
+            (state->phys_device, NULL, &count, extensions));
+
+    for (uint32_t i = 0; i < count && !found; i++)
+        found = 0 == strcmp(extensions[i].extensionName, name);
+
+    free(extensions);
+    return found;
+}
+
+static void select_physical_device(struct vulkan_state *state)
+{
+    uint32_t device_count;
+    VkPhysicalDevice *devices = NULL;
+
+    CALL_VK(vkEnumeratePhysicalDevices, (state->instance, &device_count, NULL));
+    if (device_count <= 0) {
+        abort();
+    }
+
+    devices = malloc(sizeof(*devices) * device_count);
+    if (devices == NULL)
+        exit(1);
+
+    CALL_VK(vkEnumeratePhysicalDevices, (state->instance, &device_count, devices));
+
+    uint32_t device_index = UINT_MAX;
+
+    printf("%d available devices\n", device_count);
+    for (uint32_t i = 0; i < device_count; i++) {
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(devices[i], &props);
+
+        printf("\t[%u] - %s (v:0x%x, d:0x%x)\n",
+            i, props.deviceName, props.vendorID, props.deviceID);
+
+        if (props.vendorID != REDHAT_VENDOR_ID) {
+            continue;
+        }
+
+        if (props.deviceID != VIRTIOGPU_DEVICE_ID) {
+            continue;
+        }
+
+        device_index = i;
+    }
+
+    if (state->device_index != UINT32_MAX) {
+        if (state->device_index >= device_count) {
+            fprintf(stderr, "no device %u, there are %u.\n", state->device_index, device_count);
+            abort();
+        }
+        device_index = state->device_index;
+    } else if (!getenv(VIRTIO_VAR_NAME)) {
+        fprintf(stderr, "the application will allow non-virtiogpu devices.\n");
+        device_index = 0;
+    }
+
+    if (device_index == UINT_MAX) {
+        fprintf(stderr, "Unable to find any virtio-gpu device. Aborting now.\n");
+        abort();
+    }
+
+    printf("loading device id=%u\n", device_index);
+    state->phys_device = devices[device_index];
+    free(devices);
+
+    state->host_import = !state->no_host_import
+        && device_extension_supported(state, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    state->push_descriptors = !state->no_push_descriptors
+        && device_extension_supported(state, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+    uint8_t subgroup_size_control = !state->no_subgroups
+        && device_extension_supported(state, VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME);
+
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT host_memory;
+    memset(&host_memory, 0, sizeof(host_memory));
+    host_memory.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+
+    VkPhysicalDeviceSubgroupSizeControlPropertiesEXT subgroup_control;
+    memset(&subgroup_control, 0, sizeof(subgroup_control));
+    subgroup_control.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_PROPERTIES_EXT;
+    subgroup_control.pNext = state->host_import ? &host_memory : NULL;
+
+    VkPhysicalDeviceSubgroupProperties subgroup;
+    memset(&subgroup, 0, sizeof(subgroup));
+    subgroup.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+    subgroup.pNext = subgroup_control.pNext;
+    if (subgroup_size_control)
+        subgroup.pNext = &subgroup_control;
+
+    VkPhysicalDeviceIDProperties id;
+    memset(&id, 0, sizeof(id));
+    id.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    id.pNext = &subgroup;
+
+    VkPhysicalDeviceProperties2 props;
+    memset(&props, 0, sizeof(props));
+    props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    props.pNext = &id;
+
+    vkGetPhysicalDeviceProperties2(state->phys_device, &props);
+    state->limits = props.properties.limits;
+    memcpy(state->device_uuid, id.deviceUUID, sizeof(state->device_uuid));
+    state->driver_version = props.properties.driverVersion;
+    state->subgroup_size = subgroup.subgroupSize;
+    if (subgroup.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT && !state->no_subgroups)
+        state->subgroup_operations = subgroup.supportedOperations;
+
+    state->host_import_alignment = state->host_import
+                                 ? host_memory.minImportedHostPointerAlignment
+                                 : (VkDeviceSize)sysconf(_SC_PAGESIZE);
+
+    VkPhysicalDeviceSubgroupSizeControlFeaturesEXT subgroup_features;
+    memset(&subgroup_features, 0, sizeof(subgroup_features));
+    subgroup_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES_EXT;
+
+    VkPhysicalDeviceVulkan11Features features11;
+    memset(&features11, 0, sizeof(features11));
+    features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+    features11.pNext = subgroup_size_control ? &subgroup_features : NULL;
+
+    VkPhysicalDeviceVulkan12Features features12;
+    memset(&features12, 0, sizeof(features12));
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features12.pNext = &features11;
+
+    VkPhysicalDeviceFeatures2 features;
+    memset(&features, 0, sizeof(features));
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &features12;
+
+    vkGetPhysicalDeviceFeatures2(state->phys_device, &features);
+    state->element_types = 1u << ELEMENT_TYPE_INT32 | 1u << ELEMENT_TYPE_FLOAT32;
+    if (features12.shaderFloat16 && features11.storageBuffer16BitAccess)
+        state->element_types |= 1u << ELEMENT_TYPE_FLOAT16;
+    if (features12.shaderInt8 && features12.storageBuffer8BitAccess)
+        state->element_types |= 1u << ELEMENT_TYPE_INT8;
+    if (features.features.shaderInt64)
+        state->element_types |= 1u << ELEMENT_TYPE_INT64;
+
+    /* Only compute stages matter: required sizes are checked against
+     * them, full subgroups are a compute feature. */
+    state->subgroup_size_control = subgroup_features.subgroupSizeControl
+        && (subgroup_control.requiredSubgroupSizeStages & VK_SHADER_STAGE_COMPUTE_BIT);
+    state->full_subgroups = subgroup_features.computeFullSubgroups;
+    state->min_subgroup_size = subgroup_control.minSubgroupSize;
+    state->max_subgroup_size = subgroup_control.maxSubgroupSize;
+    state->max_compute_workgroup_subgroups = subgroup_control.maxComputeWorkgroupSubgroups;
+    printf("host memory import: %s\n", state->host_import ? "yes" : "no");
+    printf("push descriptors: %s\n", state->push_descriptors ? "yes" : "no");
+    printf("subgroups: size %u, operations 0x%x", state->subgroup_size,
+           state->subgroup_operations);
+    if (state->subgroup_size_control || state->full_subgroups) {
+        printf(", %u to %u%s", state->min_subgroup_size, state->max_subgroup_size,
+               state->full_subgroups ? ", full" : "");
+    }
+    printf("\n");
+
+    printf("element types:");
+    for (uint32_t type = 0; type < ELEMENT_TYPE_COUNT; type++) {
+        if (state->element_types & 1u << type)
+            printf(" %s", element_type_name(type));
+    }
+    printf("\n");
+}
+
+/* Whether family |a| suits dispatches better than |b|: compute queues
+ * without graphics run asynchronously to it, then the more the better. */
+static uint8_t compute_family_better(const VkQueueFamilyProperties *a,
+                                     const VkQueueFamilyProperties *b)
+{
+    uint8_t a_async = !(a->queueFlags & VK_QUEUE_GRAPHICS_BIT);
+    uint8_t b_async = !(b->queueFlags & VK_QUEUE_GRAPHICS_BIT);
+
+    if (a_async != b_async)
+        return a_async;
+    return a->queueCount > b->queueCount;
+}
+
+/* Picks the queues and fills |infos| with their families, returns how many
+ * families there are. Dispatches go to up to MAX_COMPUTE_QUEUES queues of
+ * the best compute family. Staging copies go to a transfer-only family
+ * (a copy engine) when there is one, else to a spare queue of the compute
+ * family, else inline with the dispatches. */
+static uint32_t find_queues(struct vulkan_state *state, VkDeviceQueueCreateInfo infos[2])
+{
+    static const float priorities[MAX_COMPUTE_QUEUES + 1] = { 1.f, 1.f, 1.f, 1.f, 1.f };
+    uint32_t count;
+    VkQueueFamilyProperties *properties;
+
+    vkGetPhysicalDeviceQueueFamilyProperties(state->phys_device, &count, NULL);
+    if (count <= 0) {
+        abort();
+    }
+
+    properties = malloc(sizeof(*properties) * count);
+    if (NULL == properties) {
+        abort();
+    }
+
+    vkGetPhysicalDeviceQueueFamilyProperties(state->phys_device, &count, properties);
+
+    uint32_t compute_family = UINT32_MAX;
+    uint32_t transfer_family = UINT32_MAX;
+
+    for (uint32_t i = 0; i < count; i++) {
+        VkQueueFlags flags = properties[i].queueFlags;
+
+        if (flags & VK_QUEUE_COMPUTE_BIT) {
+            if (compute_family == UINT32_MAX
+                || compute_family_better(&properties[i], &properties[compute_family]))
+                compute_family = i;
+        } else if ((flags & VK_QUEUE_TRANSFER_BIT)
+                   && !(flags & VK_QUEUE_GRAPHICS_BIT)
+                   && transfer_family == UINT32_MAX) {
+            transfer_family = i;
+        }
+    }
+    assert(compute_family < UINT32_MAX);
+
+    uint32_t available = properties[compute_family].queueCount;
+    uint32_t family_count = 1;
+
+    /* Keep a queue of the compute family for the copies. */
+    if (transfer_family == UINT32_MAX && available > 1) {
+        transfer_family = compute_family;
+        available--;
+    }
+
+    state->compute_queue_count = available < MAX_COMPUTE_QUEUES ? available : MAX_COMPUTE_QUEUES;
+    for (uint32_t i = 0; i < state->compute_queue_count; i++)
+        state->compute_queues[i].family_index = compute_family;
+    state->transfer_queue.family_index = transfer_family;
+    state->timestamp_valid_bits = properties[compute_family].timestampValidBits;
+
+    VkDeviceQueueCreateInfo compute_info = {
+        VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+        NULL,
+        0,
+        compute_family,
+        state->compute_queue_count + (transfer_family == compute_family),
+        priorities
+    };
+    infos[0] = compute_info;
+
+    if (transfer_family != UINT32_MAX && transfer_family != compute_family) {
+        VkDeviceQueueCreateInfo transfer_info = {
+            VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            NULL,
+            0,
+            transfer_family,
+            1,
+            priorities
+        };
+        infos[family_count++] = transfer_info;
+    }
+
+    printf("%u compute queues of family %u, ", state->compute_queue_count, compute_family);
+    if (transfer_family == UINT32_MAX)
+        printf("no transfer queue\n");
+    else if (transfer_family == compute_family)
+        printf("transfer queue of the same family\n");
+    else
+        printf("transfer queue of family %u\n", transfer_family);
+
+    free(properties);
+    return family_count;
+}
+
+static void timeline_create(struct vulkan_state *state, struct gpu_queue *queue)
+{
+    VkSemaphoreTypeCreateInfo type_info = {
+        VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        NULL,
+        VK_SEMAPHORE_TYPE_TIMELINE,
+        0
+    };
+
+    VkSemaphoreCreateInfo info = {
+        VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        &type_info,
+        0
+    };
+
+    CALL_VK(vkCreateSemaphore, (state->device, &info, NULL, &queue->timeline));
+    queue->timeline_value = 0;
+    pthread_mutex_init(&queue->submit_lock, NULL);
+}
+
+static void timeline_destroy(struct vulkan_state *state, struct gpu_queue *queue)
+{
+    if (queue->timeline == VK_NULL_HANDLE)
+        return;
+    vkDestroySemaphore(state->device, queue->timeline, NULL);
+    pthread_mutex_destroy(&queue->submit_lock);
+}
+
+static void create_logical_device(struct vulkan_state *state)
+{
+    VkDeviceQueueCreateInfo queue_infos[2];
+    uint32_t family_count = find_queues(state, queue_infos);
+
+    /* What the kernels of the supported element types need. */
+    VkPhysicalDeviceSubgroupSizeControlFeaturesEXT subgroup_features;
+    memset(&subgroup_features, 0, sizeof(subgroup_features));
+    subgroup_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES_EXT;
+    subgroup_features.subgroupSizeControl = state->subgroup_size_control;
+    subgroup_features.computeFullSubgroups = state->full_subgroups;
+
+    VkPhysicalDeviceVulkan11Features features11;
+    memset(&features11, 0, sizeof(features11));
+    features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+    features11.storageBuffer16BitAccess = !!(state->element_types & 1u << ELEMENT_TYPE_FLOAT16);
+    if (state->subgroup_size_control || state->full_subgroups)
+        features11.pNext = &subgroup_features;
+
+    VkPhysicalDeviceVulkan12Features features12;
+    memset(&features12, 0, sizeof(features12));
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features12.pNext = &features11;
+    features12.timelineSemaphore = VK_TRUE;
+    features12.shaderFloat16 = !!(state->element_types & 1u << ELEMENT_TYPE_FLOAT16);
+    features12.shaderInt8 = !!(state->element_types & 1u << ELEMENT_TYPE_INT8);
+    features12.storageBuffer8BitAccess = !!(state->element_types & 1u << ELEMENT_TYPE_INT8);
+
+    VkPhysicalDeviceFeatures features;
+    memset(&features, 0, sizeof(features));
+    features.shaderInt64 = !!(state->element_types & 1u << ELEMENT_TYPE_INT64);
+
+    const char *extensions[3];
+    uint32_t extension_count = 0;
+    if (state->host_import)
+        extensions[extension_count++] = VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME;
+    if (state->push_descriptors)
+        extensions[extension_count++] = VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME;
+    if (state->subgroup_size_control || state->full_subgroups)
+        extensions[extension_count++] = VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME;
+
+    struct VkDeviceCreateInfo info = {
+        VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        &features12,
+        0,
+        family_count,
+        queue_infos,
+        0,
+        NULL,
+        extension_count,
+        extensions,
+        &features
+    };
+
+    CALL_VK(vkCreateDevice, (state->phys_device, &info, NULL, &state->device));
+
+    if (state->host_import) {
+        state->get_memory_host_pointer_properties = (PFN_vkGetMemoryHostPointerPropertiesEXT)
+            vkGetDeviceProcAddr(state->device, "vkGetMemoryHostPointerPropertiesEXT");
+        assert(state->get_memory_host_pointer_properties);
+    }
+    if (state->push_descriptors) {
+        state->push_descriptor_set_with_template = (PFN_vkCmdPushDescriptorSetWithTemplateKHR)
+            vkGetDeviceProcAddr(state->device, "vkCmdPushDescriptorSetWithTemplateKHR");
+        assert(state->push_descriptor_set_with_template);
+    }
+
+    for (uint32_t i = 0; i < state->compute_queue_count; i++) {
+        struct gpu_queue *queue = &state->compute_queues[i];
+
+        vkGetDeviceQueue(state->device, queue->family_index, i, &queue->queue);
+        timeline_create(state, queue);
+    }
+
+    struct gpu_queue *transfer = &state->transfer_queue;
+    if (transfer->family_index != UINT32_MAX) {
+        /* Right after the compute queues when they share the family. */
+        uint32_t index = transfer->family_index == state->compute_queues[0].family_index
+                       ? state->compute_queue_count
+                       : 0;
+        vkGetDeviceQueue(state->device, transfer->family_index, index, &transfer->queue);
+        timeline_create(state, transfer);
+    }
+}
+
+static VkDescriptorPool descriptor_pool_create(struct vulkan_state *state, uint32_t set_count)
+{
+    VkDescriptorPool pool;
+    /* The types spirv_reflect accepts, enough for any kernel. */
+    VkDescriptorPoolSize pool_sizes[] = {
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, set_count * MAX_KERNEL_BINDINGS },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, set_count * MAX_KERNEL_BINDINGS },
+    };
+
+    VkDescriptorPoolCreateInfo info = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        NULL,
+        0 /* no flags */,
+        set_count,
+        sizeof(pool_sizes) / sizeof(*pool_sizes),
+        pool_sizes
+    };
+
+    CALL_VK(vkCreateDescriptorPool, (state->device, &info, NULL, &pool));
+    return pool;
+}
+
+/* Allocates a set of |layout| from the current pool of |frame|, moving
+ * to the next one when it is full. Pools are created on demand. */
+static VkDescriptorSet descriptor_frame_allocate(struct vulkan_state *state,
+                                                 struct descriptor_frame *frame,
+                                                 VkDescriptorSetLayout layout)
+{
+    VkDescriptorSet set;
+
+    for (;;) {
+        if (frame->current == frame->pool_count) {
+            if (frame->pool_count == MAX_DESCRIPTOR_POOLS) {
+                fprintf(stderr, "too many descriptor sets in a command buffer.\n");
+                abort();
+            }
+            frame->pools[frame->pool_count] =
+                descriptor_pool_create(state, DESCRIPTOR_FRAME_SETS << frame->pool_count);
+            frame->pool_count++;
+        }
+
+        VkDescriptorSetAllocateInfo alloc_info = {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            NULL,
+            frame->pools[frame->current],
+            1,
+            &layout
+        };
+
+        VkResult res = vkAllocateDescriptorSets(state->device, &alloc_info, &set);
+        if (res != VK_ERROR_OUT_OF_POOL_MEMORY && res != VK_ERROR_FRAGMENTED_POOL) {
+            check_vkresult("vkAllocateDescriptorSets", res);
+            return set;
+        }
+        frame->current++;
+    }
+}
+
+/* Frees the sets of |frame| at once. Their command buffer must not be
+ * pending anymore. The pools are kept. */
+static void descriptor_frame_reset(struct vulkan_state *state, struct descriptor_frame *frame)
+{
+    for (uint32_t i = 0; i < frame->pool_count && i <= frame->current; i++)
+        CALL_VK(vkResetDescriptorPool, (state->device, frame->pools[i], 0));
+    frame->current = 0;
+}
+
+static void descriptor_frame_destroy(struct vulkan_state *state, struct descriptor_frame *frame)
+{
+    for (uint32_t i = 0; i < frame->pool_count; i++)
+        vkDestroyDescriptorPool(state->device, frame->pools[i], NULL);
+    memset(frame, 0, sizeof(*frame));
+}
+
+static VkCommandPool command_pool_create(struct vulkan_state *state, uint32_t family_index)
+{
+    VkCommandPool pool;
+    VkCommandPoolCreateInfo pool_info = {
+        VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        NULL,
+        VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        family_index
+    };
+
+    CALL_VK(vkCreateCommandPool, (state->device, &pool_info, NULL, &pool));
+    return pool;
+}
+
+static void command_ring_create(struct vulkan_state *state)
+{
+    VkCommandBuffer command_buffers[COMMAND_RING_SIZE];
+
+    VkCommandBufferAllocateInfo alloc_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        NULL,
+        state->command_pool,
+        VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        COMMAND_RING_SIZE
+    };
+
+    CALL_VK(vkAllocateCommandBuffers, (state->device, &alloc_info, command_buffers));
+
+    VkCommandBuffer transfer_command_buffers[2 * COMMAND_RING_SIZE];
+    if (state->transfer_queue.queue != VK_NULL_HANDLE) {
+        alloc_info.commandPool = state->transfer_command_pool;
+        alloc_info.commandBufferCount = 2 * COMMAND_RING_SIZE;
+        CALL_VK(vkAllocateCommandBuffers, (state->device, &alloc_info, transfer_command_buffers));
+    }
+
+    /* Created signaled so the first use of a slot does not block. */
+    VkFenceCreateInfo fence_info = {
+        VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        NULL,
+        VK_FENCE_CREATE_SIGNALED_BIT
+    };
+
+    for (uint32_t i = 0; i < COMMAND_RING_SIZE; i++) {
+        struct command_slot *slot = &state->command_ring[i];
+
+        memset(slot, 0, sizeof(*slot));
+        slot->command_buffer = command_buffers[i];
+        if (state->transfer_queue.queue != VK_NULL_HANDLE) {
+            slot->upload_command_buffer = transfer_command_buffers[2 * i];
+            slot->download_command_buffer = transfer_command_buffers[2 * i + 1];
+        }
+        CALL_VK(vkCreateFence, (state->device, &fence_info, NULL, &slot->fence));
+    }
+
+    state->command_ring_next = 0;
+}
+
+static void command_ring_destroy(struct vulkan_state *state)
+{
+    for (uint32_t i = 0; i < COMMAND_RING_SIZE; i++) {
+        struct command_slot *slot = &state->command_ring[i];
+
+        if (slot->fence == VK_NULL_HANDLE)
+            continue;
+
+        CALL_VK(vkWaitForFences, (state->device, 1, &slot->fence, VK_TRUE, 1e9 * 5));
+        vkDestroyFence(state->device, slot->fence, NULL);
+        vkFreeCommandBuffers(state->device, state->command_pool, 1, &slot->command_buffer);
+        if (slot->upload_command_buffer != VK_NULL_HANDLE) {
+            VkCommandBuffer transfers[] = {
+                slot->upload_command_buffer,
+                slot->download_command_buffer,
+            };
+            vkFreeCommandBuffers(state->device, state->transfer_command_pool, 2, transfers);
+        }
+        descriptor_frame_destroy(state, &slot->descriptors);
+        memset(slot, 0, sizeof(*slot));
+    }
+}
+
+/* Points |binding| of |bindings| at |size| bytes of |buffer| from
+ * |offset|, a multiple of minStorageBufferOffsetAlignment. Command
+ * buffers already recorded keep the buffers they were recorded with. */
+void kernel_bindings_write_range(const struct vulkan_state *state,
+                                 struct kernel_bindings *bindings,
+                                 VkBuffer buffer,
+                                 VkDeviceSize offset,
+                                 VkDeviceSize size,
+                                 uint32_t binding)
+{
+    assert(offset % state->limits.minStorageBufferOffsetAlignment == 0);
+    assert(binding < MAX_KERNEL_BINDINGS);
+
+    VkDescriptorBufferInfo buffer_info = {
+        buffer,
+        offset,
+        size,
+    };
+    bindings->buffers[binding] = buffer_info;
+}
+
+void kernel_bindings_write(struct kernel_bindings *bindings,
+                           VkBuffer buffer,
+                           VkDeviceSize size,
+                           uint32_t binding)
+{
+    assert(binding < MAX_KERNEL_BINDINGS);
+
+    VkDescriptorBufferInfo buffer_info = {
+        buffer,
+        0,
+        size,
+    };
+    bindings->buffers[binding] = buffer_info;
+}
+
+void descriptor_set_bind(struct vulkan_state *state,
+                         const struct gpu_memory *mem,
+                         uint32_t binding)
+{
+    assert(binding < BUFFER_COUNT);
+    kernel_bindings_write(&state->bindings, mem->vk_buffer, mem->vk_size, binding);
+    state->bound_buffers[binding] = mem->vk_buffer;
+    state->bound_sizes[binding] = mem->vk_size;
+    state->bound_offsets[binding] = mem->vk_offset;
+}
+
+VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static void arena_init(struct vulkan_state *state)
+{
+    VkPhysicalDeviceMemoryProperties *props = &state->arena.properties;
+
+    memset(&state->arena, 0, sizeof(state->arena));
+    vkGetPhysicalDeviceMemoryProperties(state->phys_device, props);
+    state->arena.atom_size = state->limits.nonCoherentAtomSize;
+
+    for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+        VkMemoryType type = props->memoryTypes[i];
+
+        printf("Memory[%d]:\n", i);
+        if (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT & type.propertyFlags)
+            printf("\tVK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT\n");
+        if (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT & type.propertyFlags)
+            printf("\tVK_MEMORY_PROPERTY_HOST_VISIBLE_BIT\n");
+        if (VK_MEMORY_PROPERTY_HOST_COHERENT_BIT & type.propertyFlags)
+            printf("\tVK_MEMORY_PROPERTY_HOST_COHERENT_BIT\n");
+        if (VK_MEMORY_PROPERTY_HOST_CACHED_BIT & type.propertyFlags)
+            printf("\tVK_MEMORY_PROPERTY_HOST_CACHED_BIT\n");
+        if (VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT & type.propertyFlags)
+            printf("\tVK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT\n");
+        if (VK_MEMORY_PROPERTY_PROTECTED_BIT & type.propertyFlags)
+            printf("\tVK_MEMORY_PROPERTY_PROTECTED_BIT\n");
+    }
+}
+
+/* Returns the type allowed by |type_bits| having all of |usage|'s required
+ * flags, and the most of its preferred ones. Ties go to the lowest index,
+ * the order the driver ranks the types in. */
+static uint32_t find_memory_type(const struct vulkan_state *state,
+                                 uint32_t type_bits,
+                                 enum memory_usage usage)
+{
+    const VkPhysicalDeviceMemoryProperties *props = &state->arena.properties;
+    VkMemoryPropertyFlags required, preferred, avoided;
+
+    switch (usage) {
+    case MEMORY_USAGE_UPLOAD:
+        required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        preferred = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        /* Sequential writes are fastest uncached, through write-combining. */
+        avoided = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        break;
+    case MEMORY_USAGE_READBACK:
+        required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        /* Uncached reads are an order of magnitude slower. */
+        preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        avoided = 0;
+        break;
+    case MEMORY_USAGE_DEVICE:
+    default:
+        required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        preferred = 0;
+        /* Leave the host-visible device memory to the mapped buffers. */
+        avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        break;
+    }
+
+    int best_score = -1;
+    uint32_t best = 0;
+
+    for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+        VkMemoryPropertyFlags type_flags = props->memoryTypes[i].propertyFlags;
+
+        if (0 == (type_bits & (1u << i)))
+            continue;
+        if ((type_flags & required) != required)
+            continue;
+
+        int score = __builtin_popcount(type_flags & preferred)
+                  + __builtin_popcount(~type_flags & avoided);
+        if (score > best_score) {
+            best_score = score;
+            best = i;
+        }
+    }
+
+    if (best_score < 0) {
+        fprintf(stderr, "Compatible memory not found (flags=0x%x).\n", required);
+        abort();
+    }
+    return best;
+}
+
+static VkDeviceMemory allocate_gpu_memory(struct vulkan_state *state,
+                                          VkDeviceSize size,
+                                          uint32_t memory_type)
+{
+    VkMemoryAllocateInfo alloc_info = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        NULL,
+        size,
+        memory_type
+    };
+
+    VkDeviceMemory vk_memory;
+    CALL_VK(vkAllocateMemory, (state->device, &alloc_info, NULL, &vk_memory));
+
+    return vk_memory;
+}
+
+static struct arena_block* arena_block_create(struct vulkan_state *state,
+                                              uint32_t memory_type,
+                                              VkDeviceSize size)
+{
+    struct arena_block *block = malloc(sizeof(*block));
+    struct arena_range *range = malloc(sizeof(*range));
+    assert(block && range);
+
+    range->offset = 0;
+    range->size = size;
+    range->next = NULL;
+
+    VkMemoryPropertyFlags flags = state->arena.properties.memoryTypes[memory_type].propertyFlags;
+
+    block->vk_memory = allocate_gpu_memory(state, size, memory_type);
+    block->size = size;
+    block->memory_type = memory_type;
+    block->mapped = NULL;
+    block->needs_flush = 0;
+    block->free_list = range;
+
+    if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        void *ptr;
+        CALL_VK(vkMapMemory, (state->device, block->vk_memory, 0, VK_WHOLE_SIZE, 0, &ptr));
+        block->mapped = ptr;
+        block->needs_flush = 0 == (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+
+    block->next = state->arena.blocks[memory_type];
+    state->arena.blocks[memory_type] = block;
+    state->arena.reserved_bytes += size;
+    state->arena.block_count++;
+
+    return block;
+}
+
+static void arena_block_destroy(struct vulkan_state *state, struct arena_block *block)
+{
+    struct arena_block **link = &state->arena.blocks[block->memory_type];
+
+    while (*link != block)
+        link = &(*link)->next;
+    *link = block->next;
+
+    while (block->free_list) {
+        struct arena_range *next = block->free_list->next;
+        free(block->free_list);
+        block->free_list = next;
+    }
+
+    if (block->mapped)
+        vkUnmapMemory(state->device, block->vk_memory);
+    vkFreeMemory(state->device, block->vk_memory, NULL);
+
+    state->arena.reserved_bytes -= block->size;
+    state->arena.block_count--;
+    free(block);
+}
+
+/* First fit. Padding left in front of an aligned range stays free. */
+static uint8_t arena_block_take(struct arena_block *block,
+                                VkDeviceSize size,
+                                VkDeviceSize alignment,
+                                VkDeviceSize *offset)
+{
+    for (struct arena_range **link = &block->free_list; *link; link = &(*link)->next) {
+        struct arena_range *range = *link;
+        VkDeviceSize start = align_up(range->offset, alignment);
+        VkDeviceSize end = range->offset + range->size;
+
+        if (start > end || end - start < size)
+            continue;
+
+        VkDeviceSize tail = end - (start + size);
+        *offset = start;
+
+        if (start == range->offset) {
+            if (tail == 0) {
+                *link = range->next;
+                free(range);
+            } else {
+                range->offset = start + size;
+                range->size = tail;
+            }
+            return 1;
+        }
+
+        range->size = start - range->offset;
+        if (tail != 0) {
+            struct arena_range *after = malloc(sizeof(*after));
+            assert(after);
+            after->offset = start + size;
+            after->size = tail;
+            after->next = range->next;
+            range->next = after;
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Puts the range back in the sorted free list, merged with its neighbours. */
+static void arena_block_give(struct arena_block *block,
+                             VkDeviceSize offset,
+                             VkDeviceSize size)
+{
+    struct arena_range *prev = NULL;
+    struct arena_range *next = block->free_list;
+
+    while (next && next->offset < offset) {
+        prev = next;
+        next = next->next;
+    }
+
+    if (prev && prev->offset + prev->size == offset) {
+        prev->size += size;
+        if (next && prev->offset + prev->size == next->offset) {
+            prev->size += next->size;
+            prev->next = next->next;
+            free(next);
+        }
+        return;
+    }
+
+    if (next && offset + size == next->offset) {
+        next->offset = offset;
+        next->size += size;
+        return;
+    }
+
+    struct arena_range *range = malloc(sizeof(*range));
+    assert(range);
+    range->offset = offset;
+    range->size = size;
+    range->next = next;
+
+    if (prev)
+        prev->next = range;
+    else
+        block->free_list = range;
+}
+
+struct arena_allocation arena_alloc(struct vulkan_state *state,
+                                    const VkMemoryRequirements *requirements,
+                                    enum memory_usage usage)
+{
+    uint32_t memory_type = find_memory_type(state, requirements->memoryTypeBits, usage);
+    VkMemoryPropertyFlags flags = state->arena.properties.memoryTypes[memory_type].propertyFlags;
+    VkDeviceSize alignment = requirements->alignment;
+    VkDeviceSize size = requirements->size;
+
+    /* Flushes and invalidates are rounded out to whole atoms: on
+     * non-coherent memory, no two allocations may share one. */
+    if (0 == (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        VkDeviceSize atom = state->arena.atom_size;
+        alignment = alignment > atom ? alignment : atom;
+        size = align_up(size, atom);
+    }
+
+    struct arena_allocation allocation = { NULL, 0, size };
+
+    for (struct arena_block *block = state->arena.blocks[memory_type];
+         block;
+         block = block->next) {
+        if (arena_block_take(block, size, alignment, &allocation.offset)) {
+            allocation.block = block;
+            break;
+        }
+    }
+
+    if (allocation.block == NULL) {
+        VkDeviceSize block_size = size > ARENA_BLOCK_SIZE
+                                ? align_up(size, state->arena.atom_size)
+                                : ARENA_BLOCK_SIZE;
+        struct arena_block *block = arena_block_create(state, memory_type, block_size);
+
+        uint8_t taken = arena_block_take(block, size, alignment, &allocation.offset);
+        assert(taken);
+        (void)taken;
+        allocation.block = block;
+    }
+
+    state->arena.live_bytes += allocation.size;
+    state->arena.live_allocations++;
+    return allocation;
+}
+
+static uint8_t arena_block_empty(const struct arena_block *block)
+{
+    return block->free_list
+        && block->free_list->offset == 0
+        && block->free_list->size == block->size;
+}
+
+void arena_free(struct vulkan_state *state, struct arena_allocation *allocation)
+{
+    struct arena_block *block = allocation->block;
+
+    arena_block_give(block, allocation->offset, allocation->size);
+    state->arena.live_bytes -= allocation->size;
+    state->arena.live_allocations--;
+    memset(allocation, 0, sizeof(*allocation));
+
+    if (!arena_block_empty(block))
+        return;
+
+    /* Keep one empty block of ARENA_BLOCK_SIZE per type around for the
+     * next allocations. Dedicated blocks and spare ones are released. */
+    uint8_t keep = block->size == ARENA_BLOCK_SIZE;
+    for (const struct arena_block *other = state->arena.blocks[block->memory_type];
+         other && keep;
+         other = other->next) {
+        if (other != block && other->size == ARENA_BLOCK_SIZE && arena_block_empty(other))
+            keep = 0;
+    }
+
+    if (!keep)
+        arena_block_destroy(state, block);
+}
+
+void arena_dump_stats(const struct vulkan_state *state)
+{
+    const struct memory_arena *arena = &state->arena;
+    VkDeviceSize free_bytes = 0, largest_free = 0;
+    uint32_t free_ranges = 0;
+
+    for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+        for (const struct arena_block *block = arena->blocks[i]; block; block = block->next) {
+            for (const struct arena_range *range = block->free_list; range; range = range->next) {
+                free_bytes += range->size;
+                free_ranges++;
+                if (range->size > largest_free)
+                    largest_free = range->size;
+            }
+        }
+    }
+
+    /* Share of the free space not usable by a single allocation. */
+    double fragmentation = free_bytes ? 1. - (double)largest_free / free_bytes : 0.;
+
+    printf("arena: %u blocks, %llu bytes reserved, %u allocations, %llu bytes live, "
+           "%u free ranges, fragmentation %.1f%%\n",
+           arena->block_count,
+           (unsigned long long)arena->reserved_bytes,
+           arena->live_allocations,
+           (unsigned long long)arena->live_bytes,
+           free_ranges,
+           fragmentation * 100.);
+}
+
+static void arena_destroy(struct vulkan_state *state)
+{
+    if (state->arena.live_allocations != 0) {
+        fprintf(stderr, "arena: %u allocations leaked.\n", state->arena.live_allocations);
+    }
+
+    for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+        while (state->arena.blocks[i])
+            arena_block_destroy(state, state->arena.blocks[i]);
+    }
+}
+
+VkBuffer create_gpu_buffer(struct vulkan_state *state, VkDeviceSize size)
+{
+    VkBufferCreateInfo buffer_info = {
+        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        NULL,
+        0,
+        size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+            | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+            | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+            | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_SHARING_MODE_EXCLUSIVE,
+        0,
+        NULL /* ignored since marked as exclusive */
+    };
+
+    VkBuffer vk_buffer;
+    CALL_VK(vkCreateBuffer, (state->device, &buffer_info, NULL, &vk_buffer));
+
+    return vk_buffer;
+}
+
+/* Returns a view on the buffer bound at |offset| in |allocation|. */
+struct gpu_memory gpu_memory_view(const struct arena_allocation *allocation,
+                                  VkBuffer vk_buffer,
+                                  VkDeviceSize offset,
+                                  VkDeviceSize size)
+{
+    struct arena_block *block = allocation->block;
+
+    struct gpu_memory info = {
+        block->mapped ? block->mapped + allocation->offset + offset : NULL,
+        size,
+        block->vk_memory,
+        vk_buffer,
+        allocation->offset + offset,
+        block->needs_flush,
+        { NULL, 0, 0 },
+        0,
+    };
+
+    return info;
+}
+
+struct gpu_memory allocate_buffer(struct vulkan_state *state,
+                                  VkDeviceSize size,
+                                  enum memory_usage usage)
+{
+    VkMemoryRequirements requirements;
+    VkBuffer vk_buffer = create_gpu_buffer(state, size);
+
+    vkGetBufferMemoryRequirements(state->device, vk_buffer, &requirements);
+    struct arena_allocation allocation = arena_alloc(state, &requirements, usage);
+
+    CALL_VK(vkBindBufferMemory, (state->device, vk_buffer,
+                                 allocation.block->vk_memory, allocation.offset));
+
+    struct gpu_memory info = gpu_memory_view(&allocation, vk_buffer, 0, size);
+    info.allocation = allocation;
+    return info;
+}
+
+void free_buffer(struct vulkan_state *state, struct gpu_memory *mem)
+{
+    vkDestroyBuffer(state->device, mem->vk_buffer, NULL);
+    if (mem->allocation.block)
+        arena_free(state, &mem->allocation);
+    if (mem->imported)
+        vkFreeMemory(state->device, mem->vk_memory, NULL);
+
+    mem->buffer = NULL;
+    mem->vk_buffer = VK_NULL_HANDLE;
+}
+
+/* Range of |mem| starting at |offset| rounded out to whole atoms, as
+ * vkFlushMappedMemoryRanges requires for non-coherent memory. */
+static VkMappedMemoryRange gpu_memory_range(const struct vulkan_state *state,
+                                            const struct gpu_memory *mem,
+                                            VkDeviceSize offset,
+                                            VkDeviceSize size)
+{
+    VkDeviceSize atom = state->arena.atom_size;
+    VkDeviceSize start = (mem->vk_offset + offset) / atom * atom;
+    VkDeviceSize end = align_up(mem->vk_offset + offset + size, atom);
+
+    assert(offset + size <= mem->vk_size);
+
+    VkMappedMemoryRange range = {
+        VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        NULL,
+        mem->vk_memory,
+        start,
+        end - start
+    };
+    return range;
+}
+
+/* Makes host writes to [offset, offset + size) visible to the device.
+ * No-op on coherent memory. */
+void gpu_memory_flush(struct vulkan_state *state,
+                      const struct gpu_memory *mem,
+                      VkDeviceSize offset,
+                      VkDeviceSize size)
+{
+    if (!mem->needs_flush)
+        return;
+
+    VkMappedMemoryRange range = gpu_memory_range(state, mem, offset, size);
+    CALL_VK(vkFlushMappedMemoryRanges, (state->device, 1, &range));
+}
+
+/* Makes device writes to [offset, offset + size) visible to the host. */
+void gpu_memory_invalidate(struct vulkan_state *state,
+                           const struct gpu_memory *mem,
+                           VkDeviceSize offset,
+                           VkDeviceSize size)
+{
+    if (!mem->needs_flush)
+        return;
+
+    VkMappedMemoryRange range = gpu_memory_range(state, mem, offset, size);
+    CALL_VK(vkInvalidateMappedMemoryRanges, (state->device, 1, &range));
+}
+
+void initialize_device(struct vulkan_state *state)
+{
+    select_physical_device(state);
+    create_logical_device(state);
+    state->command_pool = command_pool_create(state, state->compute_queues[0].family_index);
+    if (state->transfer_queue.queue != VK_NULL_HANDLE) {
+        state->transfer_command_pool = command_pool_create(state,
+                                                           state->transfer_queue.family_index);
+    }
+    command_ring_create(state);
+    arena_init(state);
+}
+
+/* Checks the workgroup size and element count of |state| against the
+ * device limits. Returns 0 and reports why if they do not fit. */
+uint8_t validate_problem_size(const struct vulkan_state *state)
+{
+    if (state->workgroup_size == 0
+        || state->workgroup_size > state->limits.maxComputeWorkGroupSize[0]
+        || state->workgroup_size > state->limits.maxComputeWorkGroupInvocations) {
+        fprintf(stderr, "unsupported workgroup size %u.\n", state->workgroup_size);
+        return 0;
+    }
+    if (state->subgroup_size_request
+        && (!state->subgroup_size_control
+            || state->subgroup_size_request < state->min_subgroup_size
+            || state->subgroup_size_request > state->max_subgroup_size
+            || (state->subgroup_size_request & (state->subgroup_size_request - 1)))) {
+        fprintf(stderr, "unsupported subgroup size %u.\n", state->subgroup_size_request);
+        return 0;
+    }
+    if (state->elt_count == 0) {
+        fprintf(stderr, "the element count must be positive.\n");
+        return 0;
+    }
+    if (sum_buffer_size(state->elt_count) > state->limits.maxStorageBufferRange) {
+        fprintf(stderr, "%u elements do not fit in a storage buffer (max %u bytes).\n",
+                state->elt_count, state->limits.maxStorageBufferRange);
+        return 0;
+    }
+    return 1;
+}
+
+/* Memory the buffers bound to the kernel are allocated from: |usage| is
+ * how the host accesses them with host placement. */
+enum memory_usage kernel_memory_usage(const struct vulkan_state *state,
+                                      enum memory_usage usage)
+{
+    if (state->placement == MEMORY_PLACEMENT_DEVICE)
+        return MEMORY_USAGE_DEVICE;
+    return usage;
+}
+
+/* Can be called again to grow the staging buffers, once they are idle. */
+void staging_create(struct vulkan_state *state, VkDeviceSize size)
+{
+    if (state->placement != MEMORY_PLACEMENT_DEVICE)
+        return;
+
+    if (state->staging_upload.vk_buffer != VK_NULL_HANDLE) {
+        if (state->staging_upload.vk_size >= size)
+            return;
+        free_buffer(state, &state->staging_upload);
+        free_buffer(state, &state->staging_download);
+    }
+
+    state->staging_upload = allocate_buffer(state, size, MEMORY_USAGE_UPLOAD);
+    state->staging_download = allocate_buffer(state, size, MEMORY_USAGE_READBACK);
+}
+
+/* Returns where the kernel input is to be written. With host placement,
+ * this is the buffer's own mapping. With device placement, this is the
+ * upload staging buffer, copied to the input buffer at dispatch time. */
+void* kernel_input(struct vulkan_state *state, const struct gpu_memory *mem)
+{
+    if (state->placement == MEMORY_PLACEMENT_DEVICE) {
+        assert(mem->vk_size <= state->staging_upload.vk_size);
+        return state->staging_upload.buffer;
+    }
+
+    assert(mem->buffer);
+    return mem->buffer;
+}
+
+/* Makes the host writes to the kernel input visible to the device. */
+void kernel_input_flush(struct vulkan_state *state, const struct gpu_memory *mem)
+{
+    const struct gpu_memory *target = mem;
+
+    if (state->placement == MEMORY_PLACEMENT_DEVICE)
+        target = &state->staging_upload;
+
+    gpu_memory_flush(state, target, 0, mem->vk_size);
+}
+
+/* Same as kernel_input, for reading the kernel output. Invalidates the
+ * range so the device writes are visible. */
+void* kernel_output(struct vulkan_state *state, const struct gpu_memory *mem)
+{
+    const struct gpu_memory *target = mem;
+
+    if (state->placement == MEMORY_PLACEMENT_DEVICE) {
+        assert(mem->vk_size <= state->staging_download.vk_size);
+        target = &state->staging_download;
+    }
+
+    gpu_memory_invalidate(state, target, 0, mem->vk_size);
+
+    assert(target->buffer);
+    return target->buffer;
+}
+
+uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void* load_file(const char *path, size_t *file_length)
+{
+    assert(file_length);
+    void *content = NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    do {
+        size_t size = lseek(fd, 0, SEEK_END);
+        lseek(fd, 0, SEEK_SET);
+        if (size == (size_t)-1) {
+            break;
+        }
+
+        content = malloc(size);
+        if (content == NULL) {
+            break;
+        }
+
+        if (read(fd, content, size) < 0) {
+            free(content);
+            content = NULL;
+            break;
+        }
+
+        *file_length = size;
+    } while (0);
+
+    close(fd);
+    return content;
+}
+
+static uint32_t* load_shader(const char *path, size_t *file_length)
+{
+    return load_file(path, file_length);
+}
+
+/* Returns |name| in the directory holding the executable. */
+char* path_next_to_binary(const char *argv0, const char *name)
+{
+    char *path = dirname(strdup(argv0));
+    size_t pathlen = strlen(path) + strlen(name) + 2;
+    path = realloc(path, pathlen);
+    strcat(path, "/");
+    strcat(path, name);
+    return path;
+}
+
+/* FNV-1a, enough to catch truncated or corrupted files. */
+static uint64_t hash_bytes(const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static struct pipeline_cache_header pipeline_cache_header_for(const struct vulkan_state *state)
+{
+    struct pipeline_cache_header header;
+    VkPhysicalDeviceProperties props;
+
+    vkGetPhysicalDeviceProperties(state->phys_device, &props);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.header_size = sizeof(header);
+    header.vendor_id = props.vendorID;
+    header.device_id = props.deviceID;
+    header.driver_version = props.driverVersion;
+    memcpy(header.cache_uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+    return header;
+}
+
+/* Returns why |file| cannot be fed to this device, NULL if it can. */
+static const char* pipeline_cache_check(const struct vulkan_state *state,
+                                        const uint8_t *file,
+                                        size_t file_size)
+{
+    struct pipeline_cache_header expected = pipeline_cache_header_for(state);
+    struct pipeline_cache_header header;
+
+    if (file_size < sizeof(header))
+        return "truncated header";
+    memcpy(&header, file, sizeof(header));
+
+    if (header.magic != expected.magic || header.header_size != expected.header_size)
+        return "not a pipeline cache";
+    if (header.vendor_id != expected.vendor_id || header.device_id != expected.device_id)
+        return "other device";
+    if (header.driver_version != expected.driver_version
+        || memcmp(header.cache_uuid, expected.cache_uuid, VK_UUID_SIZE) != 0)
+        return "other driver version";
+    if (header.data_size != file_size - sizeof(header))
+        return "truncated data";
+    if (header.data_hash != hash_bytes(file + sizeof(header), header.data_size))
+        return "corrupted data";
+
+    /* Header written by the driver: headerSize, headerVersion, vendorID,
+     * deviceID as 32-bit words, then pipelineCacheUUID. */
+    const uint8_t *vk_header = file + sizeof(header);
+    uint32_t vk_header_version;
+
+    if (header.data_size < 4 * sizeof(uint32_t) + VK_UUID_SIZE)
+        return "truncated driver header";
+    memcpy(&vk_header_version, vk_header + sizeof(uint32_t), sizeof(uint32_t));
+    if (vk_header_version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        || memcmp(vk_header + 4 * sizeof(uint32_t), expected.cache_uuid, VK_UUID_SIZE) != 0)
+        return "invalid driver header";
+
+    return NULL;
+}
+
+/* Creates the pipeline cache, seeded from |path| when it holds a valid
+ * cache for this device. |path| may be NULL to keep the cache in memory. */
+void pipeline_cache_create(struct vulkan_state *state, const char *path)
+{
+    size_t file_size = 0;
+    uint8_t *file = path ? load_file(path, &file_size) : NULL;
+    const char *error = NULL;
+
+    VkPipelineCacheCreateInfo info = {
+        VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        NULL,
+        0,
+        0,
+        NULL
+    };
+
+    if (file) {
+        error = pipeline_cache_check(state, file, file_size);
+        if (error) {
+            fprintf(stderr, "ignoring pipeline cache %s: %s.\n", path, error);
+        } else {
+            info.initialDataSize = file_size - sizeof(struct pipeline_cache_header);
+            info.pInitialData = file + sizeof(struct pipeline_cache_header);
+            state->pipeline_cache_hash = hash_bytes(info.pInitialData, info.initialDataSize);
+        }
+    }
+
+    CALL_VK(vkCreatePipelineCache, (state->device, &info, NULL, &state->pipeline_cache));
+    free(file);
+
+    state->pipeline_cache_path = path ? strdup(path) : NULL;
+}
+
+/* Writes the cache back if the pipeline creations added to it. The file is
+ * replaced atomically: concurrent processes may load it at any time. */
+void pipeline_cache_save(struct vulkan_state *state)
+{
+    size_t size;
+    uint8_t *file;
+
+    if (state->pipeline_cache_path == NULL)
+        return;
+
+    CALL_VK(vkGetPipelineCacheData, (state->device, state->pipeline_cache, &size, NULL));
+    file = malloc(sizeof(struct pipeline_cache_header) + size);
+    assert(file);
+    CALL_VK(vkGetPipelineCacheData, (state->device, state->pipeline_cache, &size,
+                                     file + sizeof(struct pipeline_cache_header)));
+
+    struct pipeline_cache_header header = pipeline_cache_header_for(state);
+    header.data_size = size;
+    header.data_hash = hash_bytes(file + sizeof(header), size);
+    memcpy(file, &header, sizeof(header));
+
+    if (header.data_hash == state->pipeline_cache_hash) {
+        free(file);
+        return;
+    }
+
+    size_t tmp_len = strlen(state->pipeline_cache_path) + 32;
+    char *tmp_path = malloc(tmp_len);
+    assert(tmp_path);
+    snprintf(tmp_path, tmp_len, "%s.%d.tmp", state->pipeline_cache_path, (int)getpid());
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "unable to write the pipeline cache to %s.\n", tmp_path);
+    } else {
+        size_t total = sizeof(header) + size;
+        ssize_t written = write(fd, file, total);
+        close(fd);
+
+        if (written < 0 || (size_t)written != total
+            || rename(tmp_path, state->pipeline_cache_path) != 0) {
+            fprintf(stderr, "unable to write the pipeline cache to %s.\n",
+                    state->pipeline_cache_path);
+            unlink(tmp_path);
+        } else {
+            state->pipeline_cache_hash = header.data_hash;
+        }
+    }
+
+    free(tmp_path);
+    free(file);
+}
+
+/* The few SPIR-V opcodes and enumerants spirv_reflect looks at. */
+#define SPV_MAGIC                       0x07230203u
+#define SPV_OP_EXECUTION_MODE           16
+#define SPV_OP_TYPE_INT                 21
+#define SPV_OP_TYPE_FLOAT               22
+#define SPV_OP_TYPE_VECTOR              23
+#define SPV_OP_TYPE_ARRAY               28
+#define SPV_OP_TYPE_STRUCT              30
+#define SPV_OP_TYPE_POINTER             32
+#define SPV_OP_CONSTANT                 43
+#define SPV_OP_CONSTANT_COMPOSITE       44
+#define SPV_OP_SPEC_CONSTANT            50
+#define SPV_OP_SPEC_CONSTANT_COMPOSITE  51
+#define SPV_OP_VARIABLE                 59
+#define SPV_OP_DECORATE                 71
+#define SPV_OP_MEMBER_DECORATE          72
+#define SPV_DECORATION_SPEC_ID          1
+#define SPV_DECORATION_BUFFER_BLOCK     3
+#define SPV_DECORATION_BUILTIN          11
+#define SPV_DECORATION_BINDING          33
+#define SPV_DECORATION_DESCRIPTOR_SET   34
+#define SPV_DECORATION_OFFSET           35
+#define SPV_BUILTIN_WORKGROUP_SIZE      25
+#define SPV_STORAGE_UNIFORM             2
+#define SPV_STORAGE_PUSH_CONSTANT       9
+#define SPV_STORAGE_STORAGE_BUFFER      12
+#define SPV_EXECUTION_MODE_LOCAL_SIZE   17
+
+/* Per result id, what the decorations and definitions say about it. */
+struct spirv_id {
+    /* Offset of the defining instruction, 0 if none. */
+    uint32_t                definition;
+    uint32_t                set;
+    uint32_t                binding;
+    uint32_t                spec_id;
+    uint8_t                 buffer_block;
+    uint8_t                 workgroup_size;
+    /* Largest member Offset of a struct, and the index of that member. */
+    uint32_t                last_member_offset;
+    uint32_t                last_member;
+};
+
+/* Size of a push constant type. Handles what push constant blocks are made
+ * of: scalars, vectors, arrays of those and nested structs. */
+static uint32_t spirv_type_size(const uint32_t *code, const struct spirv_id *ids,
+                                uint32_t bound, uint32_t type)
+{
+    if (type >= bound || ids[type].definition == 0)
+        return 0;
+    const uint32_t *op = code + ids[type].definition;
+
+    switch (op[0] & 0xffff) {
+    case SPV_OP_TYPE_INT:
+    case SPV_OP_TYPE_FLOAT:
+        return op[2] / 8;
+    case SPV_OP_TYPE_VECTOR:
+        return spirv_type_size(code, ids, bound, op[2]) * op[3];
+    case SPV_OP_TYPE_ARRAY: {
+        uint32_t length = op[3];
+        if (length >= bound || ids[length].definition == 0)
+            return 0;
+        /* Arrays are decorated with a stride, elements assumed packed. */
+        return spirv_type_size(code, ids, bound, op[2]) * code[ids[length].definition + 3];
+    }
+    case SPV_OP_TYPE_STRUCT: {
+        const struct spirv_id *id = &ids[type];
+        uint32_t member_count = (op[0] >> 16) - 2;
+        if (member_count == 0)
+            return 0;
+        uint32_t member = member_count == 1 ? 0 : id->last_member;
+        return id->last_member_offset
+             + spirv_type_size(code, ids, bound, op[2 + member]);
+    }
+    default:
+        return 0;
+    }
+}
+
+/* Reads the descriptor bindings, push constant size and workgroup size of
+ * a compute module. Returns 0 with a message if the module is malformed or
+ * uses something the registry cannot build a layout for. */
+static uint8_t spirv_reflect(const uint32_t *code, size_t size,
+                             struct kernel_reflection *reflection)
+{
+    size_t word_count = size / sizeof(uint32_t);
+
+    memset(reflection, 0, sizeof(*reflection));
+    if (word_count < 5 || code[0] != SPV_MAGIC) {
+        fprintf(stderr, "not a SPIR-V module.\n");
+        return 0;
+    }
+
+    uint32_t bound = code[3];
+    struct spirv_id *ids = calloc(bound, sizeof(*ids));
+    assert(ids);
+    for (uint32_t i = 0; i < bound; i++) {
+        ids[i].set = UINT32_MAX;
+        ids[i].binding = UINT32_MAX;
+        ids[i].spec_id = UINT32_MAX;
+    }
+
+    /* First pass: definitions and decorations, all ids are known after. */
+    for (size_t offset = 5; offset < word_count; ) {
+        uint32_t opcode = code[offset] & 0xffff;
+        uint32_t length = code[offset] >> 16;
+        const uint32_t *op = code + offset;
+
+        if (length == 0 || offset + length > word_count) {
+            fprintf(stderr, "truncated SPIR-V module.\n");
+            free(ids);
+            return 0;
+        }
+
+        switch (opcode) {
+        case SPV_OP_TYPE_INT:
+        case SPV_OP_TYPE_FLOAT:
+        case SPV_OP_TYPE_VECTOR:
+        case SPV_OP_TYPE_ARRAY:
+        case SPV_OP_TYPE_STRUCT:
+        case SPV_OP_TYPE_POINTER:
+            if (op[1] < bound)
+                ids[op[1]].definition = offset;
+            break;
+        case SPV_OP_CONSTANT:
+        case SPV_OP_CONSTANT_COMPOSITE:
+        case SPV_OP_SPEC_CONSTANT:
+        case SPV_OP_SPEC_CONSTANT_COMPOSITE:
+        case SPV_OP_VARIABLE:
+            if (op[2] < bound)
+                ids[op[2]].definition = offset;
+            break;
+        case SPV_OP_EXECUTION_MODE:
+            if (length >= 6 && op[2] == SPV_EXECUTION_MODE_LOCAL_SIZE) {
+                reflection->local_size[0] = op[3];
+                reflection->local_size[1] = op[4];
+                reflection->local_size[2] = op[5];
+            }
+            break;
+        case SPV_OP_DECORATE:
+            if (length < 3 || op[1] >= bound)
+                break;
+            if (op[2] == SPV_DECORATION_BUFFER_BLOCK)
+                ids[op[1]].buffer_block = 1;
+            else if (length >= 4 && op[2] == SPV_DECORATION_SPEC_ID)
+                ids[op[1]].spec_id = op[3];
+            else if (length >= 4 && op[2] == SPV_DECORATION_DESCRIPTOR_SET)
+                ids[op[1]].set = op[3];
+            else if (length >= 4 && op[2] == SPV_DECORATION_BINDING)
+                ids[op[1]].binding = op[3];
+            else if (length >= 4 && op[2] == SPV_DECORATION_BUILTIN
+                     && op[3] == SPV_BUILTIN_WORKGROUP_SIZE)
+                ids[op[1]].workgroup_size = 1;
+            break;
+        case SPV_OP_MEMBER_DECORATE:
+            if (length >= 5 && op[1] < bound && op[3] == SPV_DECORATION_OFFSET
+                && op[4] >= ids[op[1]].last_member_offset) {
+                ids[op[1]].last_member_offset = op[4];
+                ids[op[1]].last_member = op[2];
+            }
+            break;
+        }
+        offset += length;
+    }
+
+    uint8_t valid = 1;
+    for (uint32_t i = 0; i < bound && valid; i++) {
+        const struct spirv_id *id = &ids[i];
+        if (id->definition == 0)
+            continue;
+        const uint32_t *op = code + id->definition;
+
+        /* A WorkgroupSize builtin overrides the LocalSize mode. */
+        if (id->workgroup_size) {
+            uint32_t x = op[3];
+            if (x < bound && ids[x].definition != 0) {
+                reflection->local_size[0] = code[ids[x].definition + 3];
+                reflection->workgroup_size_id = ids[x].spec_id == 0;
+            }
+            continue;
+        }
+
+        if ((op[0] & 0xffff) != SPV_OP_VARIABLE)
+            continue;
+
+        uint32_t storage = op[3];
+        uint32_t pointer = op[1];
+        if (pointer >= bound || ids[pointer].definition == 0)
+            continue;
+        uint32_t type = code[ids[pointer].definition + 3];
+        if (type >= bound)
+            continue;
+
+        if (storage == SPV_STORAGE_PUSH_CONSTANT) {
+            reflection->push_constant_size = spirv_type_size(code, ids, bound, type);
+            continue;
+        }
+        if (storage != SPV_STORAGE_STORAGE_BUFFER && storage != SPV_STORAGE_UNIFORM) {
+            if (id->binding != UINT32_MAX) {
+                fprintf(stderr, "binding %u: only buffers are supported.\n", id->binding);
+                valid = 0;
+            }
+            continue;
+        }
+
+        uint32_t count = 1;
+        if (ids[type].definition != 0
+            && (code[ids[type].definition] & 0xffff) == SPV_OP_TYPE_ARRAY) {
+            uint32_t length = code[ids[type].definition + 3];
+            count = length < bound && ids[length].definition
+                  ? code[ids[length].definition + 3] : 1;
+            type = code[ids[type].definition + 2];
+        }
+
+        if (id->set != 0 && id->set != UINT32_MAX) {
+            fprintf(stderr, "binding %u: only descriptor set 0 is supported.\n", id->binding);
+            valid = 0;
+            continue;
+        }
+        if (id->binding == UINT32_MAX
+            || reflection->binding_count == MAX_KERNEL_BINDINGS) {
+            fprintf(stderr, "too many or unnumbered bindings.\n");
+            valid = 0;
+            continue;
+        }
+        /* Arrays take the entries of the next bindings in a kernel_bindings. */
+        if (id->binding >= MAX_KERNEL_BINDINGS || count > MAX_KERNEL_BINDINGS - id->binding) {
+            fprintf(stderr, "binding %u: past the %u buffers of a kernel_bindings.\n",
+                    id->binding, MAX_KERNEL_BINDINGS);
+            valid = 0;
+            continue;
+        }
+
+        VkDescriptorSetLayoutBinding *binding = &reflection->bindings[reflection->binding_count++];
+        binding->binding = id->binding;
+        /* Uniform storage decorated BufferBlock is how SPIR-V 1.0 spells
+         * storage buffers, DXC still emits it. */
+        binding->descriptorType = storage == SPV_STORAGE_STORAGE_BUFFER || ids[type].buffer_block
+                                ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+                                : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        binding->descriptorCount = count;
+        binding->stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        binding->pImmutableSamplers = NULL;
+    }
+
+    free(ids);
+    return valid;
+}
+
+/* Loads the module at |path| and creates its layouts. The pipeline is only
+ * created by the next kernel_registry_build. Returns NULL on failure. */
+static struct kernel* kernel_registry_add(struct vulkan_state *state,
+                                          const char *name,
+                                          const char *path)
+{
+    struct kernel_registry *registry = &state->kernels;
+    size_t code_size;
+    uint32_t *code;
+
+    assert(!registry->building);
+    if (registry->count == MAX_KERNELS) {
+        fprintf(stderr, "too many kernels, %s not loaded.\n", name);
+        return NULL;
+    }
+
+    code = load_shader(path, &code_size);
+    if (code == NULL) {
+        fprintf(stderr, "unable to load the shader %s.\n", path);
+        return NULL;
+    }
+
+    struct kernel *kernel = &registry->kernels[registry->count];
+    memset(kernel, 0, sizeof(*kernel));
+    snprintf(kernel->name, sizeof(kernel->name), "%s", name);
+
+    if (!spirv_reflect(code, code_size, &kernel->reflection)) {
+        fprintf(stderr, "unable to reflect the shader %s.\n", path);
+        free(code);
+        return NULL;
+    }
+
+    VkShaderModuleCreateInfo shader_info = {
+        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        NULL,
+        0,
+        code_size,
+        code
+    };
+
+    CALL_VK(vkCreateShaderModule,
+            (state->device, &shader_info, NULL, &kernel->shader_module));
+    free(code);
+
+    /* Sets of a push layout are never allocated, see record_bindings. */
+    VkDescriptorSetLayoutCreateInfo set_info = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        NULL,
+        state->push_descriptors ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR : 0,
+        kernel->reflection.binding_count,
+        kernel->reflection.bindings
+    };
+
+    CALL_VK(vkCreateDescriptorSetLayout,
+            (state->device, &set_info, NULL, &kernel->descriptor_layout));
+
+    VkPushConstantRange push_constant_range = {
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        0,
+        kernel->reflection.push_constant_size
+    };
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        NULL,
+        0,
+        1,
+        &kernel->descriptor_layout,
+        push_constant_range.size ? 1 : 0,
+        &push_constant_range
+    };
+
+    CALL_VK(vkCreatePipelineLayout,
+            (state->device, &layout_info, NULL, &kernel->pipeline_layout));
+
+    VkDescriptorUpdateTemplateEntry entries[MAX_KERNEL_BINDINGS];
+    for (uint32_t i = 0; i < kernel->reflection.binding_count; i++) {
+        const VkDescriptorSetLayoutBinding *binding = &kernel->reflection.bindings[i];
+        VkDescriptorUpdateTemplateEntry entry = {
+            binding->binding,
+            0,
+            binding->descriptorCount,
+            binding->descriptorType,
+            binding->binding * sizeof(VkDescriptorBufferInfo),
+            sizeof(VkDescriptorBufferInfo)
+        };
+        entries[i] = entry;
+    }
+
+    VkDescriptorUpdateTemplateCreateInfo template_info = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+        NULL,
+        0,
+        kernel->reflection.binding_count,
+        entries,
+        state->push_descriptors
+            ? VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR
+            : VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET,
+        kernel->descriptor_layout,
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        kernel->pipeline_layout,
+        0
+    };
+
+    CALL_VK(vkCreateDescriptorUpdateTemplate,
+            (state->device, &template_info, NULL, &kernel->update_template));
+
+    kernel->workgroup_size = kernel->reflection.workgroup_size_id
+                           ? state->workgroup_size
+                           : kernel->reflection.local_size[0];
+
+    registry->count++;
+    return kernel;
+}
+
+/* The compute stage of |kernel| specialized with |specialization_info|,
+ * with the subgroup requirements of kernel_subgroups_setup. */
+static VkPipelineShaderStageCreateInfo kernel_stage_info(const struct kernel *kernel,
+                                                         const VkSpecializationInfo *specialization_info)
+{
+    VkPipelineShaderStageCreateInfo stage_info = {
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        kernel->required_subgroup_size.requiredSubgroupSize
+            ? &kernel->required_subgroup_size : NULL,
+        kernel->full_subgroups ? VK_PIPELINE_SHADER_STAGE_CREATE_REQUIRE_FULL_SUBGROUPS_BIT_EXT : 0,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        kernel->shader_module,
+        SHADER_ENTRY_POINT,
+        specialization_info
+    };
+    return stage_info;
+}
+
+/* Creates the pipelines of the kernels added since the last build, in a
+ * single vkCreateComputePipelines call. */
+static void kernel_registry_build(struct vulkan_state *state)
+{
+    struct kernel_registry *registry = &state->kernels;
+    uint32_t count = registry->count - registry->built;
+    uint64_t start = get_time_ns();
+
+    if (count == 0)
+        return;
+
+    VkComputePipelineCreateInfo *infos = calloc(count, sizeof(*infos));
+    VkPipeline *pipelines = calloc(count, sizeof(*pipelines));
+    assert(infos && pipelines);
+
+    VkSpecializationInfo *specializations = calloc(count, sizeof(*specializations));
+    assert(specializations);
+
+    /* Constant 0 is the workgroup size of each kernel, tuned or not.
+     * Modules without it ignore it. */
+    VkSpecializationMapEntry specialization_entry = { 0, 0, sizeof(uint32_t) };
+
+    for (uint32_t i = 0; i < count; i++) {
+        const struct kernel *kernel = &registry->kernels[registry->built + i];
+
+        VkSpecializationInfo specialization_info = {
+            1,
+            &specialization_entry,
+            sizeof(kernel->workgroup_size),
+            &kernel->workgroup_size
+        };
+        specializations[i] = specialization_info;
+
+        VkComputePipelineCreateInfo info = {
+            VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            NULL,
+            0,
+            kernel_stage_info(kernel, &specializations[i]),
+            kernel->pipeline_layout,
+            VK_NULL_HANDLE,
+            0
+        };
+        infos[i] = info;
+    }
+
+    CALL_VK(vkCreateComputePipelines,
+            (state->device, state->pipeline_cache, count, infos, NULL, pipelines));
+
+    for (uint32_t i = 0; i < count; i++)
+        registry->kernels[registry->built + i].pipeline = pipelines[i];
+    registry->built = registry->count;
+    registry->build_ns = get_time_ns() - start;
+
+    free(specializations);
+    free(infos);
+    free(pipelines);
+}
+
+static void* kernel_registry_build_thread(void *data)
+{
+    kernel_registry_build(data);
+    return NULL;
+}
+
+/* Same as kernel_registry_build, returning immediately. The registry must
+ * not be touched until kernel_registry_wait, kernel_find does it. */
+void kernel_registry_build_async(struct vulkan_state *state)
+{
+    struct kernel_registry *registry = &state->kernels;
+
+    assert(!registry->building);
+    if (pthread_create(&registry->thread, NULL, kernel_registry_build_thread, state) != 0) {
+        kernel_registry_build(state);
+        return;
+    }
+    registry->building = 1;
+}
+
+static void kernel_registry_wait(struct vulkan_state *state)
+{
+    struct kernel_registry *registry = &state->kernels;
+
+    if (!registry->building)
+        return;
+    pthread_join(registry->thread, NULL);
+    registry->building = 0;
+}
+
+/* Returns the built kernel called |name|, NULL if there is none. */
+const struct kernel* kernel_find(struct vulkan_state *state, const char *name)
+{
+    struct kernel_registry *registry = &state->kernels;
+
+    kernel_registry_wait(state);
+    for (uint32_t i = 0; i < registry->built; i++) {
+        if (0 == strcmp(registry->kernels[i].name, name))
+            return &registry->kernels[i];
+    }
+    return NULL;
+}
+
+/* Creates a pipeline of |kernel| with other specialization constants than
+ * the one kernel_registry_build gave it. */
+static VkPipeline kernel_pipeline_create(struct vulkan_state *state,
+                                         const struct kernel *kernel,
+                                         const VkSpecializationInfo *specialization_info)
+{
+    VkPipeline pipeline;
+
+    VkComputePipelineCreateInfo info = {
+        VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        NULL,
+        0,
+        kernel_stage_info(kernel, specialization_info),
+        kernel->pipeline_layout,
+        VK_NULL_HANDLE,
+        0
+    };
+
+    CALL_VK(vkCreateComputePipelines,
+            (state->device, state->pipeline_cache, 1, &info, NULL, &pipeline));
+    return pipeline;
+}
+
+static void kernel_destroy(struct vulkan_state *state, struct kernel *kernel)
+{
+    if (kernel->pipeline != VK_NULL_HANDLE)
+        vkDestroyPipeline(state->device, kernel->pipeline, NULL);
+    vkDestroyDescriptorUpdateTemplate(state->device, kernel->update_template, NULL);
+    vkDestroyPipelineLayout(state->device, kernel->pipeline_layout, NULL);
+    vkDestroyDescriptorSetLayout(state->device, kernel->descriptor_layout, NULL);
+    vkDestroyShaderModule(state->device, kernel->shader_module, NULL);
+}
+
+/* Drops the kernel kernel_registry_add returned last, before it is built. */
+static void kernel_registry_pop(struct vulkan_state *state)
+{
+    struct kernel_registry *registry = &state->kernels;
+
+    assert(!registry->building && registry->count > registry->built);
+    kernel_destroy(state, &registry->kernels[--registry->count]);
+}
+
+static void kernel_registry_destroy(struct vulkan_state *state)
+{
+    struct kernel_registry *registry = &state->kernels;
+
+    kernel_registry_wait(state);
+    for (uint32_t i = 0; i < registry->count; i++)
+        kernel_destroy(state, &registry->kernels[i]);
+    registry->count = 0;
+    registry->built = 0;
+}
+
+/* Turns profiling on: submissions record timestamps, and the trace is
+ * written to |path| by profiler_write. */
+void profiler_create(struct vulkan_state *state, const char *path)
+{
+    struct profiler *profiler = &state->profiler;
+
+    if (state->timestamp_valid_bits == 0) {
+        fprintf(stderr, "the queue does not support timestamps, profiling disabled.\n");
+        return;
+    }
+
+    VkQueryPoolCreateInfo info = {
+        VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        NULL,
+        0,
+        VK_QUERY_TYPE_TIMESTAMP,
+        PROFILE_QUERY_RANGES * PROFILE_QUERY_COUNT,
+        0
+    };
+
+    CALL_VK(vkCreateQueryPool, (state->device, &info, NULL, &profiler->query_pool));
+    profiler->path = strdup(path);
+    profiler->period_ns = state->limits.timestampPeriod;
+    profiler->valid_mask = state->timestamp_valid_bits >= 64
+                         ? UINT64_MAX
+                         : (1ull << state->timestamp_valid_bits) - 1;
+}
+
+static void profiler_add(struct profiler *profiler,
+                         const char *name,
+                         const char *category,
+                         uint64_t start_ns,
+                         uint64_t duration_ns,
+                         uint64_t bytes,
+                         uint8_t host)
+{
+    if (profiler->event_count == profiler->event_capacity) {
+        profiler->event_capacity = profiler->event_capacity ? profiler->event_capacity * 2 : 256;
+        profiler->events = realloc(profiler->events,
+                                   sizeof(*profiler->events) * profiler->event_capacity);
+        assert(profiler->events);
+    }
+
+    struct profile_event event = { name, category, start_ns, duration_ns, bytes, host };
+    profiler->events[profiler->event_count++] = event;
+}
+
+/* Reads back the timestamps of a completed submission. |signal_ns| is when
+ * the host saw it complete, 0 if it did not wait for it. */
+static void profiler_collect(struct vulkan_state *state,
+                             struct profile_job *job,
+                             uint64_t signal_ns)
+{
+    struct profiler *profiler = &state->profiler;
+    uint64_t ticks[PROFILE_QUERY_COUNT];
+    uint64_t ns[PROFILE_QUERY_COUNT];
+
+    if (!job->pending)
+        return;
+    job->pending = 0;
+
+    CALL_VK(vkGetQueryPoolResults, (state->device, profiler->query_pool,
+                                    job->query_base, PROFILE_QUERY_COUNT,
+                                    sizeof(ticks), ticks, sizeof(*ticks),
+                                    VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+    for (uint32_t i = 0; i < PROFILE_QUERY_COUNT; i++)
+        ns[i] = (uint64_t)((double)(ticks[i] & profiler->valid_mask) * profiler->period_ns);
+
+    if (job->transfer_size) {
+        profiler_add(profiler, "upload", "copy", ns[0], ns[1] - ns[0], job->transfer_size, 0);
+        profiler_add(profiler, "download", "copy", ns[2], ns[3] - ns[2], job->transfer_size, 0);
+    }
+    /* The kernel reads and writes each element once. */
+    profiler_add(profiler, job->kernel, "dispatch", ns[1], ns[2] - ns[1],
+                 2ull * job->element_size * job->elt_count, 0);
+
+    if (signal_ns) {
+        profiler_add(profiler, job->kernel, "submit-to-signal",
+                     job->submit_ns, signal_ns - job->submit_ns, 0, 1);
+    }
+}
+
+/* Writes the collected spans as a Chrome trace (chrome://tracing, Perfetto),
+ * with per-name totals under "otherData". Also prints the totals. */
+void profiler_write(struct vulkan_state *state)
+{
+    struct profiler *profiler = &state->profiler;
+
+    if (profiler->query_pool == VK_NULL_HANDLE)
+        return;
+
+    for (uint32_t i = 0; i < COMMAND_RING_SIZE; i++) {
+        struct command_slot *slot = &state->command_ring[i];
+
+        if (!slot->profile.pending)
+            continue;
+        CALL_VK(vkWaitForFences, (state->device, 1, &slot->fence, VK_TRUE, 1e9 * 5));
+        profiler_collect(state, &slot->profile, 0);
+    }
+
+    FILE *file = fopen(profiler->path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "unable to write the profile to %s.\n", profiler->path);
+        return;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (uint32_t i = 0; i < profiler->event_count; i++) {
+        const struct profile_event *event = &profiler->events[i];
+
+        fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                      "\"pid\":\"%s\",\"tid\":\"%s\",\"ts\":%.3f,\"dur\":%.3f,"
+                      "\"args\":{\"bytes\":%llu}}\n",
+                i ? "," : "",
+                event->name, event->category,
+                event->host ? "host" : "gpu", event->category,
+                event->start_ns / 1e3, event->duration_ns / 1e3,
+                (unsigned long long)event->bytes);
+    }
+    fprintf(file, "],\n\"displayTimeUnit\":\"ns\",\n\"otherData\":{\"summary\":[\n");
+
+    /* Totals per (name, category), in order of first appearance. */
+    uint32_t written = 0;
+    for (uint32_t i = 0; i < profiler->event_count; i++) {
+        const struct profile_event *first = &profiler->events[i];
+        uint64_t total_ns = 0, bytes = 0;
+        uint32_t count = 0, seen = 0;
+
+        for (uint32_t j = 0; j < i && !seen; j++) {
+            seen = profiler->events[j].name == first->name
+                && profiler->events[j].category == first->category;
+        }
+        if (seen)
+            continue;
+
+        for (uint32_t j = i; j < profiler->event_count; j++) {
+            const struct profile_event *event = &profiler->events[j];
+            if (event->name != first->name || event->category != first->category)
+                continue;
+            total_ns += event->duration_ns;
+            bytes += event->bytes;
+            count++;
+        }
+
+        double mean_us = (double)total_ns / count / 1e3;
+        double gbps = total_ns ? (double)bytes / (double)total_ns : 0.;
+
+        fprintf(file, "%s{\"name\":\"%s\",\"category\":\"%s\",\"count\":%u,"
+                      "\"mean_us\":%.3f,\"total_us\":%.3f,\"GBps\":%.3f}\n",
+                written++ ? "," : "", first->name, first->category, count,
+                mean_us, total_ns / 1e3, gbps);
+        printf("profile: %-8s %-16s %6u x %10.3f us%s",
+               first->name, first->category, count, mean_us, bytes ? "" : "\n");
+        if (bytes)
+            printf(", %.3f GB/s\n", gbps);
+    }
+    fprintf(file, "]}}\n");
+    fclose(file);
+
+    printf("profile written to %s\n", profiler->path);
+}
+
+static void profiler_destroy(struct vulkan_state *state)
+{
+    struct profiler *profiler = &state->profiler;
+
+    if (profiler->query_pool != VK_NULL_HANDLE)
+        vkDestroyQueryPool(state->device, profiler->query_pool, NULL);
+    free(profiler->events);
+    free(profiler->path);
+    memset(profiler, 0, sizeof(*profiler));
+}
+
+static void record_barrier(VkCommandBuffer command_buffer,
+                           VkPipelineStageFlags src_stage,
+                           VkAccessFlags src_access,
+                           VkPipelineStageFlags dst_stage,
+                           VkAccessFlags dst_access)
+{
+    VkMemoryBarrier barrier = {
+        VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        NULL,
+        src_access,
+        dst_access
+    };
+
+    vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0,
+                         1, &barrier, 0, NULL, 0, NULL);
+}
+
+/* Shader writes of the last dispatch, mapped by the host or copied out. */
+static void record_results_barrier(VkCommandBuffer command_buffer)
+{
+    record_barrier(command_buffer,
+                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                   VK_ACCESS_SHADER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                   VK_ACCESS_HOST_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT);
+}
+
+/* One half of a queue family ownership transfer of |buffer|: the release
+ * is recorded on the |src_family| queue, the acquire on the |dst_family|
+ * one, after a semaphore wait on the release. |stage| and |access| are the
+ * uses of the buffer on this side. Nothing to do within a family. */
+static void record_ownership_barrier(VkCommandBuffer command_buffer,
+                                     VkBuffer buffer,
+                                     VkDeviceSize offset,
+                                     VkDeviceSize size,
+                                     uint32_t src_family,
+                                     uint32_t dst_family,
+                                     uint8_t acquire,
+                                     VkPipelineStageFlags stage,
+                                     VkAccessFlags access)
+{
+    if (src_family == dst_family)
+        return;
+
+    VkBufferMemoryBarrier barrier = {
+        VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        NULL,
+        acquire ? 0 : access,
+        acquire ? access : 0,
+        src_family,
+        dst_family,
+        buffer,
+        offset,
+        size
+    };
+
+    vkCmdPipelineBarrier(command_buffer,
+                         acquire ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : stage,
+                         acquire ? stage : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+/* Group counts covering |elt_count| invocations, rounded up: the shaders
+ * bounds check against elt_count. A row of groups is capped by
+ * maxComputeWorkGroupCount[0], larger problems spill onto more rows and
+ * the shaders rebuild the element index from row_pitch. */
+static struct sum_dispatch sum_dispatch_size(const struct vulkan_state *state,
+                                             const struct kernel *kernel,
+                                             uint32_t elt_count)
+{
+    struct sum_dispatch dispatch;
+    uint64_t invocations = ((uint64_t)elt_count + kernel->elements_per_invocation - 1)
+                         / kernel->elements_per_invocation;
+    uint32_t group_count = (uint32_t)((invocations + kernel->workgroup_size - 1)
+                                      / kernel->workgroup_size);
+    uint32_t max_row = state->limits.maxComputeWorkGroupCount[0];
+
+    dispatch.group_count_x = group_count < max_row ? group_count : max_row;
+    dispatch.group_count_y = 0;
+    if (dispatch.group_count_x != 0) {
+        dispatch.group_count_y = (group_count + dispatch.group_count_x - 1)
+                               / dispatch.group_count_x;
+    }
+    assert(dispatch.group_count_y <= state->limits.maxComputeWorkGroupCount[1]);
+
+    dispatch.constants.elt_count = elt_count;
+    dispatch.constants.row_pitch = dispatch.group_count_x * kernel->workgroup_size;
+    dispatch.constants.invocation_count = dispatch.constants.row_pitch * dispatch.group_count_y;
+    return dispatch;
+}
+
+/* Binds |bindings| to set 0 of |kernel|. Pushed into the command buffer
+ * with VK_KHR_push_descriptor, otherwise written to a set of |frame|:
+ * either way, later changes to |bindings| do not affect the recording. */
+static void record_bindings(struct vulkan_state *state,
+                            VkCommandBuffer command_buffer,
+                            struct descriptor_frame *frame,
+                            const struct kernel *kernel,
+                            const struct kernel_bindings *bindings)
+{
+    uint64_t start = get_time_ns();
+
+    if (state->push_descriptors) {
+        state->push_descriptor_set_with_template(command_buffer, kernel->update_template,
+                                                 kernel->pipeline_layout, 0, bindings);
+    } else {
+        VkDescriptorSet set = descriptor_frame_allocate(state, frame, kernel->descriptor_layout);
+
+        vkUpdateDescriptorSetWithTemplate(state->device, set, kernel->update_template, bindings);
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                kernel->pipeline_layout,
+                                0,
+                                1,
+                                &set,
+                                0,
+                                NULL);
+    }
+
+    /* Producers of a submit_queue record concurrently. */
+    __atomic_fetch_add(&state->binding_ns, get_time_ns() - start, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&state->binding_count, 1, __ATOMIC_RELAXED);
+}
+
+/* Binds |kernel| with |bindings| and dispatches it over |elt_count|
+ * elements, or with the group counts of |indirect|. */
+static void record_dispatch(struct vulkan_state *state,
+                            VkCommandBuffer command_buffer,
+                            struct descriptor_frame *frame,
+                            const struct kernel *kernel,
+                            const struct kernel_bindings *bindings,
+                            uint32_t elt_count,
+                            VkBuffer indirect)
+{
+    struct sum_dispatch dispatch = sum_dispatch_size(state, kernel, elt_count);
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipeline);
+    record_bindings(state, command_buffer, frame, kernel, bindings);
+
+    /* Scalar kernels only declare the first members. */
+    assert(kernel->reflection.push_constant_size <= sizeof(dispatch.constants));
+    if (kernel->reflection.push_constant_size) {
+        vkCmdPushConstants(command_buffer, kernel->pipeline_layout,
+                           VK_SHADER_STAGE_COMPUTE_BIT,
+                           0,
+                           kernel->reflection.push_constant_size,
+                           &dispatch.constants);
+    }
+    if (indirect != VK_NULL_HANDLE)
+        vkCmdDispatchIndirect(command_buffer, indirect, 0);
+    else
+        vkCmdDispatch(command_buffer, dispatch.group_count_x, dispatch.group_count_y, 1);
+}
+
+/* Records the dispatch of |kernel|, surrounded by the staging copies when
+ * |transfer| is set. When they run on the transfer queue instead, |owned|
+ * hands the buffers over, see record_upload and record_download. The
+ * kernel takes the sum_push_constants. With |indirect|, the group counts
+ * are read from it at execution instead. Sets come from |frame|, see
+ * record_bindings. When profiling, timestamps go to the
+ * PROFILE_QUERY_COUNT queries starting at |query_base|: they only cover
+ * the copies recorded here. */
+static void record_sum_kernel(struct vulkan_state *state,
+                              VkCommandBuffer command_buffer,
+                              const struct kernel *kernel,
+                              const struct kernel_bindings *bindings,
+                              struct descriptor_frame *frame,
+                              uint32_t elt_count,
+                              VkBuffer indirect,
+                              const struct sum_transfer *transfer,
+                              const struct sum_transfer *owned,
+                              uint32_t query_base)
+{
+    const uint32_t compute_family = state->compute_queues[0].family_index;
+    const uint32_t transfer_family = state->transfer_queue.family_index;
+    VkQueryPool query_pool = state->profiler.query_pool;
+
+    if (query_pool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(command_buffer, query_pool, query_base, PROFILE_QUERY_COUNT);
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            query_pool, query_base);
+    }
+
+    if (transfer) {
+        VkBufferCopy region = { transfer->upload_offset, transfer->input_offset, transfer->size };
+
+        /* Host writes to the staging buffer are made visible by the submission. */
+        vkCmdCopyBuffer(command_buffer, transfer->upload, transfer->input, 1, &region);
+        /* Input and output may be the same buffer: also order the shader writes. */
+        record_barrier(command_buffer,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_ACCESS_TRANSFER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+    }
+
+    if (query_pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                            query_pool, query_base + 1);
+    }
+
+    if (owned) {
+        record_ownership_barrier(command_buffer, owned->input, owned->input_offset, owned->size,
+                                 transfer_family, compute_family, 1,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+    }
+
+    record_dispatch(state, command_buffer, frame, kernel, bindings, elt_count, indirect);
+
+    if (query_pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                            query_pool, query_base + 2);
+    }
+
+    /* The input is not handed back: the next upload overwrites it. */
+    if (owned) {
+        record_ownership_barrier(command_buffer, owned->output, owned->output_offset, owned->size,
+                                 compute_family, transfer_family, 0,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_ACCESS_SHADER_WRITE_BIT);
+    }
+
+    if (transfer) {
+        VkBufferCopy region = { transfer->output_offset, transfer->download_offset, transfer->size };
+
+        record_barrier(command_buffer,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_ACCESS_SHADER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_ACCESS_TRANSFER_READ_BIT);
+        vkCmdCopyBuffer(command_buffer, transfer->output, transfer->download, 1, &region);
+        record_barrier(command_buffer,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_ACCESS_TRANSFER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT,
+                       VK_ACCESS_HOST_READ_BIT);
+    }
+
+    if (query_pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            query_pool, query_base + 3);
+    }
+}
+
+/* The transfer queue side of a job with its copies on the transfer queue:
+ * the upload to the input, handed over to the compute family. */
+static void record_upload(struct vulkan_state *state,
+                          VkCommandBuffer command_buffer,
+                          const struct sum_transfer *transfer)
+{
+    VkCommandBufferBeginInfo begin_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        NULL,
+        0,
+        NULL
+    };
+    VkBufferCopy region = { transfer->upload_offset, transfer->input_offset, transfer->size };
+
+    CALL_VK(vkBeginCommandBuffer, (command_buffer, &begin_info));
+    vkCmdCopyBuffer(command_buffer, transfer->upload, transfer->input, 1, &region);
+    record_ownership_barrier(command_buffer, transfer->input, transfer->input_offset, transfer->size,
+                             state->transfer_queue.family_index,
+                             state->compute_queues[0].family_index, 0,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_ACCESS_TRANSFER_WRITE_BIT);
+    CALL_VK(vkEndCommandBuffer, (command_buffer));
+}
+
+/* Then the download of the output, once the compute family handed it over. */
+static void record_download(struct vulkan_state *state,
+                            VkCommandBuffer command_buffer,
+                            const struct sum_transfer *transfer)
+{
+    VkCommandBufferBeginInfo begin_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        NULL,
+        0,
+        NULL
+    };
+    VkBufferCopy region = { transfer->output_offset, transfer->download_offset, transfer->size };
+
+    CALL_VK(vkBeginCommandBuffer, (command_buffer, &begin_info));
+    record_ownership_barrier(command_buffer, transfer->output, transfer->output_offset, transfer->size,
+                             state->compute_queues[0].family_index,
+                             state->transfer_queue.family_index, 1,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_ACCESS_TRANSFER_READ_BIT);
+    vkCmdCopyBuffer(command_buffer, transfer->output, transfer->download, 1, &region);
+    record_barrier(command_buffer,
+                   VK_PIPELINE_STAGE_TRANSFER_BIT,
+                   VK_ACCESS_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_HOST_BIT,
+                   VK_ACCESS_HOST_READ_BIT);
+    CALL_VK(vkEndCommandBuffer, (command_buffer));
+}
+
+/* Submits |command_buffer| to |queue|, waiting for |wait_value| of the
+ * |wait| timeline first when set, and signaling the next value of the
+ * queue timeline. Returns that value. */
+static uint64_t queue_submit(struct gpu_queue *queue,
+                             VkCommandBuffer command_buffer,
+                             const struct gpu_queue *wait,
+                             uint64_t wait_value,
+                             VkFence fence)
+{
+    const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+    /* Values must reach the queue in the order they are taken. */
+    pthread_mutex_lock(&queue->submit_lock);
+    uint64_t signal_value = ++queue->timeline_value;
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+        VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        NULL,
+        wait ? 1 : 0,
+        &wait_value,
+        1,
+        &signal_value
+    };
+
+    VkSubmitInfo submit_info = {
+        VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        &timeline_info,
+        wait ? 1 : 0,
+        wait ? &wait->timeline : NULL,
+        wait ? &wait_stage : NULL,
+        1,
+        &command_buffer,
+        1,
+        &queue->timeline
+    };
+
+    CALL_VK(vkQueueSubmit, (queue->queue, 1, &submit_info, fence));
+    pthread_mutex_unlock(&queue->submit_lock);
+    return signal_value;
+}
+
+static void submit_and_wait(struct vulkan_state *state,
+                            VkCommandBuffer command_buffer,
+                            VkFence fence)
+{
+    VkSubmitInfo submit_info = {
+        VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        NULL,
+        0,
+        NULL,
+        NULL,
+        1,
+        &command_buffer,
+        0,
+        NULL
+    };
+
+    pthread_mutex_lock(&state->compute_queues[0].submit_lock);
+    CALL_VK(vkQueueSubmit, (state->compute_queues[0].queue, 1, &submit_info, fence));
+    pthread_mutex_unlock(&state->compute_queues[0].submit_lock);
+    CALL_VK(vkWaitForFences, (state->device, 1, &fence, VK_TRUE, 1e9 * 5));
+}
+
+/* Allocates a command buffer from |pool| and begins it, for a single
+ * submission through one_shot_submit_and_wait. */
+static VkCommandBuffer one_shot_begin(struct vulkan_state *state, VkCommandPool pool)
+{
+    VkCommandBuffer command_buffer;
+    VkCommandBufferAllocateInfo alloc_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        NULL,
+        pool,
+        VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        1
+    };
+
+    VkCommandBufferBeginInfo begin_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        NULL,
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        NULL
+    };
+
+    CALL_VK(vkAllocateCommandBuffers, (state->device, &alloc_info, &command_buffer));
+    CALL_VK(vkBeginCommandBuffer, (command_buffer, &begin_info));
+    return command_buffer;
+}
+
+/* Ends |command_buffer|, submits it to |queue| and waits for it, then
+ * frees it back to |pool|. The sets of |descriptors|, when set, were only
+ * used by this submission: the frame is reset. */
+static void one_shot_submit_and_wait(struct vulkan_state *state,
+                                     struct gpu_queue *queue,
+                                     VkCommandPool pool,
+                                     VkCommandBuffer command_buffer,
+                                     struct descriptor_frame *descriptors)
+{
+    VkFence fence;
+    VkFenceCreateInfo fence_info = {
+        VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        NULL,
+        0
+    };
+
+    CALL_VK(vkEndCommandBuffer, (command_buffer));
+    CALL_VK(vkCreateFence, (state->device, &fence_info, NULL, &fence));
+    queue_submit(queue, command_buffer, NULL, 0, fence);
+    CALL_VK(vkWaitForFences, (state->device, 1, &fence, VK_TRUE, 1e9 * 5));
+    vkDestroyFence(state->device, fence, NULL);
+    vkFreeCommandBuffers(state->device, pool, 1, &command_buffer);
+    if (descriptors)
+        descriptor_frame_reset(state, descriptors);
+}
+
+/* Staging copies to record for the global bindings, NULL with host
+ * placement. */
+const struct sum_transfer* bound_transfer(const struct vulkan_state *state,
+                                          struct sum_transfer *transfer)
+{
+    if (state->placement != MEMORY_PLACEMENT_DEVICE)
+        return NULL;
+
+    memset(transfer, 0, sizeof(*transfer));
+    transfer->input = state->bound_buffers[0];
+    transfer->output = state->bound_buffers[1];
+    transfer->size = state->bound_sizes[0];
+    transfer->upload = state->staging_upload.vk_buffer;
+    transfer->download = state->staging_download.vk_buffer;
+    return transfer;
+}
+
+/* Allocates, records and submits a fresh command buffer. Kept to compare
+ * against the command ring (see USE_ONE_SHOT_SUBMIT). */
+static void execute_sum_kernel_one_shot(struct vulkan_state *state, uint32_t elt_count)
+{
+    const struct kernel *kernel = sum_kernel_select(state, elt_count);
+    struct sum_transfer transfer;
+
+    const struct sum_transfer *bound = bound_transfer(state, &transfer);
+    struct profile_job profile = {
+        kernel->name,
+        elt_count,
+        element_type_size(kernel->element_type),
+        bound ? bound->size : 0,
+        COMMAND_RING_SIZE * PROFILE_QUERY_COUNT,
+        0,
+        state->profiler.query_pool != VK_NULL_HANDLE
+    };
+
+    VkCommandBuffer command_buffer = one_shot_begin(state, state->command_pool);
+    record_sum_kernel(state, command_buffer,
+                      kernel,
+                      &state->bindings,
+                      &state->descriptors,
+                      elt_count,
+                      VK_NULL_HANDLE,
+                      bound,
+                      NULL,
+                      profile.query_base);
+
+    profile.submit_ns = get_time_ns();
+    one_shot_submit_and_wait(state, &state->compute_queues[0], state->command_pool,
+                             command_buffer, &state->descriptors);
+    profiler_collect(state, &profile, get_time_ns());
+}
+
+static uint8_t command_slot_matches(const struct command_slot *slot,
+                                    const struct kernel *kernel,
+                                    const struct kernel_bindings *bindings,
+                                    uint32_t elt_count,
+                                    VkBuffer indirect,
+                                    const struct sum_transfer *transfer)
+{
+    /* Indirect dispatches do not depend on the element count. */
+    return slot->recorded
+        && slot->pipeline == kernel->pipeline
+        && 0 == memcmp(&slot->bindings, bindings, sizeof(*bindings))
+        && slot->indirect == indirect
+        && (indirect != VK_NULL_HANDLE || slot->elt_count == elt_count)
+        && 0 == memcmp(&slot->transfer, transfer, sizeof(*transfer));
+}
+
+/* Submits |kernel| over |elt_count| elements with |bindings| and returns
+ * without waiting. |transfer| optionally adds the staging
+ * copies around the dispatch: on the transfer queue when there is one,
+ * synchronized with the dispatch by the queue timelines. Takes the next
+ * slot of the ring, and only records it again if the pipeline or the
+ * bindings changed since it was last recorded. Slots go round-robin over
+ * the compute queues: jobs in flight together must not depend on each
+ * other. With |indirect|, the group counts are read from it. Returns the
+ * job, for poll_sum_kernel and wait_sum_kernel. */
+static uint64_t command_ring_submit(struct vulkan_state *state,
+                                   const struct kernel *kernel,
+                                   const struct kernel_bindings *bindings,
+                                   uint32_t elt_count,
+                                   VkBuffer indirect,
+                                   const struct sum_transfer *transfer)
+{
+    static const struct sum_transfer no_transfer;
+    const uint32_t slot_index = state->command_ring_next;
+    struct command_slot *slot = &state->command_ring[slot_index];
+    struct gpu_queue *queue = &state->compute_queues[slot_index % state->compute_queue_count];
+    const uint8_t split = transfer && state->transfer_queue.queue != VK_NULL_HANDLE;
+
+    state->command_ring_next = (state->command_ring_next + 1) % COMMAND_RING_SIZE;
+
+    /* Only blocks when more than COMMAND_RING_SIZE jobs are in flight. */
+    CALL_VK(vkWaitForFences, (state->device, 1, &slot->fence, VK_TRUE, 1e9 * 5));
+    CALL_VK(vkResetFences, (state->device, 1, &slot->fence));
+    /* Its previous job completed without anyone waiting for it. */
+    profiler_collect(state, &slot->profile, 0);
+
+    if (!command_slot_matches(slot, kernel, bindings, elt_count, indirect,
+                              transfer ? transfer : &no_transfer)) {
+        VkCommandBufferBeginInfo begin_info = {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            NULL,
+            0,
+            NULL
+        };
+
+        CALL_VK(vkResetCommandBuffer, (slot->command_buffer, 0));
+        descriptor_frame_reset(state, &slot->descriptors);
+        CALL_VK(vkBeginCommandBuffer, (slot->command_buffer, &begin_info));
+        record_sum_kernel(state, slot->command_buffer, kernel, bindings, &slot->descriptors,
+                          elt_count, indirect,
+                          split ? NULL : transfer,
+                          split ? transfer : NULL,
+                          slot_index * PROFILE_QUERY_COUNT);
+        CALL_VK(vkEndCommandBuffer, (slot->command_buffer));
+        if (split) {
+            CALL_VK(vkResetCommandBuffer, (slot->upload_command_buffer, 0));
+            CALL_VK(vkResetCommandBuffer, (slot->download_command_buffer, 0));
+            record_upload(state, slot->upload_command_buffer, transfer);
+            record_download(state, slot->download_command_buffer, transfer);
+        }
+
+        slot->pipeline = kernel->pipeline;
+        slot->bindings = *bindings;
+        slot->elt_count = elt_count;
+        slot->indirect = indirect;
+        slot->transfer = transfer ? *transfer : no_transfer;
+        slot->recorded = 1;
+    }
+
+    slot->job = ++state->job_count;
+
+    struct profile_job profile = {
+        kernel->name,
+        elt_count,
+        element_type_size(kernel->element_type),
+        transfer && !split ? transfer->size : 0,
+        slot_index * PROFILE_QUERY_COUNT,
+        get_time_ns(),
+        state->profiler.query_pool != VK_NULL_HANDLE
+    };
+    slot->profile = profile;
+
+    if (!split) {
+        slot->queue = queue;
+        slot->timeline_value = queue_submit(queue, slot->command_buffer, NULL, 0, slot->fence);
+        return slot->job;
+    }
+
+    /* Upload, dispatch and download, each waiting for the previous one.
+     * The fence covers all three. */
+    struct gpu_queue *transfer_queue = &state->transfer_queue;
+    uint64_t uploaded = queue_submit(transfer_queue, slot->upload_command_buffer,
+                                     NULL, 0, VK_NULL_HANDLE);
+    uint64_t computed = queue_submit(queue, slot->command_buffer,
+                                     transfer_queue, uploaded, VK_NULL_HANDLE);
+    slot->queue = transfer_queue;
+    slot->timeline_value = queue_submit(transfer_queue, slot->download_command_buffer,
+                                        queue, computed, slot->fence);
+    return slot->job;
+}
+
+uint64_t submit_sum_kernel(struct vulkan_state *state,
+                           const struct kernel *kernel,
+                           const struct kernel_bindings *bindings,
+                           uint32_t elt_count,
+                           const struct sum_transfer *transfer)
+{
+    return command_ring_submit(state, kernel, bindings, elt_count, VK_NULL_HANDLE, transfer);
+}
+
+/* Allocates the buffers of a batch of up to |max_jobs| jobs totaling
+ * |max_elt_count| elements, and binds them for the sum_batch kernel. */
+void sum_batch_create(struct vulkan_state *state,
+                      struct sum_batch *batch,
+                      uint32_t max_jobs,
+                      uint32_t max_elt_count)
+{
+    const VkDeviceSize size = sum_buffer_size(max_elt_count);
+    const VkDeviceSize jobs_size = sizeof(struct batch_job) * (VkDeviceSize)max_jobs;
+
+    assert(state->sum_batch);
+    assert(max_jobs <= SUM_BATCH_MAX_JOBS);
+
+    memset(batch, 0, sizeof(*batch));
+    batch->max_jobs = max_jobs;
+    batch->max_elt_count = max_elt_count;
+    batch->input = allocate_buffer(state, size, MEMORY_USAGE_UPLOAD);
+    batch->output = allocate_buffer(state, size, MEMORY_USAGE_READBACK);
+    batch->jobs = allocate_buffer(state, jobs_size, MEMORY_USAGE_UPLOAD);
+    batch->indirect = allocate_buffer(state, sizeof(VkDispatchIndirectCommand),
+                                      MEMORY_USAGE_UPLOAD);
+
+    kernel_bindings_write(&batch->bindings, batch->input.vk_buffer, size, 0);
+    kernel_bindings_write(&batch->bindings, batch->output.vk_buffer, size, 1);
+    kernel_bindings_write(&batch->bindings, batch->jobs.vk_buffer, jobs_size, 2);
+}
+
+/* The batch must be idle. */
+void sum_batch_destroy(struct vulkan_state *state, struct sum_batch *batch)
+{
+    free_buffer(state, &batch->input);
+    free_buffer(state, &batch->output);
+    free_buffer(state, &batch->jobs);
+    free_buffer(state, &batch->indirect);
+}
+
+/* Empties the batch, once its last submission completed. */
+void sum_batch_reset(struct sum_batch *batch)
+{
+    batch->job_count = 0;
+    batch->elt_count = 0;
+}
+
+/* Appends a job over the |elt_count| values of |data|. Returns its index
+ * in the batch, or UINT32_MAX when the batch is full. */
+uint32_t sum_batch_add(struct sum_batch *batch, const int *data, uint32_t elt_count)
+{
+    if (batch->job_count == batch->max_jobs
+        || elt_count > batch->max_elt_count - batch->elt_count)
+        return UINT32_MAX;
+
+    struct batch_job *jobs = (struct batch_job*)batch->jobs.buffer;
+    struct batch_job job = { batch->elt_count, elt_count };
+
+    memcpy((int*)batch->input.buffer + job.first, data, sizeof(int) * (size_t)elt_count);
+    jobs[batch->job_count] = job;
+    batch->elt_count += elt_count;
+    return batch->job_count++;
+}
+
+/* Runs every job of the batch with a single dispatch, and returns without
+ * waiting, see wait_sum_kernel. The command buffers do not depend on the
+ * jobs: batches of any size reuse the same recording. */
+uint64_t submit_sum_batch(struct vulkan_state *state, struct sum_batch *batch)
+{
+    VkDispatchIndirectCommand *command = (VkDispatchIndirectCommand*)batch->indirect.buffer;
+
+    command->x = batch->job_count;
+    command->y = 1;
+    command->z = 1;
+
+    gpu_memory_flush(state, &batch->input, 0, sizeof(int) * (VkDeviceSize)batch->elt_count);
+    gpu_memory_flush(state, &batch->jobs, 0, sizeof(struct batch_job) * (VkDeviceSize)batch->job_count);
+    gpu_memory_flush(state, &batch->indirect, 0, sizeof(*command));
+
+    batch->job = command_ring_submit(state, state->sum_batch, &batch->bindings,
+                                     batch->elt_count, batch->indirect.vk_buffer, NULL);
+    return batch->job;
+}
+
+/* Output of job |index|, once the batch completed. */
+int* sum_batch_result(struct vulkan_state *state,
+                      const struct sum_batch *batch,
+                      uint32_t index,
+                      uint32_t *elt_count)
+{
+    const struct batch_job *job = (const struct batch_job*)batch->jobs.buffer + index;
+
+    assert(index < batch->job_count);
+    gpu_memory_invalidate(state, &batch->output,
+                          sizeof(int) * (VkDeviceSize)job->first,
+                          sizeof(int) * (VkDeviceSize)job->count);
+    *elt_count = job->count;
+    return (int*)batch->output.buffer + job->first;
+}
+
+/* The slot |job| was submitted with, NULL if it was reused since: the job
+ * completed then. */
+static struct command_slot* command_slot_find(struct vulkan_state *state, uint64_t job)
+{
+    for (uint32_t i = 0; i < COMMAND_RING_SIZE; i++) {
+        if (state->command_ring[i].job == job)
+            return &state->command_ring[i];
+    }
+    return NULL;
+}
+
+/* Returns 1 once the job returned by submit_sum_kernel has completed. */
+uint8_t poll_sum_kernel(struct vulkan_state *state, uint64_t job)
+{
+    struct command_slot *slot = command_slot_find(state, job);
+    uint64_t value;
+
+    if (slot == NULL)
+        return 1;
+
+    CALL_VK(vkGetSemaphoreCounterValue, (state->device, slot->queue->timeline, &value));
+    return value >= slot->timeline_value;
+}
+
+void wait_sum_kernel(struct vulkan_state *state, uint64_t job)
+{
+    struct command_slot *slot = command_slot_find(state, job);
+
+    if (slot == NULL)
+        return;
+
+    VkSemaphoreWaitInfo wait_info = {
+        VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        NULL,
+        0,
+        1,
+        &slot->queue->timeline,
+        &slot->timeline_value
+    };
+
+    CALL_VK(vkWaitSemaphores, (state->device, &wait_info, 1e9 * 5));
+    profiler_collect(state, &slot->profile, get_time_ns());
+}
+
+static void execute_sum_kernel_ring(struct vulkan_state *state, uint32_t elt_count)
+{
+    struct sum_transfer transfer;
+
+    wait_sum_kernel(state, submit_sum_kernel(state, sum_kernel_select(state, elt_count),
+                                             &state->bindings, elt_count,
+                                             bound_transfer(state, &transfer)));
+}
+
+/* The sum kernel to run over the first |elt_count| elements of the global
+ * bindings. The vectorized one needs both buffers aligned to a vector,
+ * and covering the last one: see sum_buffer_size. With SUM_VARIANT_AUTO,
+ * it is also skipped for dispatches smaller than a workgroup of it. The
+ * other element types have a single kernel, the device must support it. */
+const struct kernel* sum_kernel_select(const struct vulkan_state *state, uint32_t elt_count)
+{
+    if (state->element_type != ELEMENT_TYPE_INT32) {
+        assert(state->sum_types[state->element_type]);
+        return state->sum_types[state->element_type];
+    }
+
+    const struct kernel *vec4 = state->sum_vec4;
+    uint8_t usable = vec4 != NULL && state->sum_variant != SUM_VARIANT_SCALAR;
+
+    for (uint32_t i = 0; i < BUFFER_COUNT && usable; i++) {
+        usable = state->bound_offsets[i] % SUM_VECTOR_SIZE == 0
+              && state->bound_sizes[i] >= sum_buffer_size(elt_count);
+    }
+
+    if (usable && state->sum_variant == SUM_VARIANT_AUTO)
+        usable = elt_count >= (uint64_t)vec4->workgroup_size * vec4->elements_per_invocation;
+
+    return usable ? vec4 : state->sum;
+}
+
+/* Runs the kernel over the first |elt_count| elements of the global
+ * bindings, and waits for it. */
+void execute_sum_kernel(struct vulkan_state *state, uint32_t elt_count)
+{
+    if (state->one_shot_submit)
+        execute_sum_kernel_one_shot(state, elt_count);
+    else
+        execute_sum_kernel_ring(state, elt_count);
+}
+
+/* Copies |size| bytes of |data| to the start of |mem|. Mapped memory is
+ * written directly, the rest goes through the upload staging buffer and
+ * is waited for. The copy runs on the transfer queue when there is one,
+ * the compute family then acquires the buffer. */
+void gpu_memory_upload(struct vulkan_state *state,
+                       const struct gpu_memory *mem,
+                       const void *data,
+                       VkDeviceSize size)
+{
+    assert(size <= mem->vk_size);
+    if (mem->buffer) {
+        memcpy(mem->buffer, data, size);
+        gpu_memory_flush(state, mem, 0, size);
+        return;
+    }
+
+    assert(size <= state->staging_upload.vk_size);
+    memcpy(state->staging_upload.buffer, data, size);
+    gpu_memory_flush(state, &state->staging_upload, 0, size);
+
+    struct gpu_queue *transfer = &state->transfer_queue;
+    const uint8_t split = transfer->queue != VK_NULL_HANDLE;
+    const uint32_t compute_family = state->compute_queues[0].family_index;
+
+    VkBufferCopy region = { 0, 0, size };
+
+    if (!split) {
+        VkCommandBuffer command_buffer = one_shot_begin(state, state->command_pool);
+        vkCmdCopyBuffer(command_buffer, state->staging_upload.vk_buffer, mem->vk_buffer,
+                        1, &region);
+        one_shot_submit_and_wait(state, &state->compute_queues[0], state->command_pool,
+                                 command_buffer, NULL);
+        return;
+    }
+
+    /* The copy and its release, then the acquire on the compute side once
+     * the copy completed. */
+    VkCommandBuffer release = one_shot_begin(state, state->transfer_command_pool);
+    vkCmdCopyBuffer(release, state->staging_upload.vk_buffer, mem->vk_buffer, 1, &region);
+    record_ownership_barrier(release, mem->vk_buffer, 0, VK_WHOLE_SIZE,
+                             transfer->family_index, compute_family, 0,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_ACCESS_TRANSFER_WRITE_BIT);
+    one_shot_submit_and_wait(state, transfer, state->transfer_command_pool, release, NULL);
+
+    VkCommandBuffer acquire = one_shot_begin(state, state->command_pool);
+    record_ownership_barrier(acquire, mem->vk_buffer, 0, VK_WHOLE_SIZE,
+                             transfer->family_index, compute_family, 1,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_ACCESS_SHADER_READ_BIT);
+    one_shot_submit_and_wait(state, &state->compute_queues[0], state->command_pool,
+                             acquire, NULL);
+}
+
+/* Memory type |data| can be imported as, for a buffer accepting
+ * |type_bits|. UINT32_MAX when there is none, or when the driver refuses
+ * the pointer, as some do for file-backed or read-only mappings. Only
+ * HOST_COHERENT types qualify: imported memory is never vkMapMemory'd, so
+ * it cannot be flushed or invalidated. */
+static uint32_t host_import_memory_type(struct vulkan_state *state,
+                                        void *data,
+                                        uint32_t type_bits)
+{
+    VkMemoryHostPointerPropertiesEXT properties = {
+        VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT,
+        NULL,
+        0
+    };
+
+    VkResult res = state->get_memory_host_pointer_properties(
+        state->device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+        data, &properties);
+    if (res != VK_SUCCESS || properties.memoryTypeBits == 0)
+        return UINT32_MAX;
+
+    const VkMemoryPropertyFlags host = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                     | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    type_bits &= properties.memoryTypeBits;
+    for (uint32_t i = 0; i < state->arena.properties.memoryTypeCount; i++) {
+        VkMemoryPropertyFlags flags = state->arena.properties.memoryTypes[i].propertyFlags;
+
+        if ((type_bits & (1u << i)) && (flags & host) == host)
+            return i;
+    }
+    return UINT32_MAX;
+}
+
+/* Wraps the |size| bytes at |data| in a buffer the device reads and
+ * writes in place. Needs VK_EXT_external_memory_host, and |data| and |size|
+ * aligned on host_import_alignment. Returns 0 when it cannot, leaving |mem|
+ * untouched. |data| must outlive the buffer. */
+uint8_t host_memory_import(struct vulkan_state *state,
+                           void *data,
+                           VkDeviceSize size,
+                           struct gpu_memory *mem)
+{
+    const VkDeviceSize alignment = state->host_import_alignment;
+    uint32_t memory_type = UINT32_MAX;
+    VkMemoryRequirements requirements;
+    VkBuffer vk_buffer = VK_NULL_HANDLE;
+
+    if (state->host_import && (uintptr_t)data % alignment == 0 && size % alignment == 0) {
+        VkExternalMemoryBufferCreateInfo external_info = {
+            VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+            NULL,
+            VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT
+        };
+
+        VkBufferCreateInfo buffer_info = {
+            VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            &external_info,
+            0,
+            size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+                | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_SHARING_MODE_EXCLUSIVE,
+            0,
+            NULL
+        };
+
+        CALL_VK(vkCreateBuffer, (state->device, &buffer_info, NULL, &vk_buffer));
+        vkGetBufferMemoryRequirements(state->device, vk_buffer, &requirements);
+        if (requirements.size <= size)
+            memory_type = host_import_memory_type(state, data, requirements.memoryTypeBits);
+    }
+
+    if (memory_type == UINT32_MAX) {
+        if (vk_buffer != VK_NULL_HANDLE)
+            vkDestroyBuffer(state->device, vk_buffer, NULL);
+        return 0;
+    }
+
+    VkImportMemoryHostPointerInfoEXT import_info = {
+        VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+        NULL,
+        VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+        data
+    };
+
+    VkMemoryAllocateInfo alloc_info = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        &import_info,
+        size,
+        memory_type
+    };
+
+    /* The driver may still refuse the import, or be out of memory. */
+    VkDeviceMemory vk_memory;
+    if (vkAllocateMemory(state->device, &alloc_info, NULL, &vk_memory) != VK_SUCCESS) {
+        vkDestroyBuffer(state->device, vk_buffer, NULL);
+        return 0;
+    }
+    CALL_VK(vkBindBufferMemory, (state->device, vk_buffer, vk_memory, 0));
+
+    struct gpu_memory imported = {
+        data,
+        size,
+        vk_memory,
+        vk_buffer,
+        0,
+        0,
+        { NULL, 0, 0 },
+        1,
+    };
+    *mem = imported;
+    return 1;
+}
+
+/* Same as host_memory_import, falling back to a copy in an upload buffer:
+ * device writes are then not seen at |data|. */
+struct gpu_memory gpu_memory_import_host(struct vulkan_state *state,
+                                         void *data,
+                                         VkDeviceSize size)
+{
+    struct gpu_memory mem;
+
+    if (host_memory_import(state, data, size, &mem))
+        return mem;
+
+    mem = allocate_buffer(state, size, MEMORY_USAGE_UPLOAD);
+    gpu_memory_upload(state, &mem, data, size);
+    return mem;
+}
+
+/* Copies the first |size| bytes of |src| to |dst| and waits for it. The
+ * host writes to |src| must have been flushed. */
+void gpu_memory_copy(struct vulkan_state *state,
+                     const struct gpu_memory *src,
+                     const struct gpu_memory *dst,
+                     VkDeviceSize size)
+{
+    assert(size <= src->vk_size && size <= dst->vk_size);
+
+    VkCommandBuffer command_buffer = one_shot_begin(state, state->command_pool);
+    VkBufferCopy region = { 0, 0, size };
+
+    vkCmdCopyBuffer(command_buffer, src->vk_buffer, dst->vk_buffer, 1, &region);
+    record_barrier(command_buffer,
+                   VK_PIPELINE_STAGE_TRANSFER_BIT,
+                   VK_ACCESS_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_HOST_BIT,
+                   VK_ACCESS_HOST_READ_BIT);
+    one_shot_submit_and_wait(state, &state->compute_queues[0], state->command_pool,
+                             command_buffer, NULL);
+}
+
+static uint32_t reduce_identity(enum reduce_op op, enum reduce_type type)
+{
+    union reduce_value value;
+
+    if (op == REDUCE_OP_SUM)
+        value.bits = 0; /* 0 and 0.f */
+    else if (type == REDUCE_TYPE_FLOAT)
+        value.f = op == REDUCE_OP_MIN ? INFINITY : -INFINITY;
+    else
+        value.i = op == REDUCE_OP_MIN ? INT32_MAX : INT32_MIN;
+    return value.bits;
+}
+
+/* Makes sure the scratch buffers hold the partials of |elt_count| values,
+ * and points the reduction's bindings at them and at |input|. */
+static void reduce_prepare(struct vulkan_state *state,
+                           const struct gpu_memory *input,
+                           uint32_t elt_count)
+{
+    const struct kernel *kernel = state->reduce;
+    uint32_t per_group = kernel->workgroup_size * kernel->elements_per_invocation;
+    uint32_t partials = (elt_count + per_group - 1) / per_group;
+    VkDeviceSize sizes[2] = {
+        sizeof(uint32_t) * (VkDeviceSize)partials,
+        sizeof(uint32_t) * (VkDeviceSize)((partials + per_group - 1) / per_group),
+    };
+    uint8_t grown = 0;
+
+    if (state->reduce_result.vk_buffer == VK_NULL_HANDLE)
+        state->reduce_result = allocate_buffer(state, sizeof(uint32_t), MEMORY_USAGE_READBACK);
+
+    for (uint32_t i = 0; i < 2; i++) {
+        struct gpu_memory *scratch = &state->reduce_scratch[i];
+
+        if (scratch->vk_buffer != VK_NULL_HANDLE && scratch->vk_size >= sizes[i])
+            continue;
+        if (scratch->vk_buffer != VK_NULL_HANDLE)
+            free_buffer(state, scratch);
+        *scratch = allocate_buffer(state, sizes[i], MEMORY_USAGE_DEVICE);
+        grown = 1;
+    }
+
+    struct kernel_bindings *bindings = state->reduce_bindings;
+    kernel_bindings_write(&bindings[0], input->vk_buffer, input->vk_size, 0);
+    if (!grown)
+        return;
+
+    struct gpu_memory *a = &state->reduce_scratch[0];
+    struct gpu_memory *b = &state->reduce_scratch[1];
+    kernel_bindings_write(&bindings[0], a->vk_buffer, a->vk_size, 1);
+    kernel_bindings_write(&bindings[1], a->vk_buffer, a->vk_size, 0);
+    kernel_bindings_write(&bindings[1], b->vk_buffer, b->vk_size, 1);
+    kernel_bindings_write(&bindings[2], b->vk_buffer, b->vk_size, 0);
+    kernel_bindings_write(&bindings[2], a->vk_buffer, a->vk_size, 1);
+}
+
+/* Reduces the first |elt_count| values of |input| with the reduce kernel,
+ * and waits for the result. Each pass leaves one value per workgroup, the
+ * passes go back and forth between the scratch buffers until one is left.
+ * All of them are recorded in a single command buffer. */
+union reduce_value execute_reduce(struct vulkan_state *state,
+                                  const struct gpu_memory *input,
+                                  uint32_t elt_count,
+                                  enum reduce_op op,
+                                  enum reduce_type type)
+{
+    const struct kernel *kernel = state->reduce;
+    union reduce_value value;
+
+    assert(kernel);
+    assert(input->vk_size >= sizeof(uint32_t) * (VkDeviceSize)elt_count);
+
+    value.bits = reduce_identity(op, type);
+    if (elt_count == 0)
+        return value;
+
+    reduce_prepare(state, input, elt_count);
+
+    VkCommandBuffer command_buffer = one_shot_begin(state, state->command_pool);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipeline);
+
+    uint32_t per_group = kernel->workgroup_size * kernel->elements_per_invocation;
+    uint32_t count = elt_count;
+    const struct gpu_memory *output = NULL;
+
+    assert(kernel->reflection.push_constant_size == sizeof(struct reduce_push_constants));
+    for (uint32_t pass = 0; pass == 0 || count > 1; pass++) {
+        struct sum_dispatch dispatch = sum_dispatch_size(state, kernel, count);
+        struct reduce_push_constants constants = {
+            count,
+            dispatch.constants.row_pitch,
+            kernel->elements_per_invocation,
+            op,
+            type
+        };
+        const struct kernel_bindings *bindings =
+            &state->reduce_bindings[pass == 0 ? 0 : 1 + (pass - 1) % 2];
+
+        record_bindings(state, command_buffer, &state->descriptors, kernel, bindings);
+        vkCmdPushConstants(command_buffer, kernel->pipeline_layout,
+                           VK_SHADER_STAGE_COMPUTE_BIT,
+                           0,
+                           sizeof(constants),
+                           &constants);
+        vkCmdDispatch(command_buffer, dispatch.group_count_x, dispatch.group_count_y, 1);
+
+        /* Read by the next pass, or the final copy. */
+        record_barrier(command_buffer,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_ACCESS_SHADER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT);
+
+        output = &state->reduce_scratch[pass % 2 == 0 ? 0 : 1];
+        count = (count + per_group - 1) / per_group;
+    }
+
+    VkBufferCopy region = { 0, 0, sizeof(uint32_t) };
+    vkCmdCopyBuffer(command_buffer, output->vk_buffer,
+                    state->reduce_result.vk_buffer, 1, &region);
+    record_barrier(command_buffer,
+                   VK_PIPELINE_STAGE_TRANSFER_BIT,
+                   VK_ACCESS_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_HOST_BIT,
+                   VK_ACCESS_HOST_READ_BIT);
+    one_shot_submit_and_wait(state, &state->compute_queues[0], state->command_pool,
+                             command_buffer, &state->descriptors);
+
+    gpu_memory_invalidate(state, &state->reduce_result, 0, sizeof(uint32_t));
+    memcpy(&value, state->reduce_result.buffer, sizeof(value));
+    return value;
+}
+
+/* Inclusive scan of the first |elt_count| ints of |input| into |output|,
+ * waits for it. Each level scans within workgroups and leaves a total per
+ * workgroup in scan_totals, the next level scans those in place, until a
+ * single workgroup is left. Then, from the top, each level adds the
+ * scanned totals of the workgroups before. All of the passes are recorded
+ * in a single command buffer. */
+void execute_scan(struct vulkan_state *state,
+                  const struct gpu_memory *input,
+                  const struct gpu_memory *output,
+                  uint32_t elt_count)
+{
+    const struct kernel *kernel = state->scan;
+    struct kernel_bindings bindings[MAX_SCAN_LEVELS];
+    uint32_t counts[MAX_SCAN_LEVELS];
+    uint32_t level_count = 0;
+
+    assert(kernel);
+    assert(kernel->workgroup_size > 1);
+    assert(kernel->reflection.push_constant_size == sizeof(struct scan_push_constants));
+    assert(input->vk_size >= sizeof(int32_t) * (VkDeviceSize)elt_count);
+    assert(output->vk_size >= sizeof(int32_t) * (VkDeviceSize)elt_count);
+
+    if (elt_count == 0)
+        return;
+
+    memset(bindings, 0, sizeof(bindings));
+    for (uint32_t count = elt_count; level_count == 0 || count > 1; level_count++) {
+        uint32_t groups = (count + kernel->workgroup_size - 1) / kernel->workgroup_size;
+        VkDeviceSize size = sizeof(int32_t) * (VkDeviceSize)groups;
+        struct gpu_memory *totals = &state->scan_totals[level_count];
+
+        assert(level_count < MAX_SCAN_LEVELS);
+        if (totals->vk_buffer != VK_NULL_HANDLE && totals->vk_size < size)
+            free_buffer(state, totals);
+        if (totals->vk_buffer == VK_NULL_HANDLE)
+            *totals = allocate_buffer(state, size, MEMORY_USAGE_DEVICE);
+
+        /* The levels above scan the totals of the one below in place. */
+        const struct gpu_memory *in = level_count ? &state->scan_totals[level_count - 1] : input;
+        const struct gpu_memory *out = level_count ? in : output;
+        kernel_bindings_write(&bindings[level_count], in->vk_buffer, in->vk_size, 0);
+        kernel_bindings_write(&bindings[level_count], out->vk_buffer, out->vk_size, 1);
+        kernel_bindings_write(&bindings[level_count], totals->vk_buffer, totals->vk_size, 2);
+
+        counts[level_count] = count;
+        count = groups;
+    }
+
+    VkCommandBuffer command_buffer = one_shot_begin(state, state->command_pool);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipeline);
+
+    /* Up the levels scanning, then back down adding: the top level is a
+     * single workgroup, it has nothing to add. */
+    for (uint32_t pass = 0; pass < 2 * level_count - 1; pass++) {
+        uint32_t level = pass < level_count ? pass : 2 * level_count - 2 - pass;
+        struct sum_dispatch dispatch = sum_dispatch_size(state, kernel, counts[level]);
+        struct scan_push_constants constants = {
+            counts[level],
+            dispatch.constants.row_pitch,
+            pass < level_count ? SCAN_PHASE_SCAN : SCAN_PHASE_ADD
+        };
+
+        /* The previous pass wrote what this one reads. */
+        if (pass > 0) {
+            record_barrier(command_buffer,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_ACCESS_SHADER_WRITE_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+        }
+
+        record_bindings(state, command_buffer, &state->descriptors, kernel, &bindings[level]);
+        vkCmdPushConstants(command_buffer, kernel->pipeline_layout,
+                           VK_SHADER_STAGE_COMPUTE_BIT,
+                           0,
+                           sizeof(constants),
+                           &constants);
+        vkCmdDispatch(command_buffer, dispatch.group_count_x, dispatch.group_count_y, 1);
+    }
+
+    record_results_barrier(command_buffer);
+    one_shot_submit_and_wait(state, &state->compute_queues[0], state->command_pool,
+                             command_buffer, &state->descriptors);
+}
+
+void fused_chain_append(struct fused_chain *chain, enum fused_op op, int32_t operand)
+{
+    assert(chain->count < MAX_FUSED_OPS);
+    chain->ops[chain->count] = op;
+    chain->operands[chain->count] = operand;
+    chain->count++;
+}
+
+/* What the fused kernel does to one element. */
+int32_t fused_chain_apply(const struct fused_chain *chain, int32_t value)
+{
+    for (uint32_t i = 0; i < chain->count; i++) {
+        int32_t operand = chain->operands[i];
+
+        switch (chain->ops[i]) {
+        case FUSED_OP_ADD:
+            value = (int32_t)((uint32_t)value + (uint32_t)operand);
+            break;
+        case FUSED_OP_MUL:
+            value = (int32_t)((uint32_t)value * (uint32_t)operand);
+            break;
+        case FUSED_OP_MIN:
+            value = value < operand ? value : operand;
+            break;
+        case FUSED_OP_MAX:
+            value = value > operand ? value : operand;
+            break;
+        default:
+            break;
+        }
+    }
+    return value;
+}
+
+/* Returns the fused kernel specialized for the operations of |chain|,
+ * creating the pipeline on first use. The operands are not part of it. */
+static VkPipeline fused_pipeline_get(struct vulkan_state *state,
+                                     const struct fused_chain *chain)
+{
+    const struct kernel *kernel = state->fused;
+    uint32_t ops[MAX_FUSED_OPS] = { 0 };
+    uint8_t empty = 1;
+
+    for (uint32_t i = 0; i < chain->count; i++) {
+        ops[i] = chain->ops[i];
+        empty &= ops[i] == FUSED_OP_NONE;
+    }
+    if (empty)
+        return kernel->pipeline;
+
+    for (uint32_t i = 0; i < state->fused_pipeline_count; i++) {
+        if (0 == memcmp(state->fused_pipelines[i].ops, ops, sizeof(ops)))
+            return state->fused_pipelines[i].pipeline;
+    }
+
+    struct fused_pipeline *fused;
+    if (state->fused_pipeline_count < MAX_FUSED_PIPELINES) {
+        fused = &state->fused_pipelines[state->fused_pipeline_count++];
+    } else {
+        /* Only execute_fused_chain binds them, and it waits for the device. */
+        fused = &state->fused_pipelines[state->fused_pipeline_next];
+        state->fused_pipeline_next = (state->fused_pipeline_next + 1) % MAX_FUSED_PIPELINES;
+        vkDestroyPipeline(state->device, fused->pipeline, NULL);
+    }
+
+    /* Constant 0 is the workgroup size, as in kernel_registry_build. */
+    uint32_t constants[1 + MAX_FUSED_OPS];
+    VkSpecializationMapEntry entries[1 + MAX_FUSED_OPS];
+    constants[0] = kernel->workgroup_size;
+    memcpy(&constants[1], ops, sizeof(ops));
+    for (uint32_t i = 0; i < 1 + MAX_FUSED_OPS; i++) {
+        VkSpecializationMapEntry entry = { i, i * sizeof(uint32_t), sizeof(uint32_t) };
+        entries[i] = entry;
+    }
+
+    VkSpecializationInfo specialization_info = {
+        1 + MAX_FUSED_OPS,
+        entries,
+        sizeof(constants),
+        constants
+    };
+
+    fused->pipeline = kernel_pipeline_create(state, kernel, &specialization_info);
+    memcpy(fused->ops, ops, sizeof(ops));
+    return fused->pipeline;
+}
+
+/* Applies |chain| to the first |elt_count| elements of |input|, writing
+ * them to |output|, and waits for it. Fused, the whole chain is a single
+ * pass: each element is read and written once, the intermediate values
+ * stay in registers. Otherwise each operation is a pass of its own, the
+ * later ones in place over |output|, as separate kernels would do. Both
+ * are recorded in a single command buffer. */
+void execute_fused_chain(struct vulkan_state *state,
+                         const struct fused_chain *chain,
+                         const struct gpu_memory *input,
+                         const struct gpu_memory *output,
+                         uint32_t elt_count,
+                         uint8_t fuse)
+{
+    const struct kernel *kernel = state->fused;
+    const uint32_t pass_count = fuse || chain->count == 0 ? 1 : chain->count;
+    VkPipeline pipelines[MAX_FUSED_OPS];
+    struct kernel_bindings bindings[2];
+
+    assert(kernel);
+    assert(kernel->reflection.push_constant_size == sizeof(struct fused_push_constants));
+    assert(input->vk_size >= sizeof(int32_t) * (VkDeviceSize)elt_count);
+    assert(output->vk_size >= sizeof(int32_t) * (VkDeviceSize)elt_count);
+
+    /* All of them before recording: getting one may evict another. */
+    for (uint32_t pass = 0; pass < pass_count; pass++) {
+        struct fused_chain single = { { FUSED_OP_NONE }, { 0 }, 0 };
+
+        if (fuse) {
+            pipelines[pass] = fused_pipeline_get(state, chain);
+            continue;
+        }
+        if (chain->count)
+            fused_chain_append(&single, chain->ops[pass], chain->operands[pass]);
+        pipelines[pass] = fused_pipeline_get(state, &single);
+    }
+
+    memset(bindings, 0, sizeof(bindings));
+    kernel_bindings_write(&bindings[0], input->vk_buffer, input->vk_size, 0);
+    kernel_bindings_write(&bindings[0], output->vk_buffer, output->vk_size, 1);
+    kernel_bindings_write(&bindings[1], output->vk_buffer, output->vk_size, 0);
+    kernel_bindings_write(&bindings[1], output->vk_buffer, output->vk_size, 1);
+
+    VkCommandBuffer command_buffer = one_shot_begin(state, state->command_pool);
+    struct sum_dispatch dispatch = sum_dispatch_size(state, kernel, elt_count);
+    for (uint32_t pass = 0; pass < pass_count; pass++) {
+        struct fused_push_constants constants = {
+            elt_count,
+            dispatch.constants.row_pitch,
+            { 0 }
+        };
+
+        if (fuse)
+            memcpy(constants.operands, chain->operands, sizeof(constants.operands));
+        else if (chain->count)
+            constants.operands[0] = chain->operands[pass];
+
+        /* The previous pass wrote what this one reads. */
+        if (pass > 0) {
+            record_barrier(command_buffer,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_ACCESS_SHADER_WRITE_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+        }
+
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[pass]);
+        record_bindings(state, command_buffer, &state->descriptors, kernel,
+                        &bindings[pass == 0 ? 0 : 1]);
+        vkCmdPushConstants(command_buffer, kernel->pipeline_layout,
+                           VK_SHADER_STAGE_COMPUTE_BIT,
+                           0,
+                           sizeof(constants),
+                           &constants);
+        vkCmdDispatch(command_buffer, dispatch.group_count_x, dispatch.group_count_y, 1);
+    }
+
+    record_results_barrier(command_buffer);
+    one_shot_submit_and_wait(state, &state->compute_queues[0], state->command_pool,
+                             command_buffer, &state->descriptors);
+}
+
+void command_graph_init(struct command_graph *graph)
+{
+    memset(graph, 0, sizeof(*graph));
+}
+
+static struct graph_node* command_graph_add(struct command_graph *graph,
+                                            enum graph_node_type type)
+{
+    if (graph->node_count == MAX_GRAPH_NODES) {
+        fprintf(stderr, "too many nodes in a command graph.\n");
+        abort();
+    }
+
+    struct graph_node *node = &graph->nodes[graph->node_count++];
+    memset(node, 0, sizeof(*node));
+    node->type = type;
+    return node;
+}
+
+/* Adds a dispatch of |kernel| over |elt_count| elements. What it reads and
+ * writes is declared with command_graph_reads and command_graph_writes.
+ * Returns the node. */
+uint32_t command_graph_dispatch(struct command_graph *graph,
+                                const struct kernel *kernel,
+                                const struct kernel_bindings *bindings,
+                                uint32_t elt_count)
+{
+    struct graph_node *node = command_graph_add(graph, GRAPH_NODE_DISPATCH);
+
+    node->kernel = kernel;
+    node->bindings = *bindings;
+    node->elt_count = elt_count;
+    return graph->node_count - 1;
+}
+
+/* Adds a copy of the first |size| bytes of |src| to |dst|, reading the
+ * one and writing the other. Returns the node. */
+uint32_t command_graph_copy(struct command_graph *graph,
+                            const struct gpu_memory *src,
+                            const struct gpu_memory *dst,
+                            VkDeviceSize size)
+{
+    struct graph_node *node = command_graph_add(graph, GRAPH_NODE_COPY);
+    VkBufferCopy region = { 0, 0, size };
+
+    assert(size <= src->vk_size && size <= dst->vk_size);
+    node->src = src->vk_buffer;
+    node->dst = dst->vk_buffer;
+    node->region = region;
+
+    uint32_t index = graph->node_count - 1;
+    command_graph_reads(graph, index, src);
+    command_graph_writes(graph, index, dst);
+    return index;
+}
+
+static void graph_access_add(struct graph_access *accesses,
+                             uint32_t *count,
+                             const struct gpu_memory *mem)
+{
+    if (*count == MAX_NODE_ACCESSES) {
+        fprintf(stderr, "too many accesses for a command graph node.\n");
+        abort();
+    }
+
+    struct graph_access access = { mem->vk_memory, mem->vk_offset, mem->vk_size };
+    accesses[(*count)++] = access;
+}
+
+void command_graph_reads(struct command_graph *graph,
+                         uint32_t node,
+                         const struct gpu_memory *mem)
+{
+    assert(node < graph->node_count);
+    graph_access_add(graph->nodes[node].reads, &graph->nodes[node].read_count, mem);
+}
+
+void command_graph_writes(struct command_graph *graph,
+                          uint32_t node,
+                          const struct gpu_memory *mem)
+{
+    assert(node < graph->node_count);
+    graph_access_add(graph->nodes[node].writes, &graph->nodes[node].write_count, mem);
+}
+
+static uint8_t graph_accesses_overlap(const struct graph_access *a,
+                                      uint32_t a_count,
+                                      const struct graph_access *b,
+                                      uint32_t b_count)
+{
+    for (uint32_t i = 0; i < a_count; i++) {
+        for (uint32_t j = 0; j < b_count; j++) {
+            if (a[i].memory == b[j].memory
+                && a[i].offset < b[j].offset + b[j].size
+                && b[j].offset < a[i].offset + a[i].size)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Whether |node| must wait for |earlier|: it reads what |earlier| writes,
+ * or writes what |earlier| reads or writes. */
+static uint8_t graph_nodes_conflict(const struct graph_node *earlier,
+                                    const struct graph_node *node)
+{
+    return graph_accesses_overlap(earlier->writes, earlier->write_count,
+                                  node->reads, node->read_count)
+        || graph_accesses_overlap(earlier->writes, earlier->write_count,
+                                  node->writes, node->write_count)
+        || graph_accesses_overlap(earlier->reads, earlier->read_count,
+                                  node->writes, node->write_count);
+}
+
+static VkPipelineStageFlags graph_node_stage(const struct graph_node *node)
+{
+    return node->type == GRAPH_NODE_COPY ? VK_PIPELINE_STAGE_TRANSFER_BIT
+                                         : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+}
+
+/* Splits the nodes in phases, in order: a node starts a new phase when it
+ * conflicts with a node of the current one. The barriers between phases
+ * are then as few as the order of the nodes allows. Each barrier waits for
+ * everything before it, its scopes are the stages used on either side. */
+void command_graph_build(struct vulkan_state *state, struct command_graph *graph)
+{
+    uint32_t phase = 0;
+
+    graph->barrier_count = 0;
+    for (uint32_t i = 0; i < graph->node_count; i++) {
+        struct graph_node *node = &graph->nodes[i];
+
+        node->barrier = 0;
+        for (uint32_t j = phase; j < i && !node->barrier; j++)
+            node->barrier = graph_nodes_conflict(&graph->nodes[j], node);
+        if (node->barrier) {
+            phase = i;
+            graph->barrier_count++;
+        }
+    }
+
+    if (graph->command_buffer == VK_NULL_HANDLE) {
+        VkCommandBufferAllocateInfo alloc_info = {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            NULL,
+            state->command_pool,
+            VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            1
+        };
+        VkFenceCreateInfo fence_info = {
+            VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+            NULL,
+            0
+        };
+
+        CALL_VK(vkAllocateCommandBuffers, (state->device, &alloc_info, &graph->command_buffer));
+        CALL_VK(vkCreateFence, (state->device, &fence_info, NULL, &graph->fence));
+    }
+    descriptor_frame_reset(state, &graph->descriptors);
+
+    /* Begin resets the command buffer, the pool allows it. Not one time:
+     * the recording is submitted again and again. */
+    VkCommandBufferBeginInfo begin_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        NULL,
+        0,
+        NULL
+    };
+
+    VkCommandBuffer command_buffer = graph->command_buffer;
+    VkPipelineStageFlags src_stage = 0;
+    VkAccessFlags src_access = 0;
+
+    CALL_VK(vkBeginCommandBuffer, (command_buffer, &begin_info));
+    for (uint32_t i = 0; i < graph->node_count; i++) {
+        const struct graph_node *node = &graph->nodes[i];
+        const uint8_t copy = node->type == GRAPH_NODE_COPY;
+
+        if (node->barrier) {
+            VkPipelineStageFlags dst_stage = 0;
+            for (uint32_t j = i; j < graph->node_count; j++) {
+                if (j > i && graph->nodes[j].barrier)
+                    break;
+                dst_stage |= graph_node_stage(&graph->nodes[j]);
+            }
+
+            record_barrier(command_buffer, src_stage, src_access, dst_stage,
+                           (dst_stage & VK_PIPELINE_STAGE_TRANSFER_BIT
+                            ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : 0)
+                           | (dst_stage & VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                              ? VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT : 0));
+        }
+
+        if (copy) {
+            vkCmdCopyBuffer(command_buffer, node->src, node->dst, 1, &node->region);
+        } else {
+            record_dispatch(state, command_buffer, &graph->descriptors, node->kernel,
+                            &node->bindings, node->elt_count, VK_NULL_HANDLE);
+        }
+
+        src_stage |= graph_node_stage(node);
+        if (node->write_count)
+            src_access |= copy ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_WRITE_BIT;
+    }
+
+    /* Whatever was written may be read by the host after the fence. */
+    if (src_stage) {
+        record_barrier(command_buffer, src_stage, src_access,
+                       VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+    }
+    CALL_VK(vkEndCommandBuffer, (command_buffer));
+}
+
+/* Submits the recording of command_graph_build and waits for it. */
+void execute_command_graph(struct vulkan_state *state, struct command_graph *graph)
+{
+    assert(graph->command_buffer != VK_NULL_HANDLE);
+    CALL_VK(vkResetFences, (state->device, 1, &graph->fence));
+    submit_and_wait(state, graph->command_buffer, graph->fence);
+}
+
+void command_graph_destroy(struct vulkan_state *state, struct command_graph *graph)
+{
+    if (graph->command_buffer != VK_NULL_HANDLE) {
+        vkFreeCommandBuffers(state->device, state->command_pool, 1, &graph->command_buffer);
+        vkDestroyFence(state->device, graph->fence, NULL);
+    }
+    descriptor_frame_destroy(state, &graph->descriptors);
+    command_graph_init(graph);
+}
+
+/* Completes the in-flight jobs the queue timeline has reached. */
+static void submit_queue_complete(struct submit_queue *queue)
+{
+    struct vulkan_state *state = queue->state;
+    uint64_t value;
+
+    if (queue->in_flight == NULL)
+        return;
+
+    CALL_VK(vkGetSemaphoreCounterValue, (state->device, queue->queue->timeline, &value));
+    while (queue->in_flight && queue->in_flight->timeline_value <= value) {
+        struct submit_job *job = queue->in_flight;
+
+        queue->in_flight = job->next;
+        if (job->callback)
+            job->callback(job, job->callback_data);
+
+        /* The job may be reused as soon as it is seen done. */
+        pthread_mutex_lock(&queue->done_lock);
+        __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&queue->done);
+        pthread_mutex_unlock(&queue->done_lock);
+    }
+    if (queue->in_flight == NULL)
+        queue->in_flight_tail = NULL;
+}
+
+/* Submits |jobs|, in order, up to MAX_SUBMIT_BATCH per vkQueueSubmit. Only
+ * the last VkSubmitInfo of each batch signals the timeline: submissions of
+ * a queue complete in order. */
+static void submit_queue_flush(struct submit_queue *queue, struct submit_job *jobs)
+{
+    VkSubmitInfo infos[MAX_SUBMIT_BATCH];
+    VkTimelineSemaphoreSubmitInfo timeline_info;
+    uint64_t signal_value;
+
+    while (jobs) {
+        struct submit_job *first = jobs;
+        struct submit_job *last = NULL;
+        uint32_t count = 0;
+
+        for (; jobs && count < MAX_SUBMIT_BATCH; last = jobs, jobs = jobs->next, count++) {
+            VkSubmitInfo info = {
+                VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                NULL,
+                0,
+                NULL,
+                NULL,
+                1,
+                &jobs->command_buffer,
+                0,
+                NULL
+            };
+            infos[count] = info;
+        }
+
+        pthread_mutex_lock(&queue->queue->submit_lock);
+        signal_value = ++queue->queue->timeline_value;
+        VkTimelineSemaphoreSubmitInfo signal_info = {
+            VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            NULL,
+            0,
+            NULL,
+            1,
+            &signal_value
+        };
+        timeline_info = signal_info;
+        infos[count - 1].pNext = &timeline_info;
+        infos[count - 1].signalSemaphoreCount = 1;
+        infos[count - 1].pSignalSemaphores = &queue->queue->timeline;
+
+        CALL_VK(vkQueueSubmit, (queue->queue->queue, count, infos, VK_NULL_HANDLE));
+        pthread_mutex_unlock(&queue->queue->submit_lock);
+        queue->submit_count++;
+        queue->job_count += count;
+
+        for (struct submit_job *job = first; job != jobs; job = job->next)
+            job->timeline_value = signal_value;
+        last->next = NULL;
+        if (queue->in_flight_tail)
+            queue->in_flight_tail->next = first;
+        else
+            queue->in_flight = first;
+        queue->in_flight_tail = last;
+    }
+}
+
+static void* submit_queue_thread(void *data)
+{
+    struct submit_queue *queue = data;
+    struct vulkan_state *state = queue->state;
+
+    for (;;) {
+        struct submit_job *pushed = __atomic_exchange_n(&queue->pending, NULL, __ATOMIC_ACQUIRE);
+        struct submit_job *jobs = NULL;
+
+        /* The stack has the last pushed first. */
+        while (pushed) {
+            struct submit_job *next = pushed->next;
+            pushed->next = jobs;
+            jobs = pushed;
+            pushed = next;
+        }
+        if (jobs)
+            submit_queue_flush(queue, jobs);
+        submit_queue_complete(queue);
+
+        if (queue->in_flight) {
+            if (__atomic_load_n(&queue->pending, __ATOMIC_RELAXED))
+                continue;
+
+            /* New jobs wait for SUBMIT_POLL_NS at most. */
+            uint64_t value = queue->in_flight->timeline_value;
+            VkSemaphoreWaitInfo wait_info = {
+                VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                NULL,
+                0,
+                1,
+                &queue->queue->timeline,
+                &value
+            };
+            VkResult res = vkWaitSemaphores(state->device, &wait_info, SUBMIT_POLL_NS);
+            if (res != VK_SUCCESS && res != VK_TIMEOUT) {
+                fprintf(stderr, "vkWaitSemaphores failed (%d)\n", res);
+                abort();
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        while (__atomic_load_n(&queue->pending, __ATOMIC_RELAXED) == NULL && !queue->stop)
+            pthread_cond_wait(&queue->wake, &queue->lock);
+        uint8_t stop = queue->stop && queue->pending == NULL;
+        pthread_mutex_unlock(&queue->lock);
+        if (stop)
+            break;
+    }
+    return NULL;
+}
+
+/* Starts the submitter thread, on the last compute queue. */
+void submit_queue_start(struct vulkan_state *state, struct submit_queue *queue)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->state = state;
+    queue->queue = &state->compute_queues[state->compute_queue_count - 1];
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->wake, NULL);
+    pthread_mutex_init(&queue->done_lock, NULL);
+    pthread_cond_init(&queue->done, NULL);
+
+    if (pthread_create(&queue->thread, NULL, submit_queue_thread, queue) != 0) {
+        fprintf(stderr, "unable to start the submitter thread.\n");
+        abort();
+    }
+}
+
+/* Returns once every job pushed so far completed. */
+void submit_queue_stop(struct submit_queue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->stop = 1;
+    pthread_cond_signal(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+    pthread_join(queue->thread, NULL);
+
+    pthread_cond_destroy(&queue->done);
+    pthread_mutex_destroy(&queue->done_lock);
+    pthread_cond_destroy(&queue->wake);
+    pthread_mutex_destroy(&queue->lock);
+}
+
+void submit_context_init(struct vulkan_state *state, struct submit_context *context)
+{
+    memset(context, 0, sizeof(*context));
+    context->command_pool = command_pool_create(state, state->compute_queues[0].family_index);
+}
+
+/* Makes the command buffers and sets of the context available again. */
+void submit_context_reset(struct vulkan_state *state, struct submit_context *context)
+{
+    CALL_VK(vkResetCommandPool, (state->device, context->command_pool, 0));
+    descriptor_frame_reset(state, &context->descriptors);
+}
+
+void submit_context_destroy(struct vulkan_state *state, struct submit_context *context)
+{
+    vkDestroyCommandPool(state->device, context->command_pool, NULL);
+    descriptor_frame_destroy(state, &context->descriptors);
+}
+
+/* Records |kernel| over |elt_count| elements with |bindings| in |job|,
+ * from the command pool and descriptor sets of |context|. The job must
+ * not be in flight. */
+void submit_job_record_sum(struct vulkan_state *state,
+                           struct submit_context *context,
+                           struct submit_job *job,
+                           const struct kernel *kernel,
+                           const struct kernel_bindings *bindings,
+                           uint32_t elt_count)
+{
+    if (job->command_buffer == VK_NULL_HANDLE) {
+        VkCommandBufferAllocateInfo alloc_info = {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            NULL,
+            context->command_pool,
+            VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            1
+        };
+
+        CALL_VK(vkAllocateCommandBuffers, (state->device, &alloc_info, &job->command_buffer));
+    }
+
+    VkCommandBufferBeginInfo begin_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        NULL,
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        NULL
+    };
+
+    CALL_VK(vkBeginCommandBuffer, (job->command_buffer, &begin_info));
+    record_dispatch(state, job->command_buffer, &context->descriptors, kernel, bindings,
+                    elt_count, VK_NULL_HANDLE);
+    record_barrier(job->command_buffer,
+                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                   VK_ACCESS_SHADER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_HOST_BIT,
+                   VK_ACCESS_HOST_READ_BIT);
+    CALL_VK(vkEndCommandBuffer, (job->command_buffer));
+}
+
+/* Hands |job| to the submitter. Safe from any thread, lock-free but for
+ * waking the submitter when the queue was empty. */
+void submit_job_push(struct submit_queue *queue, struct submit_job *job)
+{
+    struct submit_job *head = __atomic_load_n(&queue->pending, __ATOMIC_RELAXED);
+
+    job->done = 0;
+    do {
+        job->next = head;
+    } while (!__atomic_compare_exchange_n(&queue->pending, &head, job, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    /* Otherwise the push that made it non-empty did. */
+    if (head == NULL) {
+        pthread_mutex_lock(&queue->lock);
+        pthread_cond_signal(&queue->wake);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+uint8_t submit_job_done(const struct submit_job *job)
+{
+    return __atomic_load_n(&job->done, __ATOMIC_ACQUIRE);
+}
+
+void submit_job_wait(struct submit_queue *queue, struct submit_job *job)
+{
+    if (submit_job_done(job))
+        return;
+
+    pthread_mutex_lock(&queue->done_lock);
+    while (!submit_job_done(job))
+        pthread_cond_wait(&queue->done, &queue->done_lock);
+    pthread_mutex_unlock(&queue->done_lock);
+}
+
+void destroy_state(struct vulkan_state **state)
+{
+    assert(state && *state);
+    struct vulkan_state *st = *state;
+
+#define FREE_VK(Field, Function)                \
+    if (st->Field != VK_NULL_HANDLE)            \
+        Function(st->device, st->Field, NULL)
+
+    if (st->device != VK_NULL_HANDLE)
+        command_ring_destroy(st);
+    if (st->staging_upload.vk_buffer != VK_NULL_HANDLE)
+        free_buffer(st, &st->staging_upload);
+    if (st->staging_download.vk_buffer != VK_NULL_HANDLE)
+        free_buffer(st, &st->staging_download);
+    for (uint32_t i = 0; i < 2; i++) {
+        if (st->reduce_scratch[i].vk_buffer != VK_NULL_HANDLE)
+            free_buffer(st, &st->reduce_scratch[i]);
+    }
+    if (st->reduce_result.vk_buffer != VK_NULL_HANDLE)
+        free_buffer(st, &st->reduce_result);
+    for (uint32_t i = 0; i < MAX_SCAN_LEVELS; i++) {
+        if (st->scan_totals[i].vk_buffer != VK_NULL_HANDLE)
+            free_buffer(st, &st->scan_totals[i]);
+    }
+    if (st->device != VK_NULL_HANDLE) {
+        arena_destroy(st);
+        profiler_destroy(st);
+    }
+    for (uint32_t i = 0; i < st->fused_pipeline_count; i++)
+        FREE_VK(fused_pipelines[i].pipeline, vkDestroyPipeline);
+    for (uint32_t i = 0; i < st->compute_queue_count; i++)
+        timeline_destroy(st, &st->compute_queues[i]);
+    timeline_destroy(st, &st->transfer_queue);
+
+    if (st->device != VK_NULL_HANDLE) {
+        kernel_registry_destroy(st);
+        descriptor_frame_destroy(st, &st->descriptors);
+    }
+    FREE_VK(pipeline_cache, vkDestroyPipelineCache);
+    FREE_VK(command_pool, vkDestroyCommandPool);
+    FREE_VK(transfer_command_pool, vkDestroyCommandPool);
+
+    if (st->device != VK_NULL_HANDLE)
+        vkDestroyDevice(st->device, NULL);
+    if (st->instance != VK_NULL_HANDLE)
+        vkDestroyInstance(st->instance, NULL);
+
+    free(st->pipeline_cache_path);
+    free(st->tuning_cache_path);
+    free(st);
+    *state = NULL;
+}
+
+/* Workers of host_parallel_for. The calling thread runs chunks too: a
+ * pool of N threads has N - 1 workers. */
+static struct {
+    pthread_mutex_t         lock;
+    pthread_cond_t          work_ready;
+    pthread_cond_t          work_done;
+    /* Serializes host_parallel_for callers. */
+    pthread_mutex_t         job_lock;
+
+    pthread_t               workers[HOST_MAX_THREADS];
+    uint32_t                worker_count;
+    uint8_t                 started;
+    uint8_t                 stopping;
+
+    /* Bumped for each job, workers wait for it to change. */
+    uint64_t                generation;
+    host_task               task;
+    void                   *data;
+    uint32_t                count;
+    uint32_t                chunk_size;
+    uint32_t                chunk_count;
+    uint32_t                next_chunk;
+    /* Workers still on the current job. */
+    uint32_t                busy;
+} host_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work_ready = PTHREAD_COND_INITIALIZER,
+    .work_done = PTHREAD_COND_INITIALIZER,
+    .job_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void host_pool_run_chunks(void)
+{
+    for (;;) {
+        uint32_t chunk = __atomic_fetch_add(&host_pool.next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= host_pool.chunk_count)
+            return;
+
+        uint32_t begin = chunk * host_pool.chunk_size;
+        uint32_t end = host_pool.count - begin < host_pool.chunk_size
+                     ? host_pool.count
+                     : begin + host_pool.chunk_size;
+        host_pool.task(host_pool.data, begin, end);
+    }
+}
+
+static void* host_pool_worker(void *unused)
+{
+    uint64_t seen = 0;
+
+    (void)unused;
+    pthread_mutex_lock(&host_pool.lock);
+    for (;;) {
+        while (!host_pool.stopping && host_pool.generation == seen)
+            pthread_cond_wait(&host_pool.work_ready, &host_pool.lock);
+        if (host_pool.stopping)
+            break;
+        seen = host_pool.generation;
+
+        pthread_mutex_unlock(&host_pool.lock);
+        host_pool_run_chunks();
+        pthread_mutex_lock(&host_pool.lock);
+
+        if (--host_pool.busy == 0)
+            pthread_cond_signal(&host_pool.work_done);
+    }
+    pthread_mutex_unlock(&host_pool.lock);
+    return NULL;
+}
+
+static void host_pool_stop(void)
+{
+    pthread_mutex_lock(&host_pool.lock);
+    host_pool.stopping = 1;
+    pthread_cond_broadcast(&host_pool.work_ready);
+    pthread_mutex_unlock(&host_pool.lock);
+
+    for (uint32_t i = 0; i < host_pool.worker_count; i++)
+        pthread_join(host_pool.workers[i], NULL);
+    host_pool.worker_count = 0;
+    host_pool.stopping = 0;
+}
+
+/* Runs host_parallel_for on |count| threads, the caller included. 0 picks
+ * one per online CPU. */
+void host_threads_set(uint32_t count)
+{
+    if (count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        count = cpus > 0 ? (uint32_t)cpus : 1;
+    }
+    if (count > HOST_MAX_THREADS)
+        count = HOST_MAX_THREADS;
+
+    pthread_mutex_lock(&host_pool.job_lock);
+    if (!host_pool.started) {
+        atexit(host_pool_stop);
+        host_pool.started = 1;
+    }
+    host_pool_stop();
+
+    for (uint32_t i = 0; i + 1 < count; i++) {
+        if (pthread_create(&host_pool.workers[i], NULL, host_pool_worker, NULL) != 0) {
+            fprintf(stderr, "unable to start host worker %u, running on %u threads.\n",
+                    i, i + 1);
+            break;
+        }
+        host_pool.worker_count++;
+    }
+    pthread_mutex_unlock(&host_pool.job_lock);
+}
+
+uint32_t host_threads_count(void)
+{
+    return host_pool.worker_count + 1;
+}
+
+/* Splits [0, count) in chunks of at least |grain| items, and calls |task|
+ * on each from the pool. Returns once all of them are done. */
+void host_parallel_for(uint32_t count, uint32_t grain, host_task task, void *data)
+{
+    if (!host_pool.started)
+        host_threads_set(0);
+
+    pthread_mutex_lock(&host_pool.job_lock);
+
+    /* A few chunks per thread, for the load to even out. */
+    uint32_t threads = host_pool.worker_count + 1;
+    uint32_t chunk_size = (uint32_t)(((uint64_t)count + threads * 4 - 1) / (threads * 4));
+    if (chunk_size < grain)
+        chunk_size = grain;
+    uint32_t chunk_count = (uint32_t)(((uint64_t)count + chunk_size - 1) / chunk_size);
+
+    if (host_pool.worker_count == 0 || chunk_count <= 1) {
+        if (count)
+            task(data, 0, count);
+        pthread_mutex_unlock(&host_pool.job_lock);
+        return;
+    }
+
+    pthread_mutex_lock(&host_pool.lock);
+    host_pool.task = task;
+    host_pool.data = data;
+    host_pool.count = count;
+    host_pool.chunk_size = chunk_size;
+    host_pool.chunk_count = chunk_count;
+    host_pool.next_chunk = 0;
+    host_pool.busy = host_pool.worker_count;
+    host_pool.generation++;
+    pthread_cond_broadcast(&host_pool.work_ready);
+    pthread_mutex_unlock(&host_pool.lock);
+
+    host_pool_run_chunks();
+
+    pthread_mutex_lock(&host_pool.lock);
+    while (host_pool.busy)
+        pthread_cond_wait(&host_pool.work_done, &host_pool.lock);
+    pthread_mutex_unlock(&host_pool.lock);
+
+    pthread_mutex_unlock(&host_pool.job_lock);
+}
+
+/* Payload kernels. |stop| is the lowest mismatch found so far by any
+ * chunk: checks give up once they are past it. */
+typedef void (*payload_generate_fn)(int *buffer, uint32_t begin, uint32_t end, uint32_t first);
+typedef uint32_t (*payload_check_fn)(const int *buffer, uint32_t begin, uint32_t end,
+                                     uint32_t first, const uint32_t *stop);
+
+/* Elements checked between two looks at |stop|. */
+#define PAYLOAD_CHECK_BLOCK 4096
+
+static void generate_scalar(int *buffer, uint32_t begin, uint32_t end, uint32_t first)
+{
+    for (uint32_t i = begin; i < end; i++)
+        buffer[i] = (int)(first + i);
+}
+
+static uint32_t check_scalar(const int *buffer, uint32_t begin, uint32_t end,
+                             uint32_t first, const uint32_t *stop)
+{
+    for (uint32_t i = begin; i < end; i++) {
+        if (i % PAYLOAD_CHECK_BLOCK == 0 && i >= __atomic_load_n(stop, __ATOMIC_RELAXED))
+            return UINT32_MAX;
+        if (buffer[i] != (int)((first + i) * 2u))
+            return i;
+    }
+    return UINT32_MAX;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* The mapped buffers are write-combined: whole lines are written with
+ * non-temporal stores, the scalar code handles the unaligned ends. */
+__attribute__((target("sse2")))
+static void generate_sse2(int *buffer, uint32_t begin, uint32_t end, uint32_t first)
+{
+    uint32_t i = begin;
+
+    for (; i < end && ((uintptr_t)&buffer[i] & 15); i++)
+        buffer[i] = (int)(first + i);
+
+    __m128i value = _mm_add_epi32(_mm_set1_epi32((int)(first + i)), _mm_setr_epi32(0, 1, 2, 3));
+    const __m128i step = _mm_set1_epi32(4);
+    for (; i + 4 <= end; i += 4) {
+        _mm_stream_si128((__m128i *)&buffer[i], value);
+        value = _mm_add_epi32(value, step);
+    }
+    _mm_sfence();
+
+    generate_scalar(buffer, i, end, first);
+}
+
+__attribute__((target("sse2")))
+static uint32_t check_sse2(const int *buffer, uint32_t begin, uint32_t end,
+                           uint32_t first, const uint32_t *stop)
+{
+    uint32_t i = begin;
+
+    __m128i value = _mm_add_epi32(_mm_set1_epi32((int)(first + i)), _mm_setr_epi32(0, 1, 2, 3));
+    const __m128i step = _mm_set1_epi32(4);
+    for (; i + 4 <= end; i += 4) {
+        if (i % PAYLOAD_CHECK_BLOCK < 4 && i >= __atomic_load_n(stop, __ATOMIC_RELAXED))
+            return UINT32_MAX;
+
+        __m128i got = _mm_loadu_si128((const __m128i *)&buffer[i]);
+        __m128i equal = _mm_cmpeq_epi32(got, _mm_add_epi32(value, value));
+        if (_mm_movemask_epi8(equal) != 0xffff)
+            return check_scalar(buffer, i, i + 4, first, stop);
+        value = _mm_add_epi32(value, step);
+    }
+
+    return check_scalar(buffer, i, end, first, stop);
+}
+
+__attribute__((target("avx2")))
+static void generate_avx2(int *buffer, uint32_t begin, uint32_t end, uint32_t first)
+{
+    uint32_t i = begin;
+
+    for (; i < end && ((uintptr_t)&buffer[i] & 31); i++)
+        buffer[i] = (int)(first + i);
+
+    __m256i value = _mm256_add_epi32(_mm256_set1_epi32((int)(first + i)),
+                                     _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i step = _mm256_set1_epi32(8);
+    for (; i + 8 <= end; i += 8) {
+        _mm256_stream_si256((__m256i *)&buffer[i], value);
+        value = _mm256_add_epi32(value, step);
+    }
+    _mm_sfence();
+
+    generate_scalar(buffer, i, end, first);
+}
+
+__attribute__((target("avx2")))
+static uint32_t check_avx2(const int *buffer, uint32_t begin, uint32_t end,
+                           uint32_t first, const uint32_t *stop)
+{
+    uint32_t i = begin;
+
+    __m256i value = _mm256_add_epi32(_mm256_set1_epi32((int)(first + i)),
+                                     _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i step = _mm256_set1_epi32(8);
+    for (; i + 8 <= end; i += 8) {
+        if (i % PAYLOAD_CHECK_BLOCK < 8 && i >= __atomic_load_n(stop, __ATOMIC_RELAXED))
+            return UINT32_MAX;
+
+        __m256i got = _mm256_loadu_si256((const __m256i *)&buffer[i]);
+        __m256i equal = _mm256_cmpeq_epi32(got, _mm256_add_epi32(value, value));
+        if (_mm256_movemask_epi8(equal) != -1)
+            return check_scalar(buffer, i, i + 8, first, stop);
+        value = _mm256_add_epi32(value, step);
+    }
+
+    return check_scalar(buffer, i, end, first, stop);
+}
+#endif
+
+static struct {
+    const char             *name;
+    payload_generate_fn     generate;
+    payload_check_fn        check;
+} payload_kernels;
+
+static void payload_kernels_select(void)
+{
+    if (payload_kernels.name)
+        return;
+
+    payload_kernels.name = "scalar";
+    payload_kernels.generate = generate_scalar;
+    payload_kernels.check = check_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        payload_kernels.name = "avx2";
+        payload_kernels.generate = generate_avx2;
+        payload_kernels.check = check_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        payload_kernels.name = "sse2";
+        payload_kernels.generate = generate_sse2;
+        payload_kernels.check = check_sse2;
+    }
+#endif
+}
+
+/* Instruction set the payload helpers run with. */
+const char* payload_simd_name(void)
+{
+    payload_kernels_select();
+    return payload_kernels.name;
+}
+
+struct payload_job {
+    int                    *buffer;
+    uint32_t                first;
+    /* Lowest mismatching index, UINT32_MAX while there is none. */
+    uint32_t                mismatch;
+};
+
+static void payload_generate_task(void *data, uint32_t begin, uint32_t end)
+{
+    struct payload_job *job = data;
+    payload_kernels.generate(job->buffer, begin, end, job->first);
+}
+
+static void payload_check_task(void *data, uint32_t begin, uint32_t end)
+{
+    struct payload_job *job = data;
+    uint32_t index = payload_kernels.check(job->buffer, begin, end, job->first, &job->mismatch);
+    uint32_t lowest = __atomic_load_n(&job->mismatch, __ATOMIC_RELAXED);
+
+    while (index < lowest
+           && !__atomic_compare_exchange_n(&job->mismatch, &lowest, index, 0,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Values wrap around on large payloads, as the 32-bit adds of the kernel
+ * do: computed unsigned to keep the overflow defined. */
+void generate_payload(int *buffer, uint32_t elt_count, uint32_t first)
+{
+    struct payload_job job = { buffer, first, UINT32_MAX };
+
+    payload_kernels_select();
+    host_parallel_for(elt_count, HOST_CHUNK_SIZE, payload_generate_task, &job);
+}
+
+/* Aborts on the first element that is not twice its payload value. */
+void check_payload(int *buffer, uint32_t elt_count, uint32_t first)
+{
+    struct payload_job job = { buffer, first, UINT32_MAX };
+
+    payload_kernels_select();
+    host_parallel_for(elt_count, HOST_CHUNK_SIZE, payload_check_task, &job);
+
+    if (job.mismatch != UINT32_MAX) {
+        uint32_t i = job.mismatch;
+        fprintf(stderr, "invalid value for [%u]. got %d, expected %d\n",
+                i, buffer[i], (int)((first + i) * 2u));
+        abort();
+    }
+}
+
+const char* placement_name(enum memory_placement placement)
+{
+    return placement == MEMORY_PLACEMENT_DEVICE ? "device" : "host";
+}
+
+const char* sum_variant_name(enum sum_variant variant)
+{
+    switch (variant) {
+    case SUM_VARIANT_SCALAR:
+        return "scalar";
+    case SUM_VARIANT_VEC4:
+        return "vec4";
+    default:
+        return "auto";
+    }
+}
+
+/* Bytes of a buffer holding |elt_count| ints, padded for the vectorized
+ * kernels. */
+VkDeviceSize sum_buffer_size(uint32_t elt_count)
+{
+    return element_buffer_size(ELEMENT_TYPE_INT32, elt_count);
+}
+
+static const struct {
+    const char             *name;
+    /* Its sum kernel, see kernel_infos. */
+    const char             *kernel;
+    uint32_t                size;
+} element_types[ELEMENT_TYPE_COUNT] = {
+    { "int32", "sum", 4 },
+    { "float16", "sum_f16", 2 },
+    { "float32", "sum_f32", 4 },
+    { "int8", "sum_i8", 1 },
+    { "int64", "sum_i64", 8 },
+};
+
+uint32_t element_type_size(enum element_type type)
+{
+    return element_types[type].size;
+}
+
+const char* element_type_name(enum element_type type)
+{
+    return element_types[type].name;
+}
+
+const char* element_type_kernel(enum element_type type)
+{
+    return element_types[type].kernel;
+}
+
+/* Same as sum_buffer_size, for |type|. The padding also covers the int8
+ * kernel, which processes four elements at a time. */
+VkDeviceSize element_buffer_size(enum element_type type, uint32_t elt_count)
+{
+    return align_up(element_types[type].size * (VkDeviceSize)elt_count, SUM_VECTOR_SIZE);
+}
+
+/* IEEE binary16 from a float, rounding to nearest even. */
+static uint16_t float_to_half(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint16_t sign = bits >> 16 & 0x8000;
+    int32_t exponent = (int32_t)(bits >> 23 & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    uint32_t shift = 13;
+
+    if ((bits & 0x7fffffff) > 0x7f800000)
+        return sign | 0x7e00;
+    if (exponent >= 31)
+        return sign | 0x7c00;
+    if (exponent < -10)
+        return sign;
+
+    /* Subnormals keep the implicit bit, shifted further. */
+    uint32_t half = (uint32_t)(exponent > 0 ? exponent : 0) << 10;
+    if (exponent <= 0) {
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+    }
+    half |= mantissa >> shift;
+
+    /* A carry into the exponent is still the right rounding. */
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1)))
+        half++;
+    return sign | half;
+}
+
+static float half_to_float(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = half >> 10 & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    float value;
+
+    if (exponent == 0) {
+        value = ldexpf((float)mantissa, -24);
+        return sign ? -value : value;
+    }
+
+    bits = exponent == 31 ? sign | 0x7f800000 | mantissa << 13
+                          : sign | (exponent + 127 - 15) << 23 | mantissa << 13;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* Relative error allowed on the doubled floats, about an ulp. The values
+ * are exact in both types: this is only slack for the device. */
+#define FLOAT16_TOLERANCE 1e-3f
+#define FLOAT32_TOLERANCE 1e-6f
+
+/* Payload of the float types: exact in float16, doubled as well. */
+static float payload_float(uint32_t i)
+{
+    return (float)(i % 2048) * 0.25f - 256.f;
+}
+
+/* Spread over both words, so that doubling carries between them. */
+static uint64_t payload_int64(uint32_t i)
+{
+    return (uint64_t)i * 0x9e3779b97f4a7c15ull;
+}
+
+struct typed_payload_job {
+    void                   *buffer;
+    enum element_type       type;
+    uint32_t                first;
+    /* Lowest mismatching index, UINT32_MAX while there is none. */
+    uint32_t                mismatch;
+};
+
+static void typed_generate_task(void *data, uint32_t begin, uint32_t end)
+{
+    struct typed_payload_job *job = data;
+
+    for (uint32_t i = begin; i < end; i++) {
+        uint32_t value = job->first + i;
+
+        switch (job->type) {
+        case ELEMENT_TYPE_FLOAT16:
+            ((uint16_t *)job->buffer)[i] = float_to_half(payload_float(value));
+            break;
+        case ELEMENT_TYPE_FLOAT32:
+            ((float *)job->buffer)[i] = payload_float(value);
+            break;
+        case ELEMENT_TYPE_INT8:
+            ((uint8_t *)job->buffer)[i] = (uint8_t)value;
+            break;
+        case ELEMENT_TYPE_INT64:
+            ((uint64_t *)job->buffer)[i] = payload_int64(value);
+            break;
+        default:
+            ((int *)job->buffer)[i] = (int)value;
+            break;
+        }
+    }
+}
+
+/* Element |i| of the job's buffer as a double, and what it should be. */
+static double typed_element(const struct typed_payload_job *job, uint32_t i, double *expected)
+{
+    uint32_t value = job->first + i;
+
+    switch (job->type) {
+    case ELEMENT_TYPE_FLOAT16:
+        *expected = 2.f * payload_float(value);
+        return half_to_float(((const uint16_t *)job->buffer)[i]);
+    case ELEMENT_TYPE_FLOAT32:
+        *expected = 2.f * payload_float(value);
+        return ((const float *)job->buffer)[i];
+    case ELEMENT_TYPE_INT8:
+        *expected = (int8_t)(value * 2u);
+        return ((const int8_t *)job->buffer)[i];
+    case ELEMENT_TYPE_INT64:
+        *expected = (double)(int64_t)(payload_int64(value) * 2u);
+        return (double)((const int64_t *)job->buffer)[i];
+    default:
+        *expected = (int)(value * 2u);
+        return ((const int *)job->buffer)[i];
+    }
+}
+
+/* Whether element |i| is twice its payload value. Integers wrap around as
+ * the kernels do, floats are allowed the tolerance of their type. */
+static uint8_t typed_element_matches(const struct typed_payload_job *job, uint32_t i)
+{
+    uint32_t value = job->first + i;
+    double expected;
+
+    if (job->type == ELEMENT_TYPE_INT64)
+        return ((const uint64_t *)job->buffer)[i] == payload_int64(value) * 2u;
+
+    double got = typed_element(job, i, &expected);
+    if (job->type == ELEMENT_TYPE_FLOAT16)
+        return fabs(got - expected) <= fabs(expected) * FLOAT16_TOLERANCE;
+    if (job->type == ELEMENT_TYPE_FLOAT32)
+        return fabs(got - expected) <= fabs(expected) * FLOAT32_TOLERANCE;
+    return got == expected;
+}
+
+static void typed_check_task(void *data, uint32_t begin, uint32_t end)
+{
+    struct typed_payload_job *job = data;
+    uint32_t index = UINT32_MAX;
+
+    for (uint32_t i = begin; i < end; i++) {
+        if (i % PAYLOAD_CHECK_BLOCK == 0 && i >= __atomic_load_n(&job->mismatch, __ATOMIC_RELAXED))
+            return;
+        if (!typed_element_matches(job, i)) {
+            index = i;
+            break;
+        }
+    }
+
+    uint32_t lowest = __atomic_load_n(&job->mismatch, __ATOMIC_RELAXED);
+    while (index < lowest
+           && !__atomic_compare_exchange_n(&job->mismatch, &lowest, index, 0,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* generate_payload for |type|. Only int32 has the vectorized helpers. */
+void generate_typed_payload(void *buffer, enum element_type type,
+                            uint32_t elt_count, uint32_t first)
+{
+    struct typed_payload_job job = { buffer, type, first, UINT32_MAX };
+
+    if (type == ELEMENT_TYPE_INT32) {
+        generate_payload(buffer, elt_count, first);
+        return;
+    }
+    host_parallel_for(elt_count, HOST_CHUNK_SIZE, typed_generate_task, &job);
+}
+
+/* check_payload for |type|. */
+void check_typed_payload(const void *buffer, enum element_type type,
+                         uint32_t elt_count, uint32_t first)
+{
+    struct typed_payload_job job = { (void *)buffer, type, first, UINT32_MAX };
+
+    if (type == ELEMENT_TYPE_INT32) {
+        check_payload((int *)buffer, elt_count, first);
+        return;
+    }
+    host_parallel_for(elt_count, HOST_CHUNK_SIZE, typed_check_task, &job);
+
+    if (job.mismatch != UINT32_MAX) {
+        double expected;
+        double got = typed_element(&job, job.mismatch, &expected);
+
+        fprintf(stderr, "invalid %s value for [%u]. got %.17g, expected %.17g\n",
+                element_type_name(type), job.mismatch, got, expected);
+        abort();
+    }
+}
+
+/* Deterministic values of |type|, of both signs. Int sums overflow past a
+ * few thousand values. */
+void generate_reduce_payload(union reduce_value *values, uint32_t elt_count,
+                             enum reduce_type type)
+{
+    for (uint32_t i = 0; i < elt_count; i++) {
+        uint32_t hash = i * 2654435761u;
+
+        if (type == REDUCE_TYPE_FLOAT)
+            values[i].f = ((float)(hash >> 16) - 32768.f) / 64.f;
+        else
+            values[i].bits = hash;
+    }
+}
+
+/* Single-threaded reference of execute_reduce. Float sums are accumulated
+ * in double. */
+union reduce_value reduce_on_host(const union reduce_value *values,
+                                  uint32_t elt_count,
+                                  enum reduce_op op,
+                                  enum reduce_type type)
+{
+    union reduce_value value;
+    value.bits = reduce_identity(op, type);
+
+    if (type == REDUCE_TYPE_FLOAT && op == REDUCE_OP_SUM) {
+        double sum = 0.;
+        for (uint32_t i = 0; i < elt_count; i++)
+            sum += values[i].f;
+        value.f = (float)sum;
+        return value;
+    }
+
+    for (uint32_t i = 0; i < elt_count; i++) {
+        union reduce_value x = values[i];
+
+        if (op == REDUCE_OP_SUM)
+            value.bits += x.bits;
+        else if (type == REDUCE_TYPE_FLOAT)
+            value.f = op == REDUCE_OP_MIN ? fminf(value.f, x.f) : fmaxf(value.f, x.f);
+        else if (op == REDUCE_OP_MIN)
+            value.i = x.i < value.i ? x.i : value.i;
+        else
+            value.i = x.i > value.i ? x.i : value.i;
+    }
+    return value;
+}
+
+/* Compares a device reduction of |values| against reduce_on_host. Float
+ * sums depend on the order of the adds: they are allowed an error relative
+ * to the sum of the magnitudes. */
+uint8_t reduce_value_matches(union reduce_value value,
+                             union reduce_value expected,
+                             const union reduce_value *values,
+                             uint32_t elt_count,
+                             enum reduce_op op,
+                             enum reduce_type type)
+{
+    if (type != REDUCE_TYPE_FLOAT || op != REDUCE_OP_SUM)
+        return value.bits == expected.bits;
+
+    double magnitude = 0.;
+    for (uint32_t i = 0; i < elt_count; i++)
+        magnitude += fabs(values[i].f);
+    return fabs((double)value.f - expected.f) <= magnitude * 1e-5;
+}
+
+const char* reduce_op_name(enum reduce_op op)
+{
+    switch (op) {
+    case REDUCE_OP_MIN:
+        return "min";
+    case REDUCE_OP_MAX:
+        return "max";
+    default:
+        return "sum";
+    }
+}
+
+const char* reduce_type_name(enum reduce_type type)
+{
+    return type == REDUCE_TYPE_FLOAT ? "float" : "int";
+}
+
+const char* fused_op_name(enum fused_op op)
+{
+    switch (op) {
+    case FUSED_OP_ADD:
+        return "add";
+    case FUSED_OP_MUL:
+        return "mul";
+    case FUSED_OP_MIN:
+        return "min";
+    case FUSED_OP_MAX:
+        return "max";
+    default:
+        return "none";
+    }
+}
+
+/* Kernels autotune_kernels covers: they take the sum_push_constants, see
+ * record_dispatch. Elements per invocation double from |elements_min| to
+ * |elements_max|, only the grid-stride loop of sum_vec4 takes more than
+ * its vector. */
+static const struct {
+    const char             *name;
+    uint32_t                elements_min;
+    uint32_t                elements_max;
+} tuned_kernels[] = {
+    { "sum", 1, 1 },
+    { "sum_vec4", 4, 64 },
+    { "sum_f16", 1, 1 },
+    { "sum_f32", 1, 1 },
+    { "sum_i8", 4, 4 },
+    { "sum_i64", 1, 1 },
+};
+
+static uint32_t tuned_kernel_index(const char *name)
+{
+    for (uint32_t i = 0; i < sizeof(tuned_kernels) / sizeof(*tuned_kernels); i++) {
+        if (0 == strcmp(tuned_kernels[i].name, name))
+            return i;
+    }
+    return UINT32_MAX;
+}
+
+static const struct kernel_tuning* tuning_find(const struct vulkan_state *state,
+                                               const char *name)
+{
+    for (uint32_t i = 0; i < state->tuning_count; i++) {
+        if (0 == strcmp(state->tunings[i].name, name))
+            return &state->tunings[i];
+    }
+    return NULL;
+}
+
+/* Adds |tuning|, or replaces the one of the same kernel. */
+static void tuning_set(struct vulkan_state *state, const struct kernel_tuning *tuning)
+{
+    uint32_t i = 0;
+
+    while (i < state->tuning_count && 0 != strcmp(state->tunings[i].name, tuning->name))
+        i++;
+    if (i == MAX_KERNELS)
+        return;
+    state->tunings[i] = *tuning;
+    if (i == state->tuning_count)
+        state->tuning_count++;
+}
+
+/* The device UUID in hexadecimal, the first field of the cache lines. */
+static void tuning_device_key(const struct vulkan_state *state, char key[2 * VK_UUID_SIZE + 1])
+{
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+        snprintf(key + 2 * i, 3, "%02x", state->device_uuid[i]);
+}
+
+/* Parses a line of the tuning cache:
+ *   <device UUID> <driver version> <kernel> <workgroup size> <elements per invocation>
+ * Returns 0 if it is not one. */
+static uint8_t tuning_line_parse(const char *line,
+                                 char key[2 * VK_UUID_SIZE + 1],
+                                 uint32_t *driver_version,
+                                 struct kernel_tuning *tuning)
+{
+    memset(tuning, 0, sizeof(*tuning));
+    return 5 == sscanf(line, "%32s %u %31s %u %u", key, driver_version, tuning->name,
+                       &tuning->workgroup_size, &tuning->elements_per_invocation);
+}
+
+/* Loads the tunings of this device and driver from |path|, load_kernels
+ * applies them. Must follow initialize_device. Without |path|, or a file,
+ * the kernels start untuned and tuning_cache_save does nothing. */
+void tuning_cache_load(struct vulkan_state *state, const char *path)
+{
+    char device_key[2 * VK_UUID_SIZE + 1];
+    char line[256];
+
+    state->tuning_cache_path = path ? strdup(path) : NULL;
+    FILE *file = path ? fopen(path, "r") : NULL;
+    if (file == NULL)
+        return;
+
+    tuning_device_key(state, device_key);
+    while (fgets(line, sizeof(line), file)) {
+        char key[2 * VK_UUID_SIZE + 1];
+        uint32_t driver_version;
+        struct kernel_tuning tuning;
+
+        if (!tuning_line_parse(line, key, &driver_version, &tuning))
+            continue;
+        if (0 == strcmp(key, device_key) && driver_version == state->driver_version)
+            tuning_set(state, &tuning);
+    }
+    fclose(file);
+}
+
+/* Writes the tunings of this device back, replacing the lines it had with
+ * any driver. The other devices keep theirs. The file is replaced
+ * atomically, as in pipeline_cache_save. */
+void tuning_cache_save(struct vulkan_state *state)
+{
+    char device_key[2 * VK_UUID_SIZE + 1];
+    char line[256];
+
+    if (state->tuning_cache_path == NULL)
+        return;
+
+    size_t tmp_len = strlen(state->tuning_cache_path) + 32;
+    char *tmp_path = malloc(tmp_len);
+    assert(tmp_path);
+    snprintf(tmp_path, tmp_len, "%s.%d.tmp", state->tuning_cache_path, (int)getpid());
+
+    FILE *output = fopen(tmp_path, "w");
+    if (output == NULL) {
+        fprintf(stderr, "unable to write the tuning cache to %s.\n", tmp_path);
+        free(tmp_path);
+        return;
+    }
+
+    tuning_device_key(state, device_key);
+    FILE *input = fopen(state->tuning_cache_path, "r");
+    if (input) {
+        while (fgets(line, sizeof(line), input)) {
+            char key[2 * VK_UUID_SIZE + 1];
+            uint32_t driver_version;
+            struct kernel_tuning tuning;
+
+            if (tuning_line_parse(line, key, &driver_version, &tuning)
+                && 0 != strcmp(key, device_key))
+                fputs(line, output);
+        }
+        fclose(input);
+    }
+
+    for (uint32_t i = 0; i < state->tuning_count; i++) {
+        const struct kernel_tuning *tuning = &state->tunings[i];
+
+        fprintf(output, "%s %u %s %u %u\n", device_key, state->driver_version, tuning->name,
+                tuning->workgroup_size, tuning->elements_per_invocation);
+    }
+
+    if (fclose(output) != 0 || rename(tmp_path, state->tuning_cache_path) != 0) {
+        fprintf(stderr, "unable to write the tuning cache to %s.\n", state->tuning_cache_path);
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+}
+
+/* Gives |kernel| its tuning, unless the device or the module cannot run
+ * it: the cache is only a file, it may have been edited. Invalid tunings
+ * are dropped, autotune_kernels redoes them. */
+static void kernel_tuning_apply(struct vulkan_state *state, struct kernel *kernel)
+{
+    const struct kernel_tuning *tuning = tuning_find(state, kernel->name);
+    uint32_t index = tuned_kernel_index(kernel->name);
+
+    if (tuning == NULL || index == UINT32_MAX)
+        return;
+
+    uint32_t workgroup_size = tuning->workgroup_size;
+    uint32_t elements = tuning->elements_per_invocation;
+    if (workgroup_size == 0
+        || workgroup_size > state->limits.maxComputeWorkGroupSize[0]
+        || workgroup_size > state->limits.maxComputeWorkGroupInvocations
+        || (!kernel->reflection.workgroup_size_id && workgroup_size != kernel->workgroup_size)
+        || elements < tuned_kernels[index].elements_min
+        || elements > tuned_kernels[index].elements_max
+        || elements % tuned_kernels[index].elements_min != 0) {
+        fprintf(stderr, "kernel %s: ignoring the invalid tuning %u x %u.\n",
+                kernel->name, workgroup_size, elements);
+        state->tunings[tuning - state->tunings] = state->tunings[--state->tuning_count];
+        return;
+    }
+    kernel->workgroup_size = workgroup_size;
+    kernel->elements_per_invocation = elements;
+    printf("kernel %s: tuned, workgroup size %u, %u elements per invocation\n",
+           kernel->name, workgroup_size, elements);
+}
+
+/* Time of TUNE_DISPATCH_COUNT dispatches of |kernel|, the fastest of
+ * TUNE_REPETITIONS submissions after a warm up one. */
+static uint64_t tune_measure(struct vulkan_state *state,
+                             const struct kernel *kernel,
+                             const struct kernel_bindings *bindings,
+                             uint32_t elt_count,
+                             VkFence fence)
+{
+    VkCommandBuffer command_buffer;
+    VkCommandBufferAllocateInfo alloc_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        NULL,
+        state->command_pool,
+        VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        1
+    };
+
+    VkCommandBufferBeginInfo begin_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        NULL,
+        0,
+        NULL
+    };
+
+    CALL_VK(vkAllocateCommandBuffers, (state->device, &alloc_info, &command_buffer));
+    CALL_VK(vkBeginCommandBuffer, (command_buffer, &begin_info));
+    for (uint32_t i = 0; i < TUNE_DISPATCH_COUNT; i++) {
+        /* They all write the same output. */
+        if (i > 0) {
+            record_barrier(command_buffer,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_ACCESS_SHADER_WRITE_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_ACCESS_SHADER_WRITE_BIT);
+        }
+        record_dispatch(state, command_buffer, &state->descriptors, kernel, bindings,
+                        elt_count, VK_NULL_HANDLE);
+    }
+    CALL_VK(vkEndCommandBuffer, (command_buffer));
+
+    uint64_t best = UINT64_MAX;
+    for (uint32_t i = 0; i <= TUNE_REPETITIONS; i++) {
+        uint64_t start = get_time_ns();
+        submit_and_wait(state, command_buffer, fence);
+        uint64_t ns = get_time_ns() - start;
+
+        CALL_VK(vkResetFences, (state->device, 1, &fence));
+        if (i > 0 && ns < best)
+            best = ns;
+    }
+
+    vkFreeCommandBuffers(state->device, state->command_pool, 1, &command_buffer);
+    descriptor_frame_reset(state, &state->descriptors);
+    return best;
+}
+
+/* Measures the grid of configurations of |kernel|, and switches it to
+ * the fastest. Its buffers are cleared once: their content does not
+ * change the time, but float kernels could hit slow paths on garbage. */
+static struct kernel_tuning tune_kernel(struct vulkan_state *state,
+                                        struct kernel *kernel,
+                                        VkFence fence)
+{
+    const uint32_t index = tuned_kernel_index(kernel->name);
+    uint32_t max_workgroup_size = TUNE_MAX_WORKGROUP_SIZE;
+    uint32_t elt_count = TUNE_ELT_COUNT;
+    struct kernel_tuning best = { { 0 }, kernel->workgroup_size, kernel->elements_per_invocation };
+    VkPipeline best_pipeline = kernel->pipeline;
+    uint64_t best_ns = UINT64_MAX;
+    uint32_t candidate_count = 0;
+
+    if (max_workgroup_size > state->limits.maxComputeWorkGroupSize[0])
+        max_workgroup_size = state->limits.maxComputeWorkGroupSize[0];
+    if (max_workgroup_size > state->limits.maxComputeWorkGroupInvocations)
+        max_workgroup_size = state->limits.maxComputeWorkGroupInvocations;
+    while (element_buffer_size(kernel->element_type, elt_count)
+           > state->limits.maxStorageBufferRange)
+        elt_count /= 2;
+
+    VkDeviceSize size = element_buffer_size(kernel->element_type, elt_count);
+    struct gpu_memory input = allocate_buffer(state, size, MEMORY_USAGE_DEVICE);
+    struct gpu_memory output = allocate_buffer(state, size, MEMORY_USAGE_DEVICE);
+    struct kernel_bindings bindings;
+
+    memset(&bindings, 0, sizeof(bindings));
+    kernel_bindings_write(&bindings, input.vk_buffer, input.vk_size, 0);
+    kernel_bindings_write(&bindings, output.vk_buffer, output.vk_size, 1);
+
+    VkCommandBuffer command_buffer = one_shot_begin(state, state->command_pool);
+    vkCmdFillBuffer(command_buffer, input.vk_buffer, 0, VK_WHOLE_SIZE, 0);
+    vkCmdFillBuffer(command_buffer, output.vk_buffer, 0, VK_WHOLE_SIZE, 0);
+    one_shot_submit_and_wait(state, &state->compute_queues[0], state->command_pool,
+                             command_buffer, NULL);
+
+    /* Modules with a fixed workgroup size only have their elements tuned. */
+    uint32_t workgroup_size = kernel->reflection.workgroup_size_id
+                            ? TUNE_MIN_WORKGROUP_SIZE
+                            : kernel->workgroup_size;
+    for (; workgroup_size <= max_workgroup_size; workgroup_size *= 2) {
+        VkPipeline pipeline = kernel->pipeline;
+
+        if (kernel->reflection.workgroup_size_id) {
+            VkSpecializationMapEntry entry = { 0, 0, sizeof(uint32_t) };
+            VkSpecializationInfo specialization_info = {
+                1,
+                &entry,
+                sizeof(workgroup_size),
+                &workgroup_size
+            };
+            pipeline = kernel_pipeline_create(state, kernel, &specialization_info);
+        }
+
+        for (uint32_t elements = tuned_kernels[index].elements_min;
+             elements <= tuned_kernels[index].elements_max;
+             elements *= 2) {
+            struct kernel candidate = *kernel;
+
+            candidate.pipeline = pipeline;
+            candidate.workgroup_size = workgroup_size;
+            candidate.elements_per_invocation = elements;
+            uint64_t ns = tune_measure(state, &candidate, &bindings, elt_count, fence);
+            candidate_count++;
+
+            if (ns >= best_ns)
+                continue;
+            if (best_pipeline != pipeline && best_pipeline != kernel->pipeline)
+                vkDestroyPipeline(state->device, best_pipeline, NULL);
+            best_pipeline = pipeline;
+            best_ns = ns;
+            memset(&best, 0, sizeof(best));
+            snprintf(best.name, sizeof(best.name), "%s", kernel->name);
+            best.workgroup_size = workgroup_size;
+            best.elements_per_invocation = elements;
+        }
+
+        if (pipeline != best_pipeline && pipeline != kernel->pipeline)
+            vkDestroyPipeline(state->device, pipeline, NULL);
+        if (!kernel->reflection.workgroup_size_id)
+            break;
+    }
+
+    free_buffer(state, &output);
+    free_buffer(state, &input);
+
+    if (best_pipeline != kernel->pipeline) {
+        vkDestroyPipeline(state->device, kernel->pipeline, NULL);
+        kernel->pipeline = best_pipeline;
+    }
+    kernel->workgroup_size = best.workgroup_size;
+    kernel->elements_per_invocation = best.elements_per_invocation;
+
+    double bytes = 2.0 * TUNE_DISPATCH_COUNT * element_buffer_size(kernel->element_type, elt_count);
+    printf("kernel %s: tuned to workgroup size %u, %u elements per invocation, "
+           "%.2f GB/s (%u candidates)\n",
+           kernel->name, best.workgroup_size, best.elements_per_invocation,
+           bytes / best_ns, candidate_count);
+    return best;
+}
+
+/* Tunes the kernels of tuned_kernels the cache had nothing for, so that
+ * tuning_cache_save can persist them. Their pipelines are replaced: this
+ * must run before anything is recorded with them. Returns the number of
+ * kernels tuned. */
+uint32_t autotune_kernels(struct vulkan_state *state)
+{
+    struct kernel_registry *registry = &state->kernels;
+    uint32_t count = 0;
+
+    kernel_registry_wait(state);
+    assert(state->job_count == 0);
+
+    VkFence fence;
+    VkFenceCreateInfo fence_info = {
+        VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        NULL,
+        0
+    };
+
+    CALL_VK(vkCreateFence, (state->device, &fence_info, NULL, &fence));
+    for (uint32_t i = 0; i < registry->built; i++) {
+        struct kernel *kernel = &registry->kernels[i];
+
+        if (tuned_kernel_index(kernel->name) == UINT32_MAX || tuning_find(state, kernel->name))
+            continue;
+
+        struct kernel_tuning tuning = tune_kernel(state, kernel, fence);
+        tuning_set(state, &tuning);
+        count++;
+    }
+    vkDestroyFence(state->device, fence, NULL);
+    return count;
+}
+
+/* Kernels loaded at startup, from <name>SHADER_SUFFIX next to the binary. */
+static const struct {
+    const char             *name;
+    uint32_t                elements_per_invocation;
+    /* Skipped on devices without these in compute shaders. */
+    VkSubgroupFeatureFlags  subgroup_operations;
+    /* Skipped on devices that do not support it, see element_types. */
+    enum element_type       element_type;
+    /* Skipped on devices that cannot guarantee full subgroups. */
+    uint8_t                 full_subgroups;
+} kernel_infos[] = {
+    { "sum", 1, 0, ELEMENT_TYPE_INT32, 0 },
+    /* Four ivec4 per invocation: enough work to amortize the invocation,
+     * while keeping enough of them to fill the device. */
+    { "sum_vec4", 16, 0, ELEMENT_TYPE_INT32, 0 },
+    { "reduce", 8, VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT,
+      ELEMENT_TYPE_INT32, 0 },
+    /* Where reduce is skipped, and to compare against it. */
+    { "reduce_shared", 8, 0, ELEMENT_TYPE_INT32, 0 },
+    /* A workgroup per job, see sum_batch. */
+    { "sum_batch", 1, 0, ELEMENT_TYPE_INT32, 0 },
+    { "sum_f16", 1, 0, ELEMENT_TYPE_FLOAT16, 0 },
+    { "sum_f32", 1, 0, ELEMENT_TYPE_FLOAT32, 0 },
+    /* A word of four per invocation: HLSL and WGSL have no 8-bit types. */
+    { "sum_i8", 4, 0, ELEMENT_TYPE_INT8, 0 },
+    { "sum_i64", 1, 0, ELEMENT_TYPE_INT64, 0 },
+    /* Built with no operation, see fused_pipeline_get. */
+    { "fused", 1, 0, ELEMENT_TYPE_INT32, 0 },
+    /* Subgroups scan consecutive elements: they must not have holes. */
+    { "scan", 1, VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT,
+      ELEMENT_TYPE_INT32, 1 },
+    { "scan_shared", 1, 0, ELEMENT_TYPE_INT32, 0 },
+};
+
+/* Gives |kernel|, which uses subgroup operations, the subgroup size of
+ * state->subgroup_size_request, and full subgroups when |full|. Returns 0,
+ * after saying why, if the device cannot run it that way. */
+static uint8_t kernel_subgroups_setup(const struct vulkan_state *state,
+                                      struct kernel *kernel,
+                                      uint8_t full)
+{
+    VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT *required = &kernel->required_subgroup_size;
+    uint32_t size = state->subgroup_size_request;
+
+    if (size && kernel->workgroup_size > size * state->max_compute_workgroup_subgroups) {
+        printf("kernel %s: skipped, %u invocations take more than %u subgroups of %u\n",
+               kernel->name, kernel->workgroup_size, state->max_compute_workgroup_subgroups, size);
+        return 0;
+    }
+
+    /* Without a required size, full subgroups of any size the device may
+     * pick have to cover the workgroup. */
+    uint32_t lanes = size ? size : state->max_subgroup_size;
+    if (full && (!state->full_subgroups || lanes == 0 || kernel->workgroup_size % lanes != 0)) {
+        printf("kernel %s: skipped, no full subgroups of %u invocations\n",
+               kernel->name, kernel->workgroup_size);
+        return 0;
+    }
+
+    required->sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO_EXT;
+    required->pNext = NULL;
+    required->requiredSubgroupSize = size;
+    kernel->full_subgroups = full;
+    return 1;
+}
+
+/* Adds every kernel of kernel_infos the device supports to the registry.
+ * Returns 0 if one of them could not be loaded. */
+uint8_t load_kernels(struct vulkan_state *state, const char *argv0)
+{
+    for (uint32_t i = 0; i < sizeof(kernel_infos) / sizeof(*kernel_infos); i++) {
+        const char *kernel_name = kernel_infos[i].name;
+        VkSubgroupFeatureFlags subgroup_operations = kernel_infos[i].subgroup_operations;
+
+        if ((state->subgroup_operations & subgroup_operations) != subgroup_operations) {
+            printf("kernel %s: skipped, missing subgroup operations\n", kernel_name);
+            continue;
+        }
+        if (!(state->element_types & 1u << kernel_infos[i].element_type)) {
+            printf("kernel %s: skipped, no %s support\n", kernel_name,
+                   element_type_name(kernel_infos[i].element_type));
+            continue;
+        }
+
+        size_t name_len = strlen(kernel_name) + strlen(SHADER_SUFFIX) + 1;
+        char *name = malloc(name_len);
+        assert(name);
+        snprintf(name, name_len, "%s%s", kernel_name, SHADER_SUFFIX);
+
+        char *path = path_next_to_binary(argv0, name);
+        struct kernel *kernel = kernel_registry_add(state, kernel_name, path);
+        if (kernel && subgroup_operations
+            && !kernel_subgroups_setup(state, kernel, kernel_infos[i].full_subgroups)) {
+            kernel_registry_pop(state);
+            free(path);
+            free(name);
+            continue;
+        }
+        if (kernel) {
+            kernel->elements_per_invocation = kernel_infos[i].elements_per_invocation;
+            kernel->element_type = kernel_infos[i].element_type;
+            kernel_tuning_apply(state, kernel);
+            printf("kernel %s: %s, %u bindings, %u bytes of push constants\n",
+                   kernel->name, path, kernel->reflection.binding_count,
+                   kernel->reflection.push_constant_size);
+        }
+        free(path);
+        free(name);
+
+        if (kernel == NULL)
+            return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,917 @@
+#ifndef COMPUTE_H
+#define COMPUTE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#ifdef USE_DXC
+# define SHADER_SUFFIX ".hlsl.spv"
+#elif USE_GLSLANG
+# define SHADER_SUFFIX ".glsl.spv"
+#elif USE_WGSL
+# define SHADER_SUFFIX ".wgsl.spv"
+#else
+# error "USE_DXC, USE_GLSLANG or USE_WGSL not set"
+#endif
+
+/* Bindings of the sum kernel. */
+#define BUFFER_COUNT 2
+#define MAX_KERNELS 16
+#define MAX_KERNEL_BINDINGS 8
+
+/* Bytes in a vector of the vectorized kernels, buffers bound to them are
+ * padded to a multiple of it. See sum_buffer_size. */
+#define SUM_VECTOR_SIZE 16
+
+/* Stored next to the shaders. */
+#define PIPELINE_CACHE_NAME "pipeline.cache"
+#define TUNING_CACHE_NAME "tuning.cache"
+
+/* For kernels taking their workgroup size from specialization constant 0.
+ * The others run with the size they were compiled with. */
+#define DEFAULT_WORKGROUP_SIZE 32
+
+/* Grid measured by autotune_kernels: workgroup sizes are the powers of two
+ * in between, within the device limits. Each configuration dispatches
+ * TUNE_DISPATCH_COUNT times over TUNE_ELT_COUNT elements, the fastest of
+ * TUNE_REPETITIONS submissions counts. */
+#define TUNE_MIN_WORKGROUP_SIZE 32
+#define TUNE_MAX_WORKGROUP_SIZE 1024
+#define TUNE_ELT_COUNT (1u << 22)
+#define TUNE_DISPATCH_COUNT 8
+#define TUNE_REPETITIONS 5
+
+/* Number of command buffer/fence pairs kept around for resubmission. */
+#define COMMAND_RING_SIZE 4
+/* Jobs kept in flight by the streaming mode. Must not exceed the ring. */
+#define IN_FLIGHT_COUNT 3
+/* Queues of the compute family used at most, see find_queues. */
+#define MAX_COMPUTE_QUEUES 4
+
+/* Bindings of the reduction: input to scratch, then back and forth
+ * between the two scratch buffers. */
+#define REDUCE_SET_COUNT 3
+
+/* Levels of execute_scan: each one divides the count by the workgroup
+ * size, 32 covers any uint32_t count with workgroups of two or more. */
+#define MAX_SCAN_LEVELS 32
+
+/* Operations of a fused_chain, each one a specialization constant of the
+ * fused kernel: 1 to MAX_FUSED_OPS, 0 being the workgroup size. */
+#define MAX_FUSED_OPS 8
+/* Specializations of the fused kernel kept around, see fused_pipeline_get. */
+#define MAX_FUSED_PIPELINES 16
+
+/* Nodes of a command_graph, and memory ranges each one declares it reads
+ * and writes. */
+#define MAX_GRAPH_NODES 32
+#define MAX_NODE_ACCESSES 4
+
+/* Jobs a submit_queue hands to one vkQueueSubmit at most. */
+#define MAX_SUBMIT_BATCH 32
+/* How long the submitter waits on the device before looking for new jobs. */
+#define SUBMIT_POLL_NS 100000
+
+/* Pools a descriptor_frame chains at most, each twice the size of the
+ * previous one. */
+#define MAX_DESCRIPTOR_POOLS 8
+#define DESCRIPTOR_FRAME_SETS 4
+
+/* Jobs of a sum_batch, one workgroup each: within the smallest
+ * maxComputeWorkGroupCount the spec allows. */
+#define SUM_BATCH_MAX_JOBS 65535
+
+/* Upper bound of host_threads_set. */
+#define HOST_MAX_THREADS 64
+/* Smallest range host_parallel_for hands to a thread, in elements. */
+#define HOST_CHUNK_SIZE (64 * 1024)
+
+/* Which sum kernel execute_sum_kernel runs. */
+enum sum_variant {
+    /* Picked from the bound buffers and the size, see sum_kernel_select. */
+    SUM_VARIANT_AUTO,
+    /* One int per invocation. */
+    SUM_VARIANT_SCALAR,
+    /* ivec4 loads and stores in a grid-stride loop, used whenever the
+     * bound buffers allow it. */
+    SUM_VARIANT_VEC4,
+};
+
+/* Elements of the buffers the sum kernels take, see sum_kernel_select.
+ * int32 is what sum and sum_vec4 take, the others have a kernel each. */
+enum element_type {
+    ELEMENT_TYPE_INT32,
+    ELEMENT_TYPE_FLOAT16,
+    ELEMENT_TYPE_FLOAT32,
+    ELEMENT_TYPE_INT8,
+    ELEMENT_TYPE_INT64,
+    ELEMENT_TYPE_COUNT,
+};
+
+/* Operation and element type of execute_reduce. The values match the
+ * constants of the reduce kernel. */
+enum reduce_op {
+    REDUCE_OP_SUM,
+    REDUCE_OP_MIN,
+    REDUCE_OP_MAX,
+};
+
+enum reduce_type {
+    /* int32, sums wrap around. */
+    REDUCE_TYPE_INT,
+    REDUCE_TYPE_FLOAT,
+};
+
+/* Passes of execute_scan. The values match the constants of the scan
+ * kernels. */
+enum scan_phase {
+    /* Scans within each workgroup, and writes the workgroup totals. */
+    SCAN_PHASE_SCAN,
+    /* Adds the scanned totals of the previous workgroups. */
+    SCAN_PHASE_ADD,
+};
+
+/* Elementwise operations of a fused_chain, on int32 with an operand.
+ * The values match the constants of the fused kernel. */
+enum fused_op {
+    /* Leaves the value as is: what unused operations are set to. */
+    FUSED_OP_NONE,
+    /* Additions and multiplications wrap around. */
+    FUSED_OP_ADD,
+    FUSED_OP_MUL,
+    FUSED_OP_MIN,
+    FUSED_OP_MAX,
+};
+
+/* Where the buffers bound to the kernel live. */
+enum memory_placement {
+    /* HOST_VISIBLE memory, written and read directly through a mapping. */
+    MEMORY_PLACEMENT_HOST,
+    /* DEVICE_LOCAL memory, filled and read back through staging buffers. */
+    MEMORY_PLACEMENT_DEVICE,
+};
+
+/* How the host accesses a buffer, drives the memory type choice. */
+enum memory_usage {
+    /* Never mapped. */
+    MEMORY_USAGE_DEVICE,
+    /* Written by the host, read by the device: write-combined memory. */
+    MEMORY_USAGE_UPLOAD,
+    /* Read back by the host: cached memory. */
+    MEMORY_USAGE_READBACK,
+};
+
+/* Prepended to the vkGetPipelineCacheData blob in the cache file. The
+ * driver checks its own header, but some crash on foreign or truncated
+ * data: nothing reaches them unless all of this matches. */
+struct pipeline_cache_header {
+    uint32_t                magic;
+    uint32_t                header_size;
+    uint32_t                vendor_id;
+    uint32_t                device_id;
+    uint32_t                driver_version;
+    uint8_t                 cache_uuid[VK_UUID_SIZE];
+    uint64_t                data_size;
+    uint64_t                data_hash;
+};
+
+/* What the registry needs to know about a module, see spirv_reflect. */
+struct kernel_reflection {
+    /* Descriptor set 0, the only one supported. */
+    VkDescriptorSetLayoutBinding bindings[MAX_KERNEL_BINDINGS];
+    uint32_t                binding_count;
+    uint32_t                push_constant_size;
+    /* Workgroup size the module was compiled with. */
+    uint32_t                local_size[3];
+    /* Set when the x size is specialization constant 0. */
+    uint8_t                 workgroup_size_id;
+};
+
+struct kernel {
+    char                    name[32];
+    VkShaderModule          shader_module;
+    VkDescriptorSetLayout   descriptor_layout;
+    VkPipelineLayout        pipeline_layout;
+    /* Reads a kernel_bindings, for a push or a set of the layout. */
+    VkDescriptorUpdateTemplate update_template;
+    VkPipeline              pipeline;
+    struct kernel_reflection reflection;
+    /* Along x, what the pipeline actually runs with. */
+    uint32_t                workgroup_size;
+    /* Elements each invocation processes, sizes the dispatch. */
+    uint32_t                elements_per_invocation;
+    /* Of its input and output. */
+    enum element_type       element_type;
+    /* Subgroup size the pipeline requires, 0 when it is left to the
+     * driver: chained to its stage when set, see kernel_subgroups_setup. */
+    VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT required_subgroup_size;
+    /* Its subgroups are all full, and cover consecutive invocations. */
+    uint8_t                 full_subgroups;
+};
+
+/* A configuration picked by autotune_kernels, or read from the tuning
+ * cache. load_kernels gives it to the kernel called |name|. */
+struct kernel_tuning {
+    char                    name[32];
+    uint32_t                workgroup_size;
+    uint32_t                elements_per_invocation;
+};
+
+/* Kernels are loaded one by one, then have their pipelines built in a
+ * single batch, possibly on a background thread. */
+struct kernel_registry {
+    struct kernel           kernels[MAX_KERNELS];
+    uint32_t                count;
+    /* Kernels from |built| on wait for the next build. */
+    uint32_t                built;
+
+    pthread_t               thread;
+    uint8_t                 building;
+    uint64_t                build_ns;
+};
+
+/* Push constant block of the shaders. */
+struct sum_push_constants {
+    uint32_t                elt_count;
+    /* Invocations in one row of the dispatch, see sum_dispatch_size. */
+    uint32_t                row_pitch;
+    /* Invocations in the whole dispatch, the stride of the loop of the
+     * vectorized kernels. Not part of the scalar kernels' block. */
+    uint32_t                invocation_count;
+};
+
+/* Push constant block of the reduce kernel. */
+struct reduce_push_constants {
+    uint32_t                elt_count;
+    uint32_t                row_pitch;
+    uint32_t                items_per_invocation;
+    uint32_t                op;
+    uint32_t                type;
+};
+
+/* Push constant block of the scan kernels. */
+struct scan_push_constants {
+    uint32_t                elt_count;
+    uint32_t                row_pitch;
+    uint32_t                phase;
+};
+
+/* Push constant block of the fused kernel. */
+struct fused_push_constants {
+    uint32_t                elt_count;
+    uint32_t                row_pitch;
+    /* Of each operation of the chain, in order. */
+    int32_t                 operands[MAX_FUSED_OPS];
+};
+
+/* Elementwise operations applied in order, ops[0] first. The operations
+ * select the pipeline, the operands are only push constants. */
+struct fused_chain {
+    enum fused_op           ops[MAX_FUSED_OPS];
+    int32_t                 operands[MAX_FUSED_OPS];
+    uint32_t                count;
+};
+
+/* The fused kernel specialized for a sequence of operations, padded with
+ * FUSED_OP_NONE. */
+struct fused_pipeline {
+    uint32_t                ops[MAX_FUSED_OPS];
+    VkPipeline              pipeline;
+};
+
+/* A reduced value, or one element of a reduction input. */
+union reduce_value {
+    int32_t                 i;
+    float                   f;
+    uint32_t                bits;
+};
+
+struct sum_dispatch {
+    uint32_t                group_count_x;
+    uint32_t                group_count_y;
+    struct sum_push_constants constants;
+};
+
+/* Staging copies recorded around a dispatch (device placement): |size|
+ * bytes from |upload| to |input| before it, and from |output| to
+ * |download| after it, each at its offset. */
+struct sum_transfer {
+    VkBuffer                input;
+    VkBuffer                output;
+    VkDeviceSize            size;
+    VkBuffer                upload;
+    VkBuffer                download;
+    VkDeviceSize            input_offset;
+    VkDeviceSize            output_offset;
+    VkDeviceSize            upload_offset;
+    VkDeviceSize            download_offset;
+};
+
+/* What a profiled submission ran, to label its timestamps. */
+struct profile_job {
+    const char             *kernel;
+    uint32_t                elt_count;
+    uint32_t                element_size;
+    /* Size of each staging copy, 0 without. */
+    VkDeviceSize            transfer_size;
+    uint32_t                query_base;
+    uint64_t                submit_ns;
+    /* Submitted, timestamps not collected yet. */
+    uint8_t                 pending;
+};
+
+/* One span of the trace. GPU spans are on the device clock, host spans on
+ * CLOCK_MONOTONIC: the two are not correlated. */
+struct profile_event {
+    const char             *name;
+    const char             *category;
+    uint64_t                start_ns;
+    uint64_t                duration_ns;
+    uint64_t                bytes;
+    uint8_t                 host;
+};
+
+struct profiler {
+    /* VK_NULL_HANDLE when profiling is off. */
+    VkQueryPool             query_pool;
+    char                   *path;
+    double                  period_ns;
+    uint64_t                valid_mask;
+
+    struct profile_event   *events;
+    uint32_t                event_count;
+    uint32_t                event_capacity;
+};
+
+/* A device queue, and the timeline its submissions signal. Queues
+ * complete out of order: each has its own. */
+struct gpu_queue {
+    VkQueue                 queue;
+    uint32_t                family_index;
+    VkSemaphore             timeline;
+    uint64_t                timeline_value;
+    /* Held around vkQueueSubmit, and the timeline_value it signals: the
+     * command ring, the one-shot paths and a submit_queue thread can all
+     * submit to the same queue. */
+    pthread_mutex_t         submit_lock;
+};
+
+/* Buffers of descriptor set 0 of a kernel, indexed by binding. Copied
+ * into the command buffers that use them: see record_bindings. Unused
+ * entries must stay zeroed, bindings are compared as a whole. */
+struct kernel_bindings {
+    VkDescriptorBufferInfo  buffers[MAX_KERNEL_BINDINGS];
+};
+
+/* Descriptor pools of the sets recorded in a command buffer, without
+ * VK_KHR_push_descriptor. Grown by chaining pools, reset in bulk once
+ * the command buffer completed. */
+struct descriptor_frame {
+    VkDescriptorPool        pools[MAX_DESCRIPTOR_POOLS];
+    uint32_t                pool_count;
+    /* Pool allocations come from, the previous ones are full. */
+    uint32_t                current;
+};
+
+/* A pre-recorded command buffer, and what it was recorded with. */
+struct command_slot {
+    VkCommandBuffer         command_buffer;
+    /* Staging copies, when they run on the transfer queue. */
+    VkCommandBuffer         upload_command_buffer;
+    VkCommandBuffer         download_command_buffer;
+    VkFence                 fence;
+
+    VkPipeline              pipeline;
+    struct kernel_bindings  bindings;
+    struct descriptor_frame descriptors;
+    uint32_t                elt_count;
+    /* Buffer of the VkDispatchIndirectCommand, VK_NULL_HANDLE for direct
+     * dispatches. */
+    VkBuffer                indirect;
+    struct sum_transfer     transfer;
+    uint8_t                 recorded;
+
+    /* Last job submitted, and the queue value signaled once it completes. */
+    uint64_t                job;
+    struct gpu_queue       *queue;
+    uint64_t                timeline_value;
+    struct profile_job      profile;
+};
+
+/* Free range of an arena block. Lists are sorted by offset. */
+struct arena_range {
+    VkDeviceSize            offset;
+    VkDeviceSize            size;
+    struct arena_range     *next;
+};
+
+struct arena_block {
+    VkDeviceMemory          vk_memory;
+    VkDeviceSize            size;
+    uint32_t                memory_type;
+    /* Persistent mapping, NULL if the type is not HOST_VISIBLE. */
+    uint8_t                *mapped;
+    /* Mapped but not HOST_COHERENT: host accesses need flush/invalidate. */
+    uint8_t                 needs_flush;
+    struct arena_range     *free_list;
+    struct arena_block     *next;
+};
+
+/* Size of the VkDeviceMemory blocks the arena sub-allocates buffers from.
+ * Larger requests get a block of their own. */
+#define ARENA_BLOCK_SIZE (16 * 1024 * 1024)
+
+/* One list of blocks per memory type, allocated on demand. */
+struct memory_arena {
+    VkPhysicalDeviceMemoryProperties properties;
+    struct arena_block     *blocks[VK_MAX_MEMORY_TYPES];
+    /* Granularity of flushes and invalidates. Blocks are sized in atoms so
+     * a rounded range never goes past the end of its block. */
+    VkDeviceSize            atom_size;
+
+    /* Counters, for arena_dump_stats. */
+    VkDeviceSize            live_bytes;
+    VkDeviceSize            reserved_bytes;
+    uint32_t                live_allocations;
+    uint32_t                block_count;
+};
+
+struct arena_allocation {
+    struct arena_block     *block;
+    VkDeviceSize            offset;
+    VkDeviceSize            size;
+};
+
+struct gpu_memory {
+    void           *buffer;
+    VkDeviceSize    vk_size;
+    VkDeviceMemory  vk_memory;
+    VkBuffer        vk_buffer;
+    /* Where the buffer is bound in vk_memory. */
+    VkDeviceSize    vk_offset;
+    /* See arena_block.needs_flush. */
+    uint8_t         needs_flush;
+    /* Owned allocation, block is NULL for views into another allocation. */
+    struct arena_allocation allocation;
+    /* vk_memory wraps host memory of the caller, see gpu_memory_import_host.
+     * Freed with the buffer, the host memory is not. */
+    uint8_t         imported;
+};
+
+/* Elements of one job of a sum_batch, as the sum_batch kernel reads them. */
+struct batch_job {
+    uint32_t                first;
+    uint32_t                count;
+};
+
+/* Many small independent arrays summed by a single indirect dispatch, one
+ * workgroup per job. Jobs are packed back to back in |input|, |output| has
+ * their results at the same place. The buffers are written and read in
+ * place, whatever the placement. */
+struct sum_batch {
+    struct gpu_memory       input;
+    struct gpu_memory       output;
+    /* The batch_job table. */
+    struct gpu_memory       jobs;
+    /* VkDispatchIndirectCommand, a group per job. */
+    struct gpu_memory       indirect;
+    struct kernel_bindings  bindings;
+    uint32_t                max_jobs;
+    uint32_t                max_elt_count;
+    uint32_t                job_count;
+    uint32_t                elt_count;
+    /* Ring job of the last submission, see submit_sum_batch. */
+    uint64_t                job;
+};
+
+enum graph_node_type {
+    /* A sum kernel over elt_count elements, as record_dispatch records it. */
+    GRAPH_NODE_DISPATCH,
+    GRAPH_NODE_COPY,
+};
+
+/* Memory rather than buffers: buffers aliasing it conflict too. */
+struct graph_access {
+    VkDeviceMemory          memory;
+    VkDeviceSize            offset;
+    VkDeviceSize            size;
+};
+
+struct graph_node {
+    enum graph_node_type    type;
+    const struct kernel    *kernel;
+    struct kernel_bindings  bindings;
+    uint32_t                elt_count;
+    VkBuffer                src;
+    VkBuffer                dst;
+    VkBufferCopy            region;
+
+    struct graph_access     reads[MAX_NODE_ACCESSES];
+    uint32_t                read_count;
+    struct graph_access     writes[MAX_NODE_ACCESSES];
+    uint32_t                write_count;
+    /* Set by command_graph_build: the node starts a phase, and waits for
+     * every node before it. Nodes of a phase may run together. */
+    uint8_t                 barrier;
+};
+
+/* Copies and dispatches recorded once in a command buffer, then replayed
+ * with a single submission. Only the contents of the buffers change from
+ * one replay to the next. */
+struct command_graph {
+    struct graph_node       nodes[MAX_GRAPH_NODES];
+    uint32_t                node_count;
+    /* Recorded by command_graph_build, again if the nodes change. */
+    VkCommandBuffer         command_buffer;
+    VkFence                 fence;
+    /* Sets of the recording, without push descriptors. */
+    struct descriptor_frame descriptors;
+    uint32_t                barrier_count;
+};
+
+/* Work recorded by any thread, submitted by the submit_queue thread. */
+struct submit_job {
+    /* Kept from one recording to the next: a job stays with the
+     * submit_context it was first recorded with. */
+    VkCommandBuffer         command_buffer;
+    /* Optional, called by the submitter thread once the job completed,
+     * before submit_job_done reports it. */
+    void                  (*callback)(struct submit_job *job, void *data);
+    void                   *callback_data;
+
+    /* Owned by the queue from submit_job_push on. */
+    struct submit_job      *next;
+    uint64_t                timeline_value;
+    uint8_t                 done;
+};
+
+/* Command buffers and descriptor sets of one producer thread: only this
+ * thread may record with it. Reset once all of its jobs completed. */
+struct submit_context {
+    VkCommandPool           command_pool;
+    struct descriptor_frame descriptors;
+};
+
+/* Jobs are pushed on a lock-free stack by the producers. The submitter
+ * thread takes them all at once, and submits them in order, a
+ * VkSubmitInfo each and up to MAX_SUBMIT_BATCH per vkQueueSubmit. Other
+ * submissions to |queue| are serialized with it by its submit_lock. */
+struct submit_queue {
+    struct vulkan_state    *state;
+    struct gpu_queue       *queue;
+    pthread_t               thread;
+
+    struct submit_job      *pending;
+    /* Submitted, in order, waiting for the queue timeline. Submitter only. */
+    struct submit_job      *in_flight;
+    struct submit_job      *in_flight_tail;
+
+    /* The submitter parks on |wake| when it has nothing to do. */
+    pthread_mutex_t         lock;
+    pthread_cond_t          wake;
+    uint8_t                 stop;
+    /* Broadcast on completions, for submit_job_wait. */
+    pthread_mutex_t         done_lock;
+    pthread_cond_t          done;
+
+    /* Written by the submitter, read once it stopped. */
+    uint64_t                submit_count;
+    uint64_t                job_count;
+};
+
+struct vulkan_state {
+    VkInstance              instance;
+    /* Index in vkEnumeratePhysicalDevices to load, set before
+     * initialize_device. UINT32_MAX picks one, see USE_VIRTIOGPU. */
+    uint32_t                device_index;
+    VkPhysicalDevice        phys_device;
+    VkPhysicalDeviceLimits  limits;
+    VkDevice                device;
+    /* Ring submissions go round-robin over the compute queues. The rest
+     * runs on the first one. */
+    struct gpu_queue        compute_queues[MAX_COMPUTE_QUEUES];
+    uint32_t                compute_queue_count;
+    /* Staging copies of the ring and of gpu_memory_upload. No queue when
+     * the device has none to spare: the copies go with the dispatch. */
+    struct gpu_queue        transfer_queue;
+    /* Of the compute family. */
+    uint32_t                timestamp_valid_bits;
+    /* Bit per element_type the kernels can read and write on this device,
+     * the features they need are enabled. */
+    uint32_t                element_types;
+    /* Set before initialize_device to ignore the subgroup operations, and
+     * load the shared memory kernels instead. */
+    uint8_t                 no_subgroups;
+    /* Subgroup operations usable in compute shaders, 0 if none. */
+    VkSubgroupFeatureFlags  subgroup_operations;
+    uint32_t                subgroup_size;
+    /* VK_EXT_subgroup_size_control is enabled: compute pipelines can
+     * require a size from |min_subgroup_size| to |max_subgroup_size|,
+     * and full subgroups with |full_subgroups|. */
+    uint8_t                 subgroup_size_control;
+    uint8_t                 full_subgroups;
+    uint32_t                min_subgroup_size;
+    uint32_t                max_subgroup_size;
+    uint32_t                max_compute_workgroup_subgroups;
+    /* Set before load_kernels, the subgroup size the kernels using
+     * subgroup operations require. 0 leaves it to the driver. */
+    uint32_t                subgroup_size_request;
+    /* Set before initialize_device to leave VK_EXT_external_memory_host
+     * off, and take the copy path of gpu_memory_import_host. */
+    uint8_t                 no_host_import;
+    /* VK_EXT_external_memory_host is enabled. */
+    uint8_t                 host_import;
+    /* Alignment of the host pointers and sizes to import, the page size
+     * without the extension. */
+    VkDeviceSize            host_import_alignment;
+    PFN_vkGetMemoryHostPointerPropertiesEXT get_memory_host_pointer_properties;
+    /* Set before initialize_device to leave VK_KHR_push_descriptor off,
+     * and allocate sets from the descriptor frames instead. */
+    uint8_t                 no_push_descriptors;
+    /* VK_KHR_push_descriptor is enabled. */
+    uint8_t                 push_descriptors;
+    PFN_vkCmdPushDescriptorSetWithTemplateKHR push_descriptor_set_with_template;
+    /* Host time spent binding, for the benchmark: see record_bindings. */
+    uint64_t                binding_ns;
+    uint64_t                binding_count;
+
+    VkCommandPool           command_pool;
+    /* VK_NULL_HANDLE without a transfer queue. */
+    VkCommandPool           transfer_command_pool;
+
+    struct kernel_registry  kernels;
+    /* Looked up once the registry is built. */
+    const struct kernel    *sum;
+    const struct kernel    *sum_vec4;
+    enum sum_variant        sum_variant;
+    /* Of the global bindings. The kernels of the types other than int32,
+     * NULL where the device lacks support. */
+    enum element_type       element_type;
+    const struct kernel    *sum_types[ELEMENT_TYPE_COUNT];
+    /* Bindings of the sum kernel, see descriptor_set_bind. */
+    struct kernel_bindings  bindings;
+
+    const struct kernel    *sum_batch;
+
+    /* With subgroup operations when the device has them, from shared
+     * memory otherwise. */
+    const struct kernel    *reduce;
+    /* Set by reduce_prepare, the scratch buffers are grown as needed. */
+    struct kernel_bindings  reduce_bindings[REDUCE_SET_COUNT];
+    struct gpu_memory       reduce_scratch[2];
+    struct gpu_memory       reduce_result;
+
+    /* Picked as the reduce kernel. The totals of each level are grown as
+     * needed. */
+    const struct kernel    *scan;
+    struct gpu_memory       scan_totals[MAX_SCAN_LEVELS];
+
+    /* Its pipeline is specialized with no operation, fused_pipeline_get
+     * creates the others. The oldest goes when they are all in use. */
+    const struct kernel    *fused;
+    struct fused_pipeline   fused_pipelines[MAX_FUSED_PIPELINES];
+    uint32_t                fused_pipeline_count;
+    uint32_t                fused_pipeline_next;
+
+    VkPipelineCache         pipeline_cache;
+    /* NULL when the cache is not persisted. */
+    char                   *pipeline_cache_path;
+    /* Hash of the data loaded from the file, 0 when it started empty. */
+    uint64_t                pipeline_cache_hash;
+
+    /* Of VkPhysicalDeviceIDProperties and VkPhysicalDeviceProperties, the
+     * tuning cache is keyed by both. */
+    uint8_t                 device_uuid[VK_UUID_SIZE];
+    uint32_t                driver_version;
+    /* Tunings of this device and driver, see tuning_cache_load. */
+    struct kernel_tuning    tunings[MAX_KERNELS];
+    uint32_t                tuning_count;
+    /* NULL when the tunings are not persisted. */
+    char                   *tuning_cache_path;
+
+    /* Problem size of the scenarios, and the workgroup size kernels are
+     * specialized with when they have no tuning. */
+    uint32_t                elt_count;
+    uint32_t                workgroup_size;
+
+    struct command_slot     command_ring[COMMAND_RING_SIZE];
+    uint32_t                command_ring_next;
+    uint8_t                 one_shot_submit;
+    /* Sets of the command buffers submitted and waited for at once. */
+    struct descriptor_frame descriptors;
+    /* Jobs submitted to the ring, the last one is its id. */
+    uint64_t                job_count;
+
+    enum memory_placement   placement;
+    /* Persistently mapped, only allocated with device placement. */
+    struct gpu_memory       staging_upload;
+    struct gpu_memory       staging_download;
+    /* What descriptor_set_bind last bound to each binding of the global
+     * bindings: the staging copies target these. */
+    VkBuffer                bound_buffers[BUFFER_COUNT];
+    VkDeviceSize            bound_sizes[BUFFER_COUNT];
+    /* Where they are bound in their memory, for the vector alignment. */
+    VkDeviceSize            bound_offsets[BUFFER_COUNT];
+
+    struct memory_arena     arena;
+    struct profiler         profiler;
+};
+
+void check_vkresult(const char* fname, VkResult res);
+#define CALL_VK(Func, Param) check_vkresult(#Func, Func Param)
+
+/* Instance, device and the objects every run needs. */
+struct vulkan_state* create_state(void);
+uint32_t physical_device_count(const struct vulkan_state *state);
+void initialize_device(struct vulkan_state *state);
+void destroy_state(struct vulkan_state **state);
+uint8_t validate_problem_size(const struct vulkan_state *state);
+void staging_create(struct vulkan_state *state, VkDeviceSize size);
+
+/* Memory. */
+VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment);
+VkBuffer create_gpu_buffer(struct vulkan_state *state, VkDeviceSize size);
+struct gpu_memory gpu_memory_view(const struct arena_allocation *allocation,
+                                  VkBuffer vk_buffer,
+                                  VkDeviceSize offset,
+                                  VkDeviceSize size);
+struct gpu_memory allocate_buffer(struct vulkan_state *state,
+                                  VkDeviceSize size,
+                                  enum memory_usage usage);
+void free_buffer(struct vulkan_state *state, struct gpu_memory *mem);
+struct arena_allocation arena_alloc(struct vulkan_state *state,
+                                    const VkMemoryRequirements *requirements,
+                                    enum memory_usage usage);
+void arena_free(struct vulkan_state *state, struct arena_allocation *allocation);
+void arena_dump_stats(const struct vulkan_state *state);
+void gpu_memory_flush(struct vulkan_state *state,
+                      const struct gpu_memory *mem,
+                      VkDeviceSize offset,
+                      VkDeviceSize size);
+void gpu_memory_invalidate(struct vulkan_state *state,
+                           const struct gpu_memory *mem,
+                           VkDeviceSize offset,
+                           VkDeviceSize size);
+enum memory_usage kernel_memory_usage(const struct vulkan_state *state,
+                                      enum memory_usage usage);
+void* kernel_input(struct vulkan_state *state, const struct gpu_memory *mem);
+void kernel_input_flush(struct vulkan_state *state, const struct gpu_memory *mem);
+void* kernel_output(struct vulkan_state *state, const struct gpu_memory *mem);
+void gpu_memory_upload(struct vulkan_state *state,
+                       const struct gpu_memory *mem,
+                       const void *data,
+                       VkDeviceSize size);
+uint8_t host_memory_import(struct vulkan_state *state,
+                           void *data,
+                           VkDeviceSize size,
+                           struct gpu_memory *mem);
+struct gpu_memory gpu_memory_import_host(struct vulkan_state *state,
+                                         void *data,
+                                         VkDeviceSize size);
+void gpu_memory_copy(struct vulkan_state *state,
+                     const struct gpu_memory *src,
+                     const struct gpu_memory *dst,
+                     VkDeviceSize size);
+
+/* Kernels and their pipelines. */
+char* path_next_to_binary(const char *argv0, const char *name);
+void pipeline_cache_create(struct vulkan_state *state, const char *path);
+void pipeline_cache_save(struct vulkan_state *state);
+void tuning_cache_load(struct vulkan_state *state, const char *path);
+void tuning_cache_save(struct vulkan_state *state);
+uint8_t load_kernels(struct vulkan_state *state, const char *argv0);
+uint32_t autotune_kernels(struct vulkan_state *state);
+void kernel_registry_build_async(struct vulkan_state *state);
+const struct kernel* kernel_find(struct vulkan_state *state, const char *name);
+void kernel_bindings_write(struct kernel_bindings *bindings,
+                           VkBuffer buffer,
+                           VkDeviceSize size,
+                           uint32_t binding);
+void kernel_bindings_write_range(const struct vulkan_state *state,
+                                 struct kernel_bindings *bindings,
+                                 VkBuffer buffer,
+                                 VkDeviceSize offset,
+                                 VkDeviceSize size,
+                                 uint32_t binding);
+void descriptor_set_bind(struct vulkan_state *state,
+                         const struct gpu_memory *mem,
+                         uint32_t binding);
+
+/* Submission. */
+uint64_t submit_sum_kernel(struct vulkan_state *state,
+                           const struct kernel *kernel,
+                           const struct kernel_bindings *bindings,
+                           uint32_t elt_count,
+                           const struct sum_transfer *transfer);
+const struct sum_transfer* bound_transfer(const struct vulkan_state *state,
+                                          struct sum_transfer *transfer);
+uint8_t poll_sum_kernel(struct vulkan_state *state, uint64_t job);
+void wait_sum_kernel(struct vulkan_state *state, uint64_t job);
+const struct kernel* sum_kernel_select(const struct vulkan_state *state, uint32_t elt_count);
+void execute_sum_kernel(struct vulkan_state *state, uint32_t elt_count);
+void sum_batch_create(struct vulkan_state *state,
+                      struct sum_batch *batch,
+                      uint32_t max_jobs,
+                      uint32_t max_elt_count);
+void sum_batch_destroy(struct vulkan_state *state, struct sum_batch *batch);
+void sum_batch_reset(struct sum_batch *batch);
+uint32_t sum_batch_add(struct sum_batch *batch, const int *data, uint32_t elt_count);
+uint64_t submit_sum_batch(struct vulkan_state *state, struct sum_batch *batch);
+int* sum_batch_result(struct vulkan_state *state,
+                      const struct sum_batch *batch,
+                      uint32_t index,
+                      uint32_t *elt_count);
+union reduce_value execute_reduce(struct vulkan_state *state,
+                                  const struct gpu_memory *input,
+                                  uint32_t elt_count,
+                                  enum reduce_op op,
+                                  enum reduce_type type);
+void execute_scan(struct vulkan_state *state,
+                  const struct gpu_memory *input,
+                  const struct gpu_memory *output,
+                  uint32_t elt_count);
+void command_graph_init(struct command_graph *graph);
+uint32_t command_graph_dispatch(struct command_graph *graph,
+                                const struct kernel *kernel,
+                                const struct kernel_bindings *bindings,
+                                uint32_t elt_count);
+uint32_t command_graph_copy(struct command_graph *graph,
+                            const struct gpu_memory *src,
+                            const struct gpu_memory *dst,
+                            VkDeviceSize size);
+void command_graph_reads(struct command_graph *graph,
+                         uint32_t node,
+                         const struct gpu_memory *mem);
+void command_graph_writes(struct command_graph *graph,
+                          uint32_t node,
+                          const struct gpu_memory *mem);
+void command_graph_build(struct vulkan_state *state, struct command_graph *graph);
+void execute_command_graph(struct vulkan_state *state, struct command_graph *graph);
+void command_graph_destroy(struct vulkan_state *state, struct command_graph *graph);
+void submit_queue_start(struct vulkan_state *state, struct submit_queue *queue);
+void submit_queue_stop(struct submit_queue *queue);
+void submit_context_init(struct vulkan_state *state, struct submit_context *context);
+void submit_context_reset(struct vulkan_state *state, struct submit_context *context);
+void submit_context_destroy(struct vulkan_state *state, struct submit_context *context);
+void submit_job_record_sum(struct vulkan_state *state,
+                           struct submit_context *context,
+                           struct submit_job *job,
+                           const struct kernel *kernel,
+                           const struct kernel_bindings *bindings,
+                           uint32_t elt_count);
+void submit_job_push(struct submit_queue *queue, struct submit_job *job);
+uint8_t submit_job_done(const struct submit_job *job);
+void submit_job_wait(struct submit_queue *queue, struct submit_job *job);
+void fused_chain_append(struct fused_chain *chain, enum fused_op op, int32_t operand);
+int32_t fused_chain_apply(const struct fused_chain *chain, int32_t value);
+void execute_fused_chain(struct vulkan_state *state,
+                         const struct fused_chain *chain,
+                         const struct gpu_memory *input,
+                         const struct gpu_memory *output,
+                         uint32_t elt_count,
+                         uint8_t fuse);
+
+/* Profiling, see SUM_PROFILE. */
+void profiler_create(struct vulkan_state *state, const char *path);
+void profiler_write(struct vulkan_state *state);
+
+/* Host-side parallelism, for the payload helpers. */
+typedef void (*host_task)(void *data, uint32_t begin, uint32_t end);
+void host_threads_set(uint32_t count);
+uint32_t host_threads_count(void);
+void host_parallel_for(uint32_t count, uint32_t grain, host_task task, void *data);
+const char* payload_simd_name(void);
+
+/* Helpers. */
+uint64_t get_time_ns(void);
+void generate_payload(int *buffer, uint32_t elt_count, uint32_t first);
+void check_payload(int *buffer, uint32_t elt_count, uint32_t first);
+void generate_typed_payload(void *buffer, enum element_type type,
+                            uint32_t elt_count, uint32_t first);
+void check_typed_payload(const void *buffer, enum element_type type,
+                         uint32_t elt_count, uint32_t first);
+uint32_t element_type_size(enum element_type type);
+const char* element_type_name(enum element_type type);
+const char* element_type_kernel(enum element_type type);
+VkDeviceSize element_buffer_size(enum element_type type, uint32_t elt_count);
+const char* placement_name(enum memory_placement placement);
+const char* sum_variant_name(enum sum_variant variant);
+VkDeviceSize sum_buffer_size(uint32_t elt_count);
+void generate_reduce_payload(union reduce_value *values, uint32_t elt_count,
+                             enum reduce_type type);
+union reduce_value reduce_on_host(const union reduce_value *values,
+                                  uint32_t elt_count,
+                                  enum reduce_op op,
+                                  enum reduce_type type);
+uint8_t reduce_value_matches(union reduce_value value,
+                             union reduce_value expected,
+                             const union reduce_value *values,
+                             uint32_t elt_count,
+                             enum reduce_op op,
+                             enum reduce_type type);
+const char* reduce_op_name(enum reduce_op op);
+const char* reduce_type_name(enum reduce_type type);
+const char* fused_op_name(enum fused_op op);
+
+#endif
@@ -0,0 +1,71 @@
+#version 450
+
+/* The workgroup size is specialization constant 0. */
+layout (
+    local_size_x_id = 0,
+    local_size_y = 1,
+    local_size_z = 1
+) in;
+
+/* enum fused_op on the host. */
+#define OP_NONE 0
+#define OP_ADD 1
+#define OP_MUL 2
+#define OP_MIN 3
+#define OP_MAX 4
+
+/* The operations of the chain, in order. Once specialized, the unused
+ * ones and the other cases of apply are folded away. */
+layout (constant_id = 1) const uint op0 = OP_NONE;
+layout (constant_id = 2) const uint op1 = OP_NONE;
+layout (constant_id = 3) const uint op2 = OP_NONE;
+layout (constant_id = 4) const uint op3 = OP_NONE;
+layout (constant_id = 5) const uint op4 = OP_NONE;
+layout (constant_id = 6) const uint op5 = OP_NONE;
+layout (constant_id = 7) const uint op6 = OP_NONE;
+layout (constant_id = 8) const uint op7 = OP_NONE;
+
+layout (push_constant) uniform parameters {
+    uint elt_count;
+    /* Invocations per row of the dispatch. */
+    uint row_pitch;
+    int operands[8];
+};
+
+layout (binding = 0) buffer buf_in  { int buffer_in[]; };
+layout (binding = 1) buffer buf_out { int buffer_out[]; };
+
+int apply(uint op, int value, int operand)
+{
+    switch (op) {
+    case OP_ADD:
+        return value + operand;
+    case OP_MUL:
+        return value * operand;
+    case OP_MIN:
+        return min(value, operand);
+    case OP_MAX:
+        return max(value, operand);
+    default:
+        return value;
+    }
+}
+
+void main()
+{
+    uint id = gl_GlobalInvocationID.y * row_pitch + gl_GlobalInvocationID.x;
+    if (id >= elt_count)
+        return;
+
+    /* One read and one write, whatever the length of the chain. */
+    int value = buffer_in[id];
+    value = apply(op0, value, operands[0]);
+    value = apply(op1, value, operands[1]);
+    value = apply(op2, value, operands[2]);
+    value = apply(op3, value, operands[3]);
+    value = apply(op4, value, operands[4]);
+    value = apply(op5, value, operands[5]);
+    value = apply(op6, value, operands[6]);
+    value = apply(op7, value, operands[7]);
+    buffer_out[id] = value;
+}
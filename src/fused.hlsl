@@ -0,0 +1,66 @@
+// enum fused_op on the host.
+#define OP_NONE 0
+#define OP_ADD 1
+#define OP_MUL 2
+#define OP_MIN 3
+#define OP_MAX 4
+
+// The operations of the chain, in order. Once specialized, the unused
+// ones and the other cases of apply are folded away.
+[[vk::constant_id(1)]] const uint op0 = OP_NONE;
+[[vk::constant_id(2)]] const uint op1 = OP_NONE;
+[[vk::constant_id(3)]] const uint op2 = OP_NONE;
+[[vk::constant_id(4)]] const uint op3 = OP_NONE;
+[[vk::constant_id(5)]] const uint op4 = OP_NONE;
+[[vk::constant_id(6)]] const uint op5 = OP_NONE;
+[[vk::constant_id(7)]] const uint op6 = OP_NONE;
+[[vk::constant_id(8)]] const uint op7 = OP_NONE;
+
+struct Parameters {
+  uint elt_count;
+  // Invocations per row of the dispatch.
+  uint row_pitch;
+  int operands[8];
+};
+
+[[vk::push_constant]] Parameters parameters;
+
+RWStructuredBuffer<int> buffer_in;
+RWStructuredBuffer<int> buffer_out;
+
+int apply(uint op, int value, int operand)
+{
+  switch (op) {
+  case OP_ADD:
+    return value + operand;
+  case OP_MUL:
+    return value * operand;
+  case OP_MIN:
+    return min(value, operand);
+  case OP_MAX:
+    return max(value, operand);
+  default:
+    return value;
+  }
+}
+
+// The host reads the workgroup size back from the module.
+[numthreads(32,1,1)]
+void main(uint3 threadID : SV_DispatchThreadID)
+{
+  const uint id = threadID.y * parameters.row_pitch + threadID.x;
+  if (id >= parameters.elt_count)
+      return;
+
+  // One read and one write, whatever the length of the chain.
+  int value = buffer_in[id];
+  value = apply(op0, value, parameters.operands[0]);
+  value = apply(op1, value, parameters.operands[1]);
+  value = apply(op2, value, parameters.operands[2]);
+  value = apply(op3, value, parameters.operands[3]);
+  value = apply(op4, value, parameters.operands[4]);
+  value = apply(op5, value, parameters.operands[5]);
+  value = apply(op6, value, parameters.operands[6]);
+  value = apply(op7, value, parameters.operands[7]);
+  buffer_out[id] = value;
+}
@@ -0,0 +1,69 @@
+enable chromium_experimental_push_constant;
+
+// enum fused_op on the host.
+const OP_ADD : u32 = 1u;
+const OP_MUL : u32 = 2u;
+const OP_MIN : u32 = 3u;
+const OP_MAX : u32 = 4u;
+
+// The operations of the chain, in order, 0 leaving the value as is. Once
+// specialized, the unused ones and the other cases of apply are folded away.
+@id(1) override op0 : u32 = 0u;
+@id(2) override op1 : u32 = 0u;
+@id(3) override op2 : u32 = 0u;
+@id(4) override op3 : u32 = 0u;
+@id(5) override op4 : u32 = 0u;
+@id(6) override op5 : u32 = 0u;
+@id(7) override op6 : u32 = 0u;
+@id(8) override op7 : u32 = 0u;
+
+struct Parameters {
+    elt_count : u32,
+    // Invocations per row of the dispatch.
+    row_pitch : u32,
+    // Of op0 to op7.
+    operand0 : i32,
+    operand1 : i32,
+    operand2 : i32,
+    operand3 : i32,
+    operand4 : i32,
+    operand5 : i32,
+    operand6 : i32,
+    operand7 : i32,
+}
+
+var<push_constant> parameters : Parameters;
+
+@group(0) @binding(0) var<storage, read> buffer_in : array<i32>;
+@group(0) @binding(1) var<storage, read_write> buffer_out : array<i32>;
+
+fn apply(op : u32, value : i32, operand : i32) -> i32 {
+    switch (op) {
+        case OP_ADD: { return value + operand; }
+        case OP_MUL: { return value * operand; }
+        case OP_MIN: { return min(value, operand); }
+        case OP_MAX: { return max(value, operand); }
+        default: { return value; }
+    }
+}
+
+// The host reads the workgroup size back from the module.
+@compute @workgroup_size(32, 1, 1)
+fn main(@builtin(global_invocation_id) threadID : vec3<u32>) {
+    let id : u32 = threadID.y * parameters.row_pitch + threadID.x;
+    if (id >= parameters.elt_count) {
+        return;
+    }
+
+    // One read and one write, whatever the length of the chain.
+    var value : i32 = buffer_in[id];
+    value = apply(op0, value, parameters.operand0);
+    value = apply(op1, value, parameters.operand1);
+    value = apply(op2, value, parameters.operand2);
+    value = apply(op3, value, parameters.operand3);
+    value = apply(op4, value, parameters.operand4);
+    value = apply(op5, value, parameters.operand5);
+    value = apply(op6, value, parameters.operand6);
+    value = apply(op7, value, parameters.operand7);
+    buffer_out[id] = value;
+}
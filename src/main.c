@@ -1,883 +1,1288 @@
 #include <assert.h>
 #include <fcntl.h>
-#include <libgen.h>
-#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
-#include <sys/types.h>
 #include <unistd.h>
-#include <vulkan/vulkan.h>
-
-#ifdef USE_DXC
-# define SHADER_NAME "sum.hlsl.spv"
-#elif USE_GLSLANG
-# define SHADER_NAME "sum.glsl.spv"
-#elif USE_WGSL
-# define SHADER_NAME "sum.wgsl.spv"
-#else
-# error "USE_DXC, USE_GLSLANG or USE_WGSL not set"
-#endif
-
-#define BUFFER_COUNT 2
-#define SHADER_ENTRY_POINT "main"
-#define REDHAT_VENDOR_ID 0x1af4
-#define VIRTIOGPU_DEVICE_ID 0x1012
-#define VIRTIO_VAR_NAME "USE_VIRTIOGPU"
-
-struct vulkan_state {
-    VkInstance              instance;
-    VkPhysicalDevice        phys_device;
-    VkDevice                device;
-    VkQueue                 queue;
-    uint32_t                queue_family_index;
-
-    VkDescriptorPool        descriptor_pool;
-    VkCommandPool           command_pool;
-
-    VkDescriptorSetLayout   descriptor_layout;
-    VkDescriptorSet         descriptor_set;
-    VkPipelineLayout        pipeline_layout;
-    VkPipeline              pipeline;
-    VkShaderModule          shader_module;
-    uint8_t                 memory_is_cached;
-};
 
-struct gpu_memory {
-    void           *buffer;
-    VkDeviceSize    vk_size;
-    VkDeviceMemory  vk_memory;
-    VkBuffer        vk_buffer;
-};
+#include "compute.h"
+
+#define ONE_SHOT_VAR_NAME "USE_ONE_SHOT_SUBMIT"
+#define STREAM_CHUNKS_VAR_NAME "SUM_STREAM_CHUNKS"
+#define PLACEMENT_VAR_NAME "SUM_MEMORY_PLACEMENT"
+#define ELT_COUNT_VAR_NAME "SUM_ELT_COUNT"
+#define WORKGROUP_SIZE_VAR_NAME "SUM_WORKGROUP_SIZE"
+#define NO_PIPELINE_CACHE_VAR_NAME "SUM_NO_PIPELINE_CACHE"
+/* Tunes the kernels the tuning cache has nothing for on this device and
+ * driver, see autotune_kernels. */
+#define AUTOTUNE_VAR_NAME "SUM_AUTOTUNE"
+#define PROFILE_VAR_NAME "SUM_PROFILE"
+#define HOST_THREADS_VAR_NAME "SUM_HOST_THREADS"
+#define NO_HOST_IMPORT_VAR_NAME "SUM_NO_HOST_IMPORT"
+#define NO_PUSH_DESCRIPTORS_VAR_NAME "SUM_NO_PUSH_DESCRIPTORS"
+/* Takes the shared memory kernels even where subgroup operations work. */
+#define NO_SUBGROUPS_VAR_NAME "SUM_NO_SUBGROUPS"
+/* Subgroup size the kernels with subgroup operations require, within the
+ * range of VK_EXT_subgroup_size_control. */
+#define SUBGROUP_SIZE_VAR_NAME "SUM_SUBGROUP_SIZE"
+/* Element types do_sum_element_types covers, a list of element_type_name.
+ * All of them by default. */
+#define ELEMENT_TYPES_VAR_NAME "SUM_ELEMENT_TYPES"
+/* "all", or a list of device indices. An index can be repeated to get
+ * several logical devices on one physical device. */
+#define DEVICES_VAR_NAME "SUM_DEVICES"
+/* Threads submitting concurrently in do_concurrent_submission. */
+#define PRODUCERS_VAR_NAME "SUM_PRODUCERS"
+/* File of ints to stream through the kernel, its output is written to
+ * SUM_FILE_OUTPUT in tiles of SUM_FILE_TILE elements. */
+#define FILE_INPUT_VAR_NAME "SUM_FILE_INPUT"
+#define FILE_OUTPUT_VAR_NAME "SUM_FILE_OUTPUT"
+#define FILE_TILE_VAR_NAME "SUM_FILE_TILE"
+
+#define DEFAULT_ELT_COUNT 1024
+#define REPEAT_DISPATCH_COUNT 1000
+#define DEFAULT_STREAM_CHUNKS 256
+#define DEFAULT_FILE_TILE (1024 * 1024)
+/* Jobs of do_sum_batch, of 1 to BATCH_MAX_JOB_ELT_COUNT elements. */
+#define BATCH_JOB_COUNT 1000
+#define BATCH_MAX_JOB_ELT_COUNT 1000
+#define MAX_DEVICES 16
+/* Independent chains of do_command_graph, and how many times it runs. */
+#define GRAPH_CHAIN_COUNT 2
+#define GRAPH_REPLAY_COUNT 100
+/* Each producer of do_concurrent_submission keeps PRODUCER_JOBS jobs in
+ * flight, PRODUCER_ROUNDS times. */
+#define DEFAULT_PRODUCERS 4
+#define MAX_PRODUCERS 64
+#define PRODUCER_JOBS 8
+#define PRODUCER_ROUNDS 32
+/* Dispatches timed on each device to weigh its share of the work. */
+#define CALIBRATION_ELT_COUNT (1024 * 1024)
+#define CALIBRATION_RUNS 3
 
+/* Application logic */
 
-static const char* vkresult_to_string(VkResult res)
+static void check_memory_upload(struct vulkan_state *state)
 {
-    switch (res)
-    {
-#define VK2STR(Value) case Value: return #Value
-        VK2STR(VK_SUCCESS);
-        VK2STR(VK_NOT_READY);
-        VK2STR(VK_TIMEOUT);
-        VK2STR(VK_EVENT_SET);
-        VK2STR(VK_EVENT_RESET);
-        VK2STR(VK_INCOMPLETE);
-        VK2STR(VK_ERROR_OUT_OF_HOST_MEMORY);
-        VK2STR(VK_ERROR_OUT_OF_DEVICE_MEMORY);
-        VK2STR(VK_ERROR_INITIALIZATION_FAILED);
-        VK2STR(VK_ERROR_DEVICE_LOST);
-        VK2STR(VK_ERROR_MEMORY_MAP_FAILED);
-        VK2STR(VK_ERROR_LAYER_NOT_PRESENT);
-        VK2STR(VK_ERROR_EXTENSION_NOT_PRESENT);
-        VK2STR(VK_ERROR_FEATURE_NOT_PRESENT);
-        VK2STR(VK_ERROR_INCOMPATIBLE_DRIVER);
-        VK2STR(VK_ERROR_TOO_MANY_OBJECTS);
-        VK2STR(VK_ERROR_FORMAT_NOT_SUPPORTED);
-        VK2STR(VK_ERROR_FRAGMENTED_POOL);
-        VK2STR(VK_ERROR_OUT_OF_POOL_MEMORY);
-        VK2STR(VK_ERROR_INVALID_EXTERNAL_HANDLE);
-        VK2STR(VK_ERROR_SURFACE_LOST_KHR);
-        VK2STR(VK_ERROR_NATIVE_WINDOW_IN_USE_KHR);
-        VK2STR(VK_SUBOPTIMAL_KHR);
-        VK2STR(VK_ERROR_OUT_OF_DATE_KHR);
-        VK2STR(VK_ERROR_INCOMPATIBLE_DISPLAY_KHR);
-        VK2STR(VK_ERROR_VALIDATION_FAILED_EXT);
-        VK2STR(VK_ERROR_INVALID_SHADER_NV);
-        VK2STR(VK_ERROR_FRAGMENTATION_EXT);
-        VK2STR(VK_ERROR_NOT_PERMITTED_EXT);
-        VK2STR(VK_RESULT_MAX_ENUM);
-#undef VK2STR
-        default:
-            return "VK_UNKNOWN_RETURN_VALUE";
-    }
-}
+    struct gpu_memory a;
+    const size_t size = (size_t)state->elt_count * sizeof(int);
+    void *local = NULL;
 
-static void check_vkresult(const char* fname, VkResult res)
-{
-    if (res == VK_SUCCESS) {
-        fprintf(stderr, "\033[32m%s\033[0m\n", fname);
-        return;
-    }
+    local = malloc(size);
+    assert(local);
+    generate_payload(local, state->elt_count, 0);
 
-    fprintf(stderr, "\033[31m%s = %s\033[0m\n", fname, vkresult_to_string(res));
-    assert(0);
-}
+    a = allocate_buffer(state, size, MEMORY_USAGE_READBACK);
 
-#define CALL_VK(Func, Param) check_vkresult(#Func, Func Param)
+    /* writting through the block mapping */
+    memcpy(a.buffer, local, size);
+    gpu_memory_flush(state, &a, 0, size);
 
-static void dump_available_layers(void)
-{
-    uint32_t layer_count;
-    CALL_VK(vkEnumerateInstanceLayerProperties, (&layer_count, NULL));
+    /* reading back */
+    gpu_memory_invalidate(state, &a, 0, size);
 
-    if (layer_count == 0) {
-        fprintf(stderr, "no layers available.\n");
-        return;
+    if (0 != memcmp(a.buffer, local, size)) {
+        fprintf(stderr, "identity check failed\n");
+        abort();
     }
 
-    VkLayerProperties *layers = malloc(sizeof(*layers) * layer_count);
-    assert(layers);
-
-
-    CALL_VK(vkEnumerateInstanceLayerProperties, (&layer_count, layers));
-
-    fprintf(stderr, "layers:\n");
-    for (uint32_t i = 0; i < layer_count; i++) {
-        fprintf(stderr, "\t%s: %s\n", layers[i].layerName, layers[i].description);
-    }
+    printf("\033[36m%s executed\033[0m\n", __func__);
 
-    free(layers);
+    free_buffer(state, &a);
+    free(local);
 }
 
-static struct vulkan_state* create_state(void)
+/* Same identity check, the device reading the host allocation directly when
+ * it can be imported. Without VK_EXT_external_memory_host (or with
+ * SUM_NO_HOST_IMPORT), through the copy fallback. */
+static void check_memory_import(struct vulkan_state *state)
 {
-    struct vulkan_state *state = malloc(sizeof(*state));
-    if (NULL == state) {
-        abort();
-    }
-    memset(state, 0, sizeof(*state));
-
-    struct VkApplicationInfo app_info = {
-        VK_STRUCTURE_TYPE_APPLICATION_INFO,
-        NULL,
-        "sample-compute",
-        1,
-        "sample-engine",
-        1,
-        VK_API_VERSION_1_2
-    };
-
-    dump_available_layers();
-
-    const char* validation_layers[] = {
-#ifdef DEBUG
-        "VK_LAYER_KHRONOS_validation",
-#endif
-    };
-
-    struct VkInstanceCreateInfo info = {
-        VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-        NULL,
-        0,
-        &app_info,
-        sizeof(validation_layers) / sizeof(*validation_layers),
-        validation_layers,
-        0,
-        NULL
-    };
-
-    CALL_VK(vkCreateInstance, (&info, NULL, &state->instance));
+    struct gpu_memory imported, readback;
+    const VkDeviceSize alignment = state->host_import_alignment;
+    const size_t size = (size_t)state->elt_count * sizeof(int);
+    const size_t padded_size = align_up(size, alignment);
+    void *local = NULL;
 
-    return state;
-}
+    local = aligned_alloc(alignment, padded_size);
+    assert(local);
+    generate_payload(local, state->elt_count, 0);
 
-static void select_physical_device(struct vulkan_state *state)
-{
-    uint32_t device_count;
-    VkPhysicalDevice *devices = NULL;
+    imported = gpu_memory_import_host(state, local, padded_size);
+    readback = allocate_buffer(state, size, MEMORY_USAGE_READBACK);
 
-    CALL_VK(vkEnumeratePhysicalDevices, (state->instance, &device_count, NULL));
-    if (device_count <= 0) {
+    gpu_memory_flush(state, &imported, 0, size);
+    gpu_memory_copy(state, &imported, &readback, size);
+    gpu_memory_invalidate(state, &readback, 0, size);
+
+    if (0 != memcmp(readback.buffer, local, size)) {
+        fprintf(stderr, "identity check failed\n");
         abort();
     }
 
-    devices = malloc(sizeof(*devices) * device_count);
-    if (devices == NULL)
-        exit(1);
-
-    CALL_VK(vkEnumeratePhysicalDevices, (state->instance, &device_count, devices));
+    printf("\033[36m%s executed (%s)\033[0m\n", __func__, imported.imported ? "imported" : "copied");
 
-    uint32_t device_index = UINT_MAX;
+    free_buffer(state, &readback);
+    free_buffer(state, &imported);
+    free(local);
+}
 
-    printf("%d available devices\n", device_count);
-    for (uint32_t i = 0; i < device_count; i++) {
-        VkPhysicalDeviceProperties props;
-        vkGetPhysicalDeviceProperties(devices[i], &props);
+/* Many short-lived buffers of various sizes: checks sub-allocations never
+ * overlap, and that freed space is reused instead of growing the arena. */
+static void check_memory_arena(struct vulkan_state *state)
+{
+#define ARENA_CHECK_COUNT 256
+    struct gpu_memory buffers[ARENA_CHECK_COUNT];
+    uint32_t blocks_before = state->arena.block_count;
+
+    for (uint32_t round = 0; round < 4; round++) {
+        for (uint32_t i = 0; i < ARENA_CHECK_COUNT; i++) {
+            if (round > 0 && (i % 2) != (round % 2))
+                continue;
+
+            VkDeviceSize size = 64 + ((i * 7919 + round * 104729) % 16384);
+            buffers[i] = allocate_buffer(state, size, MEMORY_USAGE_UPLOAD);
+            memset(buffers[i].buffer, (int)(i & 0xff), size);
+        }
 
-        printf("\t[%u] - %s (v:0x%x, d:0x%x)\n",
-            i, props.deviceName, props.vendorID, props.deviceID);
+        for (uint32_t i = 0; i < ARENA_CHECK_COUNT; i++) {
+            const uint8_t *ptr = buffers[i].buffer;
 
-        if (props.vendorID != REDHAT_VENDOR_ID) {
-            continue;
+            for (VkDeviceSize j = 0; j < buffers[i].vk_size; j++) {
+                if (ptr[j] != (i & 0xff)) {
+                    fprintf(stderr, "arena: buffer %u overwritten at %llu\n",
+                            i, (unsigned long long)j);
+                    abort();
+                }
+            }
         }
 
-        if (props.deviceID != VIRTIOGPU_DEVICE_ID) {
-            continue;
+        /* Frees half of the buffers, the next round fills the holes. */
+        for (uint32_t i = 0; i < ARENA_CHECK_COUNT; i++) {
+            if ((i % 2) == ((round + 1) % 2) || round == 3)
+                free_buffer(state, &buffers[i]);
         }
-
-        device_index = i;
+        arena_dump_stats(state);
     }
 
-    if (!getenv(VIRTIO_VAR_NAME)) {
-        fprintf(stderr, "the application will allow non-virtiogpu devices.\n");
-        device_index = 0;
+    if (state->arena.block_count > blocks_before + 1) {
+        fprintf(stderr, "arena: freed space was not reused (%u blocks)\n",
+                state->arena.block_count);
+        abort();
     }
 
-    if (device_index == UINT_MAX) {
-        fprintf(stderr, "Unable to find any virtio-gpu device. Aborting now.\n");
+    /* A dedicated block goes away with its buffer. */
+    VkDeviceSize reserved_before = state->arena.reserved_bytes;
+    struct gpu_memory large = allocate_buffer(state, 2 * ARENA_BLOCK_SIZE + 64,
+                                              MEMORY_USAGE_UPLOAD);
+    free_buffer(state, &large);
+    if (state->arena.reserved_bytes > reserved_before) {
+        fprintf(stderr, "arena: dedicated block kept (%llu bytes reserved)\n",
+                (unsigned long long)state->arena.reserved_bytes);
         abort();
     }
 
-    printf("loading device id=%u\n", device_index);
-    state->phys_device = devices[device_index];
-    free(devices);
+    printf("\033[36m%s executed\033[0m\n", __func__);
+#undef ARENA_CHECK_COUNT
 }
 
-static VkDeviceQueueCreateInfo find_queue(struct vulkan_state *state)
+static void do_sum_one_buffer_one_memory(struct vulkan_state *state)
 {
-    uint32_t count;
-    VkQueueFamilyProperties *properties;
+    struct gpu_memory a;
+    void *ptr;
 
-    vkGetPhysicalDeviceQueueFamilyProperties(state->phys_device, &count, NULL);
-    if (count <= 0) {
-        abort();
-    }
+    a = allocate_buffer(state, sum_buffer_size(state->elt_count),
+                        kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+    descriptor_set_bind(state, &a, 0);
+    descriptor_set_bind(state, &a, 1);
 
-    properties = malloc(sizeof(*properties) * count);
-    if (NULL == properties) {
-        abort();
-    }
+    ptr = kernel_input(state, &a);
+    generate_payload(ptr, state->elt_count, 0);
+    kernel_input_flush(state, &a);
 
-    vkGetPhysicalDeviceQueueFamilyProperties(state->phys_device, &count, properties);
+    execute_sum_kernel(state, state->elt_count);
 
+    ptr = kernel_output(state, &a);
+    check_payload(ptr, state->elt_count, 0);
+    printf("\033[36m%s executed (%s)\033[0m\n", __func__,
+           sum_kernel_select(state, state->elt_count)->name);
 
-    uint32_t compute_queue_index = UINT32_MAX;
+    free_buffer(state, &a);
+}
 
-    for (uint32_t i = 0; i < count; i++) {
-        if (properties[i].queueFlags | VK_QUEUE_COMPUTE_BIT) {
-            compute_queue_index = i;
-            break;
-        }
-    }
-    assert(compute_queue_index < UINT32_MAX);
+/* Both buffers bound in a single allocation, one after the other. */
+static void do_sum_two_buffer_one_memory(struct vulkan_state *state)
+{
+    VkBuffer buffer_a, buffer_b;
+    VkMemoryRequirements requirements;
+    struct arena_allocation allocation;
+    struct gpu_memory a, b;
+    const VkDeviceSize size = sum_buffer_size(state->elt_count);
+    void *ptr = NULL;
 
-    const float priorities[] = { 1.f };
+    buffer_a = create_gpu_buffer(state, size);
+    buffer_b = create_gpu_buffer(state, size);
 
-    VkDeviceQueueCreateInfo queue_info = {
-        VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        NULL,
-        0,
-        compute_queue_index,
-        1,
-        priorities
-    };
+    vkGetBufferMemoryRequirements(state->device, buffer_a, &requirements);
+    /* Keeps b aligned for the vectorized kernel. */
+    if (requirements.alignment < SUM_VECTOR_SIZE)
+        requirements.alignment = SUM_VECTOR_SIZE;
+    const VkDeviceSize offset_b = align_up(requirements.size, requirements.alignment);
+    requirements.size = offset_b + requirements.size;
+    allocation = arena_alloc(state, &requirements,
+                             kernel_memory_usage(state, MEMORY_USAGE_READBACK));
 
-    state->queue_family_index = compute_queue_index;
-    free(properties);
-    return queue_info;
-}
+    a = gpu_memory_view(&allocation, buffer_a, 0, size);
+    b = gpu_memory_view(&allocation, buffer_b, offset_b, size);
 
-static void create_logical_device(struct vulkan_state *state)
-{
-    VkDeviceQueueCreateInfo queue_info = find_queue(state);
-
-    struct VkDeviceCreateInfo info = {
-        VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        NULL,
-        0,
-        1,
-        &queue_info,
-        0,
-        NULL,
-        0,
-        NULL,
-        NULL
-    };
-
-    CALL_VK(vkCreateDevice, (state->phys_device, &info, NULL, &state->device));
-    vkGetDeviceQueue(state->device, queue_info.queueFamilyIndex, 0, &state->queue);
-}
+    CALL_VK(vkBindBufferMemory, (state->device, buffer_a, a.vk_memory, a.vk_offset));
+    CALL_VK(vkBindBufferMemory, (state->device, buffer_b, b.vk_memory, b.vk_offset));
 
-static void descriptor_set_layouts_create(struct vulkan_state *state, uint32_t count)
-{
-    VkDescriptorSetLayoutBinding *bindings = malloc(sizeof(*bindings) * count);
-    assert(bindings);
-
-    for (uint32_t i = 0; i < count; i++) {
-        bindings[i].binding = i;
-        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        bindings[i].descriptorCount = 1;
-        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-        bindings[i].pImmutableSamplers = NULL;
-    }
-
-    VkDescriptorSetLayoutCreateInfo info = {
-        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        NULL,
-        0,
-        count,
-        bindings
-    };
-
-    CALL_VK(vkCreateDescriptorSetLayout,
-            (state->device, &info, NULL, &state->descriptor_layout));
-    free(bindings);
-}
+    descriptor_set_bind(state, &a, 0);
+    descriptor_set_bind(state, &b, 1);
 
-static void descriptor_pool_create(struct vulkan_state *state, uint32_t size)
-{
-    VkDescriptorPoolSize pool_size = {
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-        size
-    };
-
-    VkDescriptorPoolCreateInfo info = {
-        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        NULL,
-        0 /* no flags */,
-        size,
-        1,
-        &pool_size
-    };
-
-    CALL_VK(vkCreateDescriptorPool,
-            (state->device, &info, NULL, &state->descriptor_pool));
-}
+    ptr = kernel_input(state, &a);
+    generate_payload(ptr, state->elt_count, 0);
+    kernel_input_flush(state, &a);
 
-static void command_pool_create(struct vulkan_state *state)
-{
-    VkCommandPoolCreateInfo pool_info = {
-        VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        NULL,
-        0,
-        state->queue_family_index
-    };
-
-    CALL_VK(vkCreateCommandPool,
-            (state->device, &pool_info, NULL, &state->command_pool));
-}
+    execute_sum_kernel(state, state->elt_count);
 
-static void descriptor_set_create(struct vulkan_state *state)
-{
-    VkDescriptorSetAllocateInfo alloc_info = {
-        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        NULL,
-        state->descriptor_pool,
-        1,
-        &state->descriptor_layout
-    };
-
-    CALL_VK(vkAllocateDescriptorSets,
-            (state->device, &alloc_info, &state->descriptor_set));
-}
+    ptr = kernel_output(state, &b);
+    check_payload(ptr, state->elt_count, 0);
+    printf("\033[36m%s executed (%s)\033[0m\n", __func__,
+           sum_kernel_select(state, state->elt_count)->name);
 
-static void descriptor_set_bind(struct vulkan_state *state,
-                                VkBuffer buffer,
-                                VkDeviceSize size,
-                                uint32_t binding)
-{
-    VkDescriptorBufferInfo buffer_info = {
-        buffer,
-        0,
-        size,
-    };
-
-    VkWriteDescriptorSet write_info = {
-        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        NULL,
-        state->descriptor_set,
-        binding,
-        0,
-        1,
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-        NULL,
-        &buffer_info,
-        NULL
-    };
-
-    vkUpdateDescriptorSets(state->device, 1, &write_info, 0, NULL);
+    free_buffer(state, &a);
+    free_buffer(state, &b);
+    arena_free(state, &allocation);
 }
 
-static void initialize_device(struct vulkan_state *state)
+static void do_sum_two_buffer_two_memory(struct vulkan_state *state)
 {
-    select_physical_device(state);
-    create_logical_device(state);
-    descriptor_pool_create(state, BUFFER_COUNT);
-    command_pool_create(state);
-    descriptor_set_layouts_create(state, BUFFER_COUNT);
-    descriptor_set_create(state);
+    struct gpu_memory a, b;
+    void *ptr_a, *ptr_b;
+
+    a = allocate_buffer(state, sum_buffer_size(state->elt_count),
+                        kernel_memory_usage(state, MEMORY_USAGE_UPLOAD));
+    descriptor_set_bind(state, &a, 0);
+
+    b = allocate_buffer(state, sum_buffer_size(state->elt_count),
+                        kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+    descriptor_set_bind(state, &b, 1);
+
+    ptr_a = kernel_input(state, &a);
+    generate_payload(ptr_a, state->elt_count, 0);
+    kernel_input_flush(state, &a);
+
+    execute_sum_kernel(state, state->elt_count);
+
+    ptr_b = kernel_output(state, &b);
+    check_payload(ptr_b, state->elt_count, 0);
+    printf("\033[36m%s executed (%s)\033[0m\n", __func__,
+           sum_kernel_select(state, state->elt_count)->name);
+
+    free_buffer(state, &a);
+    free_buffer(state, &b);
 }
 
-static VkDeviceMemory allocate_gpu_memory(struct vulkan_state *state, VkDeviceSize size)
+/* Doubles state->elt_count elements of |type| from one buffer to another,
+ * with the kernel of the type. */
+static void sum_element_type(struct vulkan_state *state, enum element_type type)
 {
-    uint32_t memory_index = UINT32_MAX;
-    VkPhysicalDeviceMemoryProperties props;
-
-    vkGetPhysicalDeviceMemoryProperties(state->phys_device, &props);
-
-    for (uint32_t i = 0; i < props.memoryTypeCount; i++) {
-        VkMemoryType type = props.memoryTypes[i];
-
-        printf("Memory[%d]:\n", i);
-        if (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT & type.propertyFlags)
-            printf("\tVK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT\n");
-        if (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT & type.propertyFlags)
-            printf("\tVK_MEMORY_PROPERTY_HOST_VISIBLE_BIT\n");
-        if (VK_MEMORY_PROPERTY_HOST_COHERENT_BIT & type.propertyFlags)
-            printf("\tVK_MEMORY_PROPERTY_HOST_COHERENT_BIT\n");
-        if (VK_MEMORY_PROPERTY_HOST_CACHED_BIT & type.propertyFlags)
-            printf("\tVK_MEMORY_PROPERTY_HOST_CACHED_BIT\n");
-        if (VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT & type.propertyFlags)
-            printf("\tVK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT\n");
-        if (VK_MEMORY_PROPERTY_PROTECTED_BIT & type.propertyFlags)
-            printf("\tVK_MEMORY_PROPERTY_PROTECTED_BIT\n");
-
-
-        if (type.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
-            if (0 == (type.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
-                state->memory_is_cached = 1;
-            }
+    const VkDeviceSize size = element_buffer_size(type, state->elt_count);
+    struct gpu_memory a, b;
 
-            memory_index = i;
-            break;
-        }
+    if (type != ELEMENT_TYPE_INT32 && state->sum_types[type] == NULL) {
+        printf("%s: skipped, not supported by the device\n", element_type_name(type));
+        return;
     }
-
-    if (memory_index == UINT32_MAX) {
-        fprintf(stderr, "Compatible memory not found (HOST_VISIBLE).\n");
-        abort();
+    if (size > state->limits.maxStorageBufferRange) {
+        printf("%s: skipped, %u elements exceed a storage buffer\n",
+               element_type_name(type), state->elt_count);
+        return;
     }
 
-    VkMemoryAllocateInfo alloc_info = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        NULL,
-        size,
-        memory_index
-    };
+    state->element_type = type;
+    staging_create(state, size);
+    a = allocate_buffer(state, size, kernel_memory_usage(state, MEMORY_USAGE_UPLOAD));
+    b = allocate_buffer(state, size, kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+    descriptor_set_bind(state, &a, 0);
+    descriptor_set_bind(state, &b, 1);
+
+    generate_typed_payload(kernel_input(state, &a), type, state->elt_count, 0);
+    kernel_input_flush(state, &a);
+
+    execute_sum_kernel(state, state->elt_count);
 
-    VkDeviceMemory vk_memory;
-    CALL_VK(vkAllocateMemory, (state->device, &alloc_info, NULL, &vk_memory));
+    check_typed_payload(kernel_output(state, &b), type, state->elt_count, 0);
+    printf("%s: %s, %llu bytes per buffer\n", element_type_name(type),
+           sum_kernel_select(state, state->elt_count)->name, (unsigned long long)size);
 
-    return vk_memory;
+    free_buffer(state, &a);
+    free_buffer(state, &b);
+    state->element_type = ELEMENT_TYPE_INT32;
 }
 
-static VkBuffer create_gpu_buffer(struct vulkan_state *state, VkDeviceSize size)
+/* Runs sum_element_type for each type of |types|, a comma-separated list
+ * of element_type_name. NULL runs all of them. */
+static void do_sum_element_types(struct vulkan_state *state, const char *types)
 {
-    VkBufferCreateInfo buffer_info = {
-        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        NULL,
-        0,
-        size,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_SHARING_MODE_EXCLUSIVE,
-        0,
-        NULL /* ignored since marked as exclusive */
-    };
-
-    VkBuffer vk_buffer;
-    CALL_VK(vkCreateBuffer, (state->device, &buffer_info, NULL, &vk_buffer));
-
-    return vk_buffer;
+    uint32_t selected = types ? 0 : ~0u;
+
+    if (types) {
+        char *list = strdup(types);
+        assert(list);
+        for (char *save = NULL, *token = strtok_r(list, ",", &save);
+             token;
+             token = strtok_r(NULL, ",", &save)) {
+            uint32_t type = 0;
+
+            while (type < ELEMENT_TYPE_COUNT && strcmp(token, element_type_name(type)))
+                type++;
+            if (type == ELEMENT_TYPE_COUNT) {
+                fprintf(stderr, "unknown element type %s.\n", token);
+                abort();
+            }
+            selected |= 1u << type;
+        }
+        free(list);
+    }
+
+    for (uint32_t type = 0; type < ELEMENT_TYPE_COUNT; type++) {
+        if (selected & 1u << type)
+            sum_element_type(state, type);
+    }
+    printf("\033[36m%s executed\033[0m\n", __func__);
 }
 
-static struct gpu_memory allocate_buffer(struct vulkan_state *state,
-                                         VkDeviceSize offset,
-                                         VkDeviceSize size)
+/* Same bindings dispatched over and over: measures the per-call overhead
+ * of the submission path (see USE_ONE_SHOT_SUBMIT), and with device
+ * placement the cost of the staging copies (see SUM_MEMORY_PLACEMENT). */
+static void do_sum_repeated_dispatch(struct vulkan_state *state)
 {
-    VkDeviceMemory vk_memory = allocate_gpu_memory(state, size);
-    VkBuffer vk_buffer = create_gpu_buffer(state, size);
+    struct gpu_memory a, b;
+    void *ptr;
 
-    CALL_VK(vkBindBufferMemory, (state->device, vk_buffer, vk_memory, offset));
+    a = allocate_buffer(state, sum_buffer_size(state->elt_count),
+                        kernel_memory_usage(state, MEMORY_USAGE_UPLOAD));
+    descriptor_set_bind(state, &a, 0);
 
-    struct gpu_memory info = {
-        NULL,
-        size,
-        vk_memory,
-        vk_buffer,
-    };
+    b = allocate_buffer(state, sum_buffer_size(state->elt_count),
+                        kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+    descriptor_set_bind(state, &b, 1);
 
-    return info;
-}
+    ptr = kernel_input(state, &a);
+    generate_payload(ptr, state->elt_count, 0);
+    kernel_input_flush(state, &a);
 
-static void free_buffer(struct vulkan_state *state, struct gpu_memory *mem)
-{
-    if (mem->buffer) {
-        vkUnmapMemory(state->device, mem->vk_memory);
-        mem->buffer = NULL;
+    uint64_t start = get_time_ns();
+    for (uint32_t i = 0; i < REPEAT_DISPATCH_COUNT; i++) {
+        execute_sum_kernel(state, state->elt_count);
     }
+    uint64_t elapsed = get_time_ns() - start;
+
+    ptr = kernel_output(state, &b);
+    check_payload(ptr, state->elt_count, 0);
+
+    printf("%u dispatches of %s (%s, %s memory): %.2f us/dispatch\n",
+           REPEAT_DISPATCH_COUNT,
+           sum_kernel_select(state, state->elt_count)->name,
+           state->one_shot_submit ? "one-shot" : "command ring",
+           placement_name(state->placement),
+           (double)elapsed / REPEAT_DISPATCH_COUNT / 1000.);
+    printf("\033[36m%s executed\033[0m\n", __func__);
 
-    vkFreeMemory(state->device, mem->vk_memory, NULL);
-    vkDestroyBuffer(state->device, mem->vk_buffer, NULL);
+    free_buffer(state, &a);
+    free_buffer(state, &b);
 }
 
-static uint32_t* load_shader(const char *path, size_t *file_length)
+/* Processes a long sequence of elt_count-sized chunks while keeping
+ * IN_FLIGHT_COUNT jobs in flight: chunk k+1 is generated while chunk k
+ * runs on the GPU and chunk k-1 is being checked. */
+static void do_sum_streaming(struct vulkan_state *state, uint32_t chunk_count)
 {
-    assert(file_length);
-    uint32_t *content = NULL;
+    struct gpu_memory in[IN_FLIGHT_COUNT], out[IN_FLIGHT_COUNT];
+    struct kernel_bindings sets[IN_FLIGHT_COUNT];
+    uint64_t jobs[IN_FLIGHT_COUNT] = { 0 };
+    const uint32_t elt_count = state->elt_count;
+    const VkDeviceSize size = sum_buffer_size(elt_count);
+
+    for (uint32_t i = 0; i < IN_FLIGHT_COUNT; i++) {
+        /* Written and read in place, whatever the placement. */
+        in[i] = allocate_buffer(state, size, MEMORY_USAGE_UPLOAD);
+        out[i] = allocate_buffer(state, size, MEMORY_USAGE_READBACK);
+
+        memset(&sets[i], 0, sizeof(sets[i]));
+        kernel_bindings_write(&sets[i], in[i].vk_buffer, size, 0);
+        kernel_bindings_write(&sets[i], out[i].vk_buffer, size, 1);
+    }
 
-    int fd = open(path, O_RDONLY);
-    if (fd < 0)
-        return NULL;
+    /* Chunks use distinct values so a stale result cannot pass the check. */
+#define CHUNK_FIRST(Chunk) (((Chunk) % 1024) * elt_count)
 
-    do {
-        size_t size = lseek(fd, 0, SEEK_END);
-        lseek(fd, 0, SEEK_SET);
-        if (size == (size_t)-1) {
-            break;
-        }
+    uint64_t start = get_time_ns();
+    for (uint32_t k = 0; k < chunk_count + 1; k++) {
+        if (k < chunk_count) {
+            uint32_t slot = k % IN_FLIGHT_COUNT;
 
-        content = malloc(size);
-        if (content == NULL) {
-            break;
+            /* The slot last held chunk k - IN_FLIGHT_COUNT, which has
+             * already been checked. */
+            generate_payload(in[slot].buffer, elt_count, CHUNK_FIRST(k));
+            gpu_memory_flush(state, &in[slot], 0, size);
+            jobs[slot] = submit_sum_kernel(state, state->sum, &sets[slot], elt_count, NULL);
         }
 
-        if (read(fd, content, size) < 0) {
-            free(content);
-            content = NULL;
-            break;
+        if (k > 0) {
+            uint32_t slot = (k - 1) % IN_FLIGHT_COUNT;
+
+            wait_sum_kernel(state, jobs[slot]);
+            gpu_memory_invalidate(state, &out[slot], 0, size);
+            check_payload(out[slot].buffer, elt_count, CHUNK_FIRST(k - 1));
         }
+    }
+    uint64_t elapsed = get_time_ns() - start;
 
-        *file_length = size;
-    } while (0);
+#undef CHUNK_FIRST
 
-    close(fd);
-    return content;
-}
+    printf("streamed %u chunks of %u elements: %.2f Melements/s\n",
+           chunk_count, elt_count,
+           (double)chunk_count * elt_count / ((double)elapsed / 1e9) / 1e6);
+    printf("\033[36m%s executed\033[0m\n", __func__);
 
-static void create_pipeline(struct vulkan_state *state,
-                            const uint32_t *shader,
-                            uint32_t shader_len)
-{
-    VkShaderModuleCreateInfo shader_info = {
-        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        NULL,
-        0,
-        shader_len,
-        shader
-    };
-
-    CALL_VK(vkCreateShaderModule,
-            (state->device, &shader_info, NULL, &state->shader_module));
-
-    VkPipelineShaderStageCreateInfo shader_stage_creation_info = {
-        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        NULL,
-        0,
-        VK_SHADER_STAGE_COMPUTE_BIT,
-        state->shader_module,
-        SHADER_ENTRY_POINT,
-        NULL
-    };
-
-    VkPipelineLayoutCreateInfo layout_info = {
-        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        NULL,
-        0,
-        1,
-        &state->descriptor_layout,
-        0,
-        NULL
-    };
-
-    CALL_VK(vkCreatePipelineLayout,
-            (state->device, &layout_info, NULL, &state->pipeline_layout));
-
-    VkComputePipelineCreateInfo pipeline_info = {
-        VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-        NULL,
-        0,
-        shader_stage_creation_info,
-        state->pipeline_layout,
-        VK_NULL_HANDLE,
-        0
-    };
-
-    CALL_VK(vkCreateComputePipelines,
-            (state->device, VK_NULL_HANDLE, 1, &pipeline_info, NULL, &state->pipeline));
+    for (uint32_t i = 0; i < IN_FLIGHT_COUNT; i++) {
+        assert(poll_sum_kernel(state, jobs[i]));
+        free_buffer(state, &in[i]);
+        free_buffer(state, &out[i]);
+    }
 }
 
-static void execute_sum_kernel(struct vulkan_state *state)
+/* Maps the file at |path|, rounded up to |alignment| so the mapping can be
+ * imported. The output is created or truncated to |*size|, the input size
+ * is returned in |*size|. The input is a private writable mapping: the
+ * buffers it is imported in allow transfer writes, which never reach the
+ * file. */
+static void* file_map(const char *path, uint8_t output, size_t *size, size_t alignment)
 {
-    VkCommandBuffer command_buffer;
-
-    VkCommandBufferAllocateInfo alloc_info = {
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        NULL,
-        state->command_pool,
-        VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        1
-    };
-
-    CALL_VK(vkAllocateCommandBuffers, (state->device, &alloc_info, &command_buffer));
-
-    VkCommandBufferBeginInfo begin_info = {
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        NULL,
-        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-        NULL
-    };
-
-    CALL_VK(vkBeginCommandBuffer, (command_buffer, &begin_info));
-
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, state->pipeline);
-    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-                            state->pipeline_layout,
-                            0,
-                            1,
-                            &state->descriptor_set,
-                            0,
-                            NULL);
-
-    vkCmdDispatch(command_buffer, ELT_COUNT / WORKGROUP_SIZE, 1, 1);
-
-    CALL_VK(vkEndCommandBuffer, (command_buffer));
-
-    VkSubmitInfo submit_info = {
-        VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        NULL,
-        0,
-        NULL,
-        NULL,
-        1,
-        &command_buffer,
-        0,
-        NULL
-    };
-
-    VkFence fence;
-    VkFenceCreateInfo fence_info = {
-        VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        NULL,
-        0
-    };
-
-    CALL_VK(vkCreateFence, (state->device, &fence_info, NULL, &fence));
-
-    CALL_VK(vkQueueSubmit, (state->queue, 1, &submit_info, fence));
-    CALL_VK(vkWaitForFences, (state->device, 1, &fence, VK_TRUE, 1e9 * 5));
-
-    vkDestroyFence(state->device, fence, NULL);
-}
+    struct stat st;
+    int fd = open(path, output ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
 
-static void destroy_state(struct vulkan_state **state)
-{
-    assert(state && *state);
-    struct vulkan_state *st = *state;
-
-#define FREE_VK(Field, Function)                \
-    if (st->Field != VK_NULL_HANDLE)            \
-        Function(st->device, st->Field, NULL)
-
-    FREE_VK(shader_module, vkDestroyShaderModule);
-    FREE_VK(descriptor_pool, vkDestroyDescriptorPool);
-    FREE_VK(descriptor_layout, vkDestroyDescriptorSetLayout);
-    FREE_VK(pipeline_layout, vkDestroyPipelineLayout);
-    FREE_VK(pipeline, vkDestroyPipeline);
-    FREE_VK(command_pool, vkDestroyCommandPool);
-
-    if (st->device != VK_NULL_HANDLE)
-        vkDestroyDevice(st->device, NULL);
-    if (st->instance != VK_NULL_HANDLE)
-        vkDestroyInstance(st->instance, NULL);
-
-    free(st);
-    *state = NULL;
-}
+    if (fd < 0) {
+        perror(path);
+        abort();
+    }
 
+    if (output) {
+        if (0 != ftruncate(fd, *size)) {
+            perror(path);
+            abort();
+        }
+    } else {
+        if (0 != fstat(fd, &st)) {
+            perror(path);
+            abort();
+        }
+        *size = st.st_size;
+    }
 
-/* Application logic */
+    if (*size < sizeof(int)) {
+        fprintf(stderr, "%s: no element to process.\n", path);
+        abort();
+    }
 
-static void generate_payload(int *buffer, int elt_count)
-{
-    for (int i = 0; i < elt_count; i++) {
-        buffer[i] = i;
+    void *data = mmap(NULL, align_up(*size, alignment),
+                      PROT_READ | PROT_WRITE,
+                      output ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        abort();
     }
+
+    madvise(data, *size, MADV_SEQUENTIAL);
+    return data;
 }
 
-static void check_payload(int *buffer, int elt_count)
+/* Streams a file larger than device memory through the kernel: tiles of
+ * |tile| elements go through IN_FLIGHT_COUNT slots of device buffers, each
+ * slot bound at its offset. While a tile is computed, the next one is
+ * uploaded and the previous one read back. The part of each mapping a tile
+ * covers is imported while the tile is in flight, when possible: the copies
+ * then go straight from the input file to the output file. Otherwise the
+ * host copies through staging slots. */
+static void do_sum_file_streaming(struct vulkan_state *state,
+                                  const char *input_path,
+                                  const char *output_path,
+                                  uint32_t tile)
 {
-    for (int i = 0; i < elt_count; i++) {
-        if (buffer[i] != i + i) {
-            fprintf(stderr, "invalid value for [%d]. got %d, expected %d\n",
-                    i, buffer[i], i + i);
-            abort();
-        }
+    const VkDeviceSize alignment = state->host_import_alignment;
+    struct gpu_memory device_in, device_out, upload, download;
+    struct gpu_memory imports_in[IN_FLIGHT_COUNT], imports_out[IN_FLIGHT_COUNT];
+    uint8_t imported_in[IN_FLIGHT_COUNT] = { 0 }, imported_out[IN_FLIGHT_COUNT] = { 0 };
+    struct kernel_bindings sets[IN_FLIGHT_COUNT];
+    uint64_t jobs[IN_FLIGHT_COUNT] = { 0 };
+    uint64_t imported_tiles_in = 0, imported_tiles_out = 0;
+    size_t input_size, output_size;
+
+    int *input = file_map(input_path, 0, &input_size, alignment);
+    const uint64_t elt_count = input_size / sizeof(int);
+    output_size = elt_count * sizeof(int);
+    int *output = file_map(output_path, 1, &output_size, alignment);
+
+    /* Whole vectors, in a storage buffer range. Tiles start on import
+     * boundaries when the mappings can be imported. */
+    const VkDeviceSize tile_alignment = state->host_import && alignment > SUM_VECTOR_SIZE
+                                      ? alignment : SUM_VECTOR_SIZE;
+    const uint32_t tile_elts = tile_alignment / sizeof(int);
+    const uint32_t max_tile = state->limits.maxStorageBufferRange / tile_alignment * tile_elts;
+    assert(max_tile > 0);
+    tile = tile < max_tile ? tile : max_tile;
+    tile = tile < elt_count ? tile : (uint32_t)elt_count;
+    tile = align_up(tile ? tile : 1, tile_elts);
+
+    const VkDeviceSize stride = align_up(sum_buffer_size(tile),
+                                         state->limits.minStorageBufferOffsetAlignment);
+    const uint64_t tile_count = (elt_count + tile - 1) / tile;
+    const struct kernel *kernel = state->sum_vec4 ? state->sum_vec4 : state->sum;
+
+    device_in = allocate_buffer(state, stride * IN_FLIGHT_COUNT, MEMORY_USAGE_DEVICE);
+    device_out = allocate_buffer(state, stride * IN_FLIGHT_COUNT, MEMORY_USAGE_DEVICE);
+    upload = allocate_buffer(state, stride * IN_FLIGHT_COUNT, MEMORY_USAGE_UPLOAD);
+    download = allocate_buffer(state, stride * IN_FLIGHT_COUNT, MEMORY_USAGE_READBACK);
+
+    for (uint32_t i = 0; i < IN_FLIGHT_COUNT; i++) {
+        memset(&sets[i], 0, sizeof(sets[i]));
+        kernel_bindings_write_range(state, &sets[i], device_in.vk_buffer, i * stride, stride, 0);
+        kernel_bindings_write_range(state, &sets[i], device_out.vk_buffer, i * stride, stride, 1);
     }
-}
 
-static void check_memory_upload(struct vulkan_state *state)
-{
-    struct gpu_memory a;
-    void *ptr = NULL;
-    VkMappedMemoryRange range;
-    const size_t size = ELT_COUNT * sizeof(int);
-    void *local = NULL;
+    /* Once the driver refuses a part of a file, it is copied from then on. */
+    uint8_t import_in = state->host_import, import_out = state->host_import;
+
+#define TILE_COUNT(Tile) ((Tile) + 1 < tile_count ? tile : (uint32_t)(elt_count - (Tile) * tile))
+
+    uint64_t start = get_time_ns();
+    for (uint64_t k = 0; k < tile_count + IN_FLIGHT_COUNT; k++) {
+        /* Tile k - IN_FLIGHT_COUNT is done, its slot takes tile k. */
+        if (k >= IN_FLIGHT_COUNT) {
+            const uint64_t done = k - IN_FLIGHT_COUNT;
+            const uint32_t slot = done % IN_FLIGHT_COUNT;
+            const size_t bytes = sizeof(int) * (size_t)TILE_COUNT(done);
+
+            wait_sum_kernel(state, jobs[slot]);
+            if (imported_out[slot]) {
+                gpu_memory_invalidate(state, &imports_out[slot], 0, bytes);
+                free_buffer(state, &imports_out[slot]);
+            } else {
+                gpu_memory_invalidate(state, &download, slot * stride, bytes);
+                memcpy(output + done * tile, (char*)download.buffer + slot * stride, bytes);
+            }
+            if (imported_in[slot])
+                free_buffer(state, &imports_in[slot]);
+            imported_in[slot] = imported_out[slot] = 0;
+        }
 
-    local = malloc(size);
-    generate_payload(local, ELT_COUNT);
+        if (k < tile_count) {
+            const uint32_t slot = k % IN_FLIGHT_COUNT;
+            const uint32_t count = TILE_COUNT(k);
+            const VkDeviceSize import_size = align_up(sizeof(int) * count, alignment);
 
-    a = allocate_buffer(state, 0, size);
-    memset(&range, 0, sizeof(range));
-    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    range.memory = a.vk_memory;
-    range.size = a.vk_size;
+            if (import_in) {
+                imported_in[slot] = host_memory_import(state, input + k * tile, import_size,
+                                                       &imports_in[slot]);
+                import_in = imported_in[slot];
+            }
+            if (import_out) {
+                imported_out[slot] = host_memory_import(state, output + k * tile, import_size,
+                                                        &imports_out[slot]);
+                import_out = imported_out[slot];
+            }
+            imported_tiles_in += imported_in[slot];
+            imported_tiles_out += imported_out[slot];
+
+            if (!imported_in[slot]) {
+                memcpy((char*)upload.buffer + slot * stride, input + k * tile, sizeof(int) * count);
+                gpu_memory_flush(state, &upload, slot * stride, sizeof(int) * count);
+            }
 
-    /* writting and unmapping */
-    CALL_VK(vkMapMemory, (state->device, a.vk_memory, 0, a.vk_size, 0, &ptr));
+            struct sum_transfer transfer = {
+                device_in.vk_buffer,
+                device_out.vk_buffer,
+                sizeof(int) * count,
+                imported_in[slot] ? imports_in[slot].vk_buffer : upload.vk_buffer,
+                imported_out[slot] ? imports_out[slot].vk_buffer : download.vk_buffer,
+                slot * stride,
+                slot * stride,
+                imported_in[slot] ? 0 : slot * stride,
+                imported_out[slot] ? 0 : slot * stride,
+            };
+            jobs[slot] = submit_sum_kernel(state, kernel, &sets[slot], count, &transfer);
+        }
+    }
+    uint64_t elapsed = get_time_ns() - start;
 
-    memcpy(ptr, local, size);
+#undef TILE_COUNT
 
-    if (state->memory_is_cached) {
-        CALL_VK(vkFlushMappedMemoryRanges, (state->device, 1, &range));
+    for (uint64_t i = 0; i < elt_count; i++) {
+        if ((uint32_t)output[i] != (uint32_t)input[i] * 2u) {
+            fprintf(stderr, "invalid value for [%llu]. got %d, expected %d\n",
+                    (unsigned long long)i, output[i], (int)((uint32_t)input[i] * 2u));
+            abort();
+        }
     }
 
-    vkUnmapMemory(state->device, a.vk_memory);
+    printf("streamed %llu elements in %llu tiles of %u (imported: %llu input, %llu output): "
+           "%.2f GB/s\n",
+           (unsigned long long)elt_count, (unsigned long long)tile_count, tile,
+           (unsigned long long)imported_tiles_in, (unsigned long long)imported_tiles_out,
+           (double)input_size / elapsed);
+    printf("\033[36m%s executed\033[0m\n", __func__);
 
+    free_buffer(state, &device_in);
+    free_buffer(state, &device_out);
+    free_buffer(state, &upload);
+    free_buffer(state, &download);
+    munmap(input, align_up(input_size, alignment));
+    munmap(output, align_up(output_size, alignment));
+}
+
+/* Many small jobs of various lengths in one batch, each checked on its own.
+ * Jobs use distinct values so results landing in the wrong job fail. */
+static void do_sum_batch(struct vulkan_state *state)
+{
+    struct sum_batch batch;
+    int *data = malloc(sizeof(int) * BATCH_MAX_JOB_ELT_COUNT);
+    uint32_t first = 0;
+
+    assert(data);
+    sum_batch_create(state, &batch, BATCH_JOB_COUNT, BATCH_JOB_COUNT * BATCH_MAX_JOB_ELT_COUNT);
+
+    for (uint32_t i = 0; i < BATCH_JOB_COUNT; i++) {
+        uint32_t count = (i * 7919u) % BATCH_MAX_JOB_ELT_COUNT + 1;
 
-    /* remapping and reading back */
-    CALL_VK(vkMapMemory, (state->device, a.vk_memory, 0, a.vk_size, 0, &ptr));
-    if (state->memory_is_cached) {
-        CALL_VK(vkInvalidateMappedMemoryRanges, (state->device, 1, &range));
+        generate_payload(data, count, first);
+        uint32_t index = sum_batch_add(&batch, data, count);
+        assert(index == i);
+        first += count;
     }
 
-    if (0 != memcmp(ptr, local, size)) {
-        fprintf(stderr, "identity check failed\n");
-        abort();
+    wait_sum_kernel(state, submit_sum_batch(state, &batch));
+
+    first = 0;
+    for (uint32_t i = 0; i < batch.job_count; i++) {
+        uint32_t count;
+        int *result = sum_batch_result(state, &batch, i, &count);
+
+        check_payload(result, count, first);
+        first += count;
     }
 
-    vkUnmapMemory(state->device, a.vk_memory);
+    printf("%u jobs, %u elements in one dispatch\n", batch.job_count, batch.elt_count);
     printf("\033[36m%s executed\033[0m\n", __func__);
 
-    free_buffer(state, &a);
+    sum_batch_destroy(state, &batch);
+    free(data);
 }
 
-static void do_sum_one_buffer_one_memory(struct vulkan_state *state)
+/* Host time spent preparing and checking the payload around a dispatch,
+ * from one thread to the configured count. */
+static void do_host_payload_scaling(struct vulkan_state *state)
 {
+    const uint32_t max_threads = host_threads_count();
+    const double bytes = sizeof(int) * (double)state->elt_count;
     struct gpu_memory a;
     void *ptr;
 
-    a = allocate_buffer(state, 0, sizeof(int) * ELT_COUNT);
-    descriptor_set_bind(state, a.vk_buffer, a.vk_size, 0);
-    descriptor_set_bind(state, a.vk_buffer, a.vk_size, 1);
+    a = allocate_buffer(state, sum_buffer_size(state->elt_count),
+                        kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+    descriptor_set_bind(state, &a, 0);
+    descriptor_set_bind(state, &a, 1);
 
-    VkMappedMemoryRange range = {
-        VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
-        NULL,
-        a.vk_memory,
-        0,
-        a.vk_size
-    };
+    for (uint32_t threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        host_threads_set(threads);
 
-    CALL_VK(vkMapMemory, (state->device, a.vk_memory, 0, a.vk_size, 0, &ptr));
+        ptr = kernel_input(state, &a);
+        uint64_t start = get_time_ns();
+        generate_payload(ptr, state->elt_count, 0);
+        uint64_t generate_ns = get_time_ns() - start;
+        kernel_input_flush(state, &a);
 
-    generate_payload(ptr, ELT_COUNT);
+        execute_sum_kernel(state, state->elt_count);
 
-    if (state->memory_is_cached) {
-        CALL_VK(vkFlushMappedMemoryRanges, (state->device, 1, &range));
-    }
+        ptr = kernel_output(state, &a);
+        start = get_time_ns();
+        check_payload(ptr, state->elt_count, 0);
+        uint64_t check_ns = get_time_ns() - start;
 
-    execute_sum_kernel(state);
+        printf("host payload, %2u threads (%s): generate %8.3f ms (%6.2f GB/s), "
+               "check %8.3f ms (%6.2f GB/s)\n",
+               threads, payload_simd_name(),
+               generate_ns / 1e6, bytes / generate_ns,
+               check_ns / 1e6, bytes / check_ns);
 
-    if (state->memory_is_cached) {
-        CALL_VK(vkInvalidateMappedMemoryRanges, (state->device, 1, &range));
+        if (threads == max_threads)
+            break;
     }
 
-    check_payload(ptr, ELT_COUNT);
+    free_buffer(state, &a);
     printf("\033[36m%s executed\033[0m\n", __func__);
+}
 
-    vkUnmapMemory(state->device, a.vk_memory);
-    free_buffer(state, &a);
+/* A device of the multi-device mode, and its part of the range. */
+struct device_share {
+    struct vulkan_state    *state;
+    /* Elements per second, measured by device_calibrate. */
+    double                  throughput;
+    uint32_t                first;
+    uint32_t                elt_count;
+    struct gpu_memory       input;
+    struct gpu_memory       output;
+    uint64_t                job;
+};
+
+/* A state on device |index|, configured as |config|, with its kernels. */
+static struct vulkan_state* device_state_create(const struct vulkan_state *config,
+                                                uint32_t index,
+                                                const char *argv0)
+{
+    struct vulkan_state *state = create_state();
+    if (state == NULL)
+        abort();
+
+    state->device_index = index;
+    state->placement = config->placement;
+    state->one_shot_submit = config->one_shot_submit;
+    state->no_push_descriptors = config->no_push_descriptors;
+    state->no_subgroups = config->no_subgroups;
+    state->subgroup_size_request = config->subgroup_size_request;
+    state->elt_count = config->elt_count;
+    state->workgroup_size = config->workgroup_size;
+    initialize_device(state);
+    if (!validate_problem_size(state))
+        abort();
+
+    /* Logical devices may share a physical one: keep them off the cache file. */
+    pipeline_cache_create(state, NULL);
+    if (!load_kernels(state, argv0))
+        abort();
+    kernel_registry_build_async(state);
+
+    state->sum = kernel_find(state, "sum");
+    state->sum_vec4 = kernel_find(state, "sum_vec4");
+    assert(state->sum && state->sum_vec4);
+    return state;
 }
 
-static void do_sum_two_buffer_one_memory(struct vulkan_state *state)
+static void device_share_bind(struct device_share *share, uint32_t elt_count)
 {
-    VkBuffer buffer_a, buffer_b;
-    VkDeviceMemory vk_memory;
-    VkMappedMemoryRange write_range, read_range;
-    const VkDeviceSize size = ELT_COUNT * sizeof(int);
-    void *ptr = NULL;
+    struct vulkan_state *state = share->state;
+
+    staging_create(state, sum_buffer_size(elt_count));
+    share->input = allocate_buffer(state, sum_buffer_size(elt_count),
+                                   kernel_memory_usage(state, MEMORY_USAGE_UPLOAD));
+    share->output = allocate_buffer(state, sum_buffer_size(elt_count),
+                                    kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+    descriptor_set_bind(state, &share->input, 0);
+    descriptor_set_bind(state, &share->output, 1);
+}
 
-    vk_memory = allocate_gpu_memory(state, size * 2);
-    buffer_a = create_gpu_buffer(state, size);
-    buffer_b = create_gpu_buffer(state, size);
+static void device_share_unbind(struct device_share *share)
+{
+    free_buffer(share->state, &share->input);
+    free_buffer(share->state, &share->output);
+}
 
-    CALL_VK(vkBindBufferMemory, (state->device, buffer_a, vk_memory, 0));
-    CALL_VK(vkBindBufferMemory, (state->device, buffer_b, vk_memory, size));
+/* Best of CALIBRATION_RUNS dispatches over |elt_count| elements, after a
+ * warmup one. */
+static void device_calibrate(struct device_share *share, uint32_t elt_count)
+{
+    struct vulkan_state *state = share->state;
+    uint64_t best = UINT64_MAX;
+
+    device_share_bind(share, elt_count);
+    generate_payload(kernel_input(state, &share->input), elt_count, 0);
+    kernel_input_flush(state, &share->input);
+
+    execute_sum_kernel(state, elt_count);
+    for (uint32_t i = 0; i < CALIBRATION_RUNS; i++) {
+        uint64_t start = get_time_ns();
+        execute_sum_kernel(state, elt_count);
+        uint64_t elapsed = get_time_ns() - start;
+        best = elapsed < best ? elapsed : best;
+    }
 
-    descriptor_set_bind(state, buffer_a, size, 0);
-    descriptor_set_bind(state, buffer_b, size, 1);
+    device_share_unbind(share);
+    share->throughput = elt_count / (best / 1e9);
+}
 
-    write_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    write_range.pNext = 0;
-    write_range.memory = vk_memory;
-    write_range.offset = 0;
-    write_range.size = size;
+/* Splits the element range over several devices, in proportion to their
+ * measured throughput, runs the parts concurrently and checks the merged
+ * output. Each device gets its own instance and logical device: device
+ * groups would only cover identical GPUs. */
+static void do_sum_multi_device(const struct vulkan_state *config,
+                                const char *devices,
+                                const char *argv0)
+{
+    struct device_share shares[MAX_DEVICES];
+    uint32_t share_count = 0;
+    const uint32_t elt_count = config->elt_count;
+
+    memset(shares, 0, sizeof(shares));
+    if (0 == strcmp(devices, "all")) {
+        share_count = physical_device_count(config);
+        share_count = share_count < MAX_DEVICES ? share_count : MAX_DEVICES;
+        for (uint32_t i = 0; i < share_count; i++)
+            shares[i].state = device_state_create(config, i, argv0);
+    } else {
+        char *list = strdup(devices);
+        assert(list);
+        for (char *save = NULL, *token = strtok_r(list, ",", &save);
+             token && share_count < MAX_DEVICES;
+             token = strtok_r(NULL, ",", &save)) {
+            shares[share_count++].state = device_state_create(config, strtoul(token, NULL, 0),
+                                                              argv0);
+        }
+        free(list);
+    }
+    if (share_count == 0)
+        return;
 
-    read_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    read_range.pNext = 0;
-    read_range.memory = vk_memory;
-    read_range.offset = size;
-    read_range.size = size;
+    /* Split on vector boundaries, the vectorized kernel stays usable. The
+     * rounding goes to the last device. */
+    const uint32_t calibration = elt_count < CALIBRATION_ELT_COUNT ? elt_count
+                                                                   : CALIBRATION_ELT_COUNT;
+    const uint32_t granularity = SUM_VECTOR_SIZE / sizeof(int);
+    double total_throughput = 0.;
+    uint32_t first = 0;
+
+    for (uint32_t i = 0; i < share_count; i++) {
+        device_calibrate(&shares[i], calibration);
+        total_throughput += shares[i].throughput;
+    }
+    for (uint32_t i = 0; i < share_count; i++) {
+        struct device_share *share = &shares[i];
+        uint32_t count = (uint32_t)(elt_count * (share->throughput / total_throughput));
+
+        count = count / granularity * granularity;
+        if (i + 1 == share_count || count > elt_count - first)
+            count = elt_count - first;
+        share->first = first;
+        share->elt_count = count;
+        first += count;
+    }
 
-    CALL_VK(vkMapMemory, (state->device, vk_memory, 0, size, 0, &ptr));
-    generate_payload(ptr, ELT_COUNT);
-    if (state->memory_is_cached) {
-        CALL_VK(vkFlushMappedMemoryRanges, (state->device, 1, &write_range));
+    for (uint32_t i = 0; i < share_count; i++) {
+        struct device_share *share = &shares[i];
+
+        if (share->elt_count == 0)
+            continue;
+        device_share_bind(share, share->elt_count);
+        generate_payload(kernel_input(share->state, &share->input), share->elt_count, share->first);
+        kernel_input_flush(share->state, &share->input);
     }
-    vkUnmapMemory(state->device, vk_memory);
 
-    execute_sum_kernel(state);
+    uint64_t start = get_time_ns();
+    for (uint32_t i = 0; i < share_count; i++) {
+        struct device_share *share = &shares[i];
+        struct sum_transfer transfer;
 
-    CALL_VK(vkMapMemory, (state->device, vk_memory, size, size, 0, &ptr));
-    if (state->memory_is_cached) {
-        CALL_VK(vkInvalidateMappedMemoryRanges, (state->device, 1, &read_range));
+        if (share->elt_count == 0)
+            continue;
+        share->job = submit_sum_kernel(share->state,
+                                       sum_kernel_select(share->state, share->elt_count),
+                                       &share->state->bindings,
+                                       share->elt_count,
+                                       bound_transfer(share->state, &transfer));
+    }
+    for (uint32_t i = 0; i < share_count; i++) {
+        if (shares[i].elt_count)
+            wait_sum_kernel(shares[i].state, shares[i].job);
     }
-    check_payload(ptr, ELT_COUNT);
-    vkUnmapMemory(state->device, vk_memory);
+    uint64_t elapsed = get_time_ns() - start;
+
+    int *merged = malloc(sizeof(int) * (size_t)elt_count);
+    assert(merged);
+    double fastest = 0.;
+    for (uint32_t i = 0; i < share_count; i++) {
+        struct device_share *share = &shares[i];
+
+        printf("device %u (physical %u): %u elements from %u, calibrated at %.2f Melements/s\n",
+               i, share->state->device_index, share->elt_count, share->first,
+               share->throughput / 1e6);
+        fastest = share->throughput > fastest ? share->throughput : fastest;
+
+        if (share->elt_count) {
+            memcpy(merged + share->first, kernel_output(share->state, &share->output),
+                   sizeof(int) * (size_t)share->elt_count);
+            device_share_unbind(share);
+        }
+        destroy_state(&share->state);
+    }
+    check_payload(merged, elt_count, 0);
+    free(merged);
+
+    printf("%u elements over %u devices in %.3f ms, %.2fx the fastest device alone\n",
+           elt_count, share_count, elapsed / 1e6, (elt_count / fastest) / (elapsed / 1e9));
     printf("\033[36m%s executed\033[0m\n", __func__);
+}
+
+/* Every reduction of the reduce kernel, against the host. */
+static void do_reduce(struct vulkan_state *state)
+{
+    uint32_t elt_count = state->elt_count;
+    VkDeviceSize size = sizeof(uint32_t) * (VkDeviceSize)elt_count;
+    struct gpu_memory input = allocate_buffer(state, size,
+                                              kernel_memory_usage(state, MEMORY_USAGE_UPLOAD));
+    union reduce_value *values = malloc(sizeof(*values) * elt_count);
+    assert(values);
+
+    for (uint32_t type = REDUCE_TYPE_INT; type <= REDUCE_TYPE_FLOAT; type++) {
+        generate_reduce_payload(values, elt_count, type);
+        gpu_memory_upload(state, &input, values, size);
+
+        for (uint32_t op = REDUCE_OP_SUM; op <= REDUCE_OP_MAX; op++) {
+            union reduce_value value = execute_reduce(state, &input, elt_count, op, type);
+            union reduce_value expected = reduce_on_host(values, elt_count, op, type);
+
+            if (!reduce_value_matches(value, expected, values, elt_count, op, type)) {
+                fprintf(stderr, "invalid %s %s reduction. got 0x%08x, expected 0x%08x\n",
+                        reduce_type_name(type), reduce_op_name(op),
+                        value.bits, expected.bits);
+                abort();
+            }
+        }
+    }
 
-    vkDestroyBuffer(state->device, buffer_a, NULL);
-    vkDestroyBuffer(state->device, buffer_b, NULL);
-    vkFreeMemory(state->device, vk_memory, NULL);
+    free(values);
+    free_buffer(state, &input);
+    printf("\033[36m%s executed\033[0m\n", __func__);
 }
 
-static void do_sum_two_buffer_two_memory(struct vulkan_state *state)
+/* Inclusive scan with the scan kernel, against the host. */
+static void do_scan(struct vulkan_state *state)
 {
-    struct gpu_memory a, b;
-    void *ptr_a, *ptr_b;
+    const uint32_t elt_count = state->elt_count;
+    const VkDeviceSize size = sizeof(int32_t) * (VkDeviceSize)elt_count;
+    struct gpu_memory input = allocate_buffer(state, size,
+                                              kernel_memory_usage(state, MEMORY_USAGE_UPLOAD));
+    struct gpu_memory output = allocate_buffer(state, size,
+                                               kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+    struct gpu_memory readback = output;
+    int32_t *values = malloc(size);
+    assert(values);
+
+    for (uint32_t i = 0; i < elt_count; i++)
+        values[i] = (int32_t)(i % 1000) - 499;
+    gpu_memory_upload(state, &input, values, size);
+    if (output.buffer == NULL)
+        readback = allocate_buffer(state, size, MEMORY_USAGE_READBACK);
+
+    uint64_t start = get_time_ns();
+    execute_scan(state, &input, &output, elt_count);
+    uint64_t ns = get_time_ns() - start;
+
+    if (readback.vk_buffer != output.vk_buffer)
+        gpu_memory_copy(state, &output, &readback, size);
+    gpu_memory_invalidate(state, &readback, 0, size);
+
+    /* Sums wrap around, as on the device. */
+    const int32_t *result = readback.buffer;
+    uint32_t expected = 0;
+    for (uint32_t i = 0; i < elt_count; i++) {
+        expected += (uint32_t)values[i];
+        if (result[i] != (int32_t)expected) {
+            fprintf(stderr, "invalid scan element %u. got %d, expected %d\n",
+                    i, result[i], (int32_t)expected);
+            abort();
+        }
+    }
+    printf("%s: %u elements in %.3f ms\n", state->scan->name, elt_count, ns / 1e6);
 
-    a = allocate_buffer(state, 0, sizeof(int) * ELT_COUNT);
-    descriptor_set_bind(state, a.vk_buffer, a.vk_size, 0);
+    if (readback.vk_buffer != output.vk_buffer)
+        free_buffer(state, &readback);
+    free(values);
+    free_buffer(state, &output);
+    free_buffer(state, &input);
+    printf("\033[36m%s executed\033[0m\n", __func__);
+}
+
+struct producer {
+    struct vulkan_state    *state;
+    struct submit_queue    *queue;
+    uint32_t                index;
+    struct gpu_memory       buffers[PRODUCER_JOBS];
+    /* Bumped by the submitter thread. */
+    uint32_t                callbacks;
+};
+
+static int32_t producer_value(uint32_t producer, uint32_t round, uint32_t job, uint32_t i)
+{
+    return (int32_t)(((producer * PRODUCER_ROUNDS + round) * PRODUCER_JOBS + job) * 7919u + i);
+}
+
+static void producer_job_done(struct submit_job *job, void *data)
+{
+    struct producer *producer = data;
+
+    (void)job;
+    __atomic_fetch_add(&producer->callbacks, 1, __ATOMIC_RELAXED);
+}
+
+/* Sums its buffers in place, PRODUCER_JOBS jobs at a time, recorded with
+ * a context of its own. Half the jobs also report through a callback. */
+static void* producer_thread(void *data)
+{
+    struct producer *producer = data;
+    struct vulkan_state *state = producer->state;
+    const uint32_t elt_count = state->elt_count;
+    const VkDeviceSize size = sum_buffer_size(elt_count);
+    const struct kernel *kernel = sum_kernel_select(state, elt_count);
+    struct submit_job jobs[PRODUCER_JOBS];
+    struct submit_context context;
+
+    memset(jobs, 0, sizeof(jobs));
+    submit_context_init(state, &context);
+
+    for (uint32_t round = 0; round < PRODUCER_ROUNDS; round++) {
+        for (uint32_t j = 0; j < PRODUCER_JOBS; j++) {
+            const struct gpu_memory *buffer = &producer->buffers[j];
+            int32_t *values = buffer->buffer;
+            struct kernel_bindings bindings;
+
+            for (uint32_t i = 0; i < elt_count; i++)
+                values[i] = producer_value(producer->index, round, j, i);
+            gpu_memory_flush(state, buffer, 0, size);
+
+            memset(&bindings, 0, sizeof(bindings));
+            kernel_bindings_write(&bindings, buffer->vk_buffer, size, 0);
+            kernel_bindings_write(&bindings, buffer->vk_buffer, size, 1);
+            submit_job_record_sum(state, &context, &jobs[j], kernel, &bindings, elt_count);
+            if (j % 2) {
+                jobs[j].callback = producer_job_done;
+                jobs[j].callback_data = producer;
+            }
+            submit_job_push(producer->queue, &jobs[j]);
+        }
+
+        for (uint32_t j = 0; j < PRODUCER_JOBS; j++) {
+            const struct gpu_memory *buffer = &producer->buffers[j];
+            const int32_t *values = buffer->buffer;
+
+            submit_job_wait(producer->queue, &jobs[j]);
+            gpu_memory_invalidate(state, buffer, 0, size);
+            for (uint32_t i = 0; i < elt_count; i++) {
+                int32_t expected = (int32_t)((uint32_t)producer_value(producer->index, round, j, i) * 2u);
+                if (values[i] != expected) {
+                    fprintf(stderr, "producer %u, round %u, job %u: invalid element %u. "
+                            "got %d, expected %d\n",
+                            producer->index, round, j, i, values[i], expected);
+                    abort();
+                }
+            }
+        }
+        submit_context_reset(state, &context);
+    }
 
-    b = allocate_buffer(state, 0, sizeof(int) * ELT_COUNT);
-    descriptor_set_bind(state, b.vk_buffer, b.vk_size, 1);
+    submit_context_destroy(state, &context);
+    return NULL;
+}
+
+/* Runs |producer_count| threads recording and pushing jobs to a single
+ * submit_queue, which batches their submissions. */
+static void do_concurrent_submission(struct vulkan_state *state, uint32_t producer_count)
+{
+    const VkDeviceSize size = sum_buffer_size(state->elt_count);
+    struct submit_queue queue;
 
-    VkMappedMemoryRange write_range = {
-        VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
-        NULL,
-        a.vk_memory,
-        0,
-        a.vk_size
-    };
+    if (producer_count == 0 || producer_count > MAX_PRODUCERS) {
+        fprintf(stderr, "unsupported producer count %u.\n", producer_count);
+        abort();
+    }
 
-    VkMappedMemoryRange read_range = {
-        VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
-        NULL,
-        b.vk_memory,
-        0,
-        b.vk_size
-    };
+    struct producer *producers = calloc(producer_count, sizeof(*producers));
+    assert(producers);
 
-    CALL_VK(vkMapMemory, (state->device, a.vk_memory, 0, a.vk_size, 0, &ptr_a));
-    generate_payload(ptr_a, ELT_COUNT);
-    if (state->memory_is_cached) {
-        CALL_VK(vkFlushMappedMemoryRanges, (state->device, 1, &write_range));
+    /* Allocations are not thread-safe: done up front. */
+    for (uint32_t p = 0; p < producer_count; p++) {
+        producers[p].state = state;
+        producers[p].queue = &queue;
+        producers[p].index = p;
+        for (uint32_t j = 0; j < PRODUCER_JOBS; j++)
+            producers[p].buffers[j] = allocate_buffer(state, size, MEMORY_USAGE_READBACK);
     }
-    vkUnmapMemory(state->device, a.vk_memory);
 
-    execute_sum_kernel(state);
+    pthread_t threads[MAX_PRODUCERS];
+    uint64_t start = get_time_ns();
 
-    CALL_VK(vkMapMemory, (state->device, b.vk_memory, 0, b.vk_size, 0, &ptr_b));
-    if (state->memory_is_cached) {
-        CALL_VK(vkInvalidateMappedMemoryRanges, (state->device, 1, &read_range));
+    submit_queue_start(state, &queue);
+    for (uint32_t p = 0; p < producer_count; p++) {
+        if (pthread_create(&threads[p], NULL, producer_thread, &producers[p]) != 0) {
+            fprintf(stderr, "unable to start producer %u.\n", p);
+            abort();
+        }
+    }
+    for (uint32_t p = 0; p < producer_count; p++)
+        pthread_join(threads[p], NULL);
+    submit_queue_stop(&queue);
+
+    uint64_t ns = get_time_ns() - start;
+    for (uint32_t p = 0; p < producer_count; p++) {
+        if (producers[p].callbacks != PRODUCER_ROUNDS * PRODUCER_JOBS / 2) {
+            fprintf(stderr, "producer %u: %u callbacks, expected %u\n",
+                    p, producers[p].callbacks, PRODUCER_ROUNDS * PRODUCER_JOBS / 2);
+            abort();
+        }
+        for (uint32_t j = 0; j < PRODUCER_JOBS; j++)
+            free_buffer(state, &producers[p].buffers[j]);
     }
-    check_payload(ptr_b, ELT_COUNT);
+
+    printf("%u producers: %llu jobs in %llu submissions, %.0f jobs/s\n", producer_count,
+           (unsigned long long)queue.job_count, (unsigned long long)queue.submit_count,
+           queue.job_count / (ns / 1e9));
+    free(producers);
     printf("\033[36m%s executed\033[0m\n", __func__);
-    vkUnmapMemory(state->device, b.vk_memory);
+}
 
-    free_buffer(state, &a);
-    free_buffer(state, &b);
+/* Replays a graph of GRAPH_CHAIN_COUNT independent chains, each uploading
+ * its input, summing it twice between two device buffers and reading the
+ * result back. Only the input changes between replays. The chains share
+ * phases: the graph needs a barrier per step, not per node. */
+static void do_command_graph(struct vulkan_state *state)
+{
+    const uint32_t elt_count = state->elt_count;
+    const VkDeviceSize size = sum_buffer_size(elt_count);
+    const struct kernel *kernel = sum_kernel_select(state, elt_count);
+    struct gpu_memory upload[GRAPH_CHAIN_COUNT], a[GRAPH_CHAIN_COUNT];
+    struct gpu_memory b[GRAPH_CHAIN_COUNT], readback[GRAPH_CHAIN_COUNT];
+    struct kernel_bindings forward, backward;
+    struct command_graph *graph = malloc(sizeof(*graph));
+    assert(graph);
+
+    command_graph_init(graph);
+    for (uint32_t i = 0; i < GRAPH_CHAIN_COUNT; i++) {
+        upload[i] = allocate_buffer(state, size, MEMORY_USAGE_UPLOAD);
+        a[i] = allocate_buffer(state, size, MEMORY_USAGE_DEVICE);
+        b[i] = allocate_buffer(state, size, MEMORY_USAGE_DEVICE);
+        readback[i] = allocate_buffer(state, size, MEMORY_USAGE_READBACK);
+        command_graph_copy(graph, &upload[i], &a[i], size);
+    }
+    for (uint32_t i = 0; i < GRAPH_CHAIN_COUNT; i++) {
+        memset(&forward, 0, sizeof(forward));
+        kernel_bindings_write(&forward, a[i].vk_buffer, size, 0);
+        kernel_bindings_write(&forward, b[i].vk_buffer, size, 1);
+        uint32_t node = command_graph_dispatch(graph, kernel, &forward, elt_count);
+        command_graph_reads(graph, node, &a[i]);
+        command_graph_writes(graph, node, &b[i]);
+    }
+    for (uint32_t i = 0; i < GRAPH_CHAIN_COUNT; i++) {
+        memset(&backward, 0, sizeof(backward));
+        kernel_bindings_write(&backward, b[i].vk_buffer, size, 0);
+        kernel_bindings_write(&backward, a[i].vk_buffer, size, 1);
+        uint32_t node = command_graph_dispatch(graph, kernel, &backward, elt_count);
+        command_graph_reads(graph, node, &b[i]);
+        command_graph_writes(graph, node, &a[i]);
+    }
+    for (uint32_t i = 0; i < GRAPH_CHAIN_COUNT; i++)
+        command_graph_copy(graph, &a[i], &readback[i], size);
+    command_graph_build(state, graph);
+
+    uint64_t ns = 0;
+    for (uint32_t replay = 0; replay < GRAPH_REPLAY_COUNT; replay++) {
+        for (uint32_t i = 0; i < GRAPH_CHAIN_COUNT; i++) {
+            int32_t *input = upload[i].buffer;
+            for (uint32_t j = 0; j < elt_count; j++)
+                input[j] = (int32_t)(j + replay * GRAPH_CHAIN_COUNT + i);
+            gpu_memory_flush(state, &upload[i], 0, size);
+        }
+
+        uint64_t start = get_time_ns();
+        execute_command_graph(state, graph);
+        ns += get_time_ns() - start;
+
+        for (uint32_t i = 0; i < GRAPH_CHAIN_COUNT; i++) {
+            const int32_t *output = readback[i].buffer;
+            gpu_memory_invalidate(state, &readback[i], 0, size);
+            for (uint32_t j = 0; j < elt_count; j++) {
+                int32_t expected = (int32_t)((j + replay * GRAPH_CHAIN_COUNT + i) * 4u);
+                if (output[j] != expected) {
+                    fprintf(stderr, "replay %u, chain %u: invalid element %u. got %d, expected %d\n",
+                            replay, i, j, output[j], expected);
+                    abort();
+                }
+            }
+        }
+    }
+
+    printf("command graph: %u nodes, %u barriers, %u replays of %s: %.2f us/replay\n",
+           graph->node_count, graph->barrier_count, GRAPH_REPLAY_COUNT, kernel->name,
+           ns / 1e3 / GRAPH_REPLAY_COUNT);
+
+    command_graph_destroy(state, graph);
+    free(graph);
+    for (uint32_t i = 0; i < GRAPH_CHAIN_COUNT; i++) {
+        free_buffer(state, &upload[i]);
+        free_buffer(state, &a[i]);
+        free_buffer(state, &b[i]);
+        free_buffer(state, &readback[i]);
+    }
+    printf("\033[36m%s executed\033[0m\n", __func__);
+}
+
+/* Adds, scales and clamps every element, as one fused pass then as one
+ * pass per operation. Both must match fused_chain_apply. */
+static void do_fused_chain(struct vulkan_state *state)
+{
+    const uint32_t elt_count = state->elt_count;
+    const VkDeviceSize size = sizeof(int32_t) * (VkDeviceSize)elt_count;
+    struct gpu_memory input = allocate_buffer(state, size,
+                                              kernel_memory_usage(state, MEMORY_USAGE_UPLOAD));
+    struct gpu_memory output = allocate_buffer(state, size,
+                                               kernel_memory_usage(state, MEMORY_USAGE_READBACK));
+    struct gpu_memory readback = output;
+    struct fused_chain chain = { { FUSED_OP_NONE }, { 0 }, 0 };
+    int32_t *values = malloc(size);
+    assert(values);
+
+    fused_chain_append(&chain, FUSED_OP_ADD, 3);
+    fused_chain_append(&chain, FUSED_OP_MUL, 5);
+    fused_chain_append(&chain, FUSED_OP_MAX, -100000);
+    fused_chain_append(&chain, FUSED_OP_MIN, 100000);
+
+    /* Both bounds of the clamp are hit. */
+    for (uint32_t i = 0; i < elt_count; i++)
+        values[i] = (int32_t)(i % 65536) - 32768;
+    gpu_memory_upload(state, &input, values, size);
+    if (output.buffer == NULL)
+        readback = allocate_buffer(state, size, MEMORY_USAGE_READBACK);
+
+    for (uint32_t fuse = 0; fuse < 2; fuse++) {
+        uint64_t start = get_time_ns();
+        execute_fused_chain(state, &chain, &input, &output, elt_count, fuse);
+        uint64_t ns = get_time_ns() - start;
+
+        if (readback.vk_buffer != output.vk_buffer)
+            gpu_memory_copy(state, &output, &readback, size);
+        gpu_memory_invalidate(state, &readback, 0, size);
+
+        const int32_t *result = readback.buffer;
+        for (uint32_t i = 0; i < elt_count; i++) {
+            int32_t expected = fused_chain_apply(&chain, values[i]);
+            if (result[i] != expected) {
+                fprintf(stderr, "%s chain: invalid element %u. got %d, expected %d\n",
+                        fuse ? "fused" : "unfused", i, result[i], expected);
+                abort();
+            }
+        }
+        printf("%u operations %s: %u passes, %.3f ms\n", chain.count,
+               fuse ? "fused" : "unfused", fuse ? 1 : chain.count, ns / 1e6);
+    }
+
+    if (readback.vk_buffer != output.vk_buffer)
+        free_buffer(state, &readback);
+    free(values);
+    free_buffer(state, &output);
+    free_buffer(state, &input);
+    printf("\033[36m%s executed\033[0m\n", __func__);
 }
 
 int main(int argc, char **argv)
@@ -886,40 +1291,157 @@ int main(int argc, char **argv)
         return 1;
 
     struct vulkan_state *state = NULL;
-    uint32_t *shader_code = NULL;
-    size_t shader_length;
 
     state = create_state();
     if (state == NULL)
         return 1;
 
+    state->one_shot_submit = getenv(ONE_SHOT_VAR_NAME) != NULL;
+    state->no_host_import = getenv(NO_HOST_IMPORT_VAR_NAME) != NULL;
+    state->no_push_descriptors = getenv(NO_PUSH_DESCRIPTORS_VAR_NAME) != NULL;
+    state->no_subgroups = getenv(NO_SUBGROUPS_VAR_NAME) != NULL;
+    const char *subgroup_size = getenv(SUBGROUP_SIZE_VAR_NAME);
+    state->subgroup_size_request = subgroup_size ? strtoul(subgroup_size, NULL, 0) : 0;
+
+    /* Payload generation and checks, one thread per CPU by default. */
+    const char *host_threads = getenv(HOST_THREADS_VAR_NAME);
+    host_threads_set(host_threads ? strtoul(host_threads, NULL, 0) : 0);
+
+    const char *placement = getenv(PLACEMENT_VAR_NAME);
+    if (placement && 0 == strcmp(placement, "device"))
+        state->placement = MEMORY_PLACEMENT_DEVICE;
+    printf("memory placement: %s\n", placement_name(state->placement));
+
+    const char *elt_count = getenv(ELT_COUNT_VAR_NAME);
+    state->elt_count = elt_count ? strtoul(elt_count, NULL, 0) : DEFAULT_ELT_COUNT;
+    const char *workgroup_size = getenv(WORKGROUP_SIZE_VAR_NAME);
+    state->workgroup_size = workgroup_size ? strtoul(workgroup_size, NULL, 0)
+                                           : DEFAULT_WORKGROUP_SIZE;
+
     initialize_device(state);
 
-    char *path = dirname(strdup(argv[0]));
-    size_t pathlen = strlen(path) + strlen(SHADER_NAME) + 2;
-    path = realloc(path, pathlen);
-    strcat(path, "/" SHADER_NAME);
+    if (!validate_problem_size(state)) {
+        destroy_state(&state);
+        return 1;
+    }
 
-    shader_code = load_shader(path, &shader_length);
-    printf("path: %s\n", path);
-    free(path);
-    path = NULL;
+    staging_create(state, sum_buffer_size(state->elt_count));
 
+    const char *profile = getenv(PROFILE_VAR_NAME);
+    if (profile && profile[0] != '\0')
+        profiler_create(state, profile);
+
+    if (getenv(NO_PIPELINE_CACHE_VAR_NAME)) {
+        pipeline_cache_create(state, NULL);
+    } else {
+        char *cache_path = path_next_to_binary(argv[0], PIPELINE_CACHE_NAME);
+        pipeline_cache_create(state, cache_path);
+        free(cache_path);
+    }
 
-    if (shader_code == NULL) {
-        fprintf(stderr, "unable to load the shader.\n");
+    /* Tunings are applied as the kernels load. An explicit workgroup size
+     * wins over them. */
+    if (!workgroup_size) {
+        char *tuning_path = path_next_to_binary(argv[0], TUNING_CACHE_NAME);
+        tuning_cache_load(state, tuning_path);
+        free(tuning_path);
+    }
+
+    if (!load_kernels(state, argv[0])) {
         destroy_state(&state);
         return 2;
     }
 
-    create_pipeline(state, shader_code, shader_length);
+    /* The pipelines compile while the memory checks run. Startup cost of
+     * the batch is reported: run twice to compare against a warm cache,
+     * SUM_NO_PIPELINE_CACHE measures the cold path every time. */
+    kernel_registry_build_async(state);
 
     check_memory_upload(state);
-    do_sum_one_buffer_one_memory(state);
-    do_sum_two_buffer_one_memory(state);
-    do_sum_two_buffer_two_memory(state);
+    check_memory_import(state);
+    check_memory_arena(state);
+
+    state->sum = kernel_find(state, "sum");
+    state->sum_vec4 = kernel_find(state, "sum_vec4");
+    state->sum_batch = kernel_find(state, "sum_batch");
+    state->reduce = kernel_find(state, "reduce");
+    if (state->reduce == NULL)
+        state->reduce = kernel_find(state, "reduce_shared");
+    state->scan = kernel_find(state, "scan");
+    if (state->scan == NULL)
+        state->scan = kernel_find(state, "scan_shared");
+    state->fused = kernel_find(state, "fused");
+    for (uint32_t type = ELEMENT_TYPE_INT32 + 1; type < ELEMENT_TYPE_COUNT; type++)
+        state->sum_types[type] = kernel_find(state, element_type_kernel(type));
+    assert(state->sum && state->sum_vec4 && state->sum_batch && state->fused);
+    assert(state->reduce && state->scan);
+    printf("reduce kernel: %s, scan kernel: %s\n", state->reduce->name, state->scan->name);
+    printf("%u pipelines built in %.3f ms (%s cache)\n",
+           state->kernels.built,
+           (double)state->kernels.build_ns / 1e6,
+           state->pipeline_cache_hash ? "warm" : "cold");
+
+    if (getenv(AUTOTUNE_VAR_NAME) && workgroup_size) {
+        fprintf(stderr, "%s ignored, %s is set.\n", AUTOTUNE_VAR_NAME, WORKGROUP_SIZE_VAR_NAME);
+    } else if (getenv(AUTOTUNE_VAR_NAME)) {
+        uint64_t start = get_time_ns();
+        uint32_t tuned = autotune_kernels(state);
+
+        printf("%u kernels tuned in %.3f ms\n", tuned, (get_time_ns() - start) / 1e6);
+        if (tuned)
+            tuning_cache_save(state);
+    }
+    pipeline_cache_save(state);
+
+    if (workgroup_size && !state->sum->reflection.workgroup_size_id) {
+        fprintf(stderr, "the sum kernel only runs with a workgroup size of %u.\n",
+                state->sum->workgroup_size);
+        destroy_state(&state);
+        return 1;
+    }
+    printf("%u elements, workgroup size %u\n", state->elt_count, state->sum->workgroup_size);
+
+    /* The correctness checks cover every variant, the rest picks one. */
+    for (uint32_t variant = SUM_VARIANT_SCALAR; variant <= SUM_VARIANT_VEC4; variant++) {
+        state->sum_variant = variant;
+        do_sum_one_buffer_one_memory(state);
+        do_sum_two_buffer_one_memory(state);
+        do_sum_two_buffer_two_memory(state);
+    }
+    state->sum_variant = SUM_VARIANT_AUTO;
+    do_sum_element_types(state, getenv(ELEMENT_TYPES_VAR_NAME));
+
+    do_sum_repeated_dispatch(state);
+    do_sum_batch(state);
+    do_host_payload_scaling(state);
+    do_reduce(state);
+    do_scan(state);
+    do_fused_chain(state);
+    do_command_graph(state);
+
+    const char *producers = getenv(PRODUCERS_VAR_NAME);
+    do_concurrent_submission(state, producers ? strtoul(producers, NULL, 0) : DEFAULT_PRODUCERS);
+
+    if (!state->one_shot_submit) {
+        const char *chunks = getenv(STREAM_CHUNKS_VAR_NAME);
+        do_sum_streaming(state, chunks ? strtoul(chunks, NULL, 0) : DEFAULT_STREAM_CHUNKS);
+    }
+
+    const char *file_input = getenv(FILE_INPUT_VAR_NAME);
+    const char *file_output = getenv(FILE_OUTPUT_VAR_NAME);
+    if (file_input && file_output && !state->one_shot_submit) {
+        const char *tile = getenv(FILE_TILE_VAR_NAME);
+        do_sum_file_streaming(state, file_input, file_output,
+                              tile ? strtoul(tile, NULL, 0) : DEFAULT_FILE_TILE);
+    }
+
+    const char *devices = getenv(DEVICES_VAR_NAME);
+    if (devices && devices[0] != '\0')
+        do_sum_multi_device(state, devices, argv[0]);
+
+    arena_dump_stats(state);
+    profiler_write(state);
 
-    free(shader_code);
     destroy_state(&state);
 
     puts("bye bye");
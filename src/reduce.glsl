@@ -0,0 +1,106 @@
+#version 450
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_arithmetic : require
+
+/* The workgroup size is specialization constant 0. */
+layout (
+    local_size_x_id = 0,
+    local_size_y = 1,
+    local_size_z = 1
+) in;
+
+/* enum reduce_op and enum reduce_type on the host. */
+#define OP_SUM 0
+#define OP_MIN 1
+#define OP_MAX 2
+#define TYPE_INT 0
+#define TYPE_FLOAT 1
+
+layout (push_constant) uniform parameters {
+    uint elt_count;
+    /* Invocations per row of the dispatch. */
+    uint row_pitch;
+    uint items_per_invocation;
+    uint op;
+    uint type;
+};
+
+/* Values are stored as their bit pattern, whatever the type. Each
+ * workgroup writes one value, the next pass reduces those. */
+layout (binding = 0) buffer buf_in  { uint buffer_in[]; };
+layout (binding = 1) buffer buf_out { uint buffer_out[]; };
+
+/* One value per subgroup. */
+shared uint partials[gl_WorkGroupSize.x];
+
+uint identity()
+{
+    if (op == OP_SUM)
+        return type == TYPE_FLOAT ? floatBitsToUint(0.0) : 0u;
+    if (type == TYPE_FLOAT)
+        return op == OP_MIN ? 0x7f800000u /* +inf */ : 0xff800000u /* -inf */;
+    return op == OP_MIN ? 0x7fffffffu : 0x80000000u;
+}
+
+uint combine(uint a, uint b)
+{
+    if (type == TYPE_FLOAT) {
+        float x = uintBitsToFloat(a), y = uintBitsToFloat(b);
+        if (op == OP_SUM)
+            return floatBitsToUint(x + y);
+        return floatBitsToUint(op == OP_MIN ? min(x, y) : max(x, y));
+    }
+
+    int x = int(a), y = int(b);
+    if (op == OP_SUM)
+        return uint(x + y);
+    return uint(op == OP_MIN ? min(x, y) : max(x, y));
+}
+
+/* op and type are uniform: the whole subgroup takes the same branch. */
+uint subgroup_reduce(uint value)
+{
+    if (type == TYPE_FLOAT) {
+        float x = uintBitsToFloat(value);
+        if (op == OP_SUM)
+            return floatBitsToUint(subgroupAdd(x));
+        return floatBitsToUint(op == OP_MIN ? subgroupMin(x) : subgroupMax(x));
+    }
+
+    int x = int(value);
+    if (op == OP_SUM)
+        return uint(subgroupAdd(x));
+    return uint(op == OP_MIN ? subgroupMin(x) : subgroupMax(x));
+}
+
+void main()
+{
+    uint lid = gl_LocalInvocationID.x;
+    uint group = (gl_GlobalInvocationID.y * row_pitch + gl_GlobalInvocationID.x)
+               / gl_WorkGroupSize.x;
+    uint first = group * gl_WorkGroupSize.x * items_per_invocation + lid;
+
+    /* Consecutive invocations read consecutive values. */
+    uint acc = identity();
+    for (uint i = 0; i < items_per_invocation; i++) {
+        uint id = first + i * gl_WorkGroupSize.x;
+        if (id < elt_count)
+            acc = combine(acc, buffer_in[id]);
+    }
+
+    acc = subgroup_reduce(acc);
+    if (subgroupElect())
+        partials[gl_SubgroupID] = acc;
+    barrier();
+
+    /* Tree over the subgroup results. */
+    for (uint stride = 1; stride < gl_NumSubgroups; stride *= 2) {
+        if (lid % (2 * stride) == 0 && lid + stride < gl_NumSubgroups)
+            partials[lid] = combine(partials[lid], partials[lid + stride]);
+        barrier();
+    }
+
+    /* The last row of the dispatch may have groups past the end. */
+    if (lid == 0 && first < elt_count)
+        buffer_out[group] = partials[0];
+}
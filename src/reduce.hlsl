@@ -0,0 +1,103 @@
+// enum reduce_op and enum reduce_type on the host.
+#define OP_SUM 0
+#define OP_MIN 1
+#define OP_MAX 2
+#define TYPE_INT 0
+#define TYPE_FLOAT 1
+
+#define WORKGROUP_SIZE 32
+
+struct Parameters {
+  uint elt_count;
+  // Invocations per row of the dispatch.
+  uint row_pitch;
+  uint items_per_invocation;
+  uint op;
+  uint type;
+};
+
+[[vk::push_constant]] Parameters parameters;
+
+// Values are stored as their bit pattern, whatever the type. Each
+// workgroup writes one value, the next pass reduces those.
+RWStructuredBuffer<uint> buffer_in;
+RWStructuredBuffer<uint> buffer_out;
+
+// One value per wave.
+groupshared uint partials[WORKGROUP_SIZE];
+
+uint identity()
+{
+  if (parameters.op == OP_SUM)
+    return parameters.type == TYPE_FLOAT ? asuint(0.0f) : 0u;
+  if (parameters.type == TYPE_FLOAT)
+    return parameters.op == OP_MIN ? 0x7f800000u /* +inf */ : 0xff800000u /* -inf */;
+  return parameters.op == OP_MIN ? 0x7fffffffu : 0x80000000u;
+}
+
+uint combine(uint a, uint b)
+{
+  if (parameters.type == TYPE_FLOAT) {
+    const float x = asfloat(a), y = asfloat(b);
+    if (parameters.op == OP_SUM)
+      return asuint(x + y);
+    return asuint(parameters.op == OP_MIN ? min(x, y) : max(x, y));
+  }
+
+  const int x = asint(a), y = asint(b);
+  if (parameters.op == OP_SUM)
+    return asuint(x + y);
+  return asuint(parameters.op == OP_MIN ? min(x, y) : max(x, y));
+}
+
+// op and type are uniform: the whole wave takes the same branch.
+uint wave_reduce(uint value)
+{
+  if (parameters.type == TYPE_FLOAT) {
+    const float x = asfloat(value);
+    if (parameters.op == OP_SUM)
+      return asuint(WaveActiveSum(x));
+    return asuint(parameters.op == OP_MIN ? WaveActiveMin(x) : WaveActiveMax(x));
+  }
+
+  const int x = asint(value);
+  if (parameters.op == OP_SUM)
+    return asuint(WaveActiveSum(x));
+  return asuint(parameters.op == OP_MIN ? WaveActiveMin(x) : WaveActiveMax(x));
+}
+
+// The host reads the workgroup size back from the module.
+[numthreads(WORKGROUP_SIZE,1,1)]
+void main(uint3 threadID : SV_DispatchThreadID, uint lid : SV_GroupIndex)
+{
+  const uint group = (threadID.y * parameters.row_pitch + threadID.x) / WORKGROUP_SIZE;
+  const uint first = group * WORKGROUP_SIZE * parameters.items_per_invocation + lid;
+
+  // Consecutive invocations read consecutive values.
+  uint acc = identity();
+  for (uint i = 0; i < parameters.items_per_invocation; i++) {
+    const uint id = first + i * WORKGROUP_SIZE;
+    if (id < parameters.elt_count)
+      acc = combine(acc, buffer_in[id]);
+  }
+
+  // Waves cover consecutive invocations of the group.
+  const uint lanes = WaveGetLaneCount();
+  const uint waves = (WORKGROUP_SIZE + lanes - 1) / lanes;
+
+  acc = wave_reduce(acc);
+  if (WaveIsFirstLane())
+    partials[lid / lanes] = acc;
+  GroupMemoryBarrierWithGroupSync();
+
+  // Tree over the wave results.
+  for (uint stride = 1; stride < waves; stride *= 2) {
+    if (lid % (2 * stride) == 0 && lid + stride < waves)
+      partials[lid] = combine(partials[lid], partials[lid + stride]);
+    GroupMemoryBarrierWithGroupSync();
+  }
+
+  // The last row of the dispatch may have groups past the end.
+  if (lid == 0 && first < parameters.elt_count)
+    buffer_out[group] = partials[0];
+}
@@ -0,0 +1,83 @@
+// The reduce kernel without wave operations, for the devices lacking
+// them: the whole tree goes through group shared memory.
+
+// enum reduce_op and enum reduce_type on the host.
+#define OP_SUM 0
+#define OP_MIN 1
+#define OP_MAX 2
+#define TYPE_INT 0
+#define TYPE_FLOAT 1
+
+#define WORKGROUP_SIZE 32
+
+struct Parameters {
+  uint elt_count;
+  // Invocations per row of the dispatch.
+  uint row_pitch;
+  uint items_per_invocation;
+  uint op;
+  uint type;
+};
+
+[[vk::push_constant]] Parameters parameters;
+
+// Values are stored as their bit pattern, whatever the type. Each
+// workgroup writes one value, the next pass reduces those.
+RWStructuredBuffer<uint> buffer_in;
+RWStructuredBuffer<uint> buffer_out;
+
+// One value per invocation.
+groupshared uint partials[WORKGROUP_SIZE];
+
+uint identity()
+{
+  if (parameters.op == OP_SUM)
+    return parameters.type == TYPE_FLOAT ? asuint(0.0f) : 0u;
+  if (parameters.type == TYPE_FLOAT)
+    return parameters.op == OP_MIN ? 0x7f800000u /* +inf */ : 0xff800000u /* -inf */;
+  return parameters.op == OP_MIN ? 0x7fffffffu : 0x80000000u;
+}
+
+uint combine(uint a, uint b)
+{
+  if (parameters.type == TYPE_FLOAT) {
+    const float x = asfloat(a), y = asfloat(b);
+    if (parameters.op == OP_SUM)
+      return asuint(x + y);
+    return asuint(parameters.op == OP_MIN ? min(x, y) : max(x, y));
+  }
+
+  const int x = asint(a), y = asint(b);
+  if (parameters.op == OP_SUM)
+    return asuint(x + y);
+  return asuint(parameters.op == OP_MIN ? min(x, y) : max(x, y));
+}
+
+// The host reads the workgroup size back from the module.
+[numthreads(WORKGROUP_SIZE,1,1)]
+void main(uint3 threadID : SV_DispatchThreadID, uint lid : SV_GroupIndex)
+{
+  const uint group = (threadID.y * parameters.row_pitch + threadID.x) / WORKGROUP_SIZE;
+  const uint first = group * WORKGROUP_SIZE * parameters.items_per_invocation + lid;
+
+  // Consecutive invocations read consecutive values.
+  uint acc = identity();
+  for (uint i = 0; i < parameters.items_per_invocation; i++) {
+    const uint id = first + i * WORKGROUP_SIZE;
+    if (id < parameters.elt_count)
+      acc = combine(acc, buffer_in[id]);
+  }
+
+  partials[lid] = acc;
+  GroupMemoryBarrierWithGroupSync();
+
+  for (uint stride = 1; stride < WORKGROUP_SIZE; stride *= 2) {
+    if (lid % (2 * stride) == 0 && lid + stride < WORKGROUP_SIZE)
+      partials[lid] = combine(partials[lid], partials[lid + stride]);
+    GroupMemoryBarrierWithGroupSync();
+  }
+
+  // The last row of the dispatch may have groups past the end.
+  if (lid == 0 && first < parameters.elt_count)
+    buffer_out[group] = partials[0];
+}
@@ -0,0 +1,90 @@
+enable chromium_experimental_push_constant;
+
+// The reduce kernel without subgroup operations, for the devices lacking
+// them: the whole tree goes through workgroup memory.
+
+// enum reduce_op and enum reduce_type on the host.
+const OP_SUM : u32 = 0u;
+const OP_MIN : u32 = 1u;
+const TYPE_FLOAT : u32 = 1u;
+
+const WORKGROUP_SIZE : u32 = 32u;
+
+struct Parameters {
+    elt_count : u32,
+    // Invocations per row of the dispatch.
+    row_pitch : u32,
+    items_per_invocation : u32,
+    op : u32,
+    type_ : u32,
+}
+
+var<push_constant> parameters : Parameters;
+
+// Values are stored as their bit pattern, whatever the type. Each
+// workgroup writes one value, the next pass reduces those.
+@group(0) @binding(0) var<storage, read> buffer_in : array<u32>;
+@group(0) @binding(1) var<storage, read_write> buffer_out : array<u32>;
+
+// One value per invocation.
+var<workgroup> partials : array<u32, WORKGROUP_SIZE>;
+
+fn identity() -> u32 {
+    if (parameters.op == OP_SUM) {
+        return 0u; // 0.0 and 0 share their bit pattern
+    }
+    if (parameters.type_ == TYPE_FLOAT) {
+        return select(0xff800000u /* -inf */, 0x7f800000u /* +inf */, parameters.op == OP_MIN);
+    }
+    return select(0x80000000u, 0x7fffffffu, parameters.op == OP_MIN);
+}
+
+fn combine(a : u32, b : u32) -> u32 {
+    if (parameters.type_ == TYPE_FLOAT) {
+        let x = bitcast<f32>(a);
+        let y = bitcast<f32>(b);
+        if (parameters.op == OP_SUM) {
+            return bitcast<u32>(x + y);
+        }
+        return bitcast<u32>(select(max(x, y), min(x, y), parameters.op == OP_MIN));
+    }
+
+    let x = bitcast<i32>(a);
+    let y = bitcast<i32>(b);
+    if (parameters.op == OP_SUM) {
+        return bitcast<u32>(x + y);
+    }
+    return bitcast<u32>(select(max(x, y), min(x, y), parameters.op == OP_MIN));
+}
+
+// The host reads the workgroup size back from the module.
+@compute @workgroup_size(WORKGROUP_SIZE, 1, 1)
+fn main(@builtin(global_invocation_id) threadID : vec3<u32>,
+        @builtin(local_invocation_index) lid : u32) {
+    let group : u32 = (threadID.y * parameters.row_pitch + threadID.x) / WORKGROUP_SIZE;
+    let first : u32 = group * WORKGROUP_SIZE * parameters.items_per_invocation + lid;
+
+    // Consecutive invocations read consecutive values.
+    var acc : u32 = identity();
+    for (var i : u32 = 0u; i < parameters.items_per_invocation; i++) {
+        let id : u32 = first + i * WORKGROUP_SIZE;
+        if (id < parameters.elt_count) {
+            acc = combine(acc, buffer_in[id]);
+        }
+    }
+
+    partials[lid] = acc;
+    workgroupBarrier();
+
+    for (var stride : u32 = 1u; stride < WORKGROUP_SIZE; stride *= 2u) {
+        if (lid % (2u * stride) == 0u && lid + stride < WORKGROUP_SIZE) {
+            partials[lid] = combine(partials[lid], partials[lid + stride]);
+        }
+        workgroupBarrier();
+    }
+
+    // The last row of the dispatch may have groups past the end.
+    if (lid == 0u && first < parameters.elt_count) {
+        buffer_out[group] = partials[0];
+    }
+}
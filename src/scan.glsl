@@ -0,0 +1,65 @@
+#version 450
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_arithmetic : require
+
+/* The workgroup size is specialization constant 0. The pipeline requires
+ * full subgroups: they cover the workgroup without holes. */
+layout (
+    local_size_x_id = 0,
+    local_size_y = 1,
+    local_size_z = 1
+) in;
+
+/* enum scan_phase on the host. */
+#define PHASE_SCAN 0
+#define PHASE_ADD 1
+
+layout (push_constant) uniform parameters {
+    uint elt_count;
+    /* Invocations per row of the dispatch. */
+    uint row_pitch;
+    uint phase;
+};
+
+/* PHASE_SCAN writes the inclusive scan of each workgroup's values, and
+ * their total. PHASE_ADD adds the scanned totals of the previous groups.
+ * Input and output may be the same buffer: each invocation only reads
+ * the value it writes. */
+layout (binding = 0) buffer buf_in     { int buffer_in[]; };
+layout (binding = 1) buffer buf_out    { int buffer_out[]; };
+layout (binding = 2) buffer buf_totals { int totals[]; };
+
+/* The total of each subgroup. */
+shared int partials[gl_WorkGroupSize.x];
+
+void main()
+{
+    uint group = (gl_GlobalInvocationID.y * row_pitch + gl_GlobalInvocationID.x)
+               / gl_WorkGroupSize.x;
+    uint lid = gl_SubgroupID * gl_SubgroupSize + gl_SubgroupInvocationID;
+    uint id = group * gl_WorkGroupSize.x + lid;
+
+    /* phase is uniform: the whole workgroup returns. */
+    if (phase == PHASE_ADD) {
+        if (group > 0 && id < elt_count)
+            buffer_out[id] += totals[group - 1];
+        return;
+    }
+
+    int value = subgroupInclusiveAdd(id < elt_count ? buffer_in[id] : 0);
+    if (gl_SubgroupInvocationID == gl_SubgroupSize - 1)
+        partials[gl_SubgroupID] = value;
+    barrier();
+
+    /* Each subgroup adds up the totals of the ones before it, a subgroup
+     * of them at a time. */
+    for (uint first = 0; first < gl_NumSubgroups; first += gl_SubgroupSize) {
+        uint index = first + gl_SubgroupInvocationID;
+        value += subgroupAdd(index < gl_SubgroupID ? partials[index] : 0);
+    }
+
+    if (id < elt_count)
+        buffer_out[id] = value;
+    if (lid == gl_WorkGroupSize.x - 1)
+        totals[group] = value;
+}
@@ -0,0 +1,62 @@
+// enum scan_phase on the host.
+#define PHASE_SCAN 0
+#define PHASE_ADD 1
+
+#define WORKGROUP_SIZE 32
+
+struct Parameters {
+  uint elt_count;
+  // Invocations per row of the dispatch.
+  uint row_pitch;
+  uint phase;
+};
+
+[[vk::push_constant]] Parameters parameters;
+
+// PHASE_SCAN writes the inclusive scan of each group's values, and their
+// total. PHASE_ADD adds the scanned totals of the previous groups. Input
+// and output may be the same buffer: each thread only reads the value it
+// writes.
+RWStructuredBuffer<int> buffer_in;
+RWStructuredBuffer<int> buffer_out;
+RWStructuredBuffer<int> totals;
+
+// The total of each wave.
+groupshared int partials[WORKGROUP_SIZE];
+
+// The host reads the workgroup size back from the module. The pipeline
+// requires full waves: they cover consecutive threads of the group.
+[numthreads(WORKGROUP_SIZE,1,1)]
+void main(uint3 threadID : SV_DispatchThreadID, uint lid : SV_GroupIndex)
+{
+  const uint group = (threadID.y * parameters.row_pitch + threadID.x) / WORKGROUP_SIZE;
+  const uint id = group * WORKGROUP_SIZE + lid;
+  const uint lanes = WaveGetLaneCount();
+  const uint lane = WaveGetLaneIndex();
+  const uint waves = WORKGROUP_SIZE / lanes;
+
+  // phase is uniform: the whole group returns.
+  if (parameters.phase == PHASE_ADD) {
+    if (group > 0 && id < parameters.elt_count)
+      buffer_out[id] += totals[group - 1];
+    return;
+  }
+
+  const int input = id < parameters.elt_count ? buffer_in[id] : 0;
+  int value = WavePrefixSum(input) + input;
+  if (lane == lanes - 1)
+    partials[lid / lanes] = value;
+  GroupMemoryBarrierWithGroupSync();
+
+  // Each wave adds up the totals of the ones before it, a wave of them at
+  // a time.
+  for (uint first = 0; first < waves; first += lanes) {
+    const uint index = first + lane;
+    value += WaveActiveSum(index < lid / lanes ? partials[index] : 0);
+  }
+
+  if (id < parameters.elt_count)
+    buffer_out[id] = value;
+  if (lid == WORKGROUP_SIZE - 1)
+    totals[group] = value;
+}
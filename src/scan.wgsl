@@ -0,0 +1,71 @@
+enable chromium_experimental_push_constant;
+enable subgroups;
+
+// enum scan_phase on the host.
+const PHASE_ADD : u32 = 1u;
+
+const WORKGROUP_SIZE : u32 = 32u;
+
+struct Parameters {
+    elt_count : u32,
+    // Invocations per row of the dispatch.
+    row_pitch : u32,
+    phase : u32,
+}
+
+var<push_constant> parameters : Parameters;
+
+// PHASE_SCAN writes the inclusive scan of each workgroup's values, and
+// their total. PHASE_ADD adds the scanned totals of the previous groups.
+// Input and output may be the same buffer: each invocation only reads the
+// value it writes.
+@group(0) @binding(0) var<storage, read_write> buffer_in : array<i32>;
+@group(0) @binding(1) var<storage, read_write> buffer_out : array<i32>;
+@group(0) @binding(2) var<storage, read_write> totals : array<i32>;
+
+// The total of each subgroup.
+var<workgroup> partials : array<i32, WORKGROUP_SIZE>;
+
+// The host reads the workgroup size back from the module. The pipeline
+// requires full subgroups: they cover consecutive invocations.
+@compute @workgroup_size(WORKGROUP_SIZE, 1, 1)
+fn main(@builtin(global_invocation_id) threadID : vec3<u32>,
+        @builtin(local_invocation_index) lid : u32,
+        @builtin(subgroup_invocation_id) lane : u32,
+        @builtin(subgroup_size) lanes : u32) {
+    let group : u32 = (threadID.y * parameters.row_pitch + threadID.x) / WORKGROUP_SIZE;
+    let id : u32 = group * WORKGROUP_SIZE + lid;
+    let waves : u32 = WORKGROUP_SIZE / lanes;
+
+    // phase is uniform: the whole workgroup returns.
+    if (parameters.phase == PHASE_ADD) {
+        if (group > 0u && id < parameters.elt_count) {
+            buffer_out[id] += totals[group - 1u];
+        }
+        return;
+    }
+
+    var input : i32 = 0;
+    if (id < parameters.elt_count) {
+        input = buffer_in[id];
+    }
+    var value : i32 = subgroupInclusiveAdd(input);
+    if (lane == lanes - 1u) {
+        partials[lid / lanes] = value;
+    }
+    workgroupBarrier();
+
+    // Each subgroup adds up the totals of the ones before it, a subgroup
+    // of them at a time.
+    for (var first : u32 = 0u; first < waves; first += lanes) {
+        let index : u32 = first + lane;
+        value += subgroupAdd(select(0, partials[index], index < lid / lanes));
+    }
+
+    if (id < parameters.elt_count) {
+        buffer_out[id] = value;
+    }
+    if (lid == WORKGROUP_SIZE - 1u) {
+        totals[group] = value;
+    }
+}
@@ -0,0 +1,61 @@
+#version 450
+
+/* The scan kernel without subgroup operations, for the devices lacking
+ * them: each step of the scan goes through shared memory. */
+
+/* The workgroup size is specialization constant 0. */
+layout (
+    local_size_x_id = 0,
+    local_size_y = 1,
+    local_size_z = 1
+) in;
+
+/* enum scan_phase on the host. */
+#define PHASE_SCAN 0
+#define PHASE_ADD 1
+
+layout (push_constant) uniform parameters {
+    uint elt_count;
+    /* Invocations per row of the dispatch. */
+    uint row_pitch;
+    uint phase;
+};
+
+/* Same bindings as the scan kernel. */
+layout (binding = 0) buffer buf_in     { int buffer_in[]; };
+layout (binding = 1) buffer buf_out    { int buffer_out[]; };
+layout (binding = 2) buffer buf_totals { int totals[]; };
+
+shared int values[gl_WorkGroupSize.x];
+
+void main()
+{
+    uint lid = gl_LocalInvocationID.x;
+    uint group = (gl_GlobalInvocationID.y * row_pitch + gl_GlobalInvocationID.x)
+               / gl_WorkGroupSize.x;
+    uint id = group * gl_WorkGroupSize.x + lid;
+
+    /* phase is uniform: the whole workgroup returns. */
+    if (phase == PHASE_ADD) {
+        if (group > 0 && id < elt_count)
+            buffer_out[id] += totals[group - 1];
+        return;
+    }
+
+    values[lid] = id < elt_count ? buffer_in[id] : 0;
+    barrier();
+
+    /* Hillis-Steele: after the step of |offset|, each value covers the
+     * 2 * |offset| before it. */
+    for (uint offset = 1; offset < gl_WorkGroupSize.x; offset *= 2) {
+        int addend = lid >= offset ? values[lid - offset] : 0;
+        barrier();
+        values[lid] += addend;
+        barrier();
+    }
+
+    if (id < elt_count)
+        buffer_out[id] = values[lid];
+    if (lid == gl_WorkGroupSize.x - 1)
+        totals[group] = values[lid];
+}
@@ -0,0 +1,56 @@
+// The scan kernel without wave operations, for the devices lacking them:
+// each step of the scan goes through group shared memory.
+
+// enum scan_phase on the host.
+#define PHASE_SCAN 0
+#define PHASE_ADD 1
+
+#define WORKGROUP_SIZE 32
+
+struct Parameters {
+  uint elt_count;
+  // Invocations per row of the dispatch.
+  uint row_pitch;
+  uint phase;
+};
+
+[[vk::push_constant]] Parameters parameters;
+
+// Same bindings as the scan kernel.
+RWStructuredBuffer<int> buffer_in;
+RWStructuredBuffer<int> buffer_out;
+RWStructuredBuffer<int> totals;
+
+groupshared int values[WORKGROUP_SIZE];
+
+// The host reads the workgroup size back from the module.
+[numthreads(WORKGROUP_SIZE,1,1)]
+void main(uint3 threadID : SV_DispatchThreadID, uint lid : SV_GroupIndex)
+{
+  const uint group = (threadID.y * parameters.row_pitch + threadID.x) / WORKGROUP_SIZE;
+  const uint id = group * WORKGROUP_SIZE + lid;
+
+  // phase is uniform: the whole group returns.
+  if (parameters.phase == PHASE_ADD) {
+    if (group > 0 && id < parameters.elt_count)
+      buffer_out[id] += totals[group - 1];
+    return;
+  }
+
+  values[lid] = id < parameters.elt_count ? buffer_in[id] : 0;
+  GroupMemoryBarrierWithGroupSync();
+
+  // Hillis-Steele: after the step of offset, each value covers the
+  // 2 * offset before it.
+  for (uint offset = 1; offset < WORKGROUP_SIZE; offset *= 2) {
+    const int addend = lid >= offset ? values[lid - offset] : 0;
+    GroupMemoryBarrierWithGroupSync();
+    values[lid] += addend;
+    GroupMemoryBarrierWithGroupSync();
+  }
+
+  if (id < parameters.elt_count)
+    buffer_out[id] = values[lid];
+  if (lid == WORKGROUP_SIZE - 1)
+    totals[group] = values[lid];
+}
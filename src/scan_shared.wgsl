@@ -0,0 +1,67 @@
+enable chromium_experimental_push_constant;
+
+// The scan kernel without subgroup operations, for the devices lacking
+// them: each step of the scan goes through workgroup memory.
+
+// enum scan_phase on the host.
+const PHASE_ADD : u32 = 1u;
+
+const WORKGROUP_SIZE : u32 = 32u;
+
+struct Parameters {
+    elt_count : u32,
+    // Invocations per row of the dispatch.
+    row_pitch : u32,
+    phase : u32,
+}
+
+var<push_constant> parameters : Parameters;
+
+// Same bindings as the scan kernel.
+@group(0) @binding(0) var<storage, read_write> buffer_in : array<i32>;
+@group(0) @binding(1) var<storage, read_write> buffer_out : array<i32>;
+@group(0) @binding(2) var<storage, read_write> totals : array<i32>;
+
+var<workgroup> values : array<i32, WORKGROUP_SIZE>;
+
+// The host reads the workgroup size back from the module.
+@compute @workgroup_size(WORKGROUP_SIZE, 1, 1)
+fn main(@builtin(global_invocation_id) threadID : vec3<u32>,
+        @builtin(local_invocation_index) lid : u32) {
+    let group : u32 = (threadID.y * parameters.row_pitch + threadID.x) / WORKGROUP_SIZE;
+    let id : u32 = group * WORKGROUP_SIZE + lid;
+
+    // phase is uniform: the whole workgroup returns.
+    if (parameters.phase == PHASE_ADD) {
+        if (group > 0u && id < parameters.elt_count) {
+            buffer_out[id] += totals[group - 1u];
+        }
+        return;
+    }
+
+    var input : i32 = 0;
+    if (id < parameters.elt_count) {
+        input = buffer_in[id];
+    }
+    values[lid] = input;
+    workgroupBarrier();
+
+    // Hillis-Steele: after the step of offset, each value covers the
+    // 2 * offset before it.
+    for (var offset : u32 = 1u; offset < WORKGROUP_SIZE; offset *= 2u) {
+        var addend : i32 = 0;
+        if (lid >= offset) {
+            addend = values[lid - offset];
+        }
+        workgroupBarrier();
+        values[lid] += addend;
+        workgroupBarrier();
+    }
+
+    if (id < parameters.elt_count) {
+        buffer_out[id] = values[lid];
+    }
+    if (lid == WORKGROUP_SIZE - 1u) {
+        totals[group] = values[lid];
+    }
+}
@@ -1,19 +1,26 @@
 #version 450
 
+/* The workgroup size is specialization constant 0. */
 layout (
-    local_size_x = WORKGROUP_SIZE,
+    local_size_x_id = 0,
     local_size_y = 1,
     local_size_z = 1
 ) in;
 
+layout (push_constant) uniform parameters {
+    uint elt_count;
+    /* Invocations per row of the dispatch. */
+    uint row_pitch;
+};
+
 layout (binding = 0) buffer buf_in  { int buffer_in[]; };
 layout (binding = 1) buffer buf_out { int buffer_out[]; };
 
 void main()
 {
-    if (gl_GlobalInvocationID.x >= ELT_COUNT)
+    uint id = gl_GlobalInvocationID.y * row_pitch + gl_GlobalInvocationID.x;
+    if (id >= elt_count)
         return;
 
-    uint id = gl_GlobalInvocationID.x;
     buffer_out[id] = buffer_in[id] + buffer_in[id];
 }
@@ -1,12 +1,21 @@
+struct Parameters {
+  uint elt_count;
+  // Invocations per row of the dispatch.
+  uint row_pitch;
+};
+
+[[vk::push_constant]] Parameters parameters;
+
 RWStructuredBuffer<int> buffer_in;
 RWStructuredBuffer<int> buffer_out;
 
-[numthreads(WORKGROUP_SIZE,1,1)]
+// The host reads the workgroup size back from the module.
+[numthreads(32,1,1)]
 void main(uint3 threadID : SV_DispatchThreadID)
 {
-  if (threadID.x >= 1024)
+  const uint id = threadID.y * parameters.row_pitch + threadID.x;
+  if (id >= parameters.elt_count)
       return;
 
-  const uint id = threadID.x;
   buffer_out[id] = buffer_in[id] + buffer_in[id];
 }
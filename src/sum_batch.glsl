@@ -0,0 +1,30 @@
+#version 450
+
+/* The workgroup size is specialization constant 0. */
+layout (
+    local_size_x_id = 0,
+    local_size_y = 1,
+    local_size_z = 1
+) in;
+
+/* Elements of one job, see struct batch_job. */
+struct batch_job {
+    uint first;
+    uint count;
+};
+
+/* Jobs are packed back to back in both buffers. One workgroup per job: the
+ * indirect dispatch is as wide as the batch. */
+layout (binding = 0) buffer buf_in  { int buffer_in[]; };
+layout (binding = 1) buffer buf_out { int buffer_out[]; };
+layout (binding = 2) readonly buffer buf_jobs { batch_job jobs[]; };
+
+void main()
+{
+    batch_job job = jobs[gl_WorkGroupID.x];
+
+    for (uint i = gl_LocalInvocationID.x; i < job.count; i += gl_WorkGroupSize.x) {
+        uint id = job.first + i;
+        buffer_out[id] = buffer_in[id] + buffer_in[id];
+    }
+}
@@ -0,0 +1,25 @@
+#define WORKGROUP_SIZE 32
+
+// Elements of one job, see struct batch_job.
+struct BatchJob {
+  uint first;
+  uint count;
+};
+
+// Jobs are packed back to back in both buffers. One workgroup per job: the
+// indirect dispatch is as wide as the batch.
+RWStructuredBuffer<int> buffer_in;
+RWStructuredBuffer<int> buffer_out;
+StructuredBuffer<BatchJob> jobs;
+
+// The host reads the workgroup size back from the module.
+[numthreads(WORKGROUP_SIZE,1,1)]
+void main(uint3 groupID : SV_GroupID, uint3 localID : SV_GroupThreadID)
+{
+  const BatchJob job = jobs[groupID.x];
+
+  for (uint i = localID.x; i < job.count; i += WORKGROUP_SIZE) {
+    const uint id = job.first + i;
+    buffer_out[id] = buffer_in[id] + buffer_in[id];
+  }
+}
@@ -0,0 +1,25 @@
+const WORKGROUP_SIZE : u32 = 32u;
+
+// Elements of one job, see struct batch_job.
+struct BatchJob {
+    first : u32,
+    count : u32,
+}
+
+// Jobs are packed back to back in both buffers. One workgroup per job: the
+// indirect dispatch is as wide as the batch.
+@group(0) @binding(0) var<storage, read> buffer_in : array<i32>;
+@group(0) @binding(1) var<storage, read_write> buffer_out : array<i32>;
+@group(0) @binding(2) var<storage, read> jobs : array<BatchJob>;
+
+// The host reads the workgroup size back from the module.
+@compute @workgroup_size(WORKGROUP_SIZE, 1, 1)
+fn main(@builtin(workgroup_id) groupID : vec3<u32>,
+        @builtin(local_invocation_id) localID : vec3<u32>) {
+    let job : BatchJob = jobs[groupID.x];
+
+    for (var i : u32 = localID.x; i < job.count; i += WORKGROUP_SIZE) {
+        let id : u32 = job.first + i;
+        buffer_out[id] = buffer_in[id] + buffer_in[id];
+    }
+}
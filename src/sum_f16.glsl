@@ -0,0 +1,28 @@
+#version 450
+#extension GL_EXT_shader_explicit_arithmetic_types_float16 : require
+#extension GL_EXT_shader_16bit_storage : require
+
+/* The workgroup size is specialization constant 0. */
+layout (
+    local_size_x_id = 0,
+    local_size_y = 1,
+    local_size_z = 1
+) in;
+
+layout (push_constant) uniform parameters {
+    uint elt_count;
+    /* Invocations per row of the dispatch. */
+    uint row_pitch;
+};
+
+layout (binding = 0) buffer buf_in  { float16_t buffer_in[]; };
+layout (binding = 1) buffer buf_out { float16_t buffer_out[]; };
+
+void main()
+{
+    uint id = gl_GlobalInvocationID.y * row_pitch + gl_GlobalInvocationID.x;
+    if (id >= elt_count)
+        return;
+
+    buffer_out[id] = buffer_in[id] + buffer_in[id];
+}
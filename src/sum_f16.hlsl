@@ -0,0 +1,22 @@
+struct Parameters {
+  uint elt_count;
+  // Invocations per row of the dispatch.
+  uint row_pitch;
+};
+
+[[vk::push_constant]] Parameters parameters;
+
+// Built with -enable-16bit-types.
+RWStructuredBuffer<float16_t> buffer_in;
+RWStructuredBuffer<float16_t> buffer_out;
+
+// The host reads the workgroup size back from the module.
+[numthreads(32,1,1)]
+void main(uint3 threadID : SV_DispatchThreadID)
+{
+  const uint id = threadID.y * parameters.row_pitch + threadID.x;
+  if (id >= parameters.elt_count)
+      return;
+
+  buffer_out[id] = buffer_in[id] + buffer_in[id];
+}
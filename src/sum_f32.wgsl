@@ -0,0 +1,23 @@
+enable chromium_experimental_push_constant;
+
+struct Parameters {
+    elt_count : u32,
+    // Invocations per row of the dispatch.
+    row_pitch : u32,
+}
+
+var<push_constant> parameters : Parameters;
+
+@group(0) @binding(0) var<storage, read> buffer_in : array<f32>;
+@group(0) @binding(1) var<storage, read_write> buffer_out : array<f32>;
+
+// The host reads the workgroup size back from the module.
+@compute @workgroup_size(32, 1, 1)
+fn main(@builtin(global_invocation_id) threadID : vec3<u32>) {
+    let id : u32 = threadID.y * parameters.row_pitch + threadID.x;
+    if (id >= parameters.elt_count) {
+        return;
+    }
+
+    buffer_out[id] = buffer_in[id] + buffer_in[id];
+}
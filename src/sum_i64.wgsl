@@ -0,0 +1,26 @@
+enable chromium_experimental_push_constant;
+
+struct Parameters {
+    elt_count : u32,
+    // Invocations per row of the dispatch.
+    row_pitch : u32,
+}
+
+var<push_constant> parameters : Parameters;
+
+// WGSL has no 64-bit integer: low and high words.
+@group(0) @binding(0) var<storage, read> buffer_in : array<vec2<u32>>;
+@group(0) @binding(1) var<storage, read_write> buffer_out : array<vec2<u32>>;
+
+// The host reads the workgroup size back from the module.
+@compute @workgroup_size(32, 1, 1)
+fn main(@builtin(global_invocation_id) threadID : vec3<u32>) {
+    let id : u32 = threadID.y * parameters.row_pitch + threadID.x;
+    if (id >= parameters.elt_count) {
+        return;
+    }
+
+    // Doubling is a shift, the top bit of the low word carries over.
+    let value : vec2<u32> = buffer_in[id];
+    buffer_out[id] = vec2<u32>(value.x << 1u, (value.y << 1u) | (value.x >> 31u));
+}
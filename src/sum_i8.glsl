@@ -0,0 +1,31 @@
+#version 450
+#extension GL_EXT_shader_explicit_arithmetic_types_int8 : require
+#extension GL_EXT_shader_8bit_storage : require
+
+/* The workgroup size is specialization constant 0. */
+layout (
+    local_size_x_id = 0,
+    local_size_y = 1,
+    local_size_z = 1
+) in;
+
+layout (push_constant) uniform parameters {
+    uint elt_count;
+    /* Invocations per row of the dispatch. */
+    uint row_pitch;
+};
+
+/* Four elements per invocation, as the other languages pack them in a
+ * word. Both buffers are padded to a whole number of vectors. */
+layout (binding = 0) buffer buf_in  { i8vec4 buffer_in[]; };
+layout (binding = 1) buffer buf_out { i8vec4 buffer_out[]; };
+
+void main()
+{
+    uint id = gl_GlobalInvocationID.y * row_pitch + gl_GlobalInvocationID.x;
+    if (id * 4 >= elt_count)
+        return;
+
+    /* The padding of the last vector is doubled along. */
+    buffer_out[id] = buffer_in[id] + buffer_in[id];
+}
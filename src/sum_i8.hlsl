@@ -0,0 +1,26 @@
+struct Parameters {
+  uint elt_count;
+  // Invocations per row of the dispatch.
+  uint row_pitch;
+};
+
+[[vk::push_constant]] Parameters parameters;
+
+// HLSL has no 8-bit type: four elements per word. Both buffers are padded
+// to a whole number of vectors.
+RWStructuredBuffer<uint> buffer_in;
+RWStructuredBuffer<uint> buffer_out;
+
+// The host reads the workgroup size back from the module.
+[numthreads(32,1,1)]
+void main(uint3 threadID : SV_DispatchThreadID)
+{
+  const uint id = threadID.y * parameters.row_pitch + threadID.x;
+  if (id * 4 >= parameters.elt_count)
+      return;
+
+  // Doubles each byte, wrapping around as int8 does: the bit shifted out
+  // of a byte is dropped rather than carried into the next. The padding of
+  // the last word is doubled along.
+  buffer_out[id] = (buffer_in[id] << 1) & 0xfefefefe;
+}
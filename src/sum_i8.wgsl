@@ -0,0 +1,28 @@
+enable chromium_experimental_push_constant;
+
+struct Parameters {
+    elt_count : u32,
+    // Invocations per row of the dispatch.
+    row_pitch : u32,
+}
+
+var<push_constant> parameters : Parameters;
+
+// WGSL has no 8-bit type: four elements per word. Both buffers are padded
+// to a whole number of vectors.
+@group(0) @binding(0) var<storage, read> buffer_in : array<u32>;
+@group(0) @binding(1) var<storage, read_write> buffer_out : array<u32>;
+
+// The host reads the workgroup size back from the module.
+@compute @workgroup_size(32, 1, 1)
+fn main(@builtin(global_invocation_id) threadID : vec3<u32>) {
+    let id : u32 = threadID.y * parameters.row_pitch + threadID.x;
+    if (id * 4u >= parameters.elt_count) {
+        return;
+    }
+
+    // Doubles each byte, wrapping around as int8 does: the bit shifted out
+    // of a byte is dropped rather than carried into the next. The padding
+    // of the last word is doubled along.
+    buffer_out[id] = (buffer_in[id] << 1u) & 0xfefefefeu;
+}
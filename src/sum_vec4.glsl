@@ -0,0 +1,37 @@
+#version 450
+
+/* The workgroup size is specialization constant 0. */
+layout (
+    local_size_x_id = 0,
+    local_size_y = 1,
+    local_size_z = 1
+) in;
+
+layout (push_constant) uniform parameters {
+    uint elt_count;
+    /* Invocations per row of the dispatch. */
+    uint row_pitch;
+    /* Invocations in the whole dispatch, the stride of the loop. */
+    uint invocation_count;
+};
+
+/* Both buffers are padded to a whole number of vectors. */
+layout (binding = 0) buffer buf_in  { ivec4 buffer_in[]; };
+layout (binding = 1) buffer buf_out { ivec4 buffer_out[]; };
+
+void main()
+{
+    uint id = gl_GlobalInvocationID.y * row_pitch + gl_GlobalInvocationID.x;
+    uint full = elt_count / 4;
+    uint tail = elt_count % 4;
+
+    for (uint v = id; v <= full; v += invocation_count) {
+        if (v < full) {
+            buffer_out[v] = buffer_in[v] + buffer_in[v];
+        } else {
+            /* The padding past elt_count is left untouched. */
+            for (uint c = 0; c < tail; c++)
+                buffer_out[v][c] = buffer_in[v][c] + buffer_in[v][c];
+        }
+    }
+}
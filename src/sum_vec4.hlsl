@@ -0,0 +1,32 @@
+struct Parameters {
+  uint elt_count;
+  // Invocations per row of the dispatch.
+  uint row_pitch;
+  // Invocations in the whole dispatch, the stride of the loop.
+  uint invocation_count;
+};
+
+[[vk::push_constant]] Parameters parameters;
+
+// Both buffers are padded to a whole number of vectors.
+RWStructuredBuffer<int4> buffer_in;
+RWStructuredBuffer<int4> buffer_out;
+
+// The host reads the workgroup size back from the module.
+[numthreads(32,1,1)]
+void main(uint3 threadID : SV_DispatchThreadID)
+{
+  const uint id = threadID.y * parameters.row_pitch + threadID.x;
+  const uint full = parameters.elt_count / 4;
+  const uint tail = parameters.elt_count % 4;
+
+  for (uint v = id; v <= full; v += parameters.invocation_count) {
+    if (v < full) {
+      buffer_out[v] = buffer_in[v] + buffer_in[v];
+    } else {
+      // The padding past elt_count is left untouched.
+      for (uint c = 0; c < tail; c++)
+        buffer_out[v][c] = buffer_in[v][c] + buffer_in[v][c];
+    }
+  }
+}
@@ -0,0 +1,34 @@
+enable chromium_experimental_push_constant;
+
+struct Parameters {
+    elt_count : u32,
+    // Invocations per row of the dispatch.
+    row_pitch : u32,
+    // Invocations in the whole dispatch, the stride of the loop.
+    invocation_count : u32,
+}
+
+var<push_constant> parameters : Parameters;
+
+// Both buffers are padded to a whole number of vectors.
+@group(0) @binding(0) var<storage, read> buffer_in : array<vec4<i32>>;
+@group(0) @binding(1) var<storage, read_write> buffer_out : array<vec4<i32>>;
+
+// The host reads the workgroup size back from the module.
+@compute @workgroup_size(32, 1, 1)
+fn main(@builtin(global_invocation_id) threadID : vec3<u32>) {
+    let id : u32 = threadID.y * parameters.row_pitch + threadID.x;
+    let full : u32 = parameters.elt_count / 4u;
+    let tail : u32 = parameters.elt_count % 4u;
+
+    for (var v : u32 = id; v <= full; v += parameters.invocation_count) {
+        if (v < full) {
+            buffer_out[v] = buffer_in[v] + buffer_in[v];
+        } else {
+            // The padding past elt_count is left untouched.
+            for (var c : u32 = 0u; c < tail; c++) {
+                buffer_out[v][c] = buffer_in[v][c] + buffer_in[v][c];
+            }
+        }
+    }
+}